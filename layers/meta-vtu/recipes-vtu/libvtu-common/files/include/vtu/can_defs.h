@@ -18,6 +18,7 @@
 /* Engine ECU messages */
 #define CAN_ID_ENGINE_DATA_1    0x100   /* 10ms cycle: RPM, coolant, throttle, MAF */
 #define CAN_ID_ENGINE_DATA_2    0x101   /* 100ms cycle: load, intake temp, timing */
+#define CAN_ID_ENGINE_FD        0x110   /* 20ms cycle, CAN-FD: per-cylinder knock, EGT, misfire */
 
 /* Transmission ECU messages */
 #define CAN_ID_TRANS_DATA       0x200   /* 50ms cycle: gear, fluid temp, speed */
@@ -28,6 +29,14 @@
 /* ABS/ESP messages */
 #define CAN_ID_ABS_WHEEL_SPEED  0x400   /* 20ms cycle: wheel speeds */
 
+/* Nominal broadcast cycle times (ms), for bus timing checks */
+#define CAN_CYCLE_MS_ENGINE_DATA_1      10
+#define CAN_CYCLE_MS_ENGINE_DATA_2      100
+#define CAN_CYCLE_MS_ENGINE_FD          20
+#define CAN_CYCLE_MS_TRANS_DATA         50
+#define CAN_CYCLE_MS_BCM_DATA           100
+#define CAN_CYCLE_MS_ABS_WHEEL_SPEED    20
+
 /*============================================================================
  * OBD-II Diagnostic CAN IDs (ISO 15765-4)
  *===========================================================================*/
@@ -42,71 +51,40 @@
  * CAN Frame Structure
  *===========================================================================*/
 
+#define CAN_CLASSIC_MAX_DLEN    8
+#define CAN_FD_MAX_DLEN         64
+
+/* vtu_can_frame.flags */
+#define VTU_CAN_FLAG_FD         0x01    /* CAN-FD frame */
+#define VTU_CAN_FLAG_BRS        0x02    /* CAN-FD bit rate switch */
+#define VTU_CAN_FLAG_ESI        0x04    /* CAN-FD error state indicator */
+
 /**
- * @brief Standard CAN frame (CAN 2.0B)
+ * @brief CAN frame (CAN 2.0B or CAN-FD)
  */
 struct vtu_can_frame {
     uint32_t can_id;        /* 11-bit standard ID (or 29-bit extended) */
-    uint8_t  dlc;           /* Data Length Code (0-8) */
-    uint8_t  data[8];       /* Payload */
+    uint8_t  dlc;           /* Payload length (0-8, or up to 64 for CAN-FD) */
+    uint8_t  flags;         /* VTU_CAN_FLAG_* */
+    uint8_t  data[CAN_FD_MAX_DLEN];     /* Payload */
     uint64_t timestamp_us;  /* Microsecond timestamp */
 };
 
 /*============================================================================
- * Signal Extraction Macros
- * 
- * CAN signals are packed into bytes. These macros extract them.
- * Automotive typically uses big-endian (Motorola) byte order.
- *===========================================================================*/
-
-/* Extract 16-bit value from bytes (big-endian) */
-#define CAN_GET_U16_BE(data, offset) \
-    ((uint16_t)((data)[(offset)] << 8) | (data)[(offset) + 1])
-
-/* Extract 16-bit value from bytes (little-endian) */
-#define CAN_GET_U16_LE(data, offset) \
-    ((uint16_t)((data)[(offset) + 1] << 8) | (data)[(offset)])
-
-/* Extract 8-bit value */
-#define CAN_GET_U8(data, offset) ((uint8_t)(data)[(offset)])
-
-/*============================================================================
- * ENGINE_DATA_1 (0x100) Signal Layout - 10ms cycle
+ * Signal Layouts
  * 
- * Byte 0-1: Engine RPM (0.25 rpm/bit) - range 0-16383.75 rpm
- * Byte 2:   Coolant temp (°C + 40 offset) - range -40 to 215°C
- * Byte 3:   Throttle position (0.392%/bit) - range 0-100%
- * Byte 4-5: MAF (0.01 g/s per bit) - range 0-655.35 g/s
- * Byte 6:   Reserved
- * Byte 7:   Reserved
+ * The signal layout of every broadcast message is defined in dbc/vtu.dbc.
+ * Decoders and encoders are generated from it at build time (vtu/vtu_bus.h):
+ * one inline getter and setter per signal, e.g.
+ * vtu_bus_engine_data_1_engine_rpm(data), and one decoder and encoder per
+ * message, e.g. vtu_bus_encode_engine_fd(data, values). Other DBC files go
+ * through vtu/signal_db.h.
+ *
+ * ENGINE_DATA_1 (0x100): RPM, coolant, throttle, MAF, load
+ * ENGINE_DATA_2 (0x101): intake temp, load
+ * TRANS_DATA    (0x200): gear, fluid temp, vehicle speed
+ * BCM_DATA      (0x300): fuel level, odometer
+ * ENGINE_FD     (0x110): per-cylinder knock, EGT, misfires (CAN-FD, 32 bytes)
  *===========================================================================*/
 
-#define ENGINE1_RPM_FACTOR          0.25f
-#define ENGINE1_COOLANT_OFFSET      40
-#define ENGINE1_THROTTLE_FACTOR     0.392157f  /* 100/255 */
-#define ENGINE1_MAF_FACTOR          0.01f
-
-/* Signal extraction for ENGINE_DATA_1 */
-#define ENGINE1_GET_RPM(data)       (CAN_GET_U16_BE(data, 0) * ENGINE1_RPM_FACTOR)
-#define ENGINE1_GET_COOLANT(data)   (CAN_GET_U8(data, 2) - ENGINE1_COOLANT_OFFSET)
-#define ENGINE1_GET_THROTTLE(data)  (CAN_GET_U8(data, 3) * ENGINE1_THROTTLE_FACTOR)
-#define ENGINE1_GET_MAF(data)       (CAN_GET_U16_BE(data, 4) * ENGINE1_MAF_FACTOR)
-
-/*============================================================================
- * TRANS_DATA (0x200) Signal Layout - 50ms cycle
- * 
- * Byte 0:   Current gear (0=N, 1-6=gear, 7=R)
- * Byte 1:   Transmission fluid temp (°C + 40 offset)
- * Byte 2-3: Output shaft speed (rpm)
- * Byte 4-7: Reserved
- *===========================================================================*/
-
-#define TRANS_GEAR_NEUTRAL  0
-#define TRANS_GEAR_REVERSE  7
-#define TRANS_TEMP_OFFSET   40
-
-#define TRANS_GET_GEAR(data)      CAN_GET_U8(data, 0)
-#define TRANS_GET_FLUID_TEMP(data) (CAN_GET_U8(data, 1) - TRANS_TEMP_OFFSET)
-#define TRANS_GET_OUTPUT_RPM(data) CAN_GET_U16_BE(data, 2)
-
 #endif /* VTU_CAN_DEFS_H */
\ No newline at end of file
@@ -0,0 +1,141 @@
+/**
+ * @file can_io.h
+ * @brief SocketCAN raw socket helpers shared by the VTU daemons
+ *
+ * One place for opening, tuning and reading/writing CAN_RAW sockets:
+ * receive filters and error classes, SO_RCVBUF sizing, receive
+ * timestamps, kernel drop counters (SO_RXQ_OVFL) and CAN-FD frames are
+ * all options of vtu_can_open(), and frames move in batches through
+ * recvmmsg()/sendmmsg().
+ *
+ * Frames are always handled as struct canfd_frame; classic frames use
+ * the first 8 data bytes and go over the wire with CAN_MTU. The socket
+ * can be put in non-blocking mode and watched with select()/poll()/epoll
+ * on vtu_can.sock: vtu_can_recv_many() then returns 0 once drained.
+ */
+
+#ifndef VTU_CAN_IO_H
+#define VTU_CAN_IO_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#define VTU_CAN_MAX_BATCH       64      /* Frames per recv_many/send_many call */
+
+/* vtu_can_opts.timestamps */
+#define VTU_CAN_TS_NONE         0
+#define VTU_CAN_TS_SOFTWARE     1       /* SO_TIMESTAMP, kernel receive time */
+#define VTU_CAN_TS_HARDWARE     2       /* SO_TIMESTAMPING, hardware with software fallback */
+
+/* vtu_can_opts.fd_frames */
+#define VTU_CAN_FD_OFF          0       /* Classic frames only */
+#define VTU_CAN_FD_TRY          1       /* CAN-FD if the kernel supports it */
+#define VTU_CAN_FD_REQUIRE      2       /* Fail unless the interface is CAN-FD capable */
+
+/* vtu_can_rx.ts_source */
+#define VTU_CAN_TS_SRC_NONE     0
+#define VTU_CAN_TS_SRC_SOFTWARE 1
+#define VTU_CAN_TS_SRC_HARDWARE 2
+
+/**
+ * @brief Socket options; a zeroed struct gives a plain blocking socket
+ *        that receives every frame
+ */
+struct vtu_can_opts {
+    const struct can_filter *filters;   /* Receive filters, NULL = all frames */
+    int      nfilters;                  /* With filters set: 0 = receive nothing */
+    uint32_t err_mask;                  /* CAN_ERR_* classes delivered as error frames */
+    int      rcvbuf;                    /* SO_RCVBUF bytes, 0 = kernel default */
+    int      rcv_timeout_ms;            /* SO_RCVTIMEO, 0 = block */
+    int      timestamps;                /* VTU_CAN_TS_* */
+    int      fd_frames;                 /* VTU_CAN_FD_* */
+    int      overflow;                  /* Count kernel queue drops (SO_RXQ_OVFL) */
+    int      nonblock;                  /* O_NONBLOCK, for event loops */
+};
+
+/**
+ * @brief An open CAN_RAW socket
+ */
+struct vtu_can {
+    int      sock;                      /* For select()/poll()/epoll */
+    int      ifindex;                   /* Bound interface, 0 = all */
+    int      fd_frames;                 /* CAN-FD frames are enabled */
+    int      rcvbuf;                    /* Effective SO_RCVBUF (as reported) */
+    uint32_t drops;                     /* Cumulative kernel drops, with opts.overflow */
+};
+
+/**
+ * @brief A received frame
+ */
+struct vtu_can_rx {
+    struct canfd_frame frame;
+    uint8_t  fd;                        /* Arrived as a CAN-FD frame */
+    uint8_t  ts_source;                 /* VTU_CAN_TS_SRC_* */
+    int      ifindex;                   /* Receiving interface */
+    uint64_t timestamp_us;              /* Receive time, 0 without timestamps */
+};
+
+/**
+ * @brief A frame to send
+ */
+struct vtu_can_tx {
+    struct canfd_frame frame;
+    uint8_t  fd;                        /* Send as a CAN-FD frame */
+    int      ifindex;                   /* 0 = the bound interface */
+};
+
+/**
+ * @brief Open a CAN_RAW socket and bind it
+ * @param ifname Interface name, or NULL to bind to all CAN interfaces
+ * @param opts Options, NULL for defaults
+ * @return 0 on success, -1 with errno set (the socket is closed)
+ */
+int vtu_can_open(struct vtu_can *can, const char *ifname, const struct vtu_can_opts *opts);
+
+void vtu_can_close(struct vtu_can *can);
+
+/**
+ * @brief Ask the driver of one interface to stamp frames in hardware
+ *
+ * Needed per interface with VTU_CAN_TS_HARDWARE; most CAN controllers
+ * (and vcan) can't, and frames then carry software stamps.
+ * @return 0 on success, -1 if the driver refused
+ */
+int vtu_can_enable_hw_timestamps(const struct vtu_can *can, const char *ifname);
+
+/**
+ * @brief Replace the receive filters
+ * @return 0 on success, -1 on error
+ */
+int vtu_can_set_filters(struct vtu_can *can, const struct can_filter *filters, int nfilters);
+
+/**
+ * @brief Receive up to max frames (at most VTU_CAN_MAX_BATCH) in one syscall
+ *
+ * Blocks for the first frame unless the socket is non-blocking, then
+ * takes whatever else is queued. Frames of unexpected size are dropped.
+ * @return Frames received, 0 if none is queued (non-blocking), -1 on error
+ */
+int vtu_can_recv_many(struct vtu_can *can, struct vtu_can_rx *rx, int max);
+
+/**
+ * @brief Receive one frame
+ * @return 1, 0 if none is queued (non-blocking or timeout), -1 on error
+ */
+int vtu_can_recv(struct vtu_can *can, struct vtu_can_rx *rx);
+
+/**
+ * @brief Send up to n frames (at most VTU_CAN_MAX_BATCH) in one syscall
+ * @return Frames sent, which may be fewer than n, or -1 on error (ENOBUFS
+ *         when the interface's TX queue is full)
+ */
+int vtu_can_send_many(struct vtu_can *can, const struct vtu_can_tx *tx, int n);
+
+/**
+ * @brief Send one frame on the bound interface
+ * @param fd Send as a CAN-FD frame (needs fd_frames)
+ * @return 0 on success, -1 on error
+ */
+int vtu_can_send(struct vtu_can *can, const struct canfd_frame *frame, int fd);
+
+#endif /* VTU_CAN_IO_H */
@@ -0,0 +1,168 @@
+/**
+ * @file signal_db.h
+ * @brief Table-driven CAN signal database and decoder
+ *
+ * Messages and signals come either from a DBC file (vtu_sigdb_load_dbc())
+ * or from the built-in table of the VTU bus (vtu_sigdb_builtin(), generated
+ * from dbc/vtu.dbc at build time). Loading works out where each signal sits in the
+ * payload once, so decoding a frame is a hash lookup of the CAN ID plus a
+ * few shifts and a multiply per signal of that message; no strings are
+ * touched after startup.
+ *
+ * Every signal has an index that is unique across the whole database.
+ * Consumers resolve the names they care about once with vtu_sigdb_signal()
+ * and keep one float per signal; decoding a frame updates the entries of
+ * that frame's signals:
+ *
+ *   float *values = calloc(db.nsignals, sizeof(float));
+ *   int rpm = vtu_sigdb_signal(&db, "EngineRPM");
+ *   ...
+ *   if (vtu_sigdb_decode_frame(&db, frame.can_id, frame.data, frame.len, values))
+ *       printf("%.0f rpm\n", values[rpm]);
+ *
+ * Multiplexed signals (mN in the DBC) are not supported and are skipped.
+ * IEEE float and double signals (SIG_VALTYPE_ 1/2) are not supported either;
+ * a DBC that declares one is rejected as a syntax error at that line.
+ */
+
+#ifndef VTU_SIGNAL_DB_H
+#define VTU_SIGNAL_DB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VTU_SIG_EXT_ID          0x80000000u     /* 29-bit ID (as in DBC files and CAN_EFF_FLAG) */
+
+/* vtu_signal.byte_order, as the @0/@1 of a DBC signal */
+#define VTU_SIG_MOTOROLA        0       /* Big-endian, start bit is the MSB */
+#define VTU_SIG_INTEL           1       /* Little-endian, start bit is the LSB */
+
+/**
+ * @brief One signal: physical value = raw * factor + offset
+ */
+struct vtu_signal {
+    const char *name;
+    const char *unit;
+    uint16_t message;           /* Index into vtu_sigdb.messages */
+    uint16_t start_bit;         /* DBC bit numbering */
+    uint8_t  length;            /* Bits, 1-64 */
+    uint8_t  byte_order;        /* VTU_SIG_MOTOROLA / VTU_SIG_INTEL */
+    uint8_t  is_signed;
+    double   factor;
+    double   offset;
+    float    min;
+    float    max;
+
+    /* Derived when the signal is added; all the decoder looks at */
+    uint8_t  byte;              /* First payload byte */
+    uint8_t  nbytes;            /* Bytes loaded, at most 8 */
+    uint8_t  shift;             /* Right shift of the loaded bytes */
+    uint64_t mask;
+};
+
+/**
+ * @brief One message; its signals are signals[first .. first + count - 1]
+ */
+struct vtu_message {
+    const char *name;
+    uint32_t can_id;            /* VTU_SIG_EXT_ID set for 29-bit IDs */
+    uint8_t  dlc;               /* Payload length, up to 64 */
+    uint16_t first;
+    uint16_t count;
+};
+
+struct vtu_sigdb {
+    struct vtu_message *messages;
+    int      nmessages;
+    struct vtu_signal *signals;
+    int      nsignals;
+
+    /* Open addressing, CAN ID -> message index + 1 */
+    uint16_t *hash;
+    uint32_t hash_mask;
+
+    /* Allocation sizes while building */
+    int      cap_messages;
+    int      cap_signals;
+};
+
+/**
+ * @brief Load the built-in VTU bus layout
+ * @return 0 on success, -1 on allocation failure
+ */
+int vtu_sigdb_builtin(struct vtu_sigdb *db);
+
+/**
+ * @brief Load the BO_ and SG_ entries of a DBC file (everything else but
+ *        SIG_VALTYPE_ is ignored)
+ * @param err_line Set to the offending line on a syntax error, 0 otherwise (may be NULL)
+ * @return 0 on success, -1 with errno set (EINVAL for syntax errors)
+ */
+int vtu_sigdb_load_dbc(struct vtu_sigdb *db, const char *path, int *err_line);
+
+void vtu_sigdb_free(struct vtu_sigdb *db);
+
+/**
+ * @brief Look up a signal by "Signal" or "MESSAGE.Signal"
+ * @return Signal index, -1 if unknown
+ */
+int vtu_sigdb_signal(const struct vtu_sigdb *db, const char *name);
+
+/**
+ * @brief Message of a received CAN ID (RTR/ERR flags are ignored)
+ * @return The message, NULL if it isn't in the database
+ */
+const struct vtu_message *vtu_sigdb_find(const struct vtu_sigdb *db, uint32_t can_id);
+
+/**
+ * @brief Decode the signals of one message into values[signal index]
+ *
+ * Signals that reach beyond len (a short frame) keep their old value.
+ * @return Signals decoded
+ */
+int vtu_sigdb_decode(const struct vtu_sigdb *db, const struct vtu_message *msg,
+                     const uint8_t *data, uint8_t len, float *values);
+
+/**
+ * @brief vtu_sigdb_find() followed by vtu_sigdb_decode()
+ * @return The decoded message, NULL if the ID isn't in the database
+ */
+const struct vtu_message *vtu_sigdb_decode_frame(const struct vtu_sigdb *db, uint32_t can_id,
+                                                 const uint8_t *data, uint8_t len,
+                                                 float *values);
+
+/**
+ * @brief Decode many frames of one message into one column per signal
+ *
+ * Works signal by signal over chunks of frames (structure of arrays), with
+ * the scaling done 2-4 frames at a time using NEON on arm64 and SSE2/AVX
+ * on x86; other targets use a scalar loop. Meant for log analytics and
+ * export, where the frames of an ID are processed in bulk.
+ *
+ * Frames are read in place from the caller's records: frame i has its
+ * payload at data + i * stride and its length at len + i * stride, so an
+ * array of struct canfd_frame or vtulog records can be passed as is.
+ * Payloads are read up to the end of every signal whatever the frame's
+ * length (64-byte payload buffers always do).
+ * Values are scaled in double and rounded to float once, as in
+ * vtu_sigdb_decode(), so both give the same floats (1 ulp apart at most
+ * where the compiler fuses one of the multiply-adds and not the other).
+ *
+ * @param data First frame's payload
+ * @param len First frame's length byte, NULL if every frame is msg->dlc long
+ * @param stride Bytes from one frame to the next
+ * @param columns columns[i] receives signal msg->first + i for every frame
+ *                (n floats; NAN where the frame is too short), NULL skips it
+ * @return Signals decoded
+ */
+int vtu_sigdb_decode_batch(const struct vtu_sigdb *db, const struct vtu_message *msg,
+                           const uint8_t *data, const uint8_t *len, size_t stride,
+                           size_t n, float *const *columns);
+
+/**
+ * @return The instruction set vtu_sigdb_decode_batch() was built for
+ *         ("neon", "avx", "sse2" or "scalar")
+ */
+const char *vtu_sigdb_batch_isa(void);
+
+#endif /* VTU_SIGNAL_DB_H */
@@ -0,0 +1,194 @@
+/**
+ * @file signal_store.h
+ * @brief Shared-memory store of the latest value of every CAN signal
+ *
+ * One producer (vtu-signald) decodes the bus and keeps the newest value
+ * and time of every signal of its signal database in a POSIX shared
+ * memory object; any number of consumers map it read-only and read
+ * values with plain loads - no syscalls, no locks, no decoding of their
+ * own. Each signal has its own sequence counter (a seqlock): the
+ * producer makes it odd while it writes the slot, and a reader retries
+ * when the counter was odd or changed under it, so readers never block
+ * the producer and never see a half-written value.
+ *
+ *   struct vtu_store st;
+ *   if (vtu_store_open(&st, VTU_STORE_DEFAULT_NAME) == 0) {
+ *       int rpm = vtu_store_find(&st, "EngineRPM");
+ *       float value;
+ *       uint64_t ts;
+ *       if (rpm >= 0 && vtu_store_read(&st, rpm, &value, &ts) == 0)
+ *           printf("%.0f rpm, %llu us old\n", value,
+ *                  (unsigned long long)(vtu_store_now_us() - ts));
+ *   }
+ *
+ * The object is laid out as a header, the signal names and the slots
+ * (one per signal, indexed like the producer's vtu_sigdb). A restarted
+ * producer marks the old object closed and creates a new one, so
+ * consumers reopen once vtu_store_live() returns 0.
+ */
+
+#ifndef VTU_SIGNAL_STORE_H
+#define VTU_SIGNAL_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "vtu/signal_db.h"
+
+#define VTU_STORE_DEFAULT_NAME  "/vtu-signals"  /* shm_open() name, /dev/shm/vtu-signals */
+#define VTU_STORE_MAGIC         0x53555456u     /* "VTUS" */
+#define VTU_STORE_VERSION       1
+#define VTU_STORE_NAME_LEN      64              /* "MESSAGE.Signal", NUL terminated */
+#define VTU_STORE_UNIT_LEN      16
+#define VTU_STORE_READ_SPINS    1000            /* Retries before a slot counts as stuck */
+
+/* vtu_store_header.state */
+#define VTU_STORE_LIVE          1
+#define VTU_STORE_CLOSED        2               /* Producer exited or was replaced */
+
+/**
+ * @brief Start of the shared object (one cache line)
+ */
+struct vtu_store_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nsignals;
+    uint32_t state;                     /* VTU_STORE_LIVE / VTU_STORE_CLOSED */
+    uint32_t producer_pid;
+    uint32_t names_offset;              /* Bytes from the start of the object */
+    uint32_t slots_offset;
+    uint32_t size;                      /* Whole object */
+    uint64_t created_us;                /* vtu_store_now_us() at creation */
+    uint64_t frames;                    /* Frames published since creation */
+    uint8_t  reserved[16];
+};
+
+struct vtu_store_name {
+    char     name[VTU_STORE_NAME_LEN];
+    char     unit[VTU_STORE_UNIT_LEN];
+};
+
+/**
+ * @brief Latest value of one signal
+ */
+struct vtu_store_slot {
+    uint32_t seq;                       /* Odd while the producer writes the slot */
+    float    value;
+    uint64_t timestamp_us;              /* vtu_store_now_us() when stored, 0 = never */
+};
+
+/**
+ * @brief A mapped store, for the producer or a consumer
+ */
+struct vtu_store {
+    struct vtu_store_header *hdr;
+    const struct vtu_store_name *names;
+    struct vtu_store_slot *slots;
+    int      nsignals;
+    size_t   size;
+    int      producer;                  /* Created (and writable) by this process */
+    uint64_t ino;                       /* Of the created object, to remove only our own */
+    char     name[VTU_STORE_NAME_LEN];
+};
+
+/**
+ * @brief Create the store for every signal of a database (producer side)
+ *
+ * An existing object of that name is marked closed and replaced.
+ * @return 0 on success, -1 with errno set
+ */
+int vtu_store_create(struct vtu_store *st, const char *name, const struct vtu_sigdb *db);
+
+/**
+ * @brief Map an existing store read-only (consumer side)
+ * @return 0 on success, -1 with errno set (ENOENT without a producer,
+ *         EPROTO for an object of another layout)
+ */
+int vtu_store_open(struct vtu_store *st, const char *name);
+
+/**
+ * @brief Unmap the store; the producer also marks it closed and removes it
+ */
+void vtu_store_close(struct vtu_store *st);
+
+/**
+ * @brief Look up a signal by "Signal" or "MESSAGE.Signal"
+ * @return Slot index, -1 if the store has no such signal
+ */
+int vtu_store_find(const struct vtu_store *st, const char *name);
+
+/**
+ * @brief Store the values of signals first .. first + count - 1 (producer side)
+ *
+ * Doesn't count a frame; see vtu_store_publish_frame().
+ * @param values Indexed by signal, as filled by vtu_sigdb_decode()
+ */
+void vtu_store_publish(struct vtu_store *st, int first, int count, const float *values,
+                       uint64_t timestamp_us);
+
+/**
+ * @brief Store the signals one received frame of msg carried and count the frame
+ *
+ * A frame shorter than msg->dlc stores only the signals that end within
+ * len (what vtu_sigdb_decode() filled); the others keep their value and time.
+ * @param values Indexed by signal, as filled by vtu_sigdb_decode()
+ */
+void vtu_store_publish_frame(struct vtu_store *st, const struct vtu_sigdb *db,
+                             const struct vtu_message *msg, uint8_t len, const float *values,
+                             uint64_t timestamp_us);
+
+/**
+ * @brief Monotonic clock of the slot timestamps (clock_gettime() runs in the vDSO)
+ */
+static inline uint64_t vtu_store_now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/**
+ * @return 1 while the producer of this mapping is running
+ */
+static inline int vtu_store_live(const struct vtu_store *st) {
+    return st->hdr && __atomic_load_n(&st->hdr->state, __ATOMIC_ACQUIRE) == VTU_STORE_LIVE;
+}
+
+/**
+ * @brief Read the latest value of a signal
+ * @param timestamp_us When it was stored (may be NULL)
+ * @return 0 on success, -1 if the signal hasn't been received yet or the
+ *         slot stayed mid-write (a producer that died while writing)
+ */
+static inline int vtu_store_read(const struct vtu_store *st, int sig, float *value,
+                                 uint64_t *timestamp_us) {
+    const struct vtu_store_slot *slot = &st->slots[sig];
+
+    for (int spin = 0; spin < VTU_STORE_READ_SPINS; spin++) {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        uint64_t ts;
+        float v;
+
+        if (seq & 1) {
+            continue;
+        }
+        __atomic_load(&slot->value, &v, __ATOMIC_RELAXED);
+        ts = __atomic_load_n(&slot->timestamp_us, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+        if (ts == 0) {
+            return -1;
+        }
+        *value = v;
+        if (timestamp_us) {
+            *timestamp_us = ts;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+#endif /* VTU_SIGNAL_STORE_H */
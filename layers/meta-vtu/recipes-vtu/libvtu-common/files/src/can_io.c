@@ -0,0 +1,305 @@
+/**
+ * @file can_io.c
+ * @brief SocketCAN raw socket helpers shared by the VTU daemons
+ */
+
+#define _GNU_SOURCE  /* recvmmsg(), sendmmsg() */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+
+#include "vtu/can_io.h"
+
+/* Room for a timestamp and the drop counter of one frame */
+union rx_cmsg {
+    char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+             CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr align;
+};
+
+static int set_int_opt(int sock, int level, int name, int value) {
+    return setsockopt(sock, level, name, &value, sizeof(value));
+}
+
+static int enable_fd_frames(struct vtu_can *can, const char *ifname, int mode) {
+    if (mode == VTU_CAN_FD_REQUIRE) {
+        struct ifreq ifr;
+
+        /* A classic interface rejects every CAN-FD frame written to it */
+        if (!ifname) {
+            errno = EINVAL;
+            return -1;
+        }
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+        if (ioctl(can->sock, SIOCGIFMTU, &ifr) < 0) {
+            return -1;
+        }
+        if (ifr.ifr_mtu != CANFD_MTU) {
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+    }
+    if (set_int_opt(can->sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, 1) < 0) {
+        return mode == VTU_CAN_FD_REQUIRE ? -1 : 0;
+    }
+    can->fd_frames = 1;
+    return 0;
+}
+
+static int enable_timestamps(struct vtu_can *can, int mode) {
+    if (mode == VTU_CAN_TS_SOFTWARE) {
+        return set_int_opt(can->sock, SOL_SOCKET, SO_TIMESTAMP, 1);
+    }
+    if (mode == VTU_CAN_TS_HARDWARE) {
+        return set_int_opt(can->sock, SOL_SOCKET, SO_TIMESTAMPING,
+                           SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                           SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE);
+    }
+    return 0;
+}
+
+static int set_rcvbuf(struct vtu_can *can, int bytes) {
+    socklen_t len = sizeof(can->rcvbuf);
+
+    /* SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN */
+    if (bytes > 0 &&
+        set_int_opt(can->sock, SOL_SOCKET, SO_RCVBUFFORCE, bytes) < 0 &&
+        set_int_opt(can->sock, SOL_SOCKET, SO_RCVBUF, bytes) < 0) {
+        return -1;
+    }
+    if (getsockopt(can->sock, SOL_SOCKET, SO_RCVBUF, &can->rcvbuf, &len) < 0) {
+        can->rcvbuf = 0;
+    }
+    return 0;
+}
+
+static int apply_opts(struct vtu_can *can, const char *ifname,
+                      const struct vtu_can_opts *o) {
+    if (o->filters && vtu_can_set_filters(can, o->filters, o->nfilters) < 0) {
+        return -1;
+    }
+    if (o->err_mask &&
+        setsockopt(can->sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
+                   &o->err_mask, sizeof(o->err_mask)) < 0) {
+        return -1;
+    }
+    if (set_rcvbuf(can, o->rcvbuf) < 0) {
+        return -1;
+    }
+    if (o->rcv_timeout_ms > 0) {
+        struct timeval tv = {
+            .tv_sec = o->rcv_timeout_ms / 1000,
+            .tv_usec = (o->rcv_timeout_ms % 1000) * 1000,
+        };
+        if (setsockopt(can->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+            return -1;
+        }
+    }
+    if (enable_timestamps(can, o->timestamps) < 0) {
+        return -1;
+    }
+    if (o->fd_frames != VTU_CAN_FD_OFF && enable_fd_frames(can, ifname, o->fd_frames) < 0) {
+        return -1;
+    }
+    if (o->overflow && set_int_opt(can->sock, SOL_SOCKET, SO_RXQ_OVFL, 1) < 0) {
+        return -1;
+    }
+    if (o->nonblock) {
+        int flags = fcntl(can->sock, F_GETFL);
+        if (flags < 0 || fcntl(can->sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int vtu_can_open(struct vtu_can *can, const char *ifname, const struct vtu_can_opts *opts) {
+    static const struct vtu_can_opts defaults;
+    struct sockaddr_can addr;
+    int err;
+
+    memset(can, 0, sizeof(*can));
+    can->sock = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+    if (can->sock < 0) {
+        return -1;
+    }
+
+    if (ifname) {
+        can->ifindex = (int)if_nametoindex(ifname);
+        if (can->ifindex == 0) {
+            goto fail;
+        }
+    }
+
+    /* Filters and options first, so no unwanted frame is queued once bound */
+    if (apply_opts(can, ifname, opts ? opts : &defaults) < 0) {
+        goto fail;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = can->ifindex;
+    if (bind(can->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    close(can->sock);
+    can->sock = -1;
+    errno = err;
+    return -1;
+}
+
+void vtu_can_close(struct vtu_can *can) {
+    if (can->sock >= 0) {
+        close(can->sock);
+        can->sock = -1;
+    }
+}
+
+int vtu_can_enable_hw_timestamps(const struct vtu_can *can, const char *ifname) {
+    struct hwtstamp_config hwcfg;
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    memset(&hwcfg, 0, sizeof(hwcfg));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    hwcfg.rx_filter = HWTSTAMP_FILTER_ALL;
+    ifr.ifr_data = (void *)&hwcfg;
+    return ioctl(can->sock, SIOCSHWTSTAMP, &ifr);
+}
+
+int vtu_can_set_filters(struct vtu_can *can, const struct can_filter *filters, int nfilters) {
+    return setsockopt(can->sock, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
+                      nfilters * sizeof(*filters));
+}
+
+static uint64_t timespec_to_us(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+/* Pick up the drop counter and the receive time of one frame */
+static void parse_cmsg(struct vtu_can *can, struct msghdr *msg, struct vtu_can_rx *rx) {
+    struct cmsghdr *cmsg;
+
+    rx->timestamp_us = 0;
+    rx->ts_source = VTU_CAN_TS_SRC_NONE;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&can->drops, CMSG_DATA(cmsg), sizeof(can->drops));
+        } else if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            rx->ts_source = VTU_CAN_TS_SRC_SOFTWARE;
+            rx->timestamp_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+        } else if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            /* ts[0] = software, ts[2] = raw hardware */
+            struct scm_timestamping tss;
+            memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+            if (tss.ts[2].tv_sec || tss.ts[2].tv_nsec) {
+                rx->ts_source = VTU_CAN_TS_SRC_HARDWARE;
+                rx->timestamp_us = timespec_to_us(&tss.ts[2]);
+            } else if (tss.ts[0].tv_sec || tss.ts[0].tv_nsec) {
+                rx->ts_source = VTU_CAN_TS_SRC_SOFTWARE;
+                rx->timestamp_us = timespec_to_us(&tss.ts[0]);
+            }
+        }
+    }
+}
+
+int vtu_can_recv_many(struct vtu_can *can, struct vtu_can_rx *rx, int max) {
+    struct mmsghdr msgs[VTU_CAN_MAX_BATCH];
+    struct iovec iov[VTU_CAN_MAX_BATCH];
+    struct sockaddr_can addr[VTU_CAN_MAX_BATCH];
+    union rx_cmsg cmsg[VTU_CAN_MAX_BATCH];
+    int n, kept = 0;
+
+    if (max > VTU_CAN_MAX_BATCH) {
+        max = VTU_CAN_MAX_BATCH;
+    }
+    memset(msgs, 0, max * sizeof(msgs[0]));
+    for (int i = 0; i < max; i++) {
+        /* Straight into the caller's frames, no copy */
+        iov[i].iov_base = &rx[i].frame;
+        iov[i].iov_len = sizeof(rx[i].frame);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addr[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+        msgs[i].msg_hdr.msg_control = cmsg[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(cmsg[i].buf);
+    }
+
+    /* Block for the first frame (unless non-blocking), then take the rest */
+    n = recvmmsg(can->sock, msgs, max, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        parse_cmsg(can, &msgs[i].msg_hdr, &rx[i]);
+        if (msgs[i].msg_len != CAN_MTU && msgs[i].msg_len != CANFD_MTU) {
+            continue;
+        }
+        if (kept != i) {
+            rx[kept] = rx[i];
+        }
+        rx[kept].fd = msgs[i].msg_len == CANFD_MTU;
+        rx[kept].ifindex = addr[i].can_ifindex;
+        kept++;
+    }
+    return kept;
+}
+
+int vtu_can_recv(struct vtu_can *can, struct vtu_can_rx *rx) {
+    /* An SO_RCVTIMEO expiry reads as "nothing queued" */
+    return vtu_can_recv_many(can, rx, 1);
+}
+
+int vtu_can_send_many(struct vtu_can *can, const struct vtu_can_tx *tx, int n) {
+    struct mmsghdr msgs[VTU_CAN_MAX_BATCH];
+    struct iovec iov[VTU_CAN_MAX_BATCH];
+    struct sockaddr_can addr[VTU_CAN_MAX_BATCH];
+
+    if (n > VTU_CAN_MAX_BATCH) {
+        n = VTU_CAN_MAX_BATCH;
+    }
+    memset(msgs, 0, n * sizeof(msgs[0]));
+    for (int i = 0; i < n; i++) {
+        iov[i].iov_base = (void *)&tx[i].frame;
+        iov[i].iov_len = tx[i].fd ? CANFD_MTU : CAN_MTU;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (tx[i].ifindex && tx[i].ifindex != can->ifindex) {
+            /* Needs a socket bound to all interfaces */
+            memset(&addr[i], 0, sizeof(addr[i]));
+            addr[i].can_family = AF_CAN;
+            addr[i].can_ifindex = tx[i].ifindex;
+            msgs[i].msg_hdr.msg_name = &addr[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+        }
+    }
+    return sendmmsg(can->sock, msgs, n, 0);
+}
+
+int vtu_can_send(struct vtu_can *can, const struct canfd_frame *frame, int fd) {
+    size_t len = fd ? CANFD_MTU : CAN_MTU;
+
+    return write(can->sock, frame, len) == (ssize_t)len ? 0 : -1;
+}
@@ -0,0 +1,308 @@
+/**
+ * @file signal_batch.c
+ * @brief Column-wise decoding of many frames of one message
+ *
+ * Frames are taken a chunk at a time (small enough to stay in L1) and
+ * each signal is run over the whole chunk: first the raw bits are pulled
+ * out of every payload with a load width fixed at compile time, then the
+ * raw values are converted and scaled with SIMD.
+ *
+ * Signed raw values are biased by 2^(length-1) so that every lane holds
+ * an unsigned integer that converts exactly:
+ *   - up to 24 bits: 32-bit lanes (half the extraction traffic)
+ *   - up to 52 bits: 64-bit lanes
+ *   - wider: scalar, as vtu_sigdb_decode()
+ * Scaling is always done in double and rounded to float once, like
+ * vtu_sigdb_decode(), since a float multiply-add loses bits that the
+ * scalar path keeps (e.g. a 16-bit raw value times 0.1).
+ */
+
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BATCH_NEON
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define BATCH_AVX
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BATCH_SSE2
+#endif
+
+#include "vtu/signal_db.h"
+
+#define CHUNK           256     /* Frames per pass */
+#define MAX_FLOAT_BITS  24      /* Raw values exact in a float */
+#define MAX_DOUBLE_BITS 52      /* Raw values exact in a double */
+#define TWO_POW_52      4503599627370496.0
+
+#define ALWAYS_INLINE   static inline __attribute__((always_inline))
+
+/*============================================================================
+ * Raw extraction
+ *===========================================================================*/
+
+/* Bytes of one signal; nbytes and intel are constants at every call site */
+ALWAYS_INLINE uint64_t load_bytes(const uint8_t *p, int nbytes, int intel) {
+    uint64_t v = 0;
+
+    if (intel) {
+        for (int b = nbytes - 1; b >= 0; b--) {
+            v = (v << 8) | p[b];
+        }
+    } else {
+        for (int b = 0; b < nbytes; b++) {
+            v = (v << 8) | p[b];
+        }
+    }
+    return v;
+}
+
+/*
+ * raw[i] = biased raw value of frame i. Shift, mask and bias are copied
+ * to locals: the raw[] stores could otherwise alias the signal.
+ */
+#define DEFINE_EXTRACT(name, type) \
+    ALWAYS_INLINE void name##_n(const struct vtu_signal *s, int nbytes, int intel, \
+                                const uint8_t *data, size_t stride, size_t n, type *raw) { \
+        const unsigned shift = s->shift; \
+        const type mask = (type)s->mask; \
+        const type sign = s->is_signed ? (type)1 << (s->length - 1) : 0; \
+        \
+        data += s->byte; \
+        for (size_t i = 0; i < n; i++) { \
+            type v = (type)load_bytes(data + i * stride, nbytes, intel); \
+            raw[i] = ((v >> shift) & mask) ^ sign; \
+        } \
+    } \
+    \
+    static void name(const struct vtu_signal *s, const uint8_t *data, size_t stride, \
+                     size_t n, type *raw) { \
+        int intel = s->byte_order == VTU_SIG_INTEL; \
+        \
+        switch (s->nbytes) { \
+            EXTRACT_CASE(name, 1) \
+            EXTRACT_CASE(name, 2) \
+            EXTRACT_CASE(name, 3) \
+            EXTRACT_CASE(name, 4) \
+            EXTRACT_CASE(name, 5) \
+            EXTRACT_CASE(name, 6) \
+            EXTRACT_CASE(name, 7) \
+            EXTRACT_CASE(name, 8) \
+        } \
+    }
+
+#define EXTRACT_CASE(name, nb) \
+    case nb: \
+        if (intel) { \
+            name##_n(s, nb, 1, data, stride, n, raw); \
+        } else { \
+            name##_n(s, nb, 0, data, stride, n, raw); \
+        } \
+        break;
+
+/* A signal of up to 24 bits spans at most 4 bytes, so 32-bit lanes never truncate */
+DEFINE_EXTRACT(extract32, uint32_t)
+DEFINE_EXTRACT(extract64, uint64_t)
+
+/*============================================================================
+ * Scaling: out[i] = (raw[i] - bias) * factor + offset
+ *===========================================================================*/
+
+static void scale32(const uint32_t *raw, size_t n, double bias, double factor, double offset,
+                    float *out) {
+    size_t i = 0;
+
+#if defined(BATCH_NEON)
+    float64x2_t vbias = vdupq_n_f64(bias);
+    float64x2_t vfactor = vdupq_n_f64(factor);
+    float64x2_t voffset = vdupq_n_f64(offset);
+
+    /* Lanes are below 2^24, so going through float is exact */
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vcvtq_f32_u32(vld1q_u32(raw + i));
+        float64x2_t lo = vcvt_f64_f32(vget_low_f32(v));
+        float64x2_t hi = vcvt_high_f64_f32(v);
+        lo = vaddq_f64(vmulq_f64(vsubq_f64(lo, vbias), vfactor), voffset);
+        hi = vaddq_f64(vmulq_f64(vsubq_f64(hi, vbias), vfactor), voffset);
+        vst1q_f32(out + i, vcvt_high_f32_f64(vcvt_f32_f64(lo), hi));
+    }
+#elif defined(BATCH_AVX)
+    __m256d vbias = _mm256_set1_pd(bias);
+    __m256d vfactor = _mm256_set1_pd(factor);
+    __m256d voffset = _mm256_set1_pd(offset);
+
+    /* Lanes are below 2^24, so the signed conversion is exact */
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(raw + i)));
+        v = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(v, vbias), vfactor), voffset);
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(v));
+    }
+#elif defined(BATCH_SSE2)
+    __m128d vbias = _mm_set1_pd(bias);
+    __m128d vfactor = _mm_set1_pd(factor);
+    __m128d voffset = _mm_set1_pd(offset);
+
+    /* Lanes are below 2^24, so the signed conversion is exact */
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(raw + i));
+        __m128d lo = _mm_cvtepi32_pd(v);
+        __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(v, 8));
+        lo = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(lo, vbias), vfactor), voffset);
+        hi = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(hi, vbias), vfactor), voffset);
+        _mm_storeu_ps(out + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = (float)(((double)raw[i] - bias) * factor + offset);
+    }
+}
+
+static void scale64(const uint64_t *raw, size_t n, double bias, double factor, double offset,
+                    float *out) {
+    size_t i = 0;
+
+#if defined(BATCH_NEON)
+    float64x2_t vbias = vdupq_n_f64(bias);
+    float64x2_t vfactor = vdupq_n_f64(factor);
+    float64x2_t voffset = vdupq_n_f64(offset);
+
+    for (; i + 4 <= n; i += 4) {
+        float64x2_t lo = vcvtq_f64_u64(vld1q_u64(raw + i));
+        float64x2_t hi = vcvtq_f64_u64(vld1q_u64(raw + i + 2));
+        lo = vaddq_f64(vmulq_f64(vsubq_f64(lo, vbias), vfactor), voffset);
+        hi = vaddq_f64(vmulq_f64(vsubq_f64(hi, vbias), vfactor), voffset);
+        vst1q_f32(out + i, vcvt_high_f32_f64(vcvt_f32_f64(lo), hi));
+    }
+#elif defined(BATCH_AVX)
+    /* No 64-bit integer conversion before AVX-512: OR the value into the
+     * mantissa of 2^52 and subtract 2^52 */
+    __m256d magic = _mm256_set1_pd(TWO_POW_52);
+    __m256d vbias = _mm256_set1_pd(bias);
+    __m256d vfactor = _mm256_set1_pd(factor);
+    __m256d voffset = _mm256_set1_pd(offset);
+
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_castsi256_pd(_mm256_loadu_si256((const __m256i *)(raw + i)));
+        v = _mm256_sub_pd(_mm256_or_pd(v, magic), magic);
+        v = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(v, vbias), vfactor), voffset);
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(v));
+    }
+#elif defined(BATCH_SSE2)
+    /* Same 2^52 trick as the AVX path */
+    __m128d magic = _mm_set1_pd(TWO_POW_52);
+    __m128d vbias = _mm_set1_pd(bias);
+    __m128d vfactor = _mm_set1_pd(factor);
+    __m128d voffset = _mm_set1_pd(offset);
+
+    for (; i + 4 <= n; i += 4) {
+        __m128d lo = _mm_castsi128_pd(_mm_loadu_si128((const __m128i *)(raw + i)));
+        __m128d hi = _mm_castsi128_pd(_mm_loadu_si128((const __m128i *)(raw + i + 2)));
+        lo = _mm_sub_pd(_mm_or_pd(lo, magic), magic);
+        hi = _mm_sub_pd(_mm_or_pd(hi, magic), magic);
+        lo = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(lo, vbias), vfactor), voffset);
+        hi = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(hi, vbias), vfactor), voffset);
+        _mm_storeu_ps(out + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = (float)(((double)raw[i] - bias) * factor + offset);
+    }
+}
+
+/* Signals too wide for an exact double, as in vtu_sigdb_decode() */
+static void decode_wide(const struct vtu_signal *s, const uint8_t *data, size_t stride,
+                        size_t n, float *out) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t raw = load_bytes(data + i * stride + s->byte, s->nbytes,
+                                  s->byte_order == VTU_SIG_INTEL);
+        double value;
+
+        raw = (raw >> s->shift) & s->mask;
+        if (s->is_signed && (raw >> (s->length - 1)) & 1) {
+            value = (double)(int64_t)(raw | ~s->mask);
+        } else {
+            value = (double)raw;
+        }
+        out[i] = (float)(value * s->factor + s->offset);
+    }
+}
+
+/*============================================================================
+ * API
+ *===========================================================================*/
+
+int vtu_sigdb_decode_batch(const struct vtu_sigdb *db, const struct vtu_message *msg,
+                           const uint8_t *data, const uint8_t *len, size_t stride,
+                           size_t n, float *const *columns) {
+    const struct vtu_signal *signals = &db->signals[msg->first];
+    union {
+        uint32_t r32[CHUNK];
+        uint64_t r64[CHUNK];
+    } raw;
+    int decoded = 0;
+
+    for (size_t done = 0; done < n; done += CHUNK) {
+        size_t count = n - done < CHUNK ? n - done : CHUNK;
+        const uint8_t *chunk = data + done * stride;
+        unsigned min_len = msg->dlc;
+
+        /* One pass over the lengths; short frames are rare */
+        if (len) {
+            min_len = 255;
+            for (size_t f = 0; f < count; f++) {
+                unsigned l = len[(done + f) * stride];
+                min_len = l < min_len ? l : min_len;
+            }
+        }
+
+        for (int i = 0; i < msg->count; i++) {
+            const struct vtu_signal *s = &signals[i];
+            unsigned end = s->byte + s->nbytes;
+            float *out = columns[i] ? columns[i] + done : NULL;
+
+            if (!out) {
+                continue;
+            }
+            if (s->length <= MAX_FLOAT_BITS) {
+                extract32(s, chunk, stride, count, raw.r32);
+                scale32(raw.r32, count, s->is_signed ? (double)(1u << (s->length - 1)) : 0.0,
+                        s->factor, s->offset, out);
+            } else if (s->length <= MAX_DOUBLE_BITS) {
+                extract64(s, chunk, stride, count, raw.r64);
+                scale64(raw.r64, count, s->is_signed ? (double)(1ULL << (s->length - 1)) : 0.0,
+                        s->factor, s->offset, out);
+            } else {
+                decode_wide(s, chunk, stride, count, out);
+            }
+
+            /* Frames that end before the signal does */
+            if (min_len < end) {
+                for (size_t f = 0; f < count; f++) {
+                    if ((len ? len[(done + f) * stride] : msg->dlc) < end) {
+                        out[f] = NAN;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < msg->count; i++) {
+        decoded += columns[i] != NULL;
+    }
+    return decoded;
+}
+
+const char *vtu_sigdb_batch_isa(void) {
+#if defined(BATCH_NEON)
+    return "neon";
+#elif defined(BATCH_AVX)
+    return "avx";
+#elif defined(BATCH_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,552 @@
+/**
+ * @file signal_db.c
+ * @brief Table-driven CAN signal database and decoder
+ */
+
+#define _GNU_SOURCE  /* getline() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "vtu/signal_db.h"
+
+#define SFF_MASK        0x000007FFu
+#define EFF_MASK        0x1FFFFFFFu
+#define MAX_DLEN        64
+#define MAX_INDEX       0xFFFF      /* Messages and signals are indexed with uint16_t */
+#define NAME_MAX_LEN    128
+
+/*============================================================================
+ * Built-in VTU bus layout (generated from dbc/vtu.dbc by tools/dbcgen.py)
+ *===========================================================================*/
+
+struct builtin_signal {
+    const char *name;
+    uint16_t start_bit;
+    uint8_t  length;
+    uint8_t  byte_order;
+    uint8_t  is_signed;
+    double   factor;
+    double   offset;
+    float    min;
+    float    max;
+    const char *unit;
+};
+
+struct builtin_message {
+    const char *name;
+    uint32_t can_id;
+    uint8_t  dlc;
+    const struct builtin_signal *signals;
+    int      count;
+};
+
+#include "vtu_bus_sigdb.h"
+
+/*============================================================================
+ * Building
+ *===========================================================================*/
+
+static uint32_t hash_id(uint32_t can_id) {
+    uint32_t h = can_id * 2654435761u;
+    return h ^ (h >> 15);
+}
+
+/* The key a received ID is looked up with */
+static uint32_t message_key(uint32_t can_id) {
+    return (can_id & VTU_SIG_EXT_ID) ? can_id & (VTU_SIG_EXT_ID | EFF_MASK)
+                                     : can_id & SFF_MASK;
+}
+
+static int add_message(struct vtu_sigdb *db, const char *name, uint32_t can_id, int dlc) {
+    struct vtu_message *m;
+
+    if (db->nmessages == MAX_INDEX || dlc > MAX_DLEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < db->nmessages; i++) {
+        if (db->messages[i].can_id == message_key(can_id)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (db->nmessages == db->cap_messages) {
+        int cap = db->cap_messages ? db->cap_messages * 2 : 16;
+        void *p = realloc(db->messages, cap * sizeof(*db->messages));
+        if (!p) {
+            return -1;
+        }
+        db->messages = p;
+        db->cap_messages = cap;
+    }
+    m = &db->messages[db->nmessages];
+    m->name = strdup(name);
+    if (!m->name) {
+        return -1;
+    }
+    m->can_id = message_key(can_id);
+    m->dlc = (uint8_t)dlc;
+    m->first = (uint16_t)db->nsignals;
+    m->count = 0;
+    db->nmessages++;
+    return 0;
+}
+
+/* Add a signal to the last message, working out where it sits in the payload */
+static int add_signal(struct vtu_sigdb *db, const char *name, int start_bit, int length,
+                      int byte_order, int is_signed, double factor, double offset,
+                      float min, float max, const char *unit) {
+    struct vtu_signal *s;
+    int byte, nbytes, shift;
+
+    if (db->nmessages == 0 || db->nsignals == MAX_INDEX ||
+        length < 1 || length > 64 || start_bit < 0 || start_bit >= MAX_DLEN * 8) {
+        errno = EINVAL;
+        return -1;
+    }
+    byte = start_bit / 8;
+    if (byte_order == VTU_SIG_INTEL) {
+        /* LSB at start_bit, growing towards higher bits and bytes */
+        shift = start_bit % 8;
+        nbytes = (shift + length + 7) / 8;
+    } else {
+        /* MSB at start_bit, continuing at bit 7 of the next byte */
+        int lead = 7 - start_bit % 8;
+        nbytes = (lead + length + 7) / 8;
+        shift = nbytes * 8 - lead - length;
+    }
+    /* One 64-bit load per signal */
+    if (nbytes > 8 || byte + nbytes > MAX_DLEN) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (db->nsignals == db->cap_signals) {
+        int cap = db->cap_signals ? db->cap_signals * 2 : 64;
+        void *p = realloc(db->signals, cap * sizeof(*db->signals));
+        if (!p) {
+            return -1;
+        }
+        db->signals = p;
+        db->cap_signals = cap;
+    }
+    s = &db->signals[db->nsignals];
+    memset(s, 0, sizeof(*s));
+    s->name = strdup(name);
+    s->unit = strdup(unit);
+    if (!s->name || !s->unit) {
+        free((void *)s->name);
+        free((void *)s->unit);
+        return -1;
+    }
+    s->message = (uint16_t)(db->nmessages - 1);
+    s->start_bit = (uint16_t)start_bit;
+    s->length = (uint8_t)length;
+    s->byte_order = (uint8_t)byte_order;
+    s->is_signed = (uint8_t)is_signed;
+    s->factor = factor;
+    s->offset = offset;
+    s->min = min;
+    s->max = max;
+    s->byte = (uint8_t)byte;
+    s->nbytes = (uint8_t)nbytes;
+    s->shift = (uint8_t)shift;
+    s->mask = length == 64 ? ~0ULL : (1ULL << length) - 1;
+    db->nsignals++;
+    db->messages[db->nmessages - 1].count++;
+    return 0;
+}
+
+/* At most half full, so probes stay short */
+static int build_hash(struct vtu_sigdb *db) {
+    uint32_t size = 16;
+
+    while (size < (uint32_t)db->nmessages * 2) {
+        size *= 2;
+    }
+    free(db->hash);
+    db->hash = calloc(size, sizeof(*db->hash));
+    if (!db->hash) {
+        return -1;
+    }
+    db->hash_mask = size - 1;
+    for (int i = 0; i < db->nmessages; i++) {
+        uint32_t h = hash_id(db->messages[i].can_id) & db->hash_mask;
+        while (db->hash[h]) {
+            h = (h + 1) & db->hash_mask;
+        }
+        db->hash[h] = (uint16_t)(i + 1);
+    }
+    return 0;
+}
+
+int vtu_sigdb_builtin(struct vtu_sigdb *db) {
+    size_t nmsg = sizeof(builtin_messages) / sizeof(builtin_messages[0]);
+
+    memset(db, 0, sizeof(*db));
+    for (size_t m = 0; m < nmsg; m++) {
+        const struct builtin_message *bm = &builtin_messages[m];
+        if (add_message(db, bm->name, bm->can_id, bm->dlc) < 0) {
+            goto fail;
+        }
+        for (int i = 0; i < bm->count; i++) {
+            const struct builtin_signal *bs = &bm->signals[i];
+            if (add_signal(db, bs->name, bs->start_bit, bs->length, bs->byte_order,
+                           bs->is_signed, bs->factor, bs->offset, bs->min, bs->max,
+                           bs->unit) < 0) {
+                goto fail;
+            }
+        }
+    }
+    if (build_hash(db) < 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    vtu_sigdb_free(db);
+    return -1;
+}
+
+/*============================================================================
+ * DBC parsing
+ *===========================================================================*/
+
+static char *skip_space(char *p) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return p;
+}
+
+/* Copy the next token (ended by whitespace or ':') of *pp to out */
+static int next_token(char **pp, char *out, size_t size) {
+    char *p = skip_space(*pp);
+    size_t len = strcspn(p, " \t:");
+
+    if (len == 0 || len >= size) {
+        return -1;
+    }
+    memcpy(out, p, len);
+    out[len] = '\0';
+    *pp = p + len;
+    return 0;
+}
+
+/*
+ * BO_ <id> <name>: <dlc> <transmitter>
+ * Returns 1 if the message is kept, 0 if its signals are to be ignored
+ * (VECTOR__INDEPENDENT_SIG_MSG), -1 on a syntax error.
+ */
+static int parse_message(struct vtu_sigdb *db, char *p) {
+    char name[NAME_MAX_LEN];
+    char *end;
+    unsigned long id;
+    long dlc;
+
+    id = strtoul(p, &end, 10);
+    if (end == p) {
+        return -1;
+    }
+    p = end;
+    if (next_token(&p, name, sizeof(name)) < 0) {
+        return -1;
+    }
+    p = skip_space(p);
+    if (*p != ':') {
+        return -1;
+    }
+    dlc = strtol(p + 1, &end, 10);
+    if (end == p + 1 || dlc < 0) {
+        return -1;
+    }
+    /* Bit 31 marks a 29-bit ID; anything else above 29 bits is a pseudo message */
+    if ((id & ~(unsigned long)VTU_SIG_EXT_ID) > EFF_MASK) {
+        return 0;
+    }
+    return add_message(db, name, (uint32_t)id, (int)dlc) < 0 ? -1 : 1;
+}
+
+/*
+ * SG_ <name> [M|mN] : <start>|<len>@<order><sign> (<factor>,<offset>) [<min>|<max>] "<unit>" <rx>
+ * Returns 0 on success (or a skipped multiplexed signal), -1 on a syntax error.
+ */
+static int parse_signal(struct vtu_sigdb *db, char *p) {
+    char name[NAME_MAX_LEN], mux[NAME_MAX_LEN];
+    char *unit, *q;
+    int start, length, n = 0;
+    char order, sign;
+    double factor, offset, min, max;
+
+    if (next_token(&p, name, sizeof(name)) < 0) {
+        return -1;
+    }
+    p = skip_space(p);
+    if (*p != ':') {
+        if (next_token(&p, mux, sizeof(mux)) < 0) {
+            return -1;
+        }
+        p = skip_space(p);
+        if (*p != ':') {
+            return -1;
+        }
+        if (mux[0] == 'm') {
+            return 0;   /* Multiplexed: only valid for one multiplexer value */
+        }
+    }
+    if (sscanf(p + 1, " %d|%d@%c%c (%lf,%lf) [%lf|%lf]%n",
+               &start, &length, &order, &sign, &factor, &offset, &min, &max, &n) != 8 ||
+        n == 0 || (order != '0' && order != '1') || (sign != '+' && sign != '-')) {
+        return -1;
+    }
+    p += 1 + n;
+
+    /* The unit may be empty */
+    unit = strchr(p, '"');
+    q = unit ? strchr(unit + 1, '"') : NULL;
+    if (!q) {
+        return -1;
+    }
+    *q = '\0';
+
+    return add_signal(db, name, start, length,
+                      order == '1' ? VTU_SIG_INTEL : VTU_SIG_MOTOROLA, sign == '-',
+                      factor, offset, (float)min, (float)max, unit + 1);
+}
+
+/*
+ * SIG_VALTYPE_ <id> <name> : <0|1|2>;
+ * Returns -1 if a signal that was loaded is an IEEE float (1) or double (2):
+ * decoding it as a scaled integer would give wrong values.
+ */
+static int parse_valtype(struct vtu_sigdb *db, char *p) {
+    char name[NAME_MAX_LEN];
+    char *end;
+    unsigned long id;
+    long type;
+
+    id = strtoul(p, &end, 10);
+    if (end == p) {
+        return -1;
+    }
+    p = end;
+    if (next_token(&p, name, sizeof(name)) < 0) {
+        return -1;
+    }
+    p = skip_space(p);
+    if (*p != ':') {
+        return -1;
+    }
+    type = strtol(p + 1, &end, 10);
+    if (end == p + 1) {
+        return -1;
+    }
+    if (type == 0) {
+        return 0;
+    }
+    for (int m = 0; m < db->nmessages; m++) {
+        const struct vtu_message *msg = &db->messages[m];
+        if (msg->can_id != message_key((uint32_t)id)) {
+            continue;
+        }
+        for (int i = msg->first; i < msg->first + msg->count; i++) {
+            if (strcmp(db->signals[i].name, name) == 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Quotes in a line; an odd count opens or closes a multi-line string */
+static int count_quotes(const char *p) {
+    int n = 0;
+
+    for (; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '"') {
+            n++;
+        }
+    }
+    return n;
+}
+
+int vtu_sigdb_load_dbc(struct vtu_sigdb *db, const char *path, int *err_line) {
+    FILE *f;
+    char *line = NULL;
+    size_t cap = 0;
+    int lineno = 0;
+    int in_string = 0;      /* Inside a CM_ text spanning lines */
+    int in_message = 0;     /* 1 = SG_ lines belong to a kept message, -1 = ignored */
+    int err = 0;
+
+    memset(db, 0, sizeof(*db));
+    if (err_line) {
+        *err_line = 0;
+    }
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (getline(&line, &cap, f) > 0) {
+        int was_in_string = in_string;
+        char *p;
+
+        lineno++;
+        if (count_quotes(line) % 2) {
+            in_string = !in_string;
+        }
+        if (was_in_string) {
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        p = skip_space(line);
+        errno = 0;
+
+        if (strncmp(p, "BO_ ", 4) == 0) {
+            in_message = parse_message(db, p + 4);
+            if (in_message < 0) {
+                err = errno == ENOMEM ? ENOMEM : EINVAL;
+                break;
+            }
+            if (in_message == 0) {
+                in_message = -1;
+            }
+        } else if (strncmp(p, "SG_ ", 4) == 0) {
+            if (in_message == 0 || (in_message > 0 && parse_signal(db, p + 4) < 0)) {
+                err = errno == ENOMEM ? ENOMEM : EINVAL;
+                break;
+            }
+        } else if (strncmp(p, "SIG_VALTYPE_ ", 13) == 0) {
+            in_message = 0;
+            if (parse_valtype(db, p + 13) < 0) {
+                err = EINVAL;
+                break;
+            }
+        } else if (*p) {
+            /* Signals follow their message directly */
+            in_message = 0;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    if (!err && build_hash(db) < 0) {
+        err = ENOMEM;
+    }
+    if (err) {
+        if (err_line && err == EINVAL) {
+            *err_line = lineno;
+        }
+        vtu_sigdb_free(db);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void vtu_sigdb_free(struct vtu_sigdb *db) {
+    for (int i = 0; i < db->nmessages; i++) {
+        free((void *)db->messages[i].name);
+    }
+    for (int i = 0; i < db->nsignals; i++) {
+        free((void *)db->signals[i].name);
+        free((void *)db->signals[i].unit);
+    }
+    free(db->messages);
+    free(db->signals);
+    free(db->hash);
+    memset(db, 0, sizeof(*db));
+}
+
+/*============================================================================
+ * Lookup and decoding
+ *===========================================================================*/
+
+int vtu_sigdb_signal(const struct vtu_sigdb *db, const char *name) {
+    const char *dot = strchr(name, '.');
+    const char *signal = dot ? dot + 1 : name;
+
+    for (int i = 0; i < db->nsignals; i++) {
+        const struct vtu_signal *s = &db->signals[i];
+        if (strcmp(s->name, signal) != 0) {
+            continue;
+        }
+        if (dot) {
+            const char *msg = db->messages[s->message].name;
+            if (strlen(msg) != (size_t)(dot - name) || strncmp(msg, name, dot - name) != 0) {
+                continue;
+            }
+        }
+        return i;
+    }
+    return -1;
+}
+
+const struct vtu_message *vtu_sigdb_find(const struct vtu_sigdb *db, uint32_t can_id) {
+    uint32_t key = message_key(can_id);
+    uint32_t h;
+
+    if (!db->hash) {
+        return NULL;
+    }
+    for (h = hash_id(key) & db->hash_mask; db->hash[h]; h = (h + 1) & db->hash_mask) {
+        const struct vtu_message *m = &db->messages[db->hash[h] - 1];
+        if (m->can_id == key) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+int vtu_sigdb_decode(const struct vtu_sigdb *db, const struct vtu_message *msg,
+                     const uint8_t *data, uint8_t len, float *values) {
+    const struct vtu_signal *s = &db->signals[msg->first];
+    float *out = &values[msg->first];
+    int n = 0;
+
+    for (int i = 0; i < msg->count; i++, s++) {
+        const uint8_t *p = data + s->byte;
+        uint64_t raw = 0;
+        double value;
+
+        if (s->byte + s->nbytes > len) {
+            continue;
+        }
+        if (s->byte_order == VTU_SIG_MOTOROLA) {
+            for (int b = 0; b < s->nbytes; b++) {
+                raw = (raw << 8) | p[b];
+            }
+        } else {
+            for (int b = s->nbytes - 1; b >= 0; b--) {
+                raw = (raw << 8) | p[b];
+            }
+        }
+        raw = (raw >> s->shift) & s->mask;
+
+        if (s->is_signed && (raw >> (s->length - 1)) & 1) {
+            value = (double)(int64_t)(raw | ~s->mask);
+        } else {
+            value = (double)raw;
+        }
+        out[i] = (float)(value * s->factor + s->offset);
+        n++;
+    }
+    return n;
+}
+
+const struct vtu_message *vtu_sigdb_decode_frame(const struct vtu_sigdb *db, uint32_t can_id,
+                                                 const uint8_t *data, uint8_t len,
+                                                 float *values) {
+    const struct vtu_message *msg = vtu_sigdb_find(db, can_id);
+
+    if (msg) {
+        vtu_sigdb_decode(db, msg, data, len, values);
+    }
+    return msg;
+}
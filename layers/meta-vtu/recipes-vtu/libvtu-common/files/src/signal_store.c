@@ -0,0 +1,256 @@
+/**
+ * @file signal_store.c
+ * @brief Shared-memory store of the latest value of every CAN signal
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vtu/signal_store.h"
+
+#define CACHE_LINE      64
+
+static size_t align_up(size_t n, size_t to) {
+    return (n + to - 1) & ~(to - 1);
+}
+
+static int set_name(struct vtu_store *st, const char *name) {
+    if (name[0] != '/' || strlen(name) >= sizeof(st->name)) {
+        errno = EINVAL;
+        return -1;
+    }
+    strcpy(st->name, name);
+    return 0;
+}
+
+/* Tell the consumers of a previous producer's object to reopen */
+static void retire_existing(const char *name) {
+    struct vtu_store_header *hdr;
+    struct stat sb;
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof(*hdr)) {
+        hdr = mmap(NULL, sizeof(*hdr), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (hdr != MAP_FAILED) {
+            if (hdr->magic == VTU_STORE_MAGIC) {
+                __atomic_store_n(&hdr->state, VTU_STORE_CLOSED, __ATOMIC_RELEASE);
+            }
+            munmap(hdr, sizeof(*hdr));
+        }
+    }
+    close(fd);
+    shm_unlink(name);
+}
+
+int vtu_store_create(struct vtu_store *st, const char *name, const struct vtu_sigdb *db) {
+    size_t names_offset = align_up(sizeof(struct vtu_store_header), CACHE_LINE);
+    size_t slots_offset = align_up(names_offset + db->nsignals * sizeof(struct vtu_store_name),
+                                   CACHE_LINE);
+    size_t size = slots_offset + db->nsignals * sizeof(struct vtu_store_slot);
+    struct vtu_store_name *names;
+    struct stat sb;
+    void *base;
+    int fd;
+
+    memset(st, 0, sizeof(*st));
+    if (set_name(st, name) < 0) {
+        return -1;
+    }
+
+    retire_existing(name);
+
+    /* 0644: consumers may run as other users */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0 || fstat(fd, &sb) < 0) {
+        goto fail;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        goto fail;
+    }
+    close(fd);
+
+    /* The object starts zeroed: every slot is "never received" */
+    st->hdr = base;
+    st->names = names = (struct vtu_store_name *)((char *)base + names_offset);
+    st->slots = (struct vtu_store_slot *)((char *)base + slots_offset);
+    st->nsignals = db->nsignals;
+    st->size = size;
+    st->producer = 1;
+    st->ino = sb.st_ino;
+
+    for (int i = 0; i < db->nsignals; i++) {
+        const struct vtu_signal *s = &db->signals[i];
+        snprintf(names[i].name, sizeof(names[i].name), "%s.%s",
+                 db->messages[s->message].name, s->name);
+        snprintf(names[i].unit, sizeof(names[i].unit), "%s", s->unit ? s->unit : "");
+    }
+
+    st->hdr->version = VTU_STORE_VERSION;
+    st->hdr->nsignals = db->nsignals;
+    st->hdr->state = VTU_STORE_LIVE;
+    st->hdr->producer_pid = (uint32_t)getpid();
+    st->hdr->names_offset = names_offset;
+    st->hdr->slots_offset = slots_offset;
+    st->hdr->size = size;
+    st->hdr->created_us = vtu_store_now_us();
+
+    /* Last: consumers treat the object as valid from here on */
+    __atomic_store_n(&st->hdr->magic, VTU_STORE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = saved;
+    }
+    return -1;
+}
+
+int vtu_store_open(struct vtu_store *st, const char *name) {
+    struct vtu_store_header *hdr;
+    struct stat sb;
+    size_t names_end;
+    uint32_t magic;
+    int fd;
+
+    memset(st, 0, sizeof(*st));
+    if (set_name(st, name) < 0) {
+        return -1;
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) < 0) {
+        close(fd);
+        return -1;
+    }
+    /* Still being sized by the producer */
+    if ((size_t)sb.st_size < sizeof(*hdr)) {
+        close(fd);
+        errno = EAGAIN;
+        return -1;
+    }
+    hdr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return -1;
+    }
+
+    magic = __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE);
+    if (magic != VTU_STORE_MAGIC) {
+        munmap(hdr, sb.st_size);
+        errno = magic == 0 ? EAGAIN : EPROTO;     /* 0: not filled in yet */
+        return -1;
+    }
+    names_end = hdr->names_offset + (size_t)hdr->nsignals * sizeof(struct vtu_store_name);
+    if (hdr->version != VTU_STORE_VERSION || hdr->size > (size_t)sb.st_size ||
+        names_end > hdr->slots_offset ||
+        hdr->slots_offset + (size_t)hdr->nsignals * sizeof(struct vtu_store_slot) > hdr->size) {
+        munmap(hdr, sb.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+
+    st->hdr = hdr;
+    st->names = (const struct vtu_store_name *)((const char *)hdr + hdr->names_offset);
+    st->slots = (struct vtu_store_slot *)((char *)hdr + hdr->slots_offset);
+    st->nsignals = hdr->nsignals;
+    st->size = sb.st_size;
+    return 0;
+}
+
+void vtu_store_close(struct vtu_store *st) {
+    if (!st->hdr) {
+        return;
+    }
+    if (st->producer) {
+        struct stat sb;
+        int fd;
+
+        __atomic_store_n(&st->hdr->state, VTU_STORE_CLOSED, __ATOMIC_RELEASE);
+
+        /* Unless a newer producer has taken the name over */
+        fd = shm_open(st->name, O_RDONLY, 0);
+        if (fd >= 0) {
+            if (fstat(fd, &sb) == 0 && sb.st_ino == st->ino) {
+                shm_unlink(st->name);
+            }
+            close(fd);
+        }
+    }
+    munmap(st->hdr, st->size);
+    st->hdr = NULL;
+    st->names = NULL;
+    st->slots = NULL;
+    st->nsignals = 0;
+}
+
+int vtu_store_find(const struct vtu_store *st, const char *name) {
+    int qualified = strchr(name, '.') != NULL;
+
+    for (int i = 0; i < st->nsignals; i++) {
+        const char *full = st->names[i].name;
+        const char *dot = strchr(full, '.');
+
+        if (strcmp(qualified || !dot ? full : dot + 1, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void vtu_store_publish(struct vtu_store *st, int first, int count, const float *values,
+                       uint64_t timestamp_us) {
+    for (int i = first; i < first + count; i++) {
+        struct vtu_store_slot *slot = &st->slots[i];
+        uint32_t seq = slot->seq;       /* Only this process writes it */
+        float value = values[i];
+
+        __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store(&slot->value, &value, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->timestamp_us, timestamp_us, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+}
+
+void vtu_store_publish_frame(struct vtu_store *st, const struct vtu_sigdb *db,
+                             const struct vtu_message *msg, uint8_t len, const float *values,
+                             uint64_t timestamp_us) {
+    if (len >= msg->dlc) {
+        vtu_store_publish(st, msg->first, msg->count, values, timestamp_us);
+    } else {
+        /* Short frame: signals past its end keep their old value and time */
+        int end = msg->first + msg->count;
+
+        /* One call per run of signals that fit, i.e. one for a prefix */
+        for (int i = msg->first; i < end; i++) {
+            int run = i;
+
+            while (run < end && db->signals[run].byte + db->signals[run].nbytes <= len) {
+                run++;
+            }
+            if (run > i) {
+                vtu_store_publish(st, i, run - i, values, timestamp_us);
+            }
+            i = run;    /* Signal run (if any) ends past the frame */
+        }
+    }
+    __atomic_store_n(&st->hdr->frames, st->hdr->frames + 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,539 @@
+#!/usr/bin/env python3
+"""
+dbcgen.py - generate specialized CAN decoders and encoders from a DBC file
+
+Reads the BO_/SG_ entries of a DBC file (plus GenMsgCycleTime and VAL_
+tables) and writes a C header/source pair:
+
+  <prefix>.h  message IDs, lengths and cycle times, one index per signal,
+              one static inline getter and setter per signal and one
+              static inline decoder and encoder per message, all with
+              constant shifts and masks
+  <prefix>.c  <prefix>_decode(): perfect-hash dispatch from CAN ID to the
+              message decoder, and the signal name table
+
+With --sigdb it also writes the layout table signal_db.c includes for
+vtu_sigdb_builtin(), so the built-in database comes from the same DBC.
+
+Signal indices follow file order, as in vtu_sigdb_load_dbc(), so the
+generated decoders and the signal database fill the same value arrays.
+Values are computed the same way as vtu_sigdb_decode() (double scaling,
+stored as float); the setters invert that, rounding to the nearest raw
+value and saturating at the ends of the raw range. Multiplexed signals and pseudo messages are skipped;
+IEEE float/double signals (SIG_VALTYPE_ 1/2) are rejected.
+
+Usage: dbcgen.py [--prefix vtu_bus] [--include vtu/vtu_bus.h] [--sigdb table.h]
+                 in.dbc out.h out.c
+"""
+
+import argparse
+import os
+import re
+import sys
+
+EXT_ID = 0x80000000
+SFF_MASK = 0x7FF
+EFF_MASK = 0x1FFFFFFF
+MAX_DLEN = 64
+EMPTY_KEY = 0xFFFFFFFF
+
+BO_RE = re.compile(r'BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)')
+SG_RE = re.compile(r'SG_\s+(\w+)\s*(\w*)\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*'
+                   r'\(\s*([^,\s]+)\s*,\s*([^)\s]+)\s*\)\s*'
+                   r'\[\s*([^|\s]+)\s*\|\s*([^\]\s]+)\s*\]\s*"([^"]*)"')
+CYCLE_RE = re.compile(r'BA_\s+"GenMsgCycleTime"\s+BO_\s+(\d+)\s+(\d+)\s*;')
+VAL_RE = re.compile(r'VAL_\s+(\d+)\s+(\w+)\s+(.*);')
+VAL_ENTRY_RE = re.compile(r'(-?\d+)\s+"([^"]*)"')
+VALTYPE_RE = re.compile(r'SIG_VALTYPE_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s*;')
+
+
+class DbcError(Exception):
+    pass
+
+
+class Signal:
+    def __init__(self, name, start, length, intel, signed, factor, offset,
+                 minimum, maximum, unit):
+        self.name = name
+        self.start = start
+        self.length = length
+        self.intel = intel
+        self.signed = signed
+        self.factor = factor
+        self.offset = offset
+        self.minimum = minimum
+        self.maximum = maximum
+        self.unit = unit
+        self.values = []
+        self.index = 0
+
+        # Same placement as add_signal() in signal_db.c
+        self.byte = start // 8
+        if intel:
+            self.shift = start % 8
+            self.nbytes = (self.shift + length + 7) // 8
+        else:
+            lead = 7 - start % 8
+            self.nbytes = (lead + length + 7) // 8
+            self.shift = self.nbytes * 8 - lead - length
+        if not 1 <= length <= 64 or self.nbytes > 8 or self.byte + self.nbytes > MAX_DLEN:
+            raise DbcError('signal %s does not fit one 64-bit load' % name)
+
+    @property
+    def end(self):
+        """Payload bytes needed to decode the signal"""
+        return self.byte + self.nbytes
+
+
+class Message:
+    def __init__(self, can_id, name, dlc):
+        self.can_id = can_id
+        self.name = name
+        self.dlc = dlc
+        self.cycle_ms = 0
+        self.signals = []
+
+    @property
+    def key(self):
+        """The ID as <prefix>_decode() looks it up"""
+        if self.can_id & EXT_ID:
+            return self.can_id & (EXT_ID | EFF_MASK)
+        return self.can_id & SFF_MASK
+
+
+def parse_dbc(path):
+    messages = []
+    by_id = {}
+    current = None
+    in_string = False
+
+    with open(path, encoding='utf-8', errors='replace') as f:
+        for lineno, line in enumerate(f, 1):
+            # Skip the continuation lines of multi-line CM_ texts
+            was_in_string = in_string
+            if (line.count('"') - line.count('\\"')) % 2:
+                in_string = not in_string
+            if was_in_string:
+                continue
+            text = line.strip()
+
+            if text.startswith('BO_ '):
+                m = BO_RE.match(text)
+                if not m:
+                    raise DbcError('%s:%d: invalid BO_ entry' % (path, lineno))
+                can_id, name, dlc = int(m.group(1)), m.group(2), int(m.group(3))
+                # Bit 31 marks a 29-bit ID; anything else above is a pseudo message
+                if can_id & ~EXT_ID > EFF_MASK:
+                    current = None
+                    continue
+                if dlc > MAX_DLEN:
+                    raise DbcError('%s:%d: %s is longer than %d bytes' % (path, lineno, name, MAX_DLEN))
+                current = Message(can_id, name, dlc)
+                if current.key in by_id:
+                    raise DbcError('%s:%d: duplicate ID %#x' % (path, lineno, can_id))
+                by_id[current.key] = current
+                messages.append(current)
+            elif text.startswith('SG_ '):
+                if current is None:
+                    continue
+                m = SG_RE.match(text)
+                if not m:
+                    raise DbcError('%s:%d: invalid SG_ entry' % (path, lineno))
+                if m.group(2).startswith('m'):
+                    continue    # Multiplexed: only valid for one multiplexer value
+                try:
+                    current.signals.append(Signal(
+                        m.group(1), int(m.group(3)), int(m.group(4)),
+                        m.group(5) == '1', m.group(6) == '-',
+                        float(m.group(7)), float(m.group(8)),
+                        float(m.group(9)), float(m.group(10)), m.group(11)))
+                except (DbcError, ValueError) as e:
+                    raise DbcError('%s:%d: %s' % (path, lineno, e))
+            elif text.startswith('BA_ '):
+                m = CYCLE_RE.match(text)
+                if m and int(m.group(1)) in by_id:
+                    by_id[int(m.group(1))].cycle_ms = int(m.group(2))
+            elif text.startswith('VAL_ '):
+                m = VAL_RE.match(text)
+                if m and int(m.group(1)) in by_id:
+                    for sig in by_id[int(m.group(1))].signals:
+                        if sig.name == m.group(2):
+                            sig.values = [(int(v), d) for v, d in VAL_ENTRY_RE.findall(m.group(3))]
+            elif text.startswith('SIG_VALTYPE_ '):
+                m = VALTYPE_RE.match(text)
+                if not m:
+                    raise DbcError('%s:%d: invalid SIG_VALTYPE_ entry' % (path, lineno))
+                # 1 = IEEE float, 2 = IEEE double; the decoders only scale integers
+                msg = by_id.get(int(m.group(1)))
+                if int(m.group(3)) != 0 and msg and any(sig.name == m.group(2) for sig in msg.signals):
+                    raise DbcError('%s:%d: %s is an IEEE float signal (not supported)'
+                                   % (path, lineno, m.group(2)))
+            elif text:
+                current = None  # Signals follow their message directly
+
+    index = 0
+    for msg in messages:
+        for sig in msg.signals:
+            sig.index = index
+            index += 1
+    return messages
+
+
+def perfect_hash(keys):
+    """Find (multiplier, bits) so that (key * multiplier) >> (32 - bits) is unique"""
+    bits = max(1, (len(keys) - 1).bit_length())
+    while bits <= 16:
+        mul = 0x9E3779B1
+        for _ in range(20000):
+            slots = {((k * mul) & 0xFFFFFFFF) >> (32 - bits) for k in keys}
+            if len(slots) == len(keys):
+                return mul, bits
+            mul = (mul * 0x5851F42D + 0x14057B7F) & 0xFFFFFFFF | 1
+        bits += 1
+    raise DbcError('no perfect hash for %d messages' % len(keys))
+
+
+def c_name(name):
+    """EngineRPM -> engine_rpm, ENGINE_DATA_1 -> engine_data_1"""
+    s = re.sub(r'([a-z0-9])([A-Z])', r'\1_\2', name)
+    s = re.sub(r'([A-Z]+)([A-Z][a-z])', r'\1_\2', s)
+    return re.sub(r'\W|_+', '_', s).strip('_').lower()
+
+
+def c_double(x):
+    text = repr(float(x))
+    return text if ('.' in text or 'e' in text or 'inf' in text) else text + '.0'
+
+
+def raw_expr(sig):
+    """Expression of the unscaled signal value read from data[]"""
+    wide = sig.nbytes > 4
+    ctype = 'uint64_t' if wide else 'uint32_t'
+    order = range(sig.nbytes) if not sig.intel else reversed(range(sig.nbytes))
+    parts = []
+    for pos, b in enumerate(order):
+        shift = 8 * (sig.nbytes - 1 - pos)
+        byte = 'data[%d]' % (sig.byte + b)
+        if shift:
+            parts.append('(%s)%s << %d' % (ctype, byte, shift))
+        else:
+            parts.append(byte)
+    expr = ' | '.join(parts)
+    if sig.shift:
+        expr = '(%s) >> %d' % (expr, sig.shift) if len(parts) > 1 else '%s >> %d' % (expr, sig.shift)
+    if sig.shift + sig.length < 8 * sig.nbytes:
+        mask = (1 << sig.length) - 1
+        expr = '%s & %#x%s' % ('(%s)' % expr if ' ' in expr else expr, mask, 'ull' if wide else 'u')
+    if sig.signed:
+        sign = 1 << (sig.length - 1)
+        expr = '(int64_t)((%s) ^ %#xull) - %#xll' % (expr, sign, sign)
+    return expr
+
+
+def value_expr(sig):
+    raw = raw_expr(sig)
+    if sig.factor == 1.0 and sig.offset == 0.0:
+        return '(float)(%s)' % raw if ' ' in raw else '(float)%s' % raw
+    value = '(double)(%s)' % raw if ' ' in raw else '(double)%s' % raw
+    if sig.factor != 1.0:
+        value += ' * %s' % c_double(sig.factor)
+    if sig.offset != 0.0:
+        value += ' %s %s' % ('-' if sig.offset < 0 else '+', c_double(abs(sig.offset)))
+    return '(float)(%s)' % value
+
+
+def set_lines(sig):
+    """Body of the setter: physical value in 'value' -> bits in data[]"""
+    wide = sig.nbytes > 4 or sig.shift + sig.length > 32
+    ctype = 'uint64_t' if wide else 'uint32_t'
+    suffix = 'ull' if wide else 'u'
+    top = (1 << sig.length) - 1
+    lines = []
+
+    # Signed: work in offset binary so one unsigned clamp covers both ends
+    scaled = 'value'
+    if sig.offset != 0.0:
+        scaled += ' %s %s' % ('+' if sig.offset < 0 else '-', c_double(abs(sig.offset)))
+    if sig.factor != 1.0:
+        scaled = '%s / %s' % ('(%s)' % scaled if sig.offset else scaled, c_double(sig.factor))
+    bias = 1 << (sig.length - 1) if sig.signed else 0
+    lines.append('double u = %s + %s;' % (scaled, c_double(bias + 0.5)))
+    lines.append('%s raw = !(u > 0.0) ? 0 : u >= %s ? %#x%s : (%s)u;'
+                 % (ctype, c_double(float(top + 1)), top, suffix, ctype))
+    if sig.signed:
+        lines.append('raw ^= %#x%s;' % (bias, suffix))
+    if sig.shift:
+        lines.append('raw <<= %d;' % sig.shift)
+
+    order = range(sig.nbytes) if not sig.intel else reversed(range(sig.nbytes))
+    field = top << sig.shift
+    for pos, b in enumerate(order):
+        shift = 8 * (sig.nbytes - 1 - pos)
+        mask = (field >> shift) & 0xFF
+        value = 'raw >> %d' % shift if shift else 'raw'
+        byte = 'data[%d]' % (sig.byte + b)
+        if mask == 0xFF:
+            lines.append('%s = (uint8_t)(%s);' % (byte, value))
+        else:
+            lines.append('%s = (uint8_t)((%s & %#x) | ((%s) & %#x));'
+                         % (byte, byte, 0xFF & ~mask, value, mask))
+    return lines
+
+
+def generate(messages, prefix, include, dbc_name):
+    up = prefix.upper()
+    nsignals = sum(len(m.signals) for m in messages)
+    guard = re.sub(r'\W', '_', include).upper()
+    h = []
+    c = []
+
+    h.append('/**')
+    h.append(' * @file %s' % os.path.basename(include))
+    h.append(' * @brief CAN decoders generated from %s - do not edit' % dbc_name)
+    h.append(' *')
+    h.append(' * Generated by tools/dbcgen.py. %s_<MESSAGE>_<SIGNAL> indexes the value' % up)
+    h.append(' * array the decoders fill (the same index vtu_sigdb_load_dbc() gives the')
+    h.append(' * signal); %s_<message>_<signal>(data) reads one signal of a frame' % prefix)
+    h.append(' * that is at least %s_<MESSAGE>_<SIGNAL>_MIN_LEN bytes long, and' % up)
+    h.append(' * %s_<message>_<signal>_set(data, value) writes it back.' % prefix)
+    h.append(' */')
+    h.append('')
+    h.append('#ifndef %s' % guard)
+    h.append('#define %s' % guard)
+    h.append('')
+    h.append('#include <stdint.h>')
+    h.append('')
+
+    h.append('/* Messages: CAN ID (bit 31 set for 29-bit IDs), payload length, cycle (ms, 0 = unknown) */')
+    for msg in messages:
+        base = '%s_%s' % (up, c_name(msg.name).upper())
+        h.append('#define %-40s %#x' % (base + '_ID', msg.can_id))
+        h.append('#define %-40s %d' % (base + '_DLC', msg.dlc))
+        h.append('#define %-40s %d' % (base + '_CYCLE_MS', msg.cycle_ms))
+    h.append('')
+
+    h.append('enum {')
+    for msg in messages:
+        h.append('    %s_MSG_%s,' % (up, c_name(msg.name).upper()))
+    h.append('    %s_NUM_MESSAGES' % up)
+    h.append('};')
+    h.append('')
+
+    h.append('/* Signal indices */')
+    h.append('enum {')
+    for msg in messages:
+        for sig in msg.signals:
+            h.append('    %-48s = %d,' % ('%s_%s_%s' % (up, c_name(msg.name).upper(), c_name(sig.name).upper()),
+                                          sig.index))
+    h.append('    %-48s = %d' % (up + '_NUM_SIGNALS', nsignals))
+    h.append('};')
+    h.append('')
+
+    vals = [(msg, sig) for msg in messages for sig in msg.signals if sig.values]
+    if vals:
+        h.append('/* Value descriptions (VAL_) */')
+        for msg, sig in vals:
+            for value, desc in sig.values:
+                name = '%s_%s_%s_%s' % (up, c_name(msg.name).upper(), c_name(sig.name).upper(),
+                                        c_name(desc).upper() or str(value))
+                h.append('#define %-48s %d' % (name, value))
+        h.append('')
+
+    h.append('extern const char *const %s_signal_names[%s_NUM_SIGNALS];' % (prefix, up))
+    h.append('')
+
+    for msg in messages:
+        mname = c_name(msg.name)
+        base = '%s_%s' % (up, mname.upper())
+        h.append('/*' + '=' * 76)
+        h.append(' * %s (%#x), %d bytes' % (msg.name, msg.can_id, msg.dlc))
+        h.append(' *' + '=' * 75 + '*/')
+        h.append('')
+        for sig in msg.signals:
+            sname = c_name(sig.name)
+            h.append('#define %-48s %d' % ('%s_%s_MIN_LEN' % (base, sname.upper()), sig.end))
+            h.append('')
+            h.append('/* %s: %d|%d@%d%s (%s,%s) "%s" */' % (
+                sig.name, sig.start, sig.length, 1 if sig.intel else 0, '-' if sig.signed else '+',
+                '%.15g' % sig.factor, '%.15g' % sig.offset, sig.unit))
+            h.append('static inline float %s_%s_%s(const uint8_t *data) {' % (prefix, mname, sname))
+            h.append('    return %s;' % value_expr(sig))
+            h.append('}')
+            h.append('')
+            h.append('static inline void %s_%s_%s_set(uint8_t *data, double value) {'
+                     % (prefix, mname, sname))
+            for line in set_lines(sig):
+                h.append('    ' + line)
+            h.append('}')
+            h.append('')
+
+        full = max((s.end for s in msg.signals), default=0)
+        h.append('/* Decode %s into values[]; signals beyond len keep their value */' % msg.name)
+        h.append('static inline int %s_decode_%s(const uint8_t *data, uint8_t len, float *values) {'
+                 % (prefix, mname))
+        if not msg.signals:
+            h.append('    (void)data;')
+            h.append('    (void)len;')
+            h.append('    (void)values;')
+            h.append('    return 0;')
+        else:
+            h.append('    int n = 0;')
+            h.append('')
+            h.append('    if (len >= %d) {' % full)
+            for sig in msg.signals:
+                h.append('        values[%s_%s] = %s_%s_%s(data);'
+                         % (base, c_name(sig.name).upper(), prefix, mname, c_name(sig.name)))
+            h.append('        return %d;' % len(msg.signals))
+            h.append('    }')
+            for sig in msg.signals:
+                h.append('    if (len >= %d) {' % sig.end)
+                h.append('        values[%s_%s] = %s_%s_%s(data);'
+                         % (base, c_name(sig.name).upper(), prefix, mname, c_name(sig.name)))
+                h.append('        n++;')
+                h.append('    }')
+            h.append('    return n;')
+        h.append('}')
+        h.append('')
+
+        h.append('/* Encode values[] into data (%s_%s_DLC bytes); bits no signal covers are kept */'
+                 % (up, mname.upper()))
+        h.append('static inline void %s_encode_%s(uint8_t *data, const float *values) {'
+                 % (prefix, mname))
+        if not msg.signals:
+            h.append('    (void)data;')
+            h.append('    (void)values;')
+        for sig in msg.signals:
+            h.append('    %s_%s_%s_set(data, values[%s_%s]);'
+                     % (prefix, mname, c_name(sig.name), base, c_name(sig.name).upper()))
+        h.append('}')
+        h.append('')
+
+    h.append('/**')
+    h.append(' * @brief Decode a received frame into values[] (%s_NUM_SIGNALS floats)' % up)
+    h.append(' * @param can_id SocketCAN ID (RTR/ERR flags are ignored)')
+    h.append(' * @return %s_MSG_* of the frame, -1 if the ID is not in %s' % (up, dbc_name))
+    h.append(' */')
+    h.append('int %s_decode(uint32_t can_id, const uint8_t *data, uint8_t len, float *values);' % prefix)
+    h.append('')
+    h.append('#endif /* %s */' % guard)
+
+    mul, bits = perfect_hash([m.key for m in messages]) if messages else (1, 1)
+    slots = [None] * (1 << bits)
+    for i, msg in enumerate(messages):
+        slots[((msg.key * mul) & 0xFFFFFFFF) >> (32 - bits)] = i
+
+    c.append('/**')
+    c.append(' * @file %s.c' % prefix)
+    c.append(' * @brief CAN ID dispatch generated from %s - do not edit' % dbc_name)
+    c.append(' */')
+    c.append('')
+    c.append('#include "%s"' % include)
+    c.append('')
+    c.append('#define HASH_MUL        %#xu' % mul)
+    c.append('#define HASH_SHIFT      %d' % (32 - bits))
+    c.append('')
+    c.append('const char *const %s_signal_names[%s_NUM_SIGNALS] = {' % (prefix, up))
+    for msg in messages:
+        for sig in msg.signals:
+            c.append('    "%s",' % sig.name)
+    c.append('};')
+    c.append('')
+    c.append('/* Perfect hash: slot -> the one ID that can land there */')
+    c.append('static const uint32_t slot_id[%d] = {' % len(slots))
+    for slot in slots:
+        c.append('    %#x,' % (messages[slot].key if slot is not None else EMPTY_KEY))
+    c.append('};')
+    c.append('')
+    c.append('int %s_decode(uint32_t can_id, const uint8_t *data, uint8_t len, float *values) {' % prefix)
+    c.append('    uint32_t key = (can_id & 0x80000000u) ? can_id & 0x9fffffffu : can_id & 0x7ffu;')
+    c.append('    uint32_t slot = (key * HASH_MUL) >> HASH_SHIFT;')
+    c.append('')
+    c.append('    if (slot_id[slot] != key) {')
+    c.append('        return -1;')
+    c.append('    }')
+    c.append('    switch (slot) {')
+    for s, i in enumerate(slots):
+        if i is None:
+            continue
+        msg = messages[i]
+        c.append('        case %d:' % s)
+        c.append('            %s_decode_%s(data, len, values);' % (prefix, c_name(msg.name)))
+        c.append('            return %s_MSG_%s;' % (up, c_name(msg.name).upper()))
+    c.append('    }')
+    if not messages:
+        c.append('    (void)data;')
+        c.append('    (void)len;')
+        c.append('    (void)values;')
+    c.append('    return -1;')
+    c.append('}')
+
+    return '\n'.join(h) + '\n', '\n'.join(c) + '\n'
+
+
+def generate_sigdb(messages, name, dbc_name):
+    """Layout table of vtu_sigdb_builtin(), see struct builtin_message in signal_db.c"""
+    t = []
+
+    t.append('/**')
+    t.append(' * @file %s' % name)
+    t.append(' * @brief Built-in signal database generated from %s - do not edit' % dbc_name)
+    t.append(' *')
+    t.append(' * Generated by tools/dbcgen.py --sigdb; included by signal_db.c only.')
+    t.append(' */')
+    t.append('')
+    for msg in messages:
+        if not msg.signals:
+            continue
+        t.append('static const struct builtin_signal %s_signals[] = {' % c_name(msg.name))
+        for sig in msg.signals:
+            t.append('    { "%s", %d, %d, %s, %d, %s, %s, %sf, %sf, "%s" },' % (
+                sig.name, sig.start, sig.length,
+                'VTU_SIG_INTEL' if sig.intel else 'VTU_SIG_MOTOROLA', 1 if sig.signed else 0,
+                c_double(sig.factor), c_double(sig.offset),
+                c_double(sig.minimum), c_double(sig.maximum), sig.unit))
+        t.append('};')
+        t.append('')
+    t.append('static const struct builtin_message builtin_messages[] = {')
+    for msg in messages:
+        if msg.signals:
+            t.append('    { "%s", %#x, %d, %s_signals, %d },' % (
+                msg.name, msg.can_id, msg.dlc, c_name(msg.name), len(msg.signals)))
+        else:
+            t.append('    { "%s", %#x, %d, NULL, 0 },' % (msg.name, msg.can_id, msg.dlc))
+    t.append('};')
+
+    return '\n'.join(t) + '\n'
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Generate CAN decoders and encoders from a DBC file')
+    ap.add_argument('--prefix', default='vtu_bus', help='C identifier prefix (default: vtu_bus)')
+    ap.add_argument('--include', help='how the source includes the header (default: its file name)')
+    ap.add_argument('--sigdb', metavar='TABLE', help='also write the vtu_sigdb_builtin() table')
+    ap.add_argument('dbc')
+    ap.add_argument('header')
+    ap.add_argument('source')
+    args = ap.parse_args()
+
+    try:
+        messages = parse_dbc(args.dbc)
+    except (OSError, DbcError) as e:
+        print('dbcgen: %s' % e, file=sys.stderr)
+        return 1
+
+    header, source = generate(messages, args.prefix,
+                              args.include or os.path.basename(args.header),
+                              os.path.basename(args.dbc))
+    outputs = [(args.header, header), (args.source, source)]
+    if args.sigdb:
+        outputs.append((args.sigdb, generate_sigdb(messages, os.path.basename(args.sigdb),
+                                                     os.path.basename(args.dbc))))
+    for path, text in outputs:
+        os.makedirs(os.path.dirname(path) or '.', exist_ok=True)
+        with open(path, 'w') as f:
+            f.write(text)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,68 +1,77 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sys/socket.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
+#include <errno.h>
 #include <linux/can.h>
-#include <linux/can/raw.h>
+
+#include <vtu/can_io.h>
+#include <vtu/vtu_bus.h>
 
 static volatile int running = 1;
 static struct {
-    int rpm, speed, throttle, fuel, temp, load;
+    int rpm, speed, throttle, fuel, temp, load, egt;
 } v = {0};
 
+/* Only the dashboard IDs reach userspace (IDs from vtu.dbc, all 11-bit) */
+#define DASH_FILTER(msg) { VTU_BUS_##msg##_ID, CAN_EFF_FLAG | CAN_SFF_MASK }
+static const struct can_filter filters[] = {
+    DASH_FILTER(ENGINE_DATA_1), DASH_FILTER(ENGINE_DATA_2), DASH_FILTER(ENGINE_FD),
+    DASH_FILTER(TRANS_DATA), DASH_FILTER(BCM_DATA),
+};
+
+/* Latest value of every VTU bus signal (vtu.dbc) */
+static float val[VTU_BUS_NUM_SIGNALS];
+
 static void handler(int s) { (void)s; running = 0; }
 
+/* Rounded value of a signal */
+static int sig(int i) {
+    float x = val[i];
+    return (int)(x < 0 ? x - 0.5f : x + 0.5f);
+}
+
 int main(int argc, char **argv) {
     const char *ifname = argc > 1 ? argv[1] : "vcan0";
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    struct can_frame f;
-    int s;
+    struct vtu_can_opts opts = {
+        .filters = filters, .nfilters = sizeof(filters) / sizeof(filters[0]),
+        .rcv_timeout_ms = 500,              /* Notice Ctrl+C on a quiet bus */
+        .fd_frames = VTU_CAN_FD_TRY, .overflow = 1,
+    };
+    struct vtu_can can;
+    struct vtu_can_rx rx[VTU_CAN_MAX_BATCH];
     
     signal(SIGINT, handler);
     signal(SIGTERM, handler);
     
-    s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (s < 0) { perror("socket"); return 1; }
-    
-    strcpy(ifr.ifr_name, ifname);
-    ioctl(s, SIOCGIFINDEX, &ifr);
-    
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    bind(s, (struct sockaddr *)&addr, sizeof(addr));
+    if (vtu_can_open(&can, ifname, &opts) < 0) {
+        fprintf(stderr, "%s: %s\n", ifname, strerror(errno));
+        return 1;
+    }
     
     printf("VTU Console on %s - Ctrl+C to quit\n\n", ifname);
     
     while (running) {
-        int n = read(s, &f, sizeof(f));
+        /* One status line per batch, not per frame */
+        int n = vtu_can_recv_many(&can, rx, VTU_CAN_MAX_BATCH);
+        if (n < 0 && errno != EINTR) { perror("recv"); break; }
+        for (int i = 0; i < n; i++)
+            vtu_bus_decode(rx[i].frame.can_id, rx[i].frame.data, rx[i].frame.len, val);
         if (n > 0) {
-            switch (f.can_id & 0x7FF) {
-                case 0x100:
-                    v.rpm = ((f.data[0] << 8) | f.data[1]) / 4;
-                    v.temp = f.data[2] - 40;
-                    v.load = f.data[3];
-                    break;
-                case 0x101:
-                    v.throttle = (f.data[0] * 100) / 255;
-                    break;
-                case 0x200:
-                    v.speed = f.data[0];
-                    break;
-                case 0x300:
-                    v.fuel = (f.data[0] * 100) / 255;
-                    break;
-            }
-            printf("RPM:%5d  SPEED:%3d km/h  THROTTLE:%3d%%  FUEL:%3d%%  TEMP:%3dC  LOAD:%3d%%\n",
-                   v.rpm, v.speed, v.throttle, v.fuel, v.temp, v.load);
+            v.rpm = sig(VTU_BUS_ENGINE_DATA_1_ENGINE_RPM); v.speed = sig(VTU_BUS_TRANS_DATA_VEHICLE_SPEED);
+            v.throttle = sig(VTU_BUS_ENGINE_DATA_1_THROTTLE_POS); v.fuel = sig(VTU_BUS_BCM_DATA_FUEL_LEVEL);
+            v.temp = sig(VTU_BUS_ENGINE_DATA_1_COOLANT_TEMP); v.load = sig(VTU_BUS_ENGINE_DATA_1_ENGINE_LOAD);
+            v.egt = 0;  /* Hottest cylinder (CAN-FD) */
+            for (int c = VTU_BUS_ENGINE_FD_EGT1; c <= VTU_BUS_ENGINE_FD_EGT8; c++)
+                if (sig(c) > v.egt) v.egt = sig(c);
+            printf("RPM:%5d  SPEED:%3d km/h  THROTTLE:%3d%%  FUEL:%3d%%  TEMP:%3dC  LOAD:%3d%%  EGT:%4dC  DROP:%u\n",
+                   v.rpm, v.speed, v.throttle, v.fuel, v.temp, v.load, v.egt, can.drops);
         }
     }
     
-    close(s);
+    vtu_can_close(&can);
     printf("\nDone.\n");
     return 0;
 }
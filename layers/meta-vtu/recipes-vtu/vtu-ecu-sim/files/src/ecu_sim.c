@@ -6,6 +6,7 @@
  * - Engine ECU (0x100, 0x101): RPM, coolant temp, throttle, MAF
  * - Transmission ECU (0x200): Gear, fluid temp
  * - Body Control Module (0x300): Fuel level, odometer
+ * - Engine ECU CAN-FD (0x110, with -F): Per-cylinder knock, EGT, misfires
  * - OBD-II responses (0x7E8): Responds to diagnostic requests
  */
 
@@ -18,24 +19,26 @@
 #include <errno.h>
 #include <math.h>
 
-#include <sys/socket.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
 #include <linux/can.h>
-#include <linux/can/raw.h>
 
 #include "vtu/can_defs.h"
+#include "vtu/can_io.h"
 #include "vtu/obd2_pids.h"
+#include "vtu/vtu_bus.h"
 
 /*============================================================================
  * Configuration
  *===========================================================================*/
 
 #define CAN_INTERFACE   "vcan0"
-#define ENGINE_CYCLE_MS     10      /* Engine data 1 broadcast rate */
-#define ENGINE2_CYCLE_MS    100     /* Engine data 2 broadcast rate */
-#define TRANS_CYCLE_MS      50      /* Transmission broadcast rate */
-#define BCM_CYCLE_MS        100     /* Body control broadcast rate */
+/* Broadcast rates are CAN_CYCLE_MS_* from can_defs.h, shared with the bus checks */
+
+/* ENGINE_FD carries Knock1-8, EGT1-8 and Misfire1-8 (vtu.dbc), in that order */
+#define FD_CYLINDERS    8
+_Static_assert(VTU_BUS_ENGINE_FD_KNOCK8 - VTU_BUS_ENGINE_FD_KNOCK1 == FD_CYLINDERS - 1 &&
+               VTU_BUS_ENGINE_FD_EGT8 - VTU_BUS_ENGINE_FD_EGT1 == FD_CYLINDERS - 1 &&
+               VTU_BUS_ENGINE_FD_MISFIRE8 - VTU_BUS_ENGINE_FD_MISFIRE1 == FD_CYLINDERS - 1,
+               "ENGINE_FD signals must be numbered per cylinder");
 
 /*============================================================================
  * Simulated Vehicle State
@@ -49,6 +52,7 @@ static struct {
     float maf;              /* 0-200 g/s */
     float engine_load;      /* 0-100% */
     float intake_temp;      /* -40 to 60 °C */
+    uint8_t misfires[FD_CYLINDERS];   /* Per-cylinder misfire counters */
     
     /* Transmission */
     int gear;               /* 0=N, 1-6, 7=R */
@@ -79,6 +83,9 @@ static struct {
 /* Running flag for graceful shutdown */
 static volatile sig_atomic_t running = 1;
 
+/* CAN-FD frames enabled on the socket (-F) */
+static int fd_mode = 0;
+
 /*============================================================================
  * Signal Handler
  *===========================================================================*/
@@ -94,58 +101,52 @@ static void signal_handler(int sig) {
  *===========================================================================*/
 
 /**
- * @brief Open a CAN socket
+ * @brief Open the CAN socket
  * @param ifname Interface name (e.g., "vcan0")
- * @return Socket file descriptor or -1 on error
+ * @return 0 on success, -1 on error
+ *
+ * Non-blocking, so the main loop can drain every queued OBD-II request
+ * per tick. With fd_mode set the socket also sends and receives CAN-FD
+ * frames; the interface must have the CAN-FD MTU (ip link set vcan0 mtu 72).
  */
-static int can_socket_open(const char *ifname) {
-    int sock;
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    
-    /* Create socket */
-    sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (sock < 0) {
-        perror("socket");
-        return -1;
-    }
-    
-    /* Get interface index */
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
-    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
-    
-    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
-        perror("ioctl SIOCGIFINDEX");
-        close(sock);
-        return -1;
-    }
-    
-    /* Bind socket to interface */
-    memset(&addr, 0, sizeof(addr));
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    
-    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(sock);
+static int can_socket_open(struct vtu_can *can, const char *ifname) {
+    /* Only OBD-II requests are received; broadcasts are send-only */
+    static const struct can_filter filter[] = {
+        { .can_id = CAN_ID_OBD_BROADCAST,  .can_mask = CAN_SFF_MASK },
+        { .can_id = CAN_ID_OBD_ECU_ENGINE, .can_mask = CAN_SFF_MASK },
+    };
+    struct vtu_can_opts opts = {
+        .filters = filter,
+        .nfilters = 2,
+        .fd_frames = fd_mode ? VTU_CAN_FD_REQUIRE : VTU_CAN_FD_OFF,
+        .nonblock = 1,
+    };
+    
+    if (vtu_can_open(can, ifname, &opts) < 0) {
+        if (fd_mode && errno == EOPNOTSUPP) {
+            fprintf(stderr, "%s is not CAN-FD capable (MTU must be %d)\n",
+                    ifname, (int)CANFD_MTU);
+        } else {
+            perror("vtu_can_open");
+        }
         return -1;
     }
     
-    return sock;
+    return 0;
 }
 
 /**
  * @brief Send a CAN frame
  */
-static int can_send(int sock, uint32_t id, const uint8_t *data, uint8_t len) {
-    struct can_frame frame;
+static int can_send(struct vtu_can *can, uint32_t id, const uint8_t *data, uint8_t len) {
+    struct canfd_frame frame;
     
     memset(&frame, 0, sizeof(frame));
     frame.can_id = id;
-    frame.can_dlc = len;
+    frame.len = len;
     memcpy(frame.data, data, len);
     
-    if (write(sock, &frame, sizeof(frame)) != sizeof(frame)) {
+    if (vtu_can_send(can, &frame, 0) < 0) {
         perror("write");
         return -1;
     }
@@ -154,35 +155,24 @@ static int can_send(int sock, uint32_t id, const uint8_t *data, uint8_t len) {
 }
 
 /**
- * @brief Receive a CAN frame (non-blocking)
+ * @brief Send a CAN-FD frame with bit rate switching
+ * @param len Payload length, a valid CAN-FD length (up to 64)
  */
-static int can_receive(int sock, struct can_frame *frame) {
-    fd_set rdfs;
-    struct timeval tv;
-    int ret;
-    
-    FD_ZERO(&rdfs);
-    FD_SET(sock, &rdfs);
+static int can_send_fd(struct vtu_can *can, uint32_t id, const uint8_t *data, uint8_t len) {
+    struct canfd_frame frame;
     
-    /* 1ms timeout for non-blocking behavior */
-    tv.tv_sec = 0;
-    tv.tv_usec = 1000;
-    
-    ret = select(sock + 1, &rdfs, NULL, NULL, &tv);
-    if (ret < 0) {
-        perror("select");
-        return -1;
-    }
-    if (ret == 0) {
-        return 0;  /* Timeout, no data */
-    }
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = id;
+    frame.len = len;
+    frame.flags = CANFD_BRS;
+    memcpy(frame.data, data, len);
     
-    if (read(sock, frame, sizeof(*frame)) != sizeof(*frame)) {
-        perror("read");
+    if (vtu_can_send(can, &frame, 1) < 0) {
+        perror("write");
         return -1;
     }
     
-    return 1;  /* Frame received */
+    return 0;
 }
 
 /*============================================================================
@@ -247,6 +237,11 @@ static void update_simulation(float dt) {
     
     /* Odometer increases with speed */
     vehicle.odometer += (uint32_t)(vehicle.vehicle_speed * dt / 3600.0f);
+    
+    /* Cylinder 3 misfires now and then under high load */
+    if (vehicle.engine_load > 60.0f && fmodf(vehicle.sim_time, 2.0f) < dt) {
+        vehicle.misfires[2]++;
+    }
 }
 
 /*============================================================================
@@ -256,7 +251,7 @@ static void update_simulation(float dt) {
 /**
  * @brief Build and send ENGINE_DATA_1 (0x100)
  */
-static void send_engine_data_1(int sock) {
+static void send_engine_data_1(struct vtu_can *can) {
     uint8_t data[8] = {0};
     
     /* Bytes 0-1: RPM (0.25 rpm/bit, big-endian) */
@@ -278,13 +273,13 @@ static void send_engine_data_1(int sock) {
     /* Byte 6: Engine load (0-255 = 0-100%) */
     data[6] = (uint8_t)(vehicle.engine_load * 255.0f / 100.0f);
     
-    can_send(sock, CAN_ID_ENGINE_DATA_1, data, 8);
+    can_send(can, CAN_ID_ENGINE_DATA_1, data, 8);
 }
 
 /**
  * @brief Build and send ENGINE_DATA_2 (0x101)
  */
-static void send_engine_data_2(int sock) {
+static void send_engine_data_2(struct vtu_can *can) {
     uint8_t data[8] = {0};
     
     /* Byte 0: Intake air temp (°C + 40 offset) */
@@ -293,13 +288,13 @@ static void send_engine_data_2(int sock) {
     /* Byte 1: Engine load (duplicate for compatibility) */
     data[1] = (uint8_t)(vehicle.engine_load * 255.0f / 100.0f);
     
-    can_send(sock, CAN_ID_ENGINE_DATA_2, data, 8);
+    can_send(can, CAN_ID_ENGINE_DATA_2, data, 8);
 }
 
 /**
  * @brief Build and send TRANS_DATA (0x200)
  */
-static void send_trans_data(int sock) {
+static void send_trans_data(struct vtu_can *can) {
     uint8_t data[8] = {0};
     
     /* Byte 0: Current gear */
@@ -313,13 +308,13 @@ static void send_trans_data(int sock) {
     data[2] = (speed_raw >> 8) & 0xFF;
     data[3] = speed_raw & 0xFF;
     
-    can_send(sock, CAN_ID_TRANS_DATA, data, 8);
+    can_send(can, CAN_ID_TRANS_DATA, data, 8);
 }
 
 /**
  * @brief Build and send BCM_DATA (0x300)
  */
-static void send_bcm_data(int sock) {
+static void send_bcm_data(struct vtu_can *can) {
     uint8_t data[8] = {0};
     
     /* Byte 0: Fuel level (0-255 = 0-100%) */
@@ -331,7 +326,33 @@ static void send_bcm_data(int sock) {
     data[3] = (vehicle.odometer >> 8) & 0xFF;
     data[4] = vehicle.odometer & 0xFF;
     
-    can_send(sock, CAN_ID_BCM_DATA, data, 8);
+    can_send(can, CAN_ID_BCM_DATA, data, 8);
+}
+
+/**
+ * @brief Build and send ENGINE_FD (0x110), a 32-byte CAN-FD frame
+ */
+static void send_engine_fd(struct vtu_can *can) {
+    uint8_t data[VTU_BUS_ENGINE_FD_DLC] = {0};
+    float values[VTU_BUS_NUM_SIGNALS];
+    
+    for (int cyl = 0; cyl < FD_CYLINDERS; cyl++) {
+        float phase = vehicle.sim_time * 3.0f + cyl * 0.7f;
+        
+        /* Knock level, rising with load (the encoder clamps at 0) */
+        values[VTU_BUS_ENGINE_FD_KNOCK1 + cyl] =
+            10.0f + vehicle.engine_load * 0.8f + 8.0f * sinf(phase);
+        
+        /* EGT, spread across cylinders */
+        values[VTU_BUS_ENGINE_FD_EGT1 + cyl] =
+            300.0f + vehicle.rpm * 0.08f + vehicle.engine_load * 3.0f +
+            15.0f * sinf(phase * 0.1f);
+        
+        values[VTU_BUS_ENGINE_FD_MISFIRE1 + cyl] = vehicle.misfires[cyl];
+    }
+    vtu_bus_encode_engine_fd(data, values);
+    
+    can_send_fd(can, VTU_BUS_ENGINE_FD_ID, data, VTU_BUS_ENGINE_FD_DLC);
 }
 
 /*============================================================================
@@ -341,7 +362,7 @@ static void send_bcm_data(int sock) {
 /**
  * @brief Handle OBD-II Mode 01 request
  */
-static void handle_obd2_mode01(int sock, uint8_t pid) {
+static void handle_obd2_mode01(struct vtu_can *can, uint8_t pid) {
     uint8_t response[8] = {0};
     int len = 0;
     
@@ -427,14 +448,14 @@ static void handle_obd2_mode01(int sock, uint8_t pid) {
     }
     
     if (len > 0) {
-        can_send(sock, CAN_ID_OBD_RESP_ENGINE, response, len);
+        can_send(can, CAN_ID_OBD_RESP_ENGINE, response, len);
     }
 }
 
 /**
  * @brief Process incoming OBD-II request
  */
-static void process_obd2_request(int sock, struct can_frame *frame) {
+static void process_obd2_request(struct vtu_can *can, struct canfd_frame *frame) {
     uint8_t mode, pid;
     
     /* Check if it's an OBD-II request */
@@ -445,14 +466,14 @@ static void process_obd2_request(int sock, struct can_frame *frame) {
     
     /* Extract mode and PID */
     /* Frame format: [length] [mode] [pid] ... */
-    if (frame->can_dlc < 2) return;
+    if (frame->len < 2) return;
     
     mode = frame->data[1];
-    pid = (frame->can_dlc >= 3) ? frame->data[2] : 0;
+    pid = (frame->len >= 3) ? frame->data[2] : 0;
     
     switch (mode) {
         case OBD2_MODE_CURRENT_DATA:
-            handle_obd2_mode01(sock, pid);
+            handle_obd2_mode01(can, pid);
             break;
             
         /* TODO: Add Mode 03 (DTCs), Mode 09 (VIN) in future phases */
@@ -489,17 +510,36 @@ static void sleep_ms(int ms) {
  * Main
  *===========================================================================*/
 
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-F] [IFACE]\n", prog);
+    printf("  -F          Also broadcast CAN-FD frames (0x110); IFACE needs MTU 72\n");
+    printf("  -h          Show this help\n");
+    printf("IFACE defaults to %s\n", CAN_INTERFACE);
+}
+
 int main(int argc, char *argv[]) {
-    int sock;
+    struct vtu_can can;
     const char *ifname = CAN_INTERFACE;
     uint64_t last_engine1 = 0, last_engine2 = 0;
-    uint64_t last_trans = 0, last_bcm = 0;
+    uint64_t last_trans = 0, last_bcm = 0, last_engine_fd = 0;
     uint64_t now;
-    struct can_frame rx_frame;
+    struct vtu_can_rx rx[VTU_CAN_MAX_BATCH];
+    int opt;
     
     /* Parse command line */
-    if (argc > 1) {
-        ifname = argv[1];
+    while ((opt = getopt(argc, argv, "Fh")) != -1) {
+        switch (opt) {
+            case 'F':
+                fd_mode = 1;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        ifname = argv[optind];
     }
     
     printf("VTU ECU Simulator v1.0\n");
@@ -511,23 +551,26 @@ int main(int argc, char *argv[]) {
     signal(SIGTERM, signal_handler);
     
     /* Open CAN socket */
-    sock = can_socket_open(ifname);
-    if (sock < 0) {
+    if (can_socket_open(&can, ifname) < 0) {
         fprintf(stderr, "Failed to open CAN socket on %s\n", ifname);
         fprintf(stderr, "Make sure the interface exists: ip link show %s\n", ifname);
         return 1;
     }
     
     printf("ECU Simulator running. Broadcasting on %s\n", ifname);
-    printf("  Engine Data 1 (0x100): every %d ms\n", ENGINE_CYCLE_MS);
-    printf("  Engine Data 2 (0x101): every %d ms\n", ENGINE2_CYCLE_MS);
-    printf("  Transmission  (0x200): every %d ms\n", TRANS_CYCLE_MS);
-    printf("  Body Control  (0x300): every %d ms\n", BCM_CYCLE_MS);
+    printf("  Engine Data 1 (0x100): every %d ms\n", CAN_CYCLE_MS_ENGINE_DATA_1);
+    printf("  Engine Data 2 (0x101): every %d ms\n", CAN_CYCLE_MS_ENGINE_DATA_2);
+    printf("  Transmission  (0x200): every %d ms\n", CAN_CYCLE_MS_TRANS_DATA);
+    printf("  Body Control  (0x300): every %d ms\n", CAN_CYCLE_MS_BCM_DATA);
+    if (fd_mode) {
+        printf("  Engine CAN-FD (0x110): every %d ms, %d bytes, BRS\n",
+               CAN_CYCLE_MS_ENGINE_FD, VTU_BUS_ENGINE_FD_DLC);
+    }
     printf("  OBD-II responses on 0x7E8\n\n");
     
     /* Initialize timing */
     now = get_time_ms();
-    last_engine1 = last_engine2 = last_trans = last_bcm = now;
+    last_engine1 = last_engine2 = last_trans = last_bcm = last_engine_fd = now;
     
     /* Main loop */
     while (running) {
@@ -537,39 +580,46 @@ int main(int argc, char *argv[]) {
         update_simulation(0.001f);
         
         /* Send Engine Data 1 */
-        if (now - last_engine1 >= ENGINE_CYCLE_MS) {
-            send_engine_data_1(sock);
+        if (now - last_engine1 >= CAN_CYCLE_MS_ENGINE_DATA_1) {
+            send_engine_data_1(&can);
             last_engine1 = now;
         }
         
         /* Send Engine Data 2 */
-        if (now - last_engine2 >= ENGINE2_CYCLE_MS) {
-            send_engine_data_2(sock);
+        if (now - last_engine2 >= CAN_CYCLE_MS_ENGINE_DATA_2) {
+            send_engine_data_2(&can);
             last_engine2 = now;
         }
         
         /* Send Transmission Data */
-        if (now - last_trans >= TRANS_CYCLE_MS) {
-            send_trans_data(sock);
+        if (now - last_trans >= CAN_CYCLE_MS_TRANS_DATA) {
+            send_trans_data(&can);
             last_trans = now;
         }
         
         /* Send Body Control Data */
-        if (now - last_bcm >= BCM_CYCLE_MS) {
-            send_bcm_data(sock);
+        if (now - last_bcm >= CAN_CYCLE_MS_BCM_DATA) {
+            send_bcm_data(&can);
             last_bcm = now;
         }
         
-        /* Check for incoming OBD-II requests */
-        if (can_receive(sock, &rx_frame) > 0) {
-            process_obd2_request(sock, &rx_frame);
+        /* Send Engine CAN-FD Data */
+        if (fd_mode && now - last_engine_fd >= CAN_CYCLE_MS_ENGINE_FD) {
+            send_engine_fd(&can);
+            last_engine_fd = now;
+        }
+        
+        /* Answer every OBD-II request queued since the last tick */
+        int n = vtu_can_recv_many(&can, rx, VTU_CAN_MAX_BATCH);
+        for (int i = 0; i < n; i++) {
+            process_obd2_request(&can, &rx[i].frame);
         }
         
         /* Small sleep to prevent busy-waiting */
         sleep_ms(1);
     }
     
-    close(sock);
+    vtu_can_close(&can);
     printf("ECU Simulator stopped.\n");
     
     return 0;
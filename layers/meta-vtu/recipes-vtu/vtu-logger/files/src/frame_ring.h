@@ -0,0 +1,119 @@
+/**
+ * @file frame_ring.h
+ * @brief Lock-free single-producer/single-consumer ring of log records
+ *
+ * The receive thread pushes records, the writer thread pops them. Slots
+ * are preallocated once; head and tail live on separate cache lines and
+ * are the only shared state, so neither side ever takes a lock or
+ * allocates on the capture path.
+ */
+
+#ifndef VTU_FRAME_RING_H
+#define VTU_FRAME_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vtulog.h"
+
+#define FRAME_RING_CACHELINE 64
+
+struct frame_ring {
+    struct vtulog_record *slots;
+    uint32_t mask;              /* capacity - 1, capacity is a power of two */
+
+    /* Written by the producer only */
+    _Alignas(FRAME_RING_CACHELINE) _Atomic uint32_t head;
+    uint32_t high_water;        /* Largest occupancy seen */
+    unsigned long dropped;      /* Records discarded because the ring was full */
+
+    /* Written by the consumer only */
+    _Alignas(FRAME_RING_CACHELINE) _Atomic uint32_t tail;
+};
+
+/**
+ * @brief Allocate a ring with room for capacity records
+ * @param capacity Number of slots, must be a power of two
+ * @return 0 on success, -1 on error
+ */
+static inline int frame_ring_init(struct frame_ring *ring, uint32_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = calloc(capacity, sizeof(*ring->slots));
+    if (!ring->slots) {
+        return -1;
+    }
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+static inline void frame_ring_free(struct frame_ring *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * @brief Producer: append a record
+ * @return 0 on success, -1 if the ring is full (the record is counted as dropped)
+ */
+static inline int frame_ring_push(struct frame_ring *ring,
+                                  const struct vtulog_record *rec) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t used = head - tail;
+
+    if (used > ring->mask) {
+        ring->dropped++;
+        return -1;
+    }
+
+    ring->slots[head & ring->mask] = *rec;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if (used + 1 > ring->high_water) {
+        ring->high_water = used + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Consumer: borrow up to max contiguous records without copying
+ *
+ * Call frame_ring_release() with the number of records consumed once
+ * they have been written out.
+ *
+ * @return Number of records available at *recs (0 if the ring is empty)
+ */
+static inline uint32_t frame_ring_peek(struct frame_ring *ring,
+                                       struct vtulog_record **recs,
+                                       uint32_t max) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t avail = head - tail;
+    uint32_t idx = tail & ring->mask;
+    uint32_t to_end = ring->mask + 1 - idx;
+
+    if (avail > to_end) {
+        avail = to_end;
+    }
+    if (avail > max) {
+        avail = max;
+    }
+
+    *recs = &ring->slots[idx];
+    return avail;
+}
+
+static inline void frame_ring_release(struct frame_ring *ring, uint32_t count) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+#endif /* VTU_FRAME_RING_H */
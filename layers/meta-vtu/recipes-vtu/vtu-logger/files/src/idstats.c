@@ -0,0 +1,199 @@
+/**
+ * @file idstats.c
+ * @brief Per-CAN-ID traffic statistics and cycle-time monitoring
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vtu/can_defs.h>
+
+#include "idstats.h"
+#include "vtuidx.h"
+
+/* Nominal cycles from can_defs.h (11-bit IDs) */
+static const struct {
+    uint32_t can_id;
+    uint32_t cycle_ms;
+} nominal_cycles[] = {
+    { CAN_ID_ENGINE_DATA_1,   CAN_CYCLE_MS_ENGINE_DATA_1 },
+    { CAN_ID_ENGINE_DATA_2,   CAN_CYCLE_MS_ENGINE_DATA_2 },
+    { CAN_ID_ENGINE_FD,       CAN_CYCLE_MS_ENGINE_FD },
+    { CAN_ID_TRANS_DATA,      CAN_CYCLE_MS_TRANS_DATA },
+    { CAN_ID_BCM_DATA,        CAN_CYCLE_MS_BCM_DATA },
+    { CAN_ID_ABS_WHEEL_SPEED, CAN_CYCLE_MS_ABS_WHEEL_SPEED },
+};
+
+#define NUM_NOMINAL_CYCLES (int)(sizeof(nominal_cycles) / sizeof(nominal_cycles[0]))
+
+static uint32_t nominal_cycle_us(uint32_t key) {
+    for (int i = 0; i < NUM_NOMINAL_CYCLES; i++) {
+        if (nominal_cycles[i].can_id == key) {
+            return nominal_cycles[i].cycle_ms * 1000;
+        }
+    }
+    return 0;
+}
+
+static uint32_t hash_key(uint32_t key, uint8_t channel) {
+    uint32_t h = (key ^ ((uint32_t)channel << 24)) * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+int id_stats_init(struct id_stats_table *t, uint32_t capacity) {
+    uint32_t cap = 16;
+
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    memset(t, 0, sizeof(*t));
+    t->entries = calloc(cap, sizeof(*t->entries));
+    if (!t->entries) {
+        return -1;
+    }
+    t->capacity = cap;
+    return 0;
+}
+
+void id_stats_free(struct id_stats_table *t) {
+    free(t->entries);
+    t->entries = NULL;
+}
+
+void id_stats_update(struct id_stats_table *t, const struct vtulog_record *rec) {
+    uint32_t key = vtuidx_key(rec);
+    uint32_t mask = t->capacity - 1;
+    uint32_t i = hash_key(key, rec->channel) & mask;
+    struct id_stats *e;
+
+    while (t->entries[i].used &&
+           (t->entries[i].key != key || t->entries[i].channel != rec->channel)) {
+        i = (i + 1) & mask;
+    }
+    e = &t->entries[i];
+
+    if (!e->used) {
+        /* Keep a free slot so probing always terminates */
+        if (t->count + 1 == t->capacity) {
+            t->untracked++;
+            return;
+        }
+        e->used = 1;
+        e->key = key;
+        e->channel = rec->channel;
+        e->dlc = rec->dlc;
+        e->expected_us = nominal_cycle_us(key);
+        e->min_us = UINT64_MAX;
+        e->last_us = rec->timestamp_us;
+        e->frames = 1;
+        t->count++;
+        return;
+    }
+
+    if (rec->dlc != e->dlc) {
+        e->dlc_changes++;
+        e->dlc = rec->dlc;
+    }
+    e->frames++;
+
+    /* Timestamps of different sources may step back; skip such samples */
+    if (rec->timestamp_us >= e->last_us) {
+        uint64_t gap = rec->timestamp_us - e->last_us;
+        e->intervals++;
+        e->sum_us += gap;
+        e->sum_sq += (double)gap * gap;
+        if (gap < e->min_us) {
+            e->min_us = gap;
+        }
+        if (gap > e->max_us) {
+            e->max_us = gap;
+        }
+        if (e->expected_us && gap > e->expected_us * IDSTATS_LATE_FACTOR) {
+            e->late++;
+            e->missing += gap / e->expected_us - 1;     /* Whole cycles only */
+        }
+    }
+    e->last_us = rec->timestamp_us;
+}
+
+void id_stats_summarize(const struct id_stats_table *t, struct id_stats_summary *s) {
+    memset(s, 0, sizeof(*s));
+    for (uint32_t i = 0; i < t->capacity; i++) {
+        const struct id_stats *e = &t->entries[i];
+        if (!e->used) {
+            continue;
+        }
+        s->ids++;
+        s->late += e->late;
+        s->missing += e->missing;
+        if (e->missing && (!s->worst || e->missing > s->worst->missing)) {
+            s->worst = e;
+        }
+    }
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const struct id_stats *x = *(const struct id_stats *const *)a;
+    const struct id_stats *y = *(const struct id_stats *const *)b;
+
+    if (x->channel != y->channel) {
+        return x->channel - y->channel;
+    }
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+void id_stats_dump(const struct id_stats_table *t, FILE *out,
+                   const char *(*channel_name)(uint8_t channel)) {
+    const struct id_stats **sorted = malloc((t->count + 1) * sizeof(*sorted));
+    uint32_t n = 0;
+
+    if (!sorted) {
+        return;
+    }
+    for (uint32_t i = 0; i < t->capacity; i++) {
+        if (t->entries[i].used) {
+            sorted[n++] = &t->entries[i];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_entries);
+
+    fprintf(out, "%s%-8s %10s %7s %8s %8s %8s %8s %7s %6s %7s\n",
+            channel_name ? "IFACE   " : "", "ID", "FRAMES", "DLC-CHG",
+            "MIN ms", "MEAN ms", "MAX ms", "JIT ms", "NOM ms", "LATE", "MISSING");
+    for (uint32_t i = 0; i < n; i++) {
+        const struct id_stats *e = sorted[i];
+        char id[16];
+
+        if (channel_name) {
+            const char *name = channel_name(e->channel);
+            fprintf(out, "%-8.7s", name ? name : "?");
+        }
+        if (e->key & VTUIDX_KEY_EXT) {
+            snprintf(id, sizeof(id), "%08X", e->key & ~VTUIDX_KEY_EXT);
+        } else {
+            snprintf(id, sizeof(id), "%03X", e->key);
+        }
+        fprintf(out, "%-8s %10llu %7u", id, (unsigned long long)e->frames, e->dlc_changes);
+
+        if (e->intervals) {
+            double mean = e->sum_us / e->intervals;
+            double var = e->sum_sq / e->intervals - mean * mean;
+            fprintf(out, " %8.2f %8.2f %8.2f %8.3f", e->min_us / 1000.0, mean / 1000.0,
+                    e->max_us / 1000.0, var > 0 ? sqrt(var) / 1000.0 : 0.0);
+        } else {
+            fprintf(out, " %8s %8s %8s %8s", "-", "-", "-", "-");
+        }
+
+        if (e->expected_us) {
+            fprintf(out, " %7u %6llu %7llu\n", e->expected_us / 1000,
+                    (unsigned long long)e->late, (unsigned long long)e->missing);
+        } else {
+            fprintf(out, " %7s %6s %7s\n", "-", "-", "-");
+        }
+    }
+    if (t->untracked) {
+        fprintf(out, "%lu frames of further IDs not tracked (table full)\n", t->untracked);
+    }
+    free(sorted);
+}
@@ -0,0 +1,87 @@
+/**
+ * @file idstats.h
+ * @brief Per-CAN-ID traffic statistics and cycle-time monitoring
+ *
+ * vtu-logger keeps one entry per (channel, ID) seen on the bus: frame
+ * count, DLC changes and the spacing between consecutive frames (cycle
+ * time min/mean/max and its standard deviation as the jitter). IDs with
+ * a nominal cycle in can_defs.h are also checked against it: a gap of
+ * more than IDSTATS_LATE_FACTOR cycles counts as a late frame, and every
+ * whole cycle beyond the first in that gap as a missing one.
+ *
+ * The table is open-addressed with linear probing and never grows, so an
+ * update costs a hash and (nearly always) one probe on the receive path.
+ * IDs beyond its capacity are counted as untracked.
+ */
+
+#ifndef VTU_IDSTATS_H
+#define VTU_IDSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "vtulog.h"
+
+#define IDSTATS_DEFAULT_CAPACITY    1024    /* Entries, power of two */
+#define IDSTATS_LATE_FACTOR         1.5     /* Gap / nominal cycle that counts as late */
+
+struct id_stats {
+    uint32_t key;               /* can_id | VTUIDX_KEY_EXT */
+    uint8_t  channel;
+    uint8_t  used;
+    uint8_t  dlc;               /* DLC of the last frame */
+    uint32_t expected_us;       /* Nominal cycle, 0 if not documented */
+    uint64_t last_us;           /* Timestamp of the last frame */
+    uint64_t frames;
+    uint32_t dlc_changes;
+    uint64_t intervals;         /* Cycle samples (frames - 1) */
+    uint64_t min_us;
+    uint64_t max_us;
+    double   sum_us;
+    double   sum_sq;            /* For the jitter (standard deviation) */
+    uint64_t late;
+    uint64_t missing;
+};
+
+struct id_stats_table {
+    struct id_stats *entries;
+    uint32_t capacity;
+    uint32_t count;             /* Entries in use */
+    unsigned long untracked;    /* Frames of IDs that didn't fit */
+};
+
+/**
+ * @brief Totals over all IDs, for the periodic stats line
+ */
+struct id_stats_summary {
+    uint32_t ids;
+    uint64_t late;
+    uint64_t missing;
+    const struct id_stats *worst;   /* Most missing frames, NULL if none */
+};
+
+/**
+ * @brief Allocate a table of capacity entries (rounded up to a power of two)
+ * @return 0 on success, -1 on error
+ */
+int id_stats_init(struct id_stats_table *t, uint32_t capacity);
+void id_stats_free(struct id_stats_table *t);
+
+/**
+ * @brief Account one frame
+ */
+void id_stats_update(struct id_stats_table *t, const struct vtulog_record *rec);
+
+/**
+ * @brief Sum late and missing frames over all IDs
+ */
+void id_stats_summarize(const struct id_stats_table *t, struct id_stats_summary *s);
+
+/**
+ * @brief Print one line per ID, sorted by channel and ID
+ * @param channel_name Interface name of a channel, NULL to omit the column
+ */
+void id_stats_dump(const struct id_stats_table *t, FILE *out,
+                   const char *(*channel_name)(uint8_t channel));
+
+#endif /* VTU_IDSTATS_H */
@@ -0,0 +1,145 @@
+/*
+ * VTU Log Dump
+ *
+ * Converts binary .vtulog files written by vtu-logger back into the
+ * text log layout (TIMESTAMP CAN_ID [DLC] DATA). Sealed segments are
+ * checked against their footer CRC; unsealed ones (still being written,
+ * or from a crash) are dumped up to the last whole record. Compressed
+ * segments (.vtulog.zst / .vtulog.lz4) are read transparently.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vtulog.h"
+#include "logstream.h"
+
+#define READ_BATCH 256  /* Records read per call */
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] FILE...\n", prog);
+    printf("Options:\n");
+    printf("  -o FILE     Write text output to FILE (default: stdout)\n");
+    printf("  -h          Show this help\n");
+}
+
+/* Dump one .vtulog file, returns number of records or -1 on error */
+static long dump_file(const char *path, FILE *out) {
+    struct vtulog_file_header hdr;
+    struct vtulog_record recs[READ_BATCH];
+    struct vtulog_footer ftr;
+    char line[VTULOG_TEXT_LINE_MAX];
+    char channels[VTULOG_MAX_CHANNELS * 16] = "";
+    char banner[512];
+    long count = 0;
+    uint32_t crc = 0;
+    int sealed = 0;
+    size_t n;
+
+    struct log_reader *in = log_reader_open(path);
+    if (!in) {
+        perror(path);
+        return -1;
+    }
+
+    if (log_reader_read(in, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        vtulog_check_header(&hdr) < 0) {
+        fprintf(stderr, "%s: not a supported .vtulog file\n", path);
+        log_reader_close(in);
+        return -1;
+    }
+
+    if (log_reader_set_header(in, &hdr) < 0) {
+        perror(path);
+        log_reader_close(in);
+        return -1;
+    }
+
+    for (int i = 0; log_reader_channel(in, i); i++) {
+        if (i > 0) {
+            strcat(channels, " ");
+        }
+        strcat(channels, log_reader_channel(in, i));
+    }
+    int len = vtulog_format_text_banner(hdr.start_time_us,
+                                        channels[0] ? channels : NULL,
+                                        banner, sizeof(banner));
+    fwrite(banner, 1, len, out);
+
+    while ((n = log_reader_records(in, recs, READ_BATCH, &ftr, &sealed)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            crc = vtulog_record_crc(crc, &recs[i]);
+            len = vtulog_format_record(&recs[i], log_reader_channel(in, recs[i].channel),
+                                       line);
+            fwrite(line, 1, len, out);
+        }
+        count += n;
+    }
+
+    if (log_reader_error(in)) {
+        fprintf(stderr, "%s: read error (%s)\n", path, log_reader_codec(in));
+        log_reader_close(in);
+        return -1;
+    }
+
+    if (sealed && (crc != ftr.crc32 || (uint64_t)count != ftr.record_count)) {
+        fprintf(stderr, "%s: footer mismatch (%llu frames, CRC %08X; read %ld, CRC %08X)\n",
+                path, (unsigned long long)ftr.record_count, ftr.crc32, count, crc);
+    } else if (!sealed && hdr.version >= 2) {
+        fprintf(stderr, "%s: segment not sealed (logger still running or crashed)\n",
+                path);
+    }
+
+    log_reader_close(in);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL;
+    FILE *out = stdout;
+    int opt;
+    int rc = 0;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror(out_path);
+            return 1;
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
+        long count = dump_file(argv[i], out);
+        if (count < 0) {
+            rc = 1;
+            continue;
+        }
+        if (out_path) {
+            printf("[LOGDUMP] %s: %ld frames\n", argv[i], count);
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return rc;
+}
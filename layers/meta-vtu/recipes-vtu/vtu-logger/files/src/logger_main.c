@@ -3,183 +3,1334 @@
  * 
  * Captures and logs all CAN bus traffic with timestamps.
  * Supports rotating log files and provides statistics.
+ *
+ * Frames are written in the binary .vtulog format by default (see
+ * vtulog.h); use vtu-logdump to convert them to text. The legacy text
+ * layout is still available with -f text, and -f delta stores each frame
+ * relative to the previous one with the same ID (vtudelta.h), typically in
+ * 3-6 bytes instead of 24 (classic) or up to 80 (CAN-FD).
+ *
+ * Frames are received in batches with recvmmsg() and stamped with the
+ * kernel receive time rather than the time they are written. With -T hw
+ * the logger asks for SO_TIMESTAMPING hardware receive timestamps and
+ * falls back per frame to the kernel software stamp when the driver has
+ * none; -T write stamps frames with the host clock instead.
+ *
+ * Capture and file I/O run on separate threads: the main thread receives
+ * frames and pushes them into a preallocated lock-free ring, and a writer
+ * thread drains the ring to disk. Slow SD card writes, fflush(), fsync()
+ * and rotation therefore never stall the socket; if the ring fills up the
+ * frame is counted as dropped instead of silently overflowing the kernel
+ * receive queue. Frames the kernel itself dropped because the socket
+ * queue was full are reported through SO_RXQ_OVFL.
+ *
+ * When built with liburing, -U writes segments through io_uring with
+ * registered buffers (and -D adds O_DIRECT) so flushes are asynchronous;
+ * otherwise, or if the kernel lacks io_uring, stdio is used.
+ *
+ * Segments are preallocated to their full size with fallocate() and never
+ * grow past it. Binary segments are sealed with a footer (record count and
+ * CRC-32) when closed, data is fdatasync()ed on a configurable frame/time
+ * cadence, and on startup the newest segment is recovered: anything after
+ * its last valid record is truncated and the footer is written. Numbering
+ * continues after the existing segments instead of overwriting them.
+ *
+ * Every segment gets a can-N.vtuidx sidecar (see vtuidx.h) with a sparse
+ * timestamp -> offset table and a per-ID summary, which vtu-logquery uses
+ * to pull a time window or set of IDs out of the logs without a full scan.
+ *
+ * With -t the logger records only around events: the writer keeps the
+ * last frames in a byte-sized in-memory history and, when a trigger fires
+ * (ID/payload match, signal threshold or SIGUSR1, see trigger.h), writes
+ * the pre-trigger window from it followed by live frames until the
+ * post-trigger window has passed.
+ *
+ * With -z closed segments are compressed (zstd or LZ4, chosen at build
+ * time, see logstream.h) by a low-priority background thread, and
+ * retention switches from a fixed segment count to the disk space that
+ * MAX_LOG_FILES uncompressed segments would take, so the same flash
+ * budget holds several times more history. vtu-logdump and vtu-logquery
+ * read compressed segments transparently.
+ *
+ * Several interfaces (or "any" for every CAN interface) can be captured
+ * by one process: the socket is bound to all interfaces (ifindex 0) and
+ * each frame is tagged with the channel it arrived on, so all buses end
+ * up merged in kernel receive order in a single segment stream. The
+ * channel table in the segment header maps channel numbers to interface
+ * names, and frame counts are kept per channel.
+ *
+ * The receive thread also keeps per-ID statistics (idstats.h): frame
+ * counts, DLC changes and cycle-time min/mean/max/jitter, with late and
+ * missing frames counted against the nominal cycles in can_defs.h. The
+ * totals appear in the periodic stats line; SIGUSR1 prints the full
+ * table (and also fires a trigger with -t).
+ *
+ * CAN-FD frames are received too (CAN_RAW_FD_FRAMES) and stored with
+ * their full payload of up to 64 bytes and the BRS/ESI bits; a kernel
+ * without CAN-FD support falls back to classic frames only.
  */
 
+#define _GNU_SOURCE  /* recvmmsg() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <net/if.h>
+#include <net/if_arp.h>
 #include <linux/can.h>
-#include <linux/can/raw.h>
+
+#include <vtu/can_io.h>
+
+#include "frame_ring.h"
+#include "vtulog.h"
+#include "vtuidx.h"
+#include "vtudelta.h"
+#include "trigger.h"
+#include "idstats.h"
+#include "logstream.h"
+#ifdef HAVE_LIBURING
+#include "uring_log.h"
+#endif
 
 #define LOG_DIR "/var/log/vtu"
 #define MAX_LOG_SIZE (10 * 1024 * 1024)  /* 10 MB per file */
 #define MAX_LOG_FILES 5                   /* Keep last 5 files */
 
+#define MAX_RX_BATCH VTU_CAN_MAX_BATCH    /* Upper bound for -b */
+#define DEFAULT_RX_BATCH 32               /* Frames drained per recvmmsg() */
+#define DEFAULT_RCVBUF_KB 1024            /* Socket queue: ~0.25 s of a saturated 1 Mbit/s bus */
+#define BATCH_HIST_BUCKETS 7              /* 1, 2-3, 4-7, ..., 32-63, 64 */
+#define STATS_INTERVAL_SEC 10
+
+#define DEFAULT_RING_SIZE 16384           /* Records (~4 s at 4k frames/s) */
+#define WRITER_BATCH 256                  /* Records written per ring peek */
+#define WRITER_IDLE_MS 10                 /* Writer sleep when the ring is empty */
+#define URING_FLUSH_SEC 1                 /* io_uring: partial buffer flush interval */
+#define DEFAULT_SYNC_MS 1000              /* fdatasync() cadence in milliseconds */
+#define MAX_TRIGGERS 8
+#define DEFAULT_PRE_TRIGGER_SEC 10        /* History written when a trigger fires */
+#define DEFAULT_POST_TRIGGER_SEC 10       /* Recording continues this long after it */
+#define DEFAULT_PRE_TRIGGER_KB 4096       /* History buffer size */
+#define COMPRESS_NICE 10                  /* Compression thread priority */
+
 static volatile int running = 1;
-static int can_socket = -1;
-static FILE *log_file = NULL;
-static unsigned long frame_count = 0;
-static unsigned long bytes_logged = 0;
 static int current_file_num = 0;
+static int binary_mode = 1;
+static int delta_mode = 0;              /* -f delta: binary with delta-encoded records */
+static int rx_batch = DEFAULT_RX_BATCH;
+
+/*
+ * Captured interfaces; the index is the record's channel. Entries are
+ * only appended (with "any", by the receive thread when a new interface
+ * shows up) and published through channel_count, so the writer can read
+ * names below the count it loaded without locking.
+ */
+struct channel {
+    char ifname[IFNAMSIZ];
+    int  ifindex;
+    unsigned long frames;           /* Receive thread */
+    unsigned long err_frames;
+    unsigned long interval_frames;  /* Since the last stats line */
+};
+static struct channel channels[VTULOG_MAX_CHANNELS];
+static atomic_int channel_count;
+static int capture_any = 0;             /* "any": add CAN interfaces as they appear */
+static unsigned long foreign_frames = 0;  /* From interfaces not being logged */
+
+/* Where frame timestamps come from */
+enum ts_mode {
+    TS_MODE_WRITE,      /* gettimeofday() when the frame is captured */
+    TS_MODE_KERNEL,     /* SO_TIMESTAMP software receive time */
+    TS_MODE_HARDWARE,   /* SO_TIMESTAMPING, hardware with software fallback */
+};
+static enum ts_mode ts_mode = TS_MODE_KERNEL;
+
+/* Receive socket and the frames of the current batch */
+static struct vtu_can can;
+static struct vtu_can_rx rx[MAX_RX_BATCH];
+static int rcvbuf_kb = DEFAULT_RCVBUF_KB;
+
+/* Batch size distribution for the current stats interval */
+static unsigned long batch_hist[BATCH_HIST_BUCKETS];
+
+/* Per-ID statistics (receive thread) */
+static struct id_stats_table id_stats;
+static atomic_int stats_dump_pending;   /* Set by SIGUSR1 */
+static uint64_t reported_late = 0;      /* Totals at the last stats line */
+static uint64_t reported_missing = 0;
+
+/* Receive thread -> writer thread hand-off */
+static struct frame_ring ring;
+static uint32_t ring_size = DEFAULT_RING_SIZE;
+static pthread_t writer_tid;
+static atomic_int writer_stop;
+
+/* Log output back end (writer thread) */
+static int use_uring = 0;               /* -U: io_uring requested */
+static int use_direct = 0;              /* -D: O_DIRECT requested */
+static int log_open = 0;                /* A segment is open */
+static FILE *log_file = NULL;           /* stdio back end */
+#ifdef HAVE_LIBURING
+static struct uring_log *uring_log = NULL;  /* io_uring back end, NULL if unused */
+#endif
+
+/* Durability cadence: fdatasync() after this many frames or milliseconds */
+static unsigned long sync_frames = 0;   /* -S, 0 = off */
+static unsigned long sync_ms = DEFAULT_SYNC_MS;  /* -M, 0 = off */
+
+/* Index sidecar (writer thread) */
+static uint32_t index_stride = VTUIDX_DEFAULT_STRIDE;  /* -I, 0 = no index */
+static struct vtuidx_builder seg_index;
+static char seg_path[256];              /* Path of the open segment */
+static struct vtudelta_enc delta_enc;   /* Encoder state of the open segment */
+
+/* Triggered recording (-t), writer thread */
+static struct trigger triggers[MAX_TRIGGERS];
+static int trigger_count = 0;           /* 0 = record continuously */
+static unsigned long pre_trigger_sec = DEFAULT_PRE_TRIGGER_SEC;
+static unsigned long post_trigger_sec = DEFAULT_POST_TRIGGER_SEC;
+static unsigned long pre_trigger_kb = DEFAULT_PRE_TRIGGER_KB;
+static struct pretrigger pretrig;
+static uint64_t post_end_us = 0;        /* Recording until this frame time, 0 = idle */
+static atomic_int usr1_pending;         /* Set by SIGUSR1 */
+static atomic_ulong triggers_fired;
+
+/* Background compression of closed segments (-z) */
+static int compress_level = -1;         /* -1 = off */
+static pthread_t compress_tid;
+static pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+static int compress_kick = 0;           /* A segment was closed */
+static int compress_stop = 0;
+static atomic_int open_segment;         /* Segments from this number on are off limits */
+
+/* Writer thread state */
+static unsigned long file_bytes = 0;    /* Bytes in the current file */
+static int seg_channels = 0;            /* Channels in the current segment's header */
+static unsigned long writer_frames = 0; /* Frames written since start */
+static uint64_t seg_records = 0;        /* Records in the current segment */
+static uint32_t seg_crc = 0;            /* CRC-32 of the current segment's records */
+static unsigned long unsynced_frames = 0;
+static struct timespec last_sync;
+
+/* Published by the writer for the stats line */
+static atomic_ulong frame_count;
+static atomic_ulong bytes_logged;
 
 static void signal_handler(int sig) {
     (void)sig;
     running = 0;
 }
 
-/* Get current timestamp as string with microsecond precision */
-static void get_timestamp(char *buf, size_t len) {
+static void usr1_handler(int sig) {
+    (void)sig;
+    if (trigger_count) {
+        atomic_store(&usr1_pending, 1);
+    }
+    atomic_store(&stats_dump_pending, 1);
+}
+
+/* Get current wall clock time in microseconds since the epoch */
+static uint64_t get_time_us(void) {
     struct timeval tv;
-    struct tm *tm;
     
     gettimeofday(&tv, NULL);
-    tm = localtime(&tv.tv_sec);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Get current timestamp as string with microsecond precision */
+static void get_timestamp(char *buf, size_t len) {
+    vtulog_format_time(get_time_us(), buf, len);
+}
+
+/* File name extension for the active log format */
+static const char *log_extension(void) {
+    return binary_mode ? VTULOG_EXTENSION : ".log";
+}
+
+/* Segment file on disk, for space-based retention */
+struct seg_file {
+    int num;
+    char name[64];
+    uint64_t bytes;
+};
+
+static int compare_seg_files(const void *a, const void *b) {
+    return ((const struct seg_file *)a)->num - ((const struct seg_file *)b)->num;
+}
+
+/*
+ * Compressed retention: delete the oldest segments (log, compressed log
+ * and index) until everything fits in the space MAX_LOG_FILES plain
+ * segments would use. Allocated blocks are counted, so the preallocated
+ * open segment is charged in full.
+ */
+static void enforce_space_budget(void) {
+    const uint64_t budget = (uint64_t)MAX_LOG_FILES * MAX_LOG_SIZE;
+    struct seg_file *files = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    struct dirent *de;
+    struct stat st;
+    
+    DIR *dir = opendir(LOG_DIR);
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        int num, pos;
+        if (sscanf(de->d_name, "can-%d%n", &num, &pos) != 1 || de->d_name[pos] != '.' ||
+            strlen(de->d_name) >= sizeof(files[0].name) ||
+            fstatat(dirfd(dir), de->d_name, &st, 0) < 0) {
+            continue;
+        }
+        if (count == cap) {
+            struct seg_file *f = realloc(files, (cap ? cap * 2 : 64) * sizeof(*f));
+            if (!f) {
+                break;
+            }
+            files = f;
+            cap = cap ? cap * 2 : 64;
+        }
+        files[count].num = num;
+        strcpy(files[count].name, de->d_name);
+        files[count].bytes = (uint64_t)st.st_blocks * 512;
+        total += files[count].bytes;
+        count++;
+    }
+    closedir(dir);
     
-    snprintf(buf, len, "%04d-%02d-%02d %02d:%02d:%02d.%06ld",
-             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-             tm->tm_hour, tm->tm_min, tm->tm_sec,
-             tv.tv_usec);
+    qsort(files, count, sizeof(*files), compare_seg_files);
+    for (size_t i = 0; i < count && total > budget && files[i].num < current_file_num; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", LOG_DIR, files[i].name);
+        if (unlink(path) == 0) {
+            total -= files[i].bytes;
+        }
+    }
+    free(files);
 }
 
 /* Rotate log files: delete oldest if we have too many */
 static void rotate_logs(void) {
-    char old_path[256], new_path[256];
+    char old_path[256];
+    
+    if (compress_level >= 0) {
+        enforce_space_budget();
+        return;
+    }
     
     /* Remove oldest file if we've hit the limit */
-    snprintf(old_path, sizeof(old_path), "%s/can-%d.log", 
-             LOG_DIR, current_file_num - MAX_LOG_FILES);
+    snprintf(old_path, sizeof(old_path), "%s/can-%d%s", 
+             LOG_DIR, current_file_num - MAX_LOG_FILES, log_extension());
     unlink(old_path);  /* Ignore errors if file doesn't exist */
+    
+    snprintf(old_path, sizeof(old_path), "%s/can-%d%s",
+             LOG_DIR, current_file_num - MAX_LOG_FILES, VTUIDX_EXTENSION);
+    unlink(old_path);
+}
+
+/*============================================================================
+ * Log output: stdio or io_uring
+ *===========================================================================*/
+
+static int out_open(const char *path) {
+    int fd;
+    
+#ifdef HAVE_LIBURING
+    if (uring_log) {
+        if (uring_log_open(uring_log, path, use_direct) < 0) {
+            return -1;
+        }
+        fd = uring_log_fd(uring_log);
+    } else
+#endif
+    {
+        log_file = fopen(path, "w");
+        if (!log_file) {
+            return -1;
+        }
+        fd = fileno(log_file);
+    }
+    
+    /* Reserve the whole segment up front: contiguous blocks on the SD card
+     * and no allocation on the write path. KEEP_SIZE leaves the file length
+     * at what was actually written. */
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, MAX_LOG_SIZE) < 0 &&
+        errno != EOPNOTSUPP) {
+        perror("[LOGGER] fallocate");
+    }
+    return 0;
+}
+
+static void out_write(const void *data, size_t len) {
+#ifdef HAVE_LIBURING
+    if (uring_log) {
+        uring_log_write(uring_log, data, len);
+        return;
+    }
+#endif
+    fwrite(data, 1, len, log_file);
+}
+
+static void out_flush(void) {
+#ifdef HAVE_LIBURING
+    if (uring_log) {
+        uring_log_flush(uring_log);
+        return;
+    }
+#endif
+    fflush(log_file);
+}
+
+/* Make everything written so far durable */
+static void out_sync(void) {
+#ifdef HAVE_LIBURING
+    if (uring_log) {
+        uring_log_sync(uring_log);
+        return;
+    }
+#endif
+    fflush(log_file);
+    fdatasync(fileno(log_file));
+}
+
+static void out_close(int do_fsync) {
+#ifdef HAVE_LIBURING
+    if (uring_log) {
+        uring_log_close(uring_log, do_fsync);
+        return;
+    }
+#endif
+    fflush(log_file);
+    if (do_fsync) {
+        fsync(fileno(log_file));
+    }
+    fclose(log_file);
+    log_file = NULL;
+}
+
+/* Select the output back end requested on the command line */
+static void setup_output(void) {
+    if (!use_uring) {
+        return;
+    }
+#ifdef HAVE_LIBURING
+    uring_log = uring_log_create();
+    if (uring_log) {
+        printf("[LOGGER] Writing through io_uring%s\n",
+               use_direct ? " with O_DIRECT" : "");
+        return;
+    }
+    printf("[LOGGER] io_uring unavailable (%s), using stdio\n", strerror(errno));
+#else
+    printf("[LOGGER] Built without io_uring support, using stdio\n");
+#endif
+}
+
+/* Seal the current segment (footer or text trailer) and close it */
+static void close_log_file(const char *trailer) {
+    if (!log_open) {
+        return;
+    }
+    if (binary_mode) {
+        struct vtulog_footer ftr;
+        if (delta_mode) {
+            static const uint8_t end_tag = VTUDELTA_TAG_END;
+            out_write(&end_tag, 1);
+            file_bytes++;
+        }
+        vtulog_init_footer(&ftr, seg_records, seg_crc, get_time_us());
+        out_write(&ftr, sizeof(ftr));
+        file_bytes += sizeof(ftr);
+    } else if (trailer) {
+        out_write(trailer, strlen(trailer));
+        file_bytes += strlen(trailer);
+    }
+    /* Make the finished segment durable; only the writer waits */
+    out_close(1);
+    log_open = 0;
+    
+    if (index_stride) {
+        char idx_path[512];
+        vtuidx_path(seg_path, idx_path, sizeof(idx_path));
+        if (vtuidx_write(&seg_index, idx_path, file_bytes, !binary_mode) < 0) {
+            perror("[LOGGER] Failed to write index");
+        }
+    }
 }
 
 /* Open a new log file */
 static int open_log_file(void) {
     char filepath[256];
-    char timestamp[64];
+    uint64_t start_us = get_time_us();
     
-    if (log_file) {
-        fprintf(log_file, "\n--- Log file closed ---\n");
-        fclose(log_file);
-    }
+    close_log_file("\n--- Log file closed ---\n");
     
     current_file_num++;
-    snprintf(filepath, sizeof(filepath), "%s/can-%d.log", 
-             LOG_DIR, current_file_num);
+    /* Publish before the file exists, so the compressor never sees it as closed */
+    atomic_store(&open_segment, current_file_num);
+    /* Only now does the segment just closed pass the num < open_segment test */
+    if (compress_level >= 0) {
+        pthread_mutex_lock(&compress_lock);
+        compress_kick = 1;
+        pthread_cond_signal(&compress_cond);
+        pthread_mutex_unlock(&compress_lock);
+    }
+    
+    snprintf(filepath, sizeof(filepath), "%s/can-%d%s", 
+             LOG_DIR, current_file_num, log_extension());
     
-    log_file = fopen(filepath, "w");
-    if (!log_file) {
+    if (out_open(filepath) < 0) {
         perror("Failed to open log file");
         return -1;
     }
+    log_open = 1;
+    snprintf(seg_path, sizeof(seg_path), "%s", filepath);
+    if (index_stride) {
+        vtuidx_builder_reset(&seg_index);
+    }
     
-    get_timestamp(timestamp, sizeof(timestamp));
-    fprintf(log_file, "=== VTU CAN Bus Log ===\n");
-    fprintf(log_file, "Started: %s\n", timestamp);
-    fprintf(log_file, "Format: TIMESTAMP CAN_ID [DLC] DATA\n");
-    fprintf(log_file, "========================\n\n");
-    fflush(log_file);
+    /* Snapshot the channels; a later one starts a new segment */
+    seg_channels = atomic_load_explicit(&channel_count, memory_order_acquire);
+    
+    if (binary_mode) {
+        struct vtulog_file_header hdr;
+        struct vtulog_channel table[VTULOG_MAX_CHANNELS];
+        vtulog_init_header(&hdr, capture_any ? "any" : channels[0].ifname, start_us);
+        hdr.channel_count = seg_channels;
+        memset(table, 0, sizeof(table));
+        for (int i = 0; i < seg_channels; i++) {
+            strncpy(table[i].ifname, channels[i].ifname, sizeof(table[i].ifname) - 1);
+        }
+        if (delta_mode) {
+            /* Keyframes double as the index entries */
+            hdr.flags |= VTULOG_HDR_DELTA;
+            hdr.keyframe_interval = index_stride ? index_stride : VTUIDX_DEFAULT_STRIDE;
+            vtudelta_enc_reset(&delta_enc, hdr.keyframe_interval);
+        }
+        out_write(&hdr, sizeof(hdr));
+        out_write(table, seg_channels * sizeof(table[0]));
+        file_bytes = vtulog_data_offset(&hdr);
+        seg_records = 0;
+        seg_crc = 0;
+    } else {
+        char names[VTULOG_MAX_CHANNELS * IFNAMSIZ] = "";
+        char banner[512];
+        for (int i = 0; seg_channels > 1 && i < seg_channels; i++) {
+            if (i > 0) {
+                strcat(names, " ");
+            }
+            strcat(names, channels[i].ifname);
+        }
+        int len = vtulog_format_text_banner(start_us, names[0] ? names : NULL,
+                                            banner, sizeof(banner));
+        out_write(banner, len);
+        file_bytes = len;
+    }
+    out_flush();
     
-    bytes_logged = 0;
     rotate_logs();
     
     printf("[LOGGER] Opened log file: %s\n", filepath);
     return 0;
 }
 
-/* Log a CAN frame */
-static void log_frame(struct can_frame *frame) {
-    char timestamp[64];
+/*
+ * Segment number of a "can-N<ext>" file name, 0 if it isn't one. *compressed
+ * is set for "can-N<ext>.zst" / ".lz4".
+ */
+static int segment_number(const char *name, int *compressed) {
+    const char *ext = log_extension();
+    size_t ext_len = strlen(ext);
+    int num, pos;
+    
+    if (sscanf(name, "can-%d%n", &num, &pos) != 1 || num <= 0 ||
+        strncmp(name + pos, ext, ext_len) != 0) {
+        return 0;
+    }
+    name += pos + ext_len;
+    *compressed = strcmp(name, ".zst") == 0 || strcmp(name, ".lz4") == 0;
+    return (*name == '\0' || *compressed) ? num : 0;
+}
+
+/*
+ * Find the newest existing segment, repair it if the previous run didn't
+ * close it, and continue numbering after it.
+ */
+static void recover_segments(void) {
+    char path[512];
+    struct dirent *de;
+    int last = 0, last_compressed = 0;
+    
+    DIR *dir = opendir(LOG_DIR);
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        int compressed;
+        int num = segment_number(de->d_name, &compressed);
+        if (num > last) {
+            last = num;
+            last_compressed = compressed;
+        }
+    }
+    closedir(dir);
+    
+    if (last == 0) {
+        return;
+    }
+    
+    current_file_num = last;
+    if (last_compressed) {
+        return;  /* Compressed segments are always sealed */
+    }
+    snprintf(path, sizeof(path), "%s/can-%d%s", LOG_DIR, last, log_extension());
+    
+    if (binary_mode) {
+        long kept = vtulog_recover(path);
+        if (kept < 0) {
+            printf("[LOGGER] %s is not a valid segment, leaving it\n", path);
+            return;
+        }
+        printf("[LOGGER] Recovered %s (%ld frames)\n", path, kept);
+    }
+    
+    /* A crashed run never wrote the sidecar (or recovery changed the file) */
+    if (index_stride) {
+        struct vtuidx idx;
+        struct stat st;
+        char idx_path[512];
+        int stale;
+        
+        vtuidx_path(path, idx_path, sizeof(idx_path));
+        stale = vtuidx_load(&idx, idx_path) < 0 || stat(path, &st) < 0 ||
+                idx.hdr.log_size != (uint64_t)st.st_size;
+        vtuidx_free(&idx);
+        if (stale && vtuidx_rebuild(path, index_stride) == 0) {
+            printf("[LOGGER] Rebuilt index for %s\n", path);
+        }
+    }
+}
+
+/*============================================================================
+ * Background compression
+ *===========================================================================*/
+
+static int compare_desc(const void *a, const void *b) {
+    return *(const int *)b - *(const int *)a;
+}
+
+/* Compress every closed plain segment, newest first */
+static void compress_closed_segments(void) {
+    int nums[256];
+    size_t count = 0;
+    struct dirent *de;
     
-    if (!log_file) {
+    DIR *dir = opendir(LOG_DIR);
+    if (!dir) {
         return;
     }
+    while ((de = readdir(dir)) != NULL && count < sizeof(nums) / sizeof(nums[0])) {
+        int compressed;
+        int num = segment_number(de->d_name, &compressed);
+        if (num > 0 && !compressed && num < atomic_load(&open_segment)) {
+            nums[count++] = num;
+        }
+    }
+    closedir(dir);
+    qsort(nums, count, sizeof(nums[0]), compare_desc);
     
-    /* Check if we need to rotate */
-    if (bytes_logged >= MAX_LOG_SIZE) {
+    for (size_t i = 0; i < count; i++) {
+        char path[512];
+        struct stat st;
+        
+        pthread_mutex_lock(&compress_lock);
+        int stop = compress_stop;
+        pthread_mutex_unlock(&compress_lock);
+        if (stop) {
+            return;
+        }
+        
+        snprintf(path, sizeof(path), "%s/can-%d%s", LOG_DIR, nums[i], log_extension());
+        if (stat(path, &st) < 0) {
+            continue;  /* Rotated away meanwhile */
+        }
+        if (log_compress_file(path, compress_level) < 0) {
+            fprintf(stderr, "[LOGGER] Failed to compress %s: %s\n", path, strerror(errno));
+            continue;
+        }
+        printf("[LOGGER] Compressed %s%s (%ld KB)\n", path, LOG_COMPRESS_EXT,
+               (long)(st.st_size / 1024));
+    }
+}
+
+/* Compression thread: runs a pass whenever the writer closes a segment */
+static void *compress_thread(void *arg) {
+    (void)arg;
+    
+    /* The nice value is per thread on Linux: only compression yields */
+    setpriority(PRIO_PROCESS, 0, COMPRESS_NICE);
+    
+    pthread_mutex_lock(&compress_lock);
+    while (!compress_stop) {
+        pthread_mutex_unlock(&compress_lock);
+        compress_closed_segments();
+        pthread_mutex_lock(&compress_lock);
+        while (!compress_kick && !compress_stop) {
+            pthread_cond_wait(&compress_cond, &compress_lock);
+        }
+        compress_kick = 0;
+    }
+    pthread_mutex_unlock(&compress_lock);
+    return NULL;
+}
+
+/* Convert a SocketCAN frame to a log record (fd: frame came in as CANFD_MTU) */
+static void frame_to_record(const struct canfd_frame *frame, int fd, uint64_t timestamp_us,
+                            uint8_t ts_source, uint8_t channel,
+                            struct vtulog_record *rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp_us = timestamp_us;
+    rec->flags = ts_source;
+    rec->channel = channel;
+    
+    if (frame->can_id & CAN_EFF_FLAG) {
+        rec->can_id = frame->can_id & CAN_EFF_MASK;
+        rec->flags |= VTULOG_FLAG_EXT;
+    } else {
+        rec->can_id = frame->can_id & CAN_SFF_MASK;
+    }
+    if (frame->can_id & CAN_RTR_FLAG) {
+        rec->flags |= VTULOG_FLAG_RTR;
+    }
+    if (frame->can_id & CAN_ERR_FLAG) {
+        rec->flags |= VTULOG_FLAG_ERR;
+    }
+    
+    if (fd) {
+        rec->flags |= VTULOG_FLAG_FD;
+        if (frame->flags & CANFD_BRS) {
+            rec->flags |= VTULOG_FLAG_BRS;
+        }
+        if (frame->flags & CANFD_ESI) {
+            rec->flags |= VTULOG_FLAG_ESI;
+        }
+        rec->dlc = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+    } else {
+        rec->dlc = frame->len > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame->len;
+    }
+    memcpy(rec->data, frame->data, rec->dlc);
+}
+
+/*
+ * Capture a received frame (receive thread).
+ * timestamp_us = 0 stamps the frame with the host clock.
+ */
+static void capture_frame(const struct canfd_frame *frame, int fd, uint64_t timestamp_us,
+                          uint8_t ts_source, uint8_t channel) {
+    struct vtulog_record rec;
+    
+    if (timestamp_us == 0) {
+        timestamp_us = get_time_us();
+        ts_source = VTULOG_TS_HOST;
+    }
+    frame_to_record(frame, fd, timestamp_us, ts_source, channel, &rec);
+    id_stats_update(&id_stats, &rec);
+    
+    /* Never block here: a full ring means the writer has fallen behind */
+    frame_ring_push(&ring, &rec);
+}
+
+/* Write one record to the current log file (writer thread) */
+static void write_record(const struct vtulog_record *rec) {
+    if (!log_open) {
+        return;
+    }
+    
+    /* An interface that appeared after the segment was opened */
+    if (rec->channel >= seg_channels) {
         open_log_file();
+        if (!log_open) {
+            return;
+        }
     }
     
-    get_timestamp(timestamp, sizeof(timestamp));
+    if (binary_mode) {
+        /* Worst case for a delta frame: keyframe, literal frame, end marker */
+        size_t max_len = delta_mode ? VTUDELTA_MAX_FRAME + 1 : vtulog_record_size(rec);
+        
+        /* Rotate before the segment (with its footer) would exceed the
+         * preallocated size */
+        if (file_bytes + max_len + sizeof(struct vtulog_footer) > MAX_LOG_SIZE) {
+            open_log_file();
+            if (!log_open) {
+                return;
+            }
+        }
+        if (index_stride) {
+            vtuidx_add(&seg_index, rec, file_bytes);
+        }
+        if (delta_mode) {
+            uint8_t buf[VTUDELTA_MAX_FRAME];
+            size_t len = vtudelta_encode(&delta_enc, rec, buf);
+            out_write(buf, len);
+            file_bytes += len;
+        } else {
+            out_write(rec, vtulog_record_size(rec));
+            file_bytes += vtulog_record_size(rec);
+        }
+        seg_records++;
+        seg_crc = vtulog_record_crc(seg_crc, rec);
+    } else {
+        char line[VTULOG_TEXT_LINE_MAX];
+        int len = vtulog_format_record(rec,
+                                       seg_channels > 1 ? channels[rec->channel].ifname : NULL,
+                                       line);
+        if (file_bytes + len > MAX_LOG_SIZE) {
+            open_log_file();
+            if (!log_open) {
+                return;
+            }
+        }
+        if (index_stride) {
+            vtuidx_add(&seg_index, rec, file_bytes);
+        }
+        out_write(line, len);
+        file_bytes += len;
+    }
+    writer_frames++;
+    unsynced_frames++;
     
-    /* Write timestamp and CAN ID */
-    int written = fprintf(log_file, "%s  %03X  [%d] ", 
-                         timestamp, frame->can_id & CAN_SFF_MASK, 
-                         frame->len);
+    /* Flush every 100 frames to ensure data is written; io_uring submits
+     * full buffers on its own and is flushed from the idle path instead */
+    if (log_file && writer_frames % 100 == 0) {
+        fflush(log_file);
+    }
+}
+
+/* Start (or extend) a recording window around a trigger at frame time ts */
+static void fire_trigger(const char *reason, uint64_t ts) {
+    uint64_t pre_us = (uint64_t)pre_trigger_sec * 1000000;
     
-    /* Write data bytes */
-    for (int i = 0; i < frame->len; i++) {
-        written += fprintf(log_file, " %02X", frame->data[i]);
+    atomic_fetch_add_explicit(&triggers_fired, 1, memory_order_relaxed);
+    if (post_end_us == 0) {
+        uint32_t n = pretrigger_drain(&pretrig, ts > pre_us ? ts - pre_us : 0,
+                                      write_record);
+        printf("[LOGGER] Trigger %s: recording (%u pre-trigger frames)\n", reason, n);
     }
+    post_end_us = ts + (uint64_t)post_trigger_sec * 1000000;
+}
+
+/* Triggered mode: buffer the frame, or write it inside a recording window */
+static void capture_triggered(const struct vtulog_record *rec) {
+    const char *reason = NULL;
     
-    written += fprintf(log_file, "\n");
+    /* SIGUSR1 fires on the next frame, so it shares the frame clock */
+    if (atomic_exchange(&usr1_pending, 0)) {
+        reason = "SIGUSR1";
+    }
+    for (int i = 0; !reason && i < trigger_count; i++) {
+        if (trigger_match(&triggers[i], rec)) {
+            reason = triggers[i].desc;
+        }
+    }
+    if (reason) {
+        fire_trigger(reason, rec->timestamp_us);
+    }
     
-    bytes_logged += written;
-    frame_count++;
+    if (post_end_us) {
+        if (rec->timestamp_us <= post_end_us) {
+            write_record(rec);
+            return;
+        }
+        post_end_us = 0;
+        out_flush();
+        printf("[LOGGER] Post-trigger window over, buffering\n");
+    }
+    pretrigger_push(&pretrig, rec);
+}
+
+/* Flush from the writer's idle path (ring empty) */
+static void idle_flush(void) {
+    static time_t last_flush = 0;
     
-    /* Flush every 100 frames to ensure data is written */
-    if (frame_count % 100 == 0) {
+    if (!log_open) {
+        return;
+    }
+    if (log_file) {
         fflush(log_file);
+        return;
+    }
+    
+    /* Don't turn every idle wakeup into a small io_uring write */
+    time_t now = time(NULL);
+    if (now - last_flush >= URING_FLUSH_SEC) {
+        out_flush();
+        last_flush = now;
     }
 }
 
+/* fdatasync() if the frame or time cadence is due (writer thread) */
+static void maybe_sync(void) {
+    struct timespec now;
+    int due = 0;
+    
+    if (!log_open || unsynced_frames == 0) {
+        return;
+    }
+    if (sync_frames && unsynced_frames >= sync_frames) {
+        due = 1;
+    }
+    if (!due && sync_ms) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - last_sync.tv_sec) * 1000 +
+                          (now.tv_nsec - last_sync.tv_nsec) / 1000000;
+        due = elapsed_ms >= (long)sync_ms;
+    }
+    if (!due) {
+        return;
+    }
+    
+    out_sync();
+    unsynced_frames = 0;
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+}
+
+/* Writer thread: drain the ring to disk until stopped and empty */
+static void *writer_thread(void *arg) {
+    (void)arg;
+    
+    for (;;) {
+        struct vtulog_record *recs;
+        uint32_t n = frame_ring_peek(&ring, &recs, WRITER_BATCH);
+        
+        if (n == 0) {
+            if (atomic_load(&writer_stop)) {
+                break;
+            }
+            idle_flush();
+            maybe_sync();
+            struct timespec idle = { 0, WRITER_IDLE_MS * 1000000L };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        
+        if (trigger_count) {
+            for (uint32_t i = 0; i < n; i++) {
+                capture_triggered(&recs[i]);
+            }
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                write_record(&recs[i]);
+            }
+        }
+        frame_ring_release(&ring, n);
+        maybe_sync();
+        
+        atomic_store_explicit(&frame_count, writer_frames, memory_order_relaxed);
+        atomic_store_explicit(&bytes_logged, file_bytes, memory_order_relaxed);
+    }
+    
+    return NULL;
+}
+
+/* Interface name for the per-ID table */
+static const char *channel_name(uint8_t channel) {
+    return channels[channel].ifname;
+}
+
+/* Print the per-ID table (receive thread) */
+static void dump_id_stats(void) {
+    int multi = atomic_load(&channel_count) > 1;
+    
+    printf("[LOGGER] Per-ID statistics (%u IDs):\n", id_stats.count);
+    id_stats_dump(&id_stats, stdout, multi ? channel_name : NULL);
+    fflush(stdout);
+}
+
 /* Print statistics */
 static void print_stats(void) {
     printf("\n[LOGGER] Statistics:\n");
-    printf("  Frames logged: %lu\n", frame_count);
-    printf("  Bytes written: %lu\n", bytes_logged);
+    printf("  Frames logged: %lu\n", writer_frames);
+    printf("  Bytes written: %lu\n", file_bytes);
     printf("  Current file:  %d\n", current_file_num);
+    printf("  Ring dropped:  %lu\n", ring.dropped);
+    printf("  Ring peak:     %u/%u\n", ring.high_water, ring_size);
+    printf("  Kernel drops:  %u\n", can.drops);
+    for (int i = 0; i < atomic_load(&channel_count); i++) {
+        printf("  %-14s %lu frames, %lu error frames\n", channels[i].ifname,
+               channels[i].frames, channels[i].err_frames);
+    }
+    if (foreign_frames) {
+        printf("  Not captured:  %lu (other interfaces)\n", foreign_frames);
+    }
+    if (trigger_count) {
+        printf("  Triggers:      %lu\n", atomic_load(&triggers_fired));
+        printf("  Not recorded:  %lu\n", pretrig.overwritten + pretrig.count);
+    }
+    dump_id_stats();
 }
 
-static int setup_can_socket(const char *ifname) {
-    struct sockaddr_can addr;
-    struct ifreq ifr;
+/* Record one recvmmsg() result in the power-of-two batch histogram */
+static void record_batch(int n) {
+    int bucket = 0;
     
-    can_socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (can_socket < 0) {
-        perror("Failed to create CAN socket");
-        return -1;
+    while (bucket < BATCH_HIST_BUCKETS - 1 && (n >> (bucket + 1)) > 0) {
+        bucket++;
+    }
+    batch_hist[bucket]++;
+}
+
+/* Print the periodic stats line and reset the batch histogram */
+static void print_periodic_stats(void) {
+    printf("[LOGGER] Logged %lu frames (%lu bytes) kernel drops %u "
+           "ring: peak %u/%u dropped %lu batches:", 
+           atomic_load_explicit(&frame_count, memory_order_relaxed),
+           atomic_load_explicit(&bytes_logged, memory_order_relaxed),
+           can.drops, ring.high_water, ring_size, ring.dropped);
+    for (int i = 0; i < BATCH_HIST_BUCKETS; i++) {
+        int lo = 1 << i;
+        int hi = (1 << (i + 1)) - 1;
+        if (lo == hi || i == BATCH_HIST_BUCKETS - 1) {
+            printf(" %d:%lu", lo, batch_hist[i]);
+        } else {
+            printf(" %d-%d:%lu", lo, hi, batch_hist[i]);
+        }
     }
+    if (trigger_count) {
+        printf(" triggers: %lu", atomic_load_explicit(&triggers_fired, memory_order_relaxed));
+    }
+    struct id_stats_summary sum;
+    id_stats_summarize(&id_stats, &sum);
+    printf(" ids: %u late: %llu missing: %llu", sum.ids,
+           (unsigned long long)(sum.late - reported_late),
+           (unsigned long long)(sum.missing - reported_missing));
+    if (sum.worst && sum.missing > reported_missing) {
+        uint32_t key = sum.worst->key;
+        printf(" (worst %s:%0*X: %llu missing)", channels[sum.worst->channel].ifname,
+               (key & VTUIDX_KEY_EXT) ? 8 : 3, key & ~VTUIDX_KEY_EXT,
+               (unsigned long long)sum.worst->missing);
+    }
+    reported_late = sum.late;
+    reported_missing = sum.missing;
+    int nch = atomic_load_explicit(&channel_count, memory_order_relaxed);
+    if (nch > 1) {
+        printf(" channels:");
+        for (int i = 0; i < nch; i++) {
+            printf(" %s:%lu", channels[i].ifname, channels[i].interval_frames);
+            channels[i].interval_frames = 0;
+        }
+    }
+    printf("\n");
+    memset(batch_hist, 0, sizeof(batch_hist));
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] [IFACE...]\n", prog);
+    printf("Options:\n");
+    printf("  -f FORMAT   Log format: binary (default, .vtulog), delta (.vtulog with\n");
+    printf("              delta-encoded frames, typically 3-6 bytes each) or text (.log)\n");
+    printf("  -b N        Frames received per recvmmsg() call, 1-%d (default: %d)\n",
+           MAX_RX_BATCH, DEFAULT_RX_BATCH);
+    printf("  -B KB       Socket receive buffer (default: %d, 0 = kernel default)\n",
+           DEFAULT_RCVBUF_KB);
+    printf("  -r N        Writer ring size in frames, power of two (default: %d)\n",
+           DEFAULT_RING_SIZE);
+    printf("  -U          Write through io_uring (falls back to stdio)\n");
+    printf("  -D          Open segments with O_DIRECT (implies -U)\n");
+    printf("  -S FRAMES   fdatasync() after this many frames (default: off)\n");
+    printf("  -M MS       fdatasync() at least every MS milliseconds (default: %d, 0 = off)\n",
+           DEFAULT_SYNC_MS);
+    printf("  -I N        Index every Nth frame in the .vtuidx sidecar (default: %d, 0 = no index)\n",
+           VTUIDX_DEFAULT_STRIDE);
+    printf("  -t TRIGGER  Record only around events (repeatable, up to %d):\n", MAX_TRIGGERS);
+    printf("              ID[:DATA[:MASK]]  frame match, hex (7E8:0043:00FF = DTC response)\n");
+    printf("              (29-bit if ID > 7FF, 8 digits or trailing x, e.g. 7E8x)\n");
+    printf("              SIGNAL>VALUE, SIGNAL<VALUE  threshold on rpm, coolant,\n");
+    printf("              throttle, maf, gear or trans_temp (e.g. rpm>4500)\n");
+    printf("              usr1  SIGUSR1 only (SIGUSR1 always fires with -t)\n");
+    printf("  -p SEC      Pre-trigger window (default: %d)\n", DEFAULT_PRE_TRIGGER_SEC);
+    printf("  -a SEC      Post-trigger window (default: %d)\n", DEFAULT_POST_TRIGGER_SEC);
+    printf("  -m KB       Pre-trigger history buffer (default: %d)\n", DEFAULT_PRE_TRIGGER_KB);
+    if (LOG_COMPRESS_NAME[0]) {
+        printf("  -z LEVEL    Compress closed segments with %s at LEVEL (default: off, "
+               "suggested: %d)\n", LOG_COMPRESS_NAME,
+               LOG_COMPRESS_DEFAULT_LEVEL);
+    } else {
+        printf("  -z LEVEL    Compress closed segments (not available in this build)\n");
+    }
+    printf("  -T MODE     Timestamps: kernel (default), hw (hardware if the\n");
+    printf("              driver supports it, else kernel) or write (host clock)\n");
+    printf("  -h          Show this help\n");
+    printf("IFACE defaults to vcan0. Up to %d interfaces, or \"any\" for every CAN\n",
+           VTULOG_MAX_CHANNELS);
+    printf("interface, are captured into one merged log with a channel per interface\n");
+    printf("SIGUSR1 prints per-ID frame counts and cycle times\n");
+}
+
+/* Ask the driver of one interface to stamp received frames in hardware */
+static void enable_hw_timestamps(const char *ifname) {
+    /* Most CAN controllers (and vcan) can't, in which case software
+     * stamps are used */
+    if (vtu_can_enable_hw_timestamps(&can, ifname) < 0) {
+        printf("[LOGGER] Hardware timestamps unavailable on %s, "
+               "using kernel software timestamps\n", ifname);
+    }
+}
+
+/* Append a capture channel, returns its number or -1 if the table is full */
+static int add_channel(const char *ifname, int ifindex) {
+    int n = atomic_load_explicit(&channel_count, memory_order_relaxed);
     
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
-    if (ioctl(can_socket, SIOCGIFINDEX, &ifr) < 0) {
-        perror("Failed to get interface index");
-        close(can_socket);
+    if (n == VTULOG_MAX_CHANNELS) {
         return -1;
     }
+    strncpy(channels[n].ifname, ifname, IFNAMSIZ - 1);
+    channels[n].ifindex = ifindex;
+    /* The name must be visible before the writer can see the channel */
+    atomic_store_explicit(&channel_count, n + 1, memory_order_release);
+    return n;
+}
+
+/* Add every CAN interface that exists now ("any") */
+static void add_all_can_interfaces(void) {
+    struct if_nameindex *ifs = if_nameindex();
     
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
+    if (!ifs) {
+        perror("[LOGGER] if_nameindex");
+        return;
+    }
+    for (struct if_nameindex *it = ifs; it->if_index != 0; it++) {
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, it->if_name, IFNAMSIZ - 1);
+        if (ioctl(can.sock, SIOCGIFHWADDR, &ifr) == 0 &&
+            ifr.ifr_hwaddr.sa_family == ARPHRD_CAN &&
+            add_channel(it->if_name, it->if_index) < 0) {
+            printf("[LOGGER] More than %d CAN interfaces, ignoring %s\n",
+                   VTULOG_MAX_CHANNELS, it->if_name);
+        }
+    }
+    if_freenameindex(ifs);
+}
+
+static int setup_can_socket(char **ifnames, int count) {
+    struct vtu_can_opts opts = {
+        .rcvbuf = rcvbuf_kb * 1024,
+        .fd_frames = VTU_CAN_FD_TRY,
+        .overflow = 1,
+        .rcv_timeout_ms = 500,      /* Notice SIGUSR1/Ctrl+C on a quiet bus */
+    };
+    
+    for (int i = 0; i < count && !capture_any; i++) {
+        int ifindex = (int)if_nametoindex(ifnames[i]);
+        if (ifindex == 0) {
+            fprintf(stderr, "Failed to get interface index of %s: %s\n",
+                    ifnames[i], strerror(errno));
+            return -1;
+        }
+        add_channel(ifnames[i], ifindex);
+    }
     
-    if (bind(can_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("Failed to bind CAN socket");
-        close(can_socket);
+    if (ts_mode == TS_MODE_KERNEL) {
+        opts.timestamps = VTU_CAN_TS_SOFTWARE;
+    } else if (ts_mode == TS_MODE_HARDWARE) {
+        opts.timestamps = VTU_CAN_TS_HARDWARE;
+    }
+    
+    /* One interface: bind to it. Several: bind to all of them and tell
+     * the frames apart by the receiving interface */
+    if (vtu_can_open(&can, count == 1 && !capture_any ? ifnames[0] : NULL, &opts) < 0) {
+        perror("Failed to open CAN socket");
         return -1;
     }
     
-    /* Set timestamp option for accurate logging */
-    int timestamp_on = 1;
-    setsockopt(can_socket, SOL_SOCKET, SO_TIMESTAMP, 
-               &timestamp_on, sizeof(timestamp_on));
+    if (capture_any) {
+        add_all_can_interfaces();
+    }
+    if (ts_mode == TS_MODE_HARDWARE) {
+        for (int i = 0; i < atomic_load(&channel_count); i++) {
+            enable_hw_timestamps(channels[i].ifname);
+        }
+    }
+    
+    /* Older kernels only deliver classic frames */
+    if (!can.fd_frames) {
+        printf("[LOGGER] CAN-FD not supported, capturing classic frames only\n");
+    }
+    if (opts.rcvbuf && can.rcvbuf < opts.rcvbuf) {
+        printf("[LOGGER] Receive buffer limited to %d KB (net.core.rmem_max)\n",
+               can.rcvbuf / 1024);
+    }
     
-    printf("[LOGGER] Listening on %s\n", ifname);
+    for (int i = 0; i < atomic_load(&channel_count); i++) {
+        printf("[LOGGER] Listening on %s (channel %d)\n", channels[i].ifname, i);
+    }
+    if (capture_any) {
+        printf("[LOGGER] Capturing all CAN interfaces, including new ones\n");
+    }
     return 0;
 }
 
+/*
+ * Channel of the interface a frame arrived on (receive thread), -1 if it
+ * isn't captured. With "any", unknown CAN interfaces are added on the fly.
+ */
+static int lookup_channel(int ifindex) {
+    static int last = 0;
+    int n = atomic_load_explicit(&channel_count, memory_order_relaxed);
+    char ifname[IF_NAMESIZE];
+    
+    /* Consecutive frames mostly come from the same bus */
+    if (last < n && channels[last].ifindex == ifindex) {
+        return last;
+    }
+    for (int i = 0; i < n; i++) {
+        if (channels[i].ifindex == ifindex) {
+            last = i;
+            return i;
+        }
+    }
+    if (!capture_any || !if_indextoname(ifindex, ifname)) {
+        return -1;
+    }
+    int ch = add_channel(ifname, ifindex);
+    if (ch >= 0) {
+        printf("[LOGGER] New interface %s (channel %d)\n", ifname, ch);
+        if (ts_mode == TS_MODE_HARDWARE) {
+            enable_hw_timestamps(ifname);
+        }
+        last = ch;
+    }
+    return ch;
+}
+
 int main(int argc, char *argv[]) {
-    const char *can_if = "vcan0";
-    struct can_frame frame;
-    struct timeval last_stat_time, now;
+    struct timespec last_stat_time, now;
+    int opt;
     
-    if (argc > 1) {
-        can_if = argv[1];
+    while ((opt = getopt(argc, argv, "f:b:B:r:UDS:M:I:t:p:a:m:z:T:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "binary") == 0) {
+                    binary_mode = 1;
+                    delta_mode = 0;
+                } else if (strcmp(optarg, "delta") == 0) {
+                    binary_mode = 1;
+                    delta_mode = 1;
+                } else if (strcmp(optarg, "text") == 0) {
+                    binary_mode = 0;
+                    delta_mode = 0;
+                } else {
+                    fprintf(stderr, "Unknown log format: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'b':
+                rx_batch = atoi(optarg);
+                if (rx_batch < 1 || rx_batch > MAX_RX_BATCH) {
+                    fprintf(stderr, "Batch size must be 1-%d\n", MAX_RX_BATCH);
+                    return 1;
+                }
+                break;
+            case 'B':
+                rcvbuf_kb = atoi(optarg);
+                if (rcvbuf_kb < 0 || rcvbuf_kb > 65536) {
+                    fprintf(stderr, "Receive buffer must be 0-65536 KB\n");
+                    return 1;
+                }
+                break;
+            case 'r':
+                ring_size = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'U':
+                use_uring = 1;
+                break;
+            case 'D':
+                use_uring = 1;
+                use_direct = 1;
+                break;
+            case 'S':
+                sync_frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'M':
+                sync_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'I':
+                index_stride = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                if (trigger_count == MAX_TRIGGERS ||
+                    trigger_parse(optarg, &triggers[trigger_count]) < 0) {
+                    fprintf(stderr, "Invalid trigger: %s\n", optarg);
+                    return 1;
+                }
+                trigger_count++;
+                break;
+            case 'p':
+                pre_trigger_sec = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                post_trigger_sec = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                pre_trigger_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                compress_level = atoi(optarg);
+                if (compress_level < 0) {
+                    compress_level = -1;
+                }
+                break;
+            case 'T':
+                if (strcmp(optarg, "kernel") == 0) {
+                    ts_mode = TS_MODE_KERNEL;
+                } else if (strcmp(optarg, "hw") == 0) {
+                    ts_mode = TS_MODE_HARDWARE;
+                } else if (strcmp(optarg, "write") == 0) {
+                    ts_mode = TS_MODE_WRITE;
+                } else {
+                    fprintf(stderr, "Unknown timestamp mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    
+    static char *default_ifname[] = { "vcan0" };
+    char **ifnames = default_ifname;
+    int ifname_count = 1;
+    if (optind < argc) {
+        ifnames = &argv[optind];
+        ifname_count = argc - optind;
+    }
+    for (int i = 0; i < ifname_count; i++) {
+        if (strcmp(ifnames[i], "any") == 0) {
+            capture_any = 1;
+        }
+    }
+    if (capture_any ? ifname_count != 1 : ifname_count > VTULOG_MAX_CHANNELS) {
+        fprintf(stderr, "Give up to %d interfaces, or \"any\" alone\n",
+                VTULOG_MAX_CHANNELS);
+        return 1;
     }
     
     printf("VTU CAN Bus Logger v1.0\n");
@@ -191,26 +1342,86 @@ int main(int argc, char *argv[]) {
     /* Setup signal handlers */
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, usr1_handler);
+    
+    if (setup_can_socket(ifnames, ifname_count) < 0) {
+        return 1;
+    }
+    
+    if (frame_ring_init(&ring, ring_size) < 0) {
+        fprintf(stderr, "Invalid ring size %u (must be a power of two >= 2)\n",
+                ring_size);
+        return 1;
+    }
+    
+    if (index_stride && vtuidx_builder_init(&seg_index, index_stride) < 0) {
+        fprintf(stderr, "Failed to allocate index\n");
+        return 1;
+    }
     
-    if (setup_can_socket(can_if) < 0) {
+    if (id_stats_init(&id_stats, IDSTATS_DEFAULT_CAPACITY) < 0) {
+        fprintf(stderr, "Failed to allocate ID statistics\n");
         return 1;
     }
     
+    if (trigger_count && pretrigger_init(&pretrig, (size_t)pre_trigger_kb * 1024) < 0) {
+        fprintf(stderr, "Invalid pre-trigger buffer size %lu KB\n", pre_trigger_kb);
+        return 1;
+    }
+    
+    if (compress_level >= 0 && !LOG_COMPRESS_NAME[0]) {
+        printf("[LOGGER] Built without compression support, ignoring -z\n");
+        compress_level = -1;
+    }
+    
+    setup_output();
+    recover_segments();
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+    
     if (open_log_file() < 0) {
         return 1;
     }
     
-    printf("[LOGGER] Logging to %s/\n", LOG_DIR);
+    if (pthread_create(&writer_tid, NULL, writer_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start writer thread\n");
+        return 1;
+    }
+    if (compress_level >= 0 &&
+        pthread_create(&compress_tid, NULL, compress_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start compression thread, not compressing\n");
+        compress_level = -1;
+    }
+    
+    printf("[LOGGER] Logging to %s/ (%s format)\n", LOG_DIR,
+           delta_mode ? "delta" : binary_mode ? "binary" : "text");
     printf("[LOGGER] Max file size: %d MB\n", MAX_LOG_SIZE / (1024*1024));
-    printf("[LOGGER] Keeping last %d files\n", MAX_LOG_FILES);
+    if (trigger_count) {
+        printf("[LOGGER] Triggered recording: %d trigger(s) + SIGUSR1, "
+               "window -%lus/+%lus, history %lu KB (%u frames)\n",
+               trigger_count, pre_trigger_sec, post_trigger_sec, pre_trigger_kb,
+               pretrig.capacity);
+    }
+    if (compress_level >= 0) {
+        printf("[LOGGER] Compressing closed segments with %s level %d, "
+               "keeping up to %d MB\n", LOG_COMPRESS_NAME,
+               compress_level, MAX_LOG_FILES * MAX_LOG_SIZE / (1024*1024));
+    } else {
+        printf("[LOGGER] Keeping last %d files\n", MAX_LOG_FILES);
+    }
+    printf("[LOGGER] Receive batch: %d frames, ring: %u frames\n",
+           rx_batch, ring_size);
     printf("[LOGGER] Press Ctrl+C to stop\n\n");
     
-    gettimeofday(&last_stat_time, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &last_stat_time);
     
     while (running) {
-        ssize_t nbytes = read(can_socket, &frame, sizeof(frame));
+        if (atomic_exchange(&stats_dump_pending, 0)) {
+            dump_id_stats();
+        }
         
-        if (nbytes < 0) {
+        int n = vtu_can_recv_many(&can, rx, rx_batch);
+        
+        if (n < 0) {
             if (errno == EINTR) {
                 continue;  /* Interrupted by signal */
             }
@@ -218,29 +1429,70 @@ int main(int argc, char *argv[]) {
             break;
         }
         
-        if (nbytes == sizeof(frame)) {
-            log_frame(&frame);
+        if (n > 0) {
+            record_batch(n);   /* 0: receive timeout */
+        }
+        
+        for (int i = 0; i < n; i++) {
+            uint8_t ts_source = rx[i].ts_source == VTU_CAN_TS_SRC_HARDWARE ? VTULOG_TS_HARDWARE :
+                                rx[i].ts_source == VTU_CAN_TS_SRC_SOFTWARE ? VTULOG_TS_KERNEL :
+                                VTULOG_TS_HOST;
+            int ch = lookup_channel(rx[i].ifindex);
+            if (ch < 0) {
+                foreign_frames++;
+                continue;
+            }
+            channels[ch].frames++;
+            channels[ch].interval_frames++;
+            if (rx[i].frame.can_id & CAN_ERR_FLAG) {
+                channels[ch].err_frames++;
+            }
+            capture_frame(&rx[i].frame, rx[i].fd, rx[i].timestamp_us, ts_source, ch);
         }
         
-        /* Print statistics every 10 seconds */
-        gettimeofday(&now, NULL);
-        if (now.tv_sec - last_stat_time.tv_sec >= 10) {
-            printf("[LOGGER] Logged %lu frames (%lu bytes)\n", 
-                   frame_count, bytes_logged);
+        /* Print statistics every 10 seconds, checked once per batch */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - last_stat_time.tv_sec >= STATS_INTERVAL_SEC) {
+            print_periodic_stats();
             last_stat_time = now;
         }
     }
     
     printf("\n[LOGGER] Shutting down...\n");
+    
+    /* Let the writer drain what was captured */
+    atomic_store(&writer_stop, 1);
+    pthread_join(writer_tid, NULL);
+    
     print_stats();
     
-    if (log_file) {
-        char timestamp[64];
+    if (log_open) {
+        char timestamp[64], trailer[96];
         get_timestamp(timestamp, sizeof(timestamp));
-        fprintf(log_file, "\n--- Stopped: %s ---\n", timestamp);
-        fclose(log_file);
+        snprintf(trailer, sizeof(trailer), "\n--- Stopped: %s ---\n", timestamp);
+        close_log_file(trailer);
+    }
+    
+    /* Finishes the file in progress; the rest is picked up on the next start */
+    if (compress_level >= 0) {
+        pthread_mutex_lock(&compress_lock);
+        compress_stop = 1;
+        pthread_cond_signal(&compress_cond);
+        pthread_mutex_unlock(&compress_lock);
+        pthread_join(compress_tid, NULL);
     }
     
-    close(can_socket);
+#ifdef HAVE_LIBURING
+    uring_log_destroy(uring_log);
+#endif
+    if (index_stride) {
+        vtuidx_builder_free(&seg_index);
+    }
+    if (trigger_count) {
+        pretrigger_free(&pretrig);
+    }
+    id_stats_free(&id_stats);
+    frame_ring_free(&ring);
+    vtu_can_close(&can);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,374 @@
+/*
+ * VTU Log Query
+ *
+ * Extracts a time window and/or a set of CAN IDs from vtu-logger segments
+ * (binary or text) and prints the matching frames in the text log layout.
+ *
+ * When a segment has an up-to-date .vtuidx sidecar, segments whose time
+ * range or ID summary rule them out are skipped without being opened, and
+ * reading starts at the nearest indexed offset before the window and stops
+ * once the window (or the last occurrence of every requested ID) has been
+ * passed. Segments without a usable index are scanned in full.
+ * Compressed segments are read transparently; seeking in them means
+ * decompressing up to the indexed offset, which is still far cheaper than
+ * parsing the frames.
+ *
+ * With -S the matching frames are decoded instead of printed and each
+ * signal's count, minimum, mean and maximum are reported. Frames are
+ * queued per message and decoded in batches (vtu_sigdb_decode_batch()).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include <vtu/signal_db.h>
+
+#include "vtulog.h"
+#include "vtuidx.h"
+#include "logstream.h"
+#include "logscan.h"
+
+#define READ_BATCH 256  /* Records read per call */
+#define DECODE_BATCH 256    /* Frames of one message decoded per call (-S) */
+
+/* Query */
+static struct log_filter filter;
+static int list_only = 0;
+
+/* Signal summary (-S) */
+struct signal_stats {
+    uint64_t count;
+    double   sum;
+    float    min;
+    float    max;
+};
+
+static int summarize = 0;
+static struct vtu_sigdb sigdb;
+static struct vtulog_record *pending;       /* DECODE_BATCH frames per message */
+static size_t *pending_count;
+static struct signal_stats *stats;          /* Per signal */
+static float *column_buf;                   /* DECODE_BATCH floats per signal of a message */
+static float **columns;
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] FILE...\n", prog);
+    printf("Options:\n");
+    printf("  -s TIME     Start of the window (inclusive)\n");
+    printf("  -e TIME     End of the window (inclusive)\n");
+    printf("  -i IDS      Comma-separated hex CAN IDs; 29-bit if above 7FF, written\n");
+    printf("              with 8 digits or with a trailing x (7E8x)\n");
+    printf("  -o FILE     Write matching frames to FILE (default: stdout)\n");
+    printf("  -l          List each segment's index summary instead of frames\n");
+    printf("  -S          Summarize decoded signals (count, min, mean, max) instead\n");
+    printf("              of printing frames\n");
+    printf("  -d DBC      Signal layouts for -S (default: built-in VTU bus layout)\n");
+    printf("  -h          Show this help\n");
+    printf("\n");
+    printf("TIME is \"YYYY-MM-DD HH:MM:SS[.uuuuuu]\" (local time) or seconds\n");
+    printf("since the epoch, e.g. 1700000000.25\n");
+}
+
+static void list_index(const char *path, const struct vtuidx *idx) {
+    char first[32], last[32];
+
+    vtulog_format_time(idx->hdr.first_us, first, sizeof(first));
+    vtulog_format_time(idx->hdr.last_us, last, sizeof(last));
+    printf("%s: %llu frames, %s .. %s, %u IDs\n", path,
+           (unsigned long long)idx->hdr.record_count, first, last, idx->hdr.id_count);
+    printf("  %-9s %10s  %-26s  %-26s\n", "ID", "COUNT", "FIRST", "LAST");
+    for (uint32_t i = 0; i < idx->hdr.id_count; i++) {
+        const struct vtuidx_id *id = &idx->ids[i];
+        vtulog_format_time(id->first_us, first, sizeof(first));
+        vtulog_format_time(id->last_us, last, sizeof(last));
+        if (id->key & VTUIDX_KEY_EXT) {
+            printf("  %08X  %10u  %s  %s\n", id->key & ~VTUIDX_KEY_EXT, id->count, first, last);
+        } else {
+            printf("  %03X       %10u  %s  %s\n", id->key, id->count, first, last);
+        }
+    }
+}
+
+/* Print one segment's index summary, -1 on error */
+static int list_file(const char *path) {
+    struct vtuidx idx;
+    char idx_path[512];
+
+    struct log_reader *in = log_reader_open(path);
+    if (!in) {
+        perror(path);
+        return -1;
+    }
+    vtuidx_path(path, idx_path, sizeof(idx_path));
+    if (vtuidx_load(&idx, idx_path) == 0 &&
+        (int64_t)idx.hdr.log_size == log_reader_size(in)) {
+        list_index(path, &idx);
+    } else {
+        printf("%s: no up-to-date index\n", path);
+    }
+    vtuidx_free(&idx);
+    log_reader_close(in);
+    return 0;
+}
+
+/*============================================================================
+ * Signal summary
+ *===========================================================================*/
+
+static int summary_init(const char *dbc_path) {
+    int max_signals = 1;
+    int line;
+
+    if (dbc_path) {
+        if (vtu_sigdb_load_dbc(&sigdb, dbc_path, &line) < 0) {
+            if (line) {
+                fprintf(stderr, "%s:%d: invalid DBC entry\n", dbc_path, line);
+            } else {
+                fprintf(stderr, "%s: %s\n", dbc_path, strerror(errno));
+            }
+            return -1;
+        }
+    } else if (vtu_sigdb_builtin(&sigdb) < 0) {
+        perror("signal database");
+        return -1;
+    }
+
+    for (int m = 0; m < sigdb.nmessages; m++) {
+        if (sigdb.messages[m].count > max_signals) {
+            max_signals = sigdb.messages[m].count;
+        }
+    }
+    pending = malloc((size_t)(sigdb.nmessages + 1) * DECODE_BATCH * sizeof(*pending));
+    pending_count = calloc(sigdb.nmessages + 1, sizeof(*pending_count));
+    stats = calloc(sigdb.nsignals + 1, sizeof(*stats));
+    column_buf = malloc((size_t)max_signals * DECODE_BATCH * sizeof(*column_buf));
+    columns = malloc(max_signals * sizeof(*columns));
+    if (!pending || !pending_count || !stats || !column_buf || !columns) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i < max_signals; i++) {
+        columns[i] = column_buf + (size_t)i * DECODE_BATCH;
+    }
+    return 0;
+}
+
+/* Decode the queued frames of one message into the statistics */
+static void summary_flush(int m) {
+    const struct vtu_message *msg = &sigdb.messages[m];
+    size_t n = pending_count[m];
+    struct vtulog_record *recs = &pending[(size_t)m * DECODE_BATCH];
+
+    if (n == 0) {
+        return;
+    }
+    vtu_sigdb_decode_batch(&sigdb, msg, recs[0].data, &recs[0].dlc, sizeof(recs[0]), n,
+                           columns);
+    for (int i = 0; i < msg->count; i++) {
+        struct signal_stats *st = &stats[msg->first + i];
+        for (size_t f = 0; f < n; f++) {
+            float v = columns[i][f];
+            if (isnan(v)) {
+                continue;
+            }
+            if (st->count == 0 || v < st->min) {
+                st->min = v;
+            }
+            if (st->count == 0 || v > st->max) {
+                st->max = v;
+            }
+            st->sum += v;
+            st->count++;
+        }
+    }
+    pending_count[m] = 0;
+}
+
+static void summary_add(const struct vtulog_record *rec) {
+    const struct vtu_message *msg;
+    int m;
+
+    if (rec->flags & (VTULOG_FLAG_RTR | VTULOG_FLAG_ERR)) {
+        return;
+    }
+    msg = vtu_sigdb_find(&sigdb, rec->can_id |
+                                 ((rec->flags & VTULOG_FLAG_EXT) ? VTU_SIG_EXT_ID : 0));
+    if (!msg) {
+        return;
+    }
+    m = (int)(msg - sigdb.messages);
+    pending[(size_t)m * DECODE_BATCH + pending_count[m]] = *rec;
+    if (++pending_count[m] == DECODE_BATCH) {
+        summary_flush(m);
+    }
+}
+
+static void summary_print(FILE *out) {
+    char name[96];
+
+    for (int m = 0; m < sigdb.nmessages; m++) {
+        summary_flush(m);
+    }
+    fprintf(out, "%-40s %-6s %10s %12s %12s %12s\n", "SIGNAL", "UNIT", "COUNT", "MIN", "MEAN",
+            "MAX");
+    for (int i = 0; i < sigdb.nsignals; i++) {
+        const struct vtu_signal *s = &sigdb.signals[i];
+        const struct signal_stats *st = &stats[i];
+        if (st->count == 0) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "%s.%s", sigdb.messages[s->message].name, s->name);
+        fprintf(out, "%-40s %-6s %10llu %12.3f %12.3f %12.3f\n", name, s->unit,
+                (unsigned long long)st->count, st->min, st->sum / st->count, st->max);
+    }
+}
+
+static void summary_free(void) {
+    vtu_sigdb_free(&sigdb);
+    free(pending);
+    free(pending_count);
+    free(stats);
+    free(column_buf);
+    free(columns);
+}
+
+/*============================================================================
+ * Query
+ *===========================================================================*/
+
+/* Query one segment, returns number of matching frames, -1 on error */
+static long query_file(const char *path, FILE *out) {
+    struct vtulog_record recs[READ_BATCH];
+    char line[VTULOG_TEXT_LINE_MAX];
+    struct log_scan *scan;
+    long matched = 0;
+    size_t n;
+
+    switch (log_scan_open(&scan, path, &filter)) {
+        case LOG_SCAN_ERROR:
+            perror(path);
+            return -1;
+        case LOG_SCAN_SKIPPED:
+            return 0;
+    }
+    if (!log_scan_indexed(scan)) {
+        fprintf(stderr, "%s: no up-to-date index, scanning the whole segment\n", path);
+    }
+
+    while ((n = log_scan_next(scan, recs, READ_BATCH)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (summarize) {
+                summary_add(&recs[i]);
+                continue;
+            }
+            int len = vtulog_format_record(&recs[i],
+                                           log_scan_channel(scan, recs[i].channel), line);
+            fwrite(line, 1, len, out);
+        }
+        matched += n;
+    }
+    if (log_scan_error(scan)) {
+        fprintf(stderr, "%s: read error (%s)\n", path, log_scan_codec(scan));
+        matched = -1;
+    }
+    log_scan_close(scan);
+    return matched;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL;
+    const char *dbc_path = NULL;
+    FILE *out = stdout;
+    int opt;
+    int rc = 0;
+
+    log_filter_init(&filter);
+    while ((opt = getopt(argc, argv, "s:e:i:o:lSd:h")) != -1) {
+        switch (opt) {
+            case 's':
+            case 'e':
+                if (log_filter_parse_time(optarg, opt == 's' ? &filter.start_us
+                                                             : &filter.end_us) < 0) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'i':
+                if (log_filter_parse_ids(&filter, optarg) < 0) {
+                    fprintf(stderr, "Invalid ID list (hex IDs, at most %d)\n",
+                            LOG_FILTER_MAX_IDS);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'l':
+                list_only = 1;
+                break;
+            case 'S':
+                summarize = 1;
+                break;
+            case 'd':
+                dbc_path = optarg;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (summarize && !list_only && summary_init(dbc_path) < 0) {
+        return 1;
+    }
+
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror(out_path);
+            return 1;
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
+        /* Let "can-*" globs pick up the sidecars without complaint */
+        size_t len = strlen(argv[i]);
+        if (len > strlen(VTUIDX_EXTENSION) &&
+            strcmp(argv[i] + len - strlen(VTUIDX_EXTENSION), VTUIDX_EXTENSION) == 0) {
+            continue;
+        }
+
+        if (list_only) {
+            rc |= list_file(argv[i]) < 0;
+            continue;
+        }
+        long count = query_file(argv[i], out);
+        if (count < 0) {
+            rc = 1;
+            continue;
+        }
+        if (out_path) {
+            printf("[LOGQUERY] %s: %ld frames\n", argv[i], count);
+        }
+    }
+
+    if (summarize && !list_only) {
+        summary_print(out);
+        summary_free();
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return rc;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file logscan.c
+ * @brief Filtered reading of log segments (time window and CAN IDs)
+ */
+
+#define _XOPEN_SOURCE 700  /* strptime() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "logscan.h"
+#include "logstream.h"
+#include "vtuidx.h"
+
+struct log_scan {
+    struct log_reader *in;
+    const struct log_filter *f;
+    int      text;
+    int      indexed;
+    int      done;
+    uint64_t stop_us;           /* No frame after this one can match */
+};
+
+void log_filter_init(struct log_filter *f) {
+    memset(f, 0, sizeof(*f));
+    f->end_us = UINT64_MAX;
+}
+
+int log_filter_parse_time(const char *arg, uint64_t *us) {
+    struct tm tm;
+    const char *rest;
+    double frac = 0.0;
+
+    if (isdigit((unsigned char)arg[0]) && !strchr(arg, '-')) {
+        char *end;
+        double sec = strtod(arg, &end);
+        if (*end != '\0' || sec < 0) {
+            return -1;
+        }
+        *us = (uint64_t)(sec * 1000000.0 + 0.5);
+        return 0;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    rest = strptime(arg, "%Y-%m-%d %H:%M:%S", &tm);
+    if (!rest) {
+        return -1;
+    }
+    if (*rest == '.') {
+        char *end;
+        frac = strtod(rest, &end);
+        rest = end;
+    }
+    if (*rest != '\0') {
+        return -1;
+    }
+    tm.tm_isdst = -1;
+    time_t sec = mktime(&tm);
+    if (sec == (time_t)-1) {
+        return -1;
+    }
+    *us = (uint64_t)sec * 1000000 + (uint64_t)(frac * 1000000.0 + 0.5);
+    return 0;
+}
+
+int log_filter_parse_ids(struct log_filter *f, char *arg) {
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        char *end;
+        if (f->id_count == LOG_FILTER_MAX_IDS ||
+            vtuidx_parse_key(tok, &end, &f->id_keys[f->id_count]) < 0 || *end != '\0') {
+            return -1;
+        }
+        f->id_count++;
+    }
+    return 0;
+}
+
+int log_filter_match(const struct log_filter *f, const struct vtulog_record *rec) {
+    if (rec->timestamp_us < f->start_us || rec->timestamp_us > f->end_us) {
+        return 0;
+    }
+    if (f->id_count == 0) {
+        return 1;
+    }
+    uint32_t key = vtuidx_key(rec);
+    for (int i = 0; i < f->id_count; i++) {
+        if (f->id_keys[i] == key) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Use the index to decide where to read. Returns 0 to skip the segment,
+ * otherwise 1 with *offset and *stop_us set.
+ */
+static int plan_read(const struct log_filter *f, const struct vtuidx *idx,
+                     uint64_t *offset, uint64_t *stop_us) {
+    uint64_t last = 0;
+
+    if (idx->hdr.record_count == 0 ||
+        idx->hdr.last_us < f->start_us || idx->hdr.first_us > f->end_us) {
+        return 0;
+    }
+
+    if (f->id_count == 0) {
+        last = idx->hdr.last_us;
+    }
+    for (int i = 0; i < f->id_count; i++) {
+        const struct vtuidx_id *id = vtuidx_find(idx, f->id_keys[i]);
+        if (id && id->last_us >= f->start_us && id->first_us <= f->end_us &&
+            id->last_us > last) {
+            last = id->last_us;
+        }
+    }
+    if (last == 0) {
+        return 0;  /* None of the IDs occurs in the window */
+    }
+
+    *offset = vtuidx_seek(idx, f->start_us);
+    *stop_us = last < f->end_us ? last : f->end_us;
+    return 1;
+}
+
+int log_scan_open(struct log_scan **scan, const char *path, const struct log_filter *f) {
+    struct vtulog_file_header hdr;
+    struct vtuidx idx;
+    char idx_path[512];
+    uint64_t offset = 0;
+    struct log_scan *s = calloc(1, sizeof(*s));
+
+    if (!s) {
+        return LOG_SCAN_ERROR;
+    }
+    s->f = f;
+    s->stop_us = f->end_us;
+    s->in = log_reader_open(path);
+    if (!s->in) {
+        free(s);
+        return LOG_SCAN_ERROR;
+    }
+    s->text = log_reader_read(s->in, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+              vtulog_check_header(&hdr) < 0;
+
+    vtuidx_path(path, idx_path, sizeof(idx_path));
+    s->indexed = vtuidx_load(&idx, idx_path) == 0 &&
+                 (int64_t)idx.hdr.log_size == log_reader_size(s->in);
+    if (s->indexed && !plan_read(f, &idx, &offset, &s->stop_us)) {
+        vtuidx_free(&idx);
+        log_scan_close(s);
+        return LOG_SCAN_SKIPPED;
+    }
+    vtuidx_free(&idx);
+
+    if (s->text) {
+        /* Start over: the header probe consumed the first bytes */
+        log_reader_close(s->in);
+        s->in = log_reader_open(path);
+        if (!s->in) {
+            free(s);
+            return LOG_SCAN_ERROR;
+        }
+    } else {
+        /* The header and channel table have been read already */
+        if (log_reader_set_header(s->in, &hdr) < 0) {
+            log_scan_close(s);
+            return LOG_SCAN_ERROR;
+        }
+        uint64_t data = vtulog_data_offset(&hdr);
+        offset = offset > data ? offset - data : 0;
+    }
+    if (offset > 0 && log_reader_skip(s->in, offset) < 0) {
+        s->done = 1;
+    }
+
+    *scan = s;
+    return LOG_SCAN_OPEN;
+}
+
+void log_scan_close(struct log_scan *s) {
+    if (!s) {
+        return;
+    }
+    log_reader_close(s->in);
+    free(s);
+}
+
+static size_t next_text(struct log_scan *s, struct vtulog_record *recs, size_t max) {
+    char line[VTULOG_TEXT_LINE_MAX];
+    size_t n = 0;
+
+    while (n < max) {
+        if (!log_reader_gets(s->in, line, sizeof(line))) {
+            s->done = 1;
+            break;
+        }
+        if (vtulog_parse_record(line, &recs[n]) < 0) {
+            continue;
+        }
+        if (recs[n].timestamp_us > s->stop_us) {
+            s->done = 1;
+            break;
+        }
+        if (log_filter_match(s->f, &recs[n])) {
+            n++;
+        }
+    }
+    return n;
+}
+
+size_t log_scan_next(struct log_scan *s, struct vtulog_record *recs, size_t max) {
+    struct vtulog_footer ftr;
+    int sealed = 0;
+    size_t n = 0;
+
+    if (s->text) {
+        return s->done ? 0 : next_text(s, recs, max);
+    }
+
+    /* Filter in place, reading on until something matches */
+    while (n == 0 && !s->done) {
+        size_t got = log_reader_records(s->in, recs, max, &ftr, &sealed);
+        if (got == 0) {
+            s->done = 1;
+        }
+        for (size_t i = 0; i < got; i++) {
+            if (recs[i].timestamp_us > s->stop_us) {
+                s->done = 1;
+                break;
+            }
+            if (log_filter_match(s->f, &recs[i])) {
+                recs[n++] = recs[i];
+            }
+        }
+    }
+    return n;
+}
+
+int log_scan_indexed(const struct log_scan *s) {
+    return s->indexed;
+}
+
+int log_scan_error(const struct log_scan *s) {
+    return log_reader_error(s->in);
+}
+
+const char *log_scan_channel(const struct log_scan *s, uint8_t channel) {
+    return log_reader_channel(s->in, channel);
+}
+
+const char *log_scan_codec(const struct log_scan *s) {
+    return log_reader_codec(s->in);
+}
@@ -0,0 +1,94 @@
+/**
+ * @file logscan.h
+ * @brief Filtered reading of log segments (time window and CAN IDs)
+ *
+ * Shared by vtu-logquery and vtu-replay. A scan opens any segment the
+ * logger produces (binary, delta-encoded or text, plain or compressed),
+ * uses its .vtuidx sidecar when it is up to date to skip the segment or
+ * start close to the window, and returns only the frames that match.
+ */
+
+#ifndef VTU_LOGSCAN_H
+#define VTU_LOGSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vtulog.h"
+
+#define LOG_FILTER_MAX_IDS  64  /* IDs accepted by -i */
+
+/**
+ * @brief Which frames to return
+ */
+struct log_filter {
+    uint64_t start_us;          /* Window, inclusive */
+    uint64_t end_us;
+    uint32_t id_keys[LOG_FILTER_MAX_IDS];  /* vtuidx_key() form, none = all IDs */
+    int      id_count;
+};
+
+/**
+ * @brief Match everything
+ */
+void log_filter_init(struct log_filter *f);
+
+/**
+ * @brief Parse "YYYY-MM-DD HH:MM:SS[.uuuuuu]" (local time) or epoch seconds
+ * @return 0 on success, -1 if the argument is not a time
+ */
+int log_filter_parse_time(const char *arg, uint64_t *us);
+
+/**
+ * @brief Add a comma-separated list of hex IDs (see vtuidx_parse_key()); modifies arg
+ * @return 0 on success, -1 on a bad ID or more than LOG_FILTER_MAX_IDS
+ */
+int log_filter_parse_ids(struct log_filter *f, char *arg);
+
+/**
+ * @return 1 if the frame passes the filter
+ */
+int log_filter_match(const struct log_filter *f, const struct vtulog_record *rec);
+
+struct log_scan;
+
+/* log_scan_open() results */
+#define LOG_SCAN_OPEN       1   /* *scan is ready */
+#define LOG_SCAN_SKIPPED    0   /* The index shows no frame can match */
+#define LOG_SCAN_ERROR      -1  /* Not readable (errno set) */
+
+/**
+ * @brief Start a filtered read of one segment
+ * @param f Must stay valid until log_scan_close()
+ * @return LOG_SCAN_OPEN, LOG_SCAN_SKIPPED or LOG_SCAN_ERROR
+ */
+int log_scan_open(struct log_scan **scan, const char *path, const struct log_filter *f);
+void log_scan_close(struct log_scan *s);
+
+/**
+ * @brief Next matching frames, in file order
+ * @return Number stored in recs, 0 once the window or the segment has ended
+ */
+size_t log_scan_next(struct log_scan *s, struct vtulog_record *recs, size_t max);
+
+/**
+ * @return 1 if an up-to-date index was used
+ */
+int log_scan_indexed(const struct log_scan *s);
+
+/**
+ * @return Nonzero if a read or decode error occurred
+ */
+int log_scan_error(const struct log_scan *s);
+
+/**
+ * @brief Interface name of a channel, NULL for a single-channel segment
+ */
+const char *log_scan_channel(const struct log_scan *s, uint8_t channel);
+
+/**
+ * @brief Codec of the segment, for error messages
+ */
+const char *log_scan_codec(const struct log_scan *s);
+
+#endif /* VTU_LOGSCAN_H */
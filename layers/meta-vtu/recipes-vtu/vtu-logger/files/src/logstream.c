@@ -0,0 +1,608 @@
+/**
+ * @file logstream.c
+ * @brief Compressed log segments: background compression and transparent reading
+ */
+
+#define _GNU_SOURCE  /* fseeko() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "logstream.h"
+#include "vtudelta.h"
+
+#define STREAM_BUF_SIZE (64 * 1024)
+
+/* Frame magics as they appear at the start of the file */
+static const uint8_t zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+static const uint8_t lz4_magic[4]  = { 0x04, 0x22, 0x4D, 0x18 };
+
+enum codec {
+    CODEC_NONE,
+    CODEC_ZSTD,
+    CODEC_LZ4,
+};
+
+static const char *const codec_names[] = { "none", "zstd", "lz4" };
+
+struct log_reader {
+    FILE    *f;
+    enum codec codec;
+    int      eof;           /* Nothing left to decode after out[] */
+    int      error;
+    int64_t  size;          /* Uncompressed size, -1 if unknown */
+    uint64_t pos;           /* Offset of out[out_pos] in the uncompressed stream */
+    uint64_t record_offset; /* See log_reader_record_offset() */
+    int      records_done;  /* Footer (or end marker) reached */
+
+    struct vtudelta_dec *delta;     /* Set for delta-encoded segments */
+    uint64_t key_offset;            /* Keyframe just consumed, UINT64_MAX if none */
+
+    uint8_t  channel_count;         /* From the header's channel table */
+    struct vtulog_channel channels[VTULOG_MAX_CHANNELS];
+
+    uint8_t *in;            /* Compressed input not yet decoded */
+    size_t   in_pos;
+    size_t   in_len;
+
+    uint8_t *out;           /* Uncompressed data not yet consumed */
+    size_t   out_pos;
+    size_t   out_len;
+
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zstd;
+    size_t   zstd_ret;      /* Last ZSTD_decompressStream() result, 0 = frame complete */
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_dctx *lz4;
+    size_t   lz4_ret;       /* Last LZ4F_decompress() hint, 0 = frame complete */
+#endif
+};
+
+/*============================================================================
+ * Compression
+ *===========================================================================*/
+
+#if defined(HAVE_ZSTD)
+
+static int compress_stream(FILE *in, FILE *out, uint64_t size, int level) {
+    size_t out_cap = ZSTD_CStreamOutSize();
+    uint8_t *ibuf = malloc(STREAM_BUF_SIZE);
+    uint8_t *obuf = malloc(out_cap);
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    int rc = -1;
+
+    if (!ibuf || !obuf || !cctx) {
+        goto out;
+    }
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setPledgedSrcSize(cctx, size);  /* Stored in the frame header */
+
+    for (;;) {
+        size_t n = fread(ibuf, 1, STREAM_BUF_SIZE, in);
+        int last = n < STREAM_BUF_SIZE;
+        ZSTD_inBuffer input = { ibuf, n, 0 };
+        size_t remaining;
+
+        if (ferror(in)) {
+            goto out;
+        }
+        do {
+            ZSTD_outBuffer output = { obuf, out_cap, 0 };
+            remaining = ZSTD_compressStream2(cctx, &output, &input,
+                                             last ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                fprintf(stderr, "[LOGGER] zstd: %s\n", ZSTD_getErrorName(remaining));
+                goto out;
+            }
+            if (fwrite(obuf, 1, output.pos, out) != output.pos) {
+                goto out;
+            }
+        } while (last ? remaining != 0 : input.pos < input.size);
+
+        if (last) {
+            break;
+        }
+    }
+    rc = 0;
+
+out:
+    ZSTD_freeCCtx(cctx);
+    free(ibuf);
+    free(obuf);
+    return rc;
+}
+
+#elif defined(HAVE_LZ4)
+
+static int compress_stream(FILE *in, FILE *out, uint64_t size, int level) {
+    LZ4F_preferences_t prefs;
+    LZ4F_cctx *cctx = NULL;
+    uint8_t *ibuf = malloc(STREAM_BUF_SIZE);
+    uint8_t *obuf = NULL;
+    size_t out_cap, n;
+    int rc = -1;
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = level;
+    prefs.frameInfo.contentSize = size;  /* Stored in the frame header */
+
+    out_cap = LZ4F_compressBound(STREAM_BUF_SIZE, &prefs) + LZ4F_HEADER_SIZE_MAX;
+    obuf = malloc(out_cap);
+    if (!ibuf || !obuf || LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+        goto out;
+    }
+
+    n = LZ4F_compressBegin(cctx, obuf, out_cap, &prefs);
+    if (LZ4F_isError(n) || fwrite(obuf, 1, n, out) != n) {
+        goto out;
+    }
+    while ((n = fread(ibuf, 1, STREAM_BUF_SIZE, in)) > 0) {
+        size_t len = LZ4F_compressUpdate(cctx, obuf, out_cap, ibuf, n, NULL);
+        if (LZ4F_isError(len) || fwrite(obuf, 1, len, out) != len) {
+            goto out;
+        }
+    }
+    if (ferror(in)) {
+        goto out;
+    }
+    n = LZ4F_compressEnd(cctx, obuf, out_cap, NULL);
+    if (LZ4F_isError(n) || fwrite(obuf, 1, n, out) != n) {
+        goto out;
+    }
+    rc = 0;
+
+out:
+    LZ4F_freeCompressionContext(cctx);
+    free(ibuf);
+    free(obuf);
+    return rc;
+}
+
+#endif
+
+int log_compress_file(const char *path, int level) {
+#if !defined(HAVE_ZSTD) && !defined(HAVE_LZ4)
+    (void)path;
+    (void)level;
+    errno = ENOTSUP;
+    return -1;
+#else
+    char dst_path[512], tmp_path[520];
+    struct stat st;
+    int ok, err;
+
+    snprintf(dst_path, sizeof(dst_path), "%s%s", path, LOG_COMPRESS_EXT);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dst_path);
+
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return -1;
+    }
+    if (fstat(fileno(in), &st) < 0) {
+        fclose(in);
+        return -1;
+    }
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    ok = compress_stream(in, out, st.st_size, level) == 0 &&
+         fflush(out) == 0 && fsync(fileno(out)) == 0;
+    err = errno;
+    ok = fclose(out) == 0 && ok;
+    fclose(in);
+
+    if (!ok || rename(tmp_path, dst_path) < 0) {
+        err = ok ? errno : err;
+        unlink(tmp_path);
+        errno = err ? err : EIO;
+        return -1;
+    }
+    unlink(path);
+    return 0;
+#endif
+}
+
+/*============================================================================
+ * Reading
+ *===========================================================================*/
+
+/* Decode more data into out[] after out_len, returns bytes added (0 = end) */
+static size_t decode(struct log_reader *r) {
+    uint8_t *dst = r->out + r->out_len;
+    size_t room = STREAM_BUF_SIZE - r->out_len;
+
+    if (r->codec == CODEC_NONE) {
+        size_t n = fread(dst, 1, room, r->f);
+        if (n == 0) {
+            r->eof = 1;
+            r->error |= ferror(r->f);
+        }
+        return n;
+    }
+
+    for (;;) {
+        if (r->in_pos == r->in_len) {
+            r->in_len = fread(r->in, 1, STREAM_BUF_SIZE, r->f);
+            r->in_pos = 0;
+            if (r->in_len == 0) {
+                r->eof = 1;
+                r->error |= ferror(r->f);
+#ifdef HAVE_ZSTD
+                r->error |= r->codec == CODEC_ZSTD && r->zstd_ret != 0;  /* Truncated */
+#endif
+#ifdef HAVE_LZ4
+                r->error |= r->codec == CODEC_LZ4 && r->lz4_ret != 0;
+#endif
+                return 0;
+            }
+        }
+
+#ifdef HAVE_ZSTD
+        if (r->codec == CODEC_ZSTD) {
+            ZSTD_inBuffer input = { r->in, r->in_len, r->in_pos };
+            ZSTD_outBuffer output = { dst, room, 0 };
+            r->zstd_ret = ZSTD_decompressStream(r->zstd, &output, &input);
+            r->in_pos = input.pos;
+            if (ZSTD_isError(r->zstd_ret)) {
+                r->error = 1;
+                r->eof = 1;
+                return 0;
+            }
+            if (output.pos > 0) {
+                return output.pos;
+            }
+        }
+#endif
+#ifdef HAVE_LZ4
+        if (r->codec == CODEC_LZ4) {
+            size_t dst_len = room;
+            size_t src_len = r->in_len - r->in_pos;
+            r->lz4_ret = LZ4F_decompress(r->lz4, dst, &dst_len,
+                                         r->in + r->in_pos, &src_len, NULL);
+            r->in_pos += src_len;
+            if (LZ4F_isError(r->lz4_ret)) {
+                r->error = 1;
+                r->eof = 1;
+                return 0;
+            }
+            if (dst_len > 0) {
+                return dst_len;
+            }
+        }
+#endif
+    }
+}
+
+/* Make at least need bytes available in out[] unless the stream ends first */
+static size_t ensure(struct log_reader *r, size_t need) {
+    while (r->out_len - r->out_pos < need && !r->eof) {
+        if (r->out_pos > 0) {
+            memmove(r->out, r->out + r->out_pos, r->out_len - r->out_pos);
+            r->out_len -= r->out_pos;
+            r->out_pos = 0;
+        }
+        r->out_len += decode(r);
+    }
+    return r->out_len - r->out_pos;
+}
+
+struct log_reader *log_reader_open(const char *path) {
+    struct log_reader *r = calloc(1, sizeof(*r));
+    struct stat st;
+
+    if (!r) {
+        return NULL;
+    }
+    r->size = -1;
+    r->in = malloc(STREAM_BUF_SIZE);
+    r->out = malloc(STREAM_BUF_SIZE);
+    r->f = fopen(path, "rb");
+    if (!r->in || !r->out || !r->f) {
+        log_reader_close(r);
+        return NULL;
+    }
+
+    r->in_len = fread(r->in, 1, STREAM_BUF_SIZE, r->f);
+    if (r->in_len >= 4 && memcmp(r->in, zstd_magic, 4) == 0) {
+        r->codec = CODEC_ZSTD;
+    } else if (r->in_len >= 4 && memcmp(r->in, lz4_magic, 4) == 0) {
+        r->codec = CODEC_LZ4;
+    }
+
+    switch (r->codec) {
+        case CODEC_NONE:
+            /* What was read is already the data */
+            memcpy(r->out, r->in, r->in_len);
+            r->out_len = r->in_len;
+            r->in_len = 0;
+            if (fstat(fileno(r->f), &st) == 0) {
+                r->size = st.st_size;
+            }
+            return r;
+
+        case CODEC_ZSTD:
+#ifdef HAVE_ZSTD
+            r->zstd = ZSTD_createDCtx();
+            if (r->zstd) {
+                unsigned long long size = ZSTD_getFrameContentSize(r->in, r->in_len);
+                if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR) {
+                    r->size = (int64_t)size;
+                }
+                return r;
+            }
+#endif
+            break;
+
+        case CODEC_LZ4:
+#ifdef HAVE_LZ4
+            if (!LZ4F_isError(LZ4F_createDecompressionContext(&r->lz4, LZ4F_VERSION))) {
+                LZ4F_frameInfo_t info;
+                size_t consumed = r->in_len;
+                r->lz4_ret = LZ4F_getFrameInfo(r->lz4, &info, r->in, &consumed);
+                if (!LZ4F_isError(r->lz4_ret)) {
+                    r->in_pos = consumed;
+                    if (info.contentSize) {
+                        r->size = (int64_t)info.contentSize;
+                    }
+                    return r;
+                }
+            }
+#endif
+            break;
+    }
+
+    log_reader_close(r);
+    errno = ENOTSUP;
+    return NULL;
+}
+
+void log_reader_close(struct log_reader *r) {
+    if (!r) {
+        return;
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(r->zstd);
+#endif
+#ifdef HAVE_LZ4
+    if (r->lz4) {
+        LZ4F_freeDecompressionContext(r->lz4);
+    }
+#endif
+    if (r->f) {
+        fclose(r->f);
+    }
+    free(r->delta);
+    free(r->in);
+    free(r->out);
+    free(r);
+}
+
+size_t log_reader_read(struct log_reader *r, void *buf, size_t len) {
+    uint8_t *p = buf;
+    size_t done = 0;
+
+    while (done < len) {
+        size_t avail = ensure(r, 1);
+        if (avail == 0) {
+            break;
+        }
+        size_t n = len - done < avail ? len - done : avail;
+        memcpy(p + done, r->out + r->out_pos, n);
+        r->out_pos += n;
+        r->pos += n;
+        done += n;
+    }
+    return done;
+}
+
+int log_reader_skip(struct log_reader *r, uint64_t len) {
+    while (len > 0) {
+        size_t avail = r->out_len - r->out_pos;
+
+        if (avail == 0 && r->codec == CODEC_NONE) {
+            /* Plain file: seek instead of reading through */
+            if (r->size >= 0 && len > (uint64_t)(r->size - ftello(r->f))) {
+                return -1;
+            }
+            if (fseeko(r->f, (off_t)len, SEEK_CUR) < 0) {
+                return -1;
+            }
+            r->pos += len;
+            return 0;
+        }
+        if (avail == 0) {
+            avail = ensure(r, 1);
+            if (avail == 0) {
+                return -1;
+            }
+        }
+        size_t n = len < avail ? (size_t)len : avail;
+        r->out_pos += n;
+        r->pos += n;
+        len -= n;
+    }
+    return 0;
+}
+
+char *log_reader_gets(struct log_reader *r, char *buf, int size) {
+    size_t max = size - 1;
+    size_t avail = ensure(r, 1);
+    const uint8_t *nl;
+
+    if (avail == 0 || size < 2) {
+        return NULL;
+    }
+
+    /* Pull in more data until a whole line (or max bytes) is buffered */
+    while (!(nl = memchr(r->out + r->out_pos, '\n', avail)) && avail < max && !r->eof) {
+        avail = ensure(r, avail + 1);
+    }
+
+    size_t n = nl ? (size_t)(nl - (r->out + r->out_pos)) + 1 : avail;
+    if (n > max) {
+        n = max;
+    }
+    memcpy(buf, r->out + r->out_pos, n);
+    buf[n] = '\0';
+    r->out_pos += n;
+    r->pos += n;
+    return buf;
+}
+
+int log_reader_set_header(struct log_reader *r, const struct vtulog_file_header *hdr) {
+    size_t table = hdr->channel_count * sizeof(struct vtulog_channel);
+
+    r->channel_count = hdr->channel_count;
+    if (table > 0 && log_reader_read(r, r->channels, table) != table) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < r->channel_count; i++) {
+        r->channels[i].ifname[sizeof(r->channels[i].ifname) - 1] = '\0';
+    }
+
+    if (!(hdr->flags & VTULOG_HDR_DELTA)) {
+        return 0;
+    }
+    if (!r->delta) {
+        r->delta = malloc(sizeof(*r->delta));
+        if (!r->delta) {
+            return -1;
+        }
+    }
+    vtudelta_dec_reset(r->delta);
+    r->key_offset = UINT64_MAX;
+    return 0;
+}
+
+const char *log_reader_channel(const struct log_reader *r, uint8_t channel) {
+    if (r->channel_count < 2 || channel >= r->channel_count) {
+        return NULL;
+    }
+    return r->channels[channel].ifname;
+}
+
+static void consume(struct log_reader *r, size_t n) {
+    r->out_pos += n;
+    r->pos += n;
+}
+
+/* Footer after the end marker of a delta-encoded segment */
+static void read_delta_footer(struct log_reader *r, struct vtulog_footer *ftr, int *sealed) {
+    const size_t ftr_size = sizeof(struct vtulog_footer);
+
+    if (ensure(r, ftr_size) >= ftr_size &&
+        memcmp(r->out + r->out_pos, VTULOG_FOOTER_MAGIC, VTULOG_MAGIC_LEN) == 0) {
+        memcpy(ftr, r->out + r->out_pos, ftr_size);
+        consume(r, ftr_size);
+        *sealed = 1;
+    }
+}
+
+static size_t delta_records(struct log_reader *r, struct vtulog_record *recs,
+                            size_t max, struct vtulog_footer *ftr, int *sealed) {
+    size_t n = 0;
+    size_t used;
+
+    while (n < max) {
+        size_t avail = ensure(r, VTUDELTA_MAX_FRAME);
+        int rc = vtudelta_decode(r->delta, r->out + r->out_pos, avail, &recs[n], &used);
+
+        if (rc == VTUDELTA_KEYFRAME) {
+            r->key_offset = r->pos;
+            consume(r, used);
+            continue;
+        }
+        if (rc == VTUDELTA_END) {
+            consume(r, used);
+            read_delta_footer(r, ftr, sealed);
+            r->records_done = 1;
+            break;
+        }
+        if (rc != VTUDELTA_FRAME) {
+            break;  /* End of stream, torn or zeroed tail */
+        }
+        /* A frame right after a keyframe is found by seeking to the keyframe */
+        r->record_offset = r->key_offset != UINT64_MAX ? r->key_offset : r->pos;
+        r->key_offset = UINT64_MAX;
+        consume(r, used);
+        n++;
+    }
+    return n;
+}
+
+size_t log_reader_records(struct log_reader *r, struct vtulog_record *recs,
+                          size_t max, struct vtulog_footer *ftr, int *sealed) {
+    const size_t rec_max = sizeof(struct vtulog_record);
+    const size_t ftr_size = sizeof(struct vtulog_footer);
+    size_t n = 0;
+
+    if (r->records_done) {
+        return 0;
+    }
+    if (r->delta) {
+        return delta_records(r, recs, max, ftr, sealed);
+    }
+
+    while (n < max) {
+        /* A record is only certain once a footer's worth of data follows it */
+        size_t avail = ensure(r, rec_max + ftr_size);
+
+        if (avail < rec_max + ftr_size && avail == ftr_size &&
+            memcmp(r->out + r->out_pos, VTULOG_FOOTER_MAGIC, VTULOG_MAGIC_LEN) == 0) {
+            memcpy(ftr, r->out + r->out_pos, ftr_size);
+            consume(r, ftr_size);
+            *sealed = 1;
+            r->records_done = 1;
+            break;
+        }
+        if (avail < VTULOG_CLASSIC_RECORD_SIZE) {
+            break;  /* End of stream (or torn tail) */
+        }
+
+        /* CAN-FD records are longer; the DLC in the fixed head tells */
+        struct vtulog_record *rec = &recs[n];
+        memcpy(rec, r->out + r->out_pos, VTULOG_RECORD_HEAD_SIZE);
+        size_t size = vtulog_record_size(rec);
+        if (rec->dlc > VTULOG_MAX_DLEN || avail < size) {
+            break;
+        }
+        memcpy(rec, r->out + r->out_pos, size);
+        memset((uint8_t *)rec + size, 0, rec_max - size);
+        r->record_offset = r->pos;
+        consume(r, size);
+        n++;
+    }
+    return n;
+}
+
+uint64_t log_reader_record_offset(const struct log_reader *r) {
+    return r->record_offset;
+}
+
+int64_t log_reader_size(const struct log_reader *r) {
+    return r->size;
+}
+
+const char *log_reader_codec(const struct log_reader *r) {
+    return codec_names[r->codec];
+}
+
+int log_reader_error(const struct log_reader *r) {
+    return r->error;
+}
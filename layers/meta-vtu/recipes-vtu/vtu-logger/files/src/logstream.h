@@ -0,0 +1,140 @@
+/**
+ * @file logstream.h
+ * @brief Compressed log segments: background compression and transparent reading
+ *
+ * vtu-logger can compress closed segments (can-N.vtulog -> can-N.vtulog.zst)
+ * with the codec chosen at build time: zstd (HAVE_ZSTD) or LZ4 frames
+ * (HAVE_LZ4). The readers open plain and compressed segments alike; the
+ * codec is recognised from the frame magic, not the file name.
+ *
+ * Compressed files record the uncompressed size in the frame header, so
+ * the .vtuidx sidecar (which describes the uncompressed segment) stays
+ * valid and its offsets still apply.
+ */
+
+#ifndef VTU_LOGSTREAM_H
+#define VTU_LOGSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vtulog.h"
+
+#if defined(HAVE_ZSTD)
+#define LOG_COMPRESS_NAME           "zstd"
+#define LOG_COMPRESS_EXT            ".zst"
+#define LOG_COMPRESS_DEFAULT_LEVEL  3
+#elif defined(HAVE_LZ4)
+#define LOG_COMPRESS_NAME           "lz4"
+#define LOG_COMPRESS_EXT            ".lz4"
+#define LOG_COMPRESS_DEFAULT_LEVEL  0   /* Fast mode; 3 and up select LZ4-HC */
+#else
+#define LOG_COMPRESS_NAME           ""      /* Built without compression */
+#define LOG_COMPRESS_EXT            ""
+#define LOG_COMPRESS_DEFAULT_LEVEL  0
+#endif
+
+/*============================================================================
+ * Compression (vtu-logger)
+ *===========================================================================*/
+
+/**
+ * @brief Compress a closed segment in place
+ *
+ * Writes path + LOG_COMPRESS_EXT through a temporary file, syncs it,
+ * renames it into place and only then removes the original, so a crash
+ * leaves either the plain or the compressed segment.
+ *
+ * @return 0 on success, -1 on error (errno set; ENOTSUP if built without
+ *         a codec)
+ */
+int log_compress_file(const char *path, int level);
+
+/*============================================================================
+ * Reading (vtu-logdump, vtu-logquery)
+ *===========================================================================*/
+
+struct log_reader;
+
+/**
+ * @brief Open a plain or compressed segment
+ * @return Reader, or NULL on error (errno set; ENOTSUP if the file uses a
+ *         codec this build can't decode)
+ */
+struct log_reader *log_reader_open(const char *path);
+void log_reader_close(struct log_reader *r);
+
+/**
+ * @brief Read up to len bytes of the uncompressed stream
+ * @return Bytes read; less than len only at the end of the stream or on error
+ */
+size_t log_reader_read(struct log_reader *r, void *buf, size_t len);
+
+/**
+ * @brief Skip len bytes forward (decompressing and discarding if needed)
+ * @return 0 on success, -1 if the stream ended first or on error
+ */
+int log_reader_skip(struct log_reader *r, uint64_t len);
+
+/**
+ * @brief fgets() on the uncompressed stream
+ */
+char *log_reader_gets(struct log_reader *r, char *buf, int size);
+
+/**
+ * @brief Select the record encoding for log_reader_records()
+ *
+ * Call with the header read through log_reader_read(), before the first
+ * log_reader_records() call. Also reads the channel table that follows
+ * the header, so the stream is left at the first record.
+ *
+ * @return 0 on success, -1 on allocation failure or a truncated table
+ */
+int log_reader_set_header(struct log_reader *r, const struct vtulog_file_header *hdr);
+
+/**
+ * @brief Interface name of a record's channel in a multi-channel segment
+ * @return NULL if the segment has a single channel (or ch is out of range)
+ */
+const char *log_reader_channel(const struct log_reader *r, uint8_t channel);
+
+/**
+ * @brief Read the next records of a .vtulog stream positioned after the header
+ *
+ * Stops at the segment footer: the call that reaches it sets *sealed to 1
+ * and fills *ftr, later calls return 0. A stream that ends without a
+ * footer (unsealed segment) returns its whole records and then 0, leaving
+ * *sealed alone; the caller initialises it to 0.
+ *
+ * Delta-encoded segments are decoded on the fly; reading may only start
+ * at the header or at a keyframe (a .vtuidx offset).
+ *
+ * @return Number of records stored in recs
+ */
+size_t log_reader_records(struct log_reader *r, struct vtulog_record *recs,
+                          size_t max, struct vtulog_footer *ftr, int *sealed);
+
+/**
+ * @brief Segment offset to seek to for the last record returned
+ *
+ * The record's own offset, or for a delta-encoded segment the keyframe
+ * directly preceding it if there is one (used to build .vtuidx entries).
+ */
+uint64_t log_reader_record_offset(const struct log_reader *r);
+
+/**
+ * @brief Uncompressed size of the segment, -1 if unknown
+ */
+int64_t log_reader_size(const struct log_reader *r);
+
+/**
+ * @brief Codec of the open file: "none", "zstd" or "lz4"
+ */
+const char *log_reader_codec(const struct log_reader *r);
+
+/**
+ * @return Nonzero if a read or decode error occurred
+ */
+int log_reader_error(const struct log_reader *r);
+
+#endif /* VTU_LOGSTREAM_H */
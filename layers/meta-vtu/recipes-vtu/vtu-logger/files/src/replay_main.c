@@ -0,0 +1,497 @@
+/*
+ * VTU CAN Log Replay
+ *
+ * Retransmits frames recorded by vtu-logger onto a CAN interface, to
+ * reproduce field issues on vcan0 or to load the other daemons with real
+ * traffic. Every segment format is accepted: binary, delta-encoded or
+ * text, plain or compressed, with the same -s/-e/-i selection as
+ * vtu-logquery (including the .vtuidx shortcuts).
+ *
+ * By default frames keep their original spacing, anchored to the first
+ * replayed frame; -x scales that timeline (2 = twice as fast). Frames that
+ * fall due together go out in one sendmmsg() call, and the time that call
+ * returns is compared with each frame's schedule to report the replay
+ * jitter. -F ignores the timestamps and sends in sendmmsg() batches as
+ * fast as the interface accepts them.
+ *
+ * Error frames are logged but cannot be transmitted; they are skipped.
+ *
+ * Multi-channel logs go out on one interface by default. With -I given a
+ * list, channel N is sent on the Nth interface of the list, so the buses
+ * of a multi-interface capture are reproduced side by side.
+ *
+ * CAN-FD frames are sent as such, with their BRS/ESI bits; if the kernel
+ * or interface cannot do CAN-FD they are skipped and counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#include <vtu/can_io.h>
+
+#include "vtulog.h"
+#include "vtuidx.h"
+#include "logscan.h"
+
+#define DEFAULT_IFACE       "vcan0"
+#define READ_BATCH          256     /* Records read per call */
+#define DEFAULT_TX_BATCH    32      /* Frames per sendmmsg() */
+#define MAX_TX_BATCH        VTU_CAN_MAX_BATCH
+#define MIN_SCALE           0.1
+#define MAX_SCALE           100.0
+#define ENOBUFS_BACKOFF_US  200     /* TX queue full: wait for the controller */
+#define JITTER_BUCKETS      10000   /* 1 µs buckets, the last one collects the rest */
+
+static volatile int running = 1;
+static struct vtu_can can;
+static char can_ifnames[256] = DEFAULT_IFACE;  /* -I list, comma-separated */
+static char *tx_names[VTULOG_MAX_CHANNELS];
+static int tx_ifindex[VTULOG_MAX_CHANNELS];     /* Channel -> interface */
+static int tx_ifcount = 0;
+
+/* Selection and timing */
+static struct log_filter filter;
+static double scale = 1.0;
+static int fast_mode = 0;
+static int tx_batch = DEFAULT_TX_BATCH;
+static unsigned long loops = 1;         /* 0 = until interrupted */
+
+/* Log time -> CLOCK_MONOTONIC, anchored at the first frame of each pass */
+static int have_base = 0;
+static uint64_t base_log_us;
+static uint64_t base_mono_us;
+
+/* Frames waiting for the next sendmmsg() */
+static struct vtu_can_tx tx[MAX_TX_BATCH];
+static uint64_t tx_due[MAX_TX_BATCH];
+static int tx_pending = 0;
+
+/* Statistics */
+static unsigned long frames_sent = 0;
+static unsigned long error_frames = 0;
+static unsigned long unmapped_frames = 0;   /* Channel without an interface */
+static unsigned long fd_skipped = 0;    /* CAN-FD frames without CAN-FD support */
+static int fd_enabled = 0;
+static unsigned long tx_full = 0;       /* ENOBUFS retries */
+static uint32_t jitter_hist[JITTER_BUCKETS];
+static uint64_t jitter_sum = 0;
+static uint64_t jitter_max = 0;
+static unsigned long jitter_count = 0;
+
+static void signal_handler(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t due_us) {
+    struct timespec ts = {
+        .tv_sec = due_us / 1000000,
+        .tv_nsec = (due_us % 1000000) * 1000,
+    };
+    while (running && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] FILE...\n", prog);
+    printf("Options:\n");
+    printf("  -I IFACES   CAN interface to send on (default: %s), or a comma-separated\n",
+           DEFAULT_IFACE);
+    printf("              list to send logged channel N on the Nth interface\n");
+    printf("  -x SCALE    Speed factor, %.1f-%.0f (default: 1 = original timing)\n",
+           MIN_SCALE, MAX_SCALE);
+    printf("  -F          Ignore timestamps, send as fast as possible\n");
+    printf("  -b N        Frames per sendmmsg() call, 1-%d (default: %d)\n",
+           MAX_TX_BATCH, DEFAULT_TX_BATCH);
+    printf("  -L N        Replay the selection N times (default: 1, 0 = until ^C)\n");
+    printf("  -s TIME     Start of the window (inclusive)\n");
+    printf("  -e TIME     End of the window (inclusive)\n");
+    printf("  -i IDS      Comma-separated hex CAN IDs; 29-bit if above 7FF, written\n");
+    printf("              with 8 digits or with a trailing x (7E8x)\n");
+    printf("  -h          Show this help\n");
+    printf("\n");
+    printf("FILEs are replayed in the order given (use ls -v for can-N segments).\n");
+    printf("TIME is \"YYYY-MM-DD HH:MM:SS[.uuuuuu]\" (local time) or seconds\n");
+    printf("since the epoch, e.g. 1700000000.25\n");
+}
+
+static int setup_can_socket(char *ifnames) {
+    /* Send only: don't queue our own traffic (or anyone else's) for reading */
+    static const struct can_filter no_rx[1];
+    struct vtu_can_opts opts = {
+        .filters = no_rx,
+        .nfilters = 0,
+        .fd_frames = VTU_CAN_FD_TRY,
+    };
+    char *first = NULL;
+    int fd_capable = 1;     /* Every interface has the CAN-FD MTU */
+
+    for (char *name = strtok(ifnames, ","); name; name = strtok(NULL, ",")) {
+        if (tx_ifcount == VTULOG_MAX_CHANNELS) {
+            fprintf(stderr, "At most %d interfaces\n", VTULOG_MAX_CHANNELS);
+            return -1;
+        }
+        tx_names[tx_ifcount] = name;
+        tx_ifindex[tx_ifcount] = (int)if_nametoindex(name);
+        if (tx_ifindex[tx_ifcount] == 0) {
+            fprintf(stderr, "Failed to get interface index of %s: %s\n",
+                    name, strerror(errno));
+            return -1;
+        }
+        if (!first) {
+            first = name;
+        }
+        tx_ifcount++;
+    }
+    if (tx_ifcount == 0) {
+        fprintf(stderr, "No interface given\n");
+        return -1;
+    }
+
+    /* Several interfaces: bind to all, each frame names its own */
+    if (vtu_can_open(&can, tx_ifcount == 1 ? first : NULL, &opts) < 0) {
+        perror("Failed to open CAN socket");
+        return -1;
+    }
+
+    for (int i = 0; i < tx_ifcount; i++) {
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, tx_names[i], IFNAMSIZ - 1);
+        if (ioctl(can.sock, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu != CANFD_MTU) {
+            fd_capable = 0;
+        }
+    }
+
+    /* A CAN-FD frame on a classic interface would fail the whole batch */
+    if (!fd_capable) {
+        printf("[REPLAY] Not all interfaces are CAN-FD capable, CAN-FD frames will be skipped\n");
+    } else if (!can.fd_frames) {
+        printf("[REPLAY] CAN-FD not supported, CAN-FD frames will be skipped\n");
+    } else {
+        fd_enabled = 1;
+    }
+    return 0;
+}
+
+static void record_jitter(uint64_t late_us) {
+    jitter_hist[late_us < JITTER_BUCKETS ? late_us : JITTER_BUCKETS - 1]++;
+    jitter_sum += late_us;
+    if (late_us > jitter_max) {
+        jitter_max = late_us;
+    }
+    jitter_count++;
+}
+
+/* Send everything pending */
+static void flush_tx(void) {
+    int done = 0;
+
+    while (done < tx_pending && running) {
+        int n = vtu_can_send_many(&can, tx + done, tx_pending - done);
+        if (n < 0) {
+            if (errno == ENOBUFS || errno == EAGAIN) {
+                /* CAN sockets report a full TX queue instead of blocking */
+                tx_full++;
+                usleep(ENOBUFS_BACKOFF_US);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("sendmmsg");
+            running = 0;
+            break;
+        }
+        /* Lateness includes the send itself: sample once the call returns */
+        if (!fast_mode) {
+            uint64_t now = now_us();
+            for (int i = done; i < done + n; i++) {
+                record_jitter(now > tx_due[i] ? now - tx_due[i] : 0);
+            }
+        }
+        done += n;
+    }
+    frames_sent += done;
+    tx_pending = 0;
+}
+
+/* Queue one frame, waiting for its time slot unless in fast mode */
+static void replay_record(const struct vtulog_record *rec) {
+    struct canfd_frame *frame;
+    uint64_t due = 0;
+
+    if (rec->flags & VTULOG_FLAG_ERR) {
+        error_frames++;
+        return;
+    }
+    if ((rec->flags & VTULOG_FLAG_FD) && !fd_enabled) {
+        fd_skipped++;
+        return;
+    }
+    if (tx_ifcount > 1 && rec->channel >= tx_ifcount) {
+        unmapped_frames++;
+        return;
+    }
+
+    if (!fast_mode) {
+        if (!have_base) {
+            base_log_us = rec->timestamp_us;
+            base_mono_us = now_us();
+            have_base = 1;
+        }
+        /* Timestamps may step back slightly; such frames are simply due now */
+        if (rec->timestamp_us > base_log_us) {
+            due = base_mono_us + (uint64_t)((rec->timestamp_us - base_log_us) / scale);
+        } else {
+            due = base_mono_us;
+        }
+        /* Send what is already due before sleeping for this frame */
+        if (tx_pending > 0 && due > now_us()) {
+            flush_tx();
+        }
+        sleep_until(due);
+    }
+
+    memset(&tx[tx_pending], 0, sizeof(tx[tx_pending]));
+    frame = &tx[tx_pending].frame;
+    frame->can_id = rec->can_id;
+    if (rec->flags & VTULOG_FLAG_EXT) {
+        frame->can_id |= CAN_EFF_FLAG;
+    }
+    if (rec->flags & VTULOG_FLAG_RTR) {
+        frame->can_id |= CAN_RTR_FLAG;
+    }
+    if (rec->flags & VTULOG_FLAG_FD) {
+        if (rec->flags & VTULOG_FLAG_BRS) {
+            frame->flags |= CANFD_BRS;
+        }
+        if (rec->flags & VTULOG_FLAG_ESI) {
+            frame->flags |= CANFD_ESI;
+        }
+        frame->len = rec->dlc > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : rec->dlc;
+        tx[tx_pending].fd = 1;
+    } else {
+        frame->len = rec->dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : rec->dlc;
+    }
+    memcpy(frame->data, rec->data, frame->len);
+    if (tx_ifcount > 1) {
+        tx[tx_pending].ifindex = tx_ifindex[rec->channel];
+    }
+    tx_due[tx_pending] = due;
+
+    if (++tx_pending == tx_batch) {
+        flush_tx();
+    }
+}
+
+/* Replay the selected frames of one segment, -1 on error */
+static int replay_file(const char *path) {
+    struct vtulog_record recs[READ_BATCH];
+    struct log_scan *scan;
+    size_t n;
+    int rc = 0;
+
+    switch (log_scan_open(&scan, path, &filter)) {
+        case LOG_SCAN_ERROR:
+            perror(path);
+            return -1;
+        case LOG_SCAN_SKIPPED:
+            return 0;
+    }
+
+    while (running && (n = log_scan_next(scan, recs, READ_BATCH)) > 0) {
+        for (size_t i = 0; i < n && running; i++) {
+            replay_record(&recs[i]);
+        }
+    }
+    if (log_scan_error(scan)) {
+        fprintf(stderr, "%s: read error (%s)\n", path, log_scan_codec(scan));
+        rc = -1;
+    }
+    log_scan_close(scan);
+    return rc;
+}
+
+/* Smallest lateness that at least pct percent of the frames met */
+static unsigned long jitter_percentile(double pct) {
+    unsigned long want = (unsigned long)(jitter_count * pct / 100.0 + 0.5);
+    unsigned long seen = 0;
+
+    for (int i = 0; i < JITTER_BUCKETS; i++) {
+        seen += jitter_hist[i];
+        if (seen >= want && seen > 0) {
+            return i;
+        }
+    }
+    return JITTER_BUCKETS - 1;
+}
+
+static void print_stats(uint64_t elapsed_us) {
+    double sec = elapsed_us / 1e6;
+
+    printf("[REPLAY] Sent %lu frames in %.3f s (%.0f frames/s)\n",
+           frames_sent, sec, sec > 0 ? frames_sent / sec : 0.0);
+    if (error_frames || tx_full) {
+        printf("[REPLAY] Skipped %lu error frames, %lu TX queue full retries\n",
+               error_frames, tx_full);
+    }
+    if (unmapped_frames) {
+        printf("[REPLAY] Skipped %lu frames of channels beyond the -I list\n",
+               unmapped_frames);
+    }
+    if (fd_skipped) {
+        printf("[REPLAY] Skipped %lu CAN-FD frames (no CAN-FD support)\n", fd_skipped);
+    }
+    if (jitter_count) {
+        printf("[REPLAY] Lateness vs schedule (us): avg %.1f  p50 %lu  p99 %lu  "
+               "p99.9 %lu  max %llu\n",
+               (double)jitter_sum / jitter_count, jitter_percentile(50),
+               jitter_percentile(99), jitter_percentile(99.9),
+               (unsigned long long)jitter_max);
+    }
+}
+
+/* Whole decimal number, no sign; -1 if arg is anything else */
+static int parse_count(const char *arg, unsigned long *value) {
+    char *end;
+
+    if (*arg < '0' || *arg > '9') {
+        return -1;
+    }
+    errno = 0;
+    *value = strtoul(arg, &end, 10);
+    return (*end != '\0' || errno == ERANGE) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t start;
+    unsigned long count;
+    char *end;
+    int opt;
+    int rc = 0;
+
+    log_filter_init(&filter);
+    while ((opt = getopt(argc, argv, "I:x:Fb:L:s:e:i:h")) != -1) {
+        switch (opt) {
+            case 'I':
+                snprintf(can_ifnames, sizeof(can_ifnames), "%s", optarg);
+                break;
+            case 'x':
+                scale = strtod(optarg, &end);
+                /* Written so that NaN fails too */
+                if (end == optarg || *end != '\0' ||
+                    !(scale >= MIN_SCALE && scale <= MAX_SCALE)) {
+                    fprintf(stderr, "Speed factor must be %.1f-%.0f\n", MIN_SCALE, MAX_SCALE);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'F':
+                fast_mode = 1;
+                break;
+            case 'b':
+                if (parse_count(optarg, &count) < 0 || count < 1 || count > MAX_TX_BATCH) {
+                    fprintf(stderr, "Batch size must be 1-%d\n", MAX_TX_BATCH);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                tx_batch = (int)count;
+                break;
+            case 'L':
+                if (parse_count(optarg, &loops) < 0) {
+                    fprintf(stderr, "Invalid pass count: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+            case 'e':
+                if (log_filter_parse_time(optarg, opt == 's' ? &filter.start_us
+                                                             : &filter.end_us) < 0) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'i':
+                if (log_filter_parse_ids(&filter, optarg) < 0) {
+                    fprintf(stderr, "Invalid ID list (hex IDs, at most %d)\n",
+                            LOG_FILTER_MAX_IDS);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    printf("[REPLAY] Sending on %s, %s\n", can_ifnames,
+           fast_mode ? "as fast as possible" : "original timing");
+    if (setup_can_socket(can_ifnames) < 0) {
+        return 1;
+    }
+
+    /* The default 50 µs timer slack would dominate the replay jitter */
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    if (!fast_mode && scale != 1.0) {
+        printf("[REPLAY] Speed factor %.2fx\n", scale);
+    }
+
+    start = now_us();
+    for (unsigned long pass = 0; running && (loops == 0 || pass < loops); pass++) {
+        unsigned long sent_before = frames_sent;
+
+        for (int i = optind; i < argc && running; i++) {
+            /* Let "can-*" globs pick up the sidecars without complaint */
+            size_t len = strlen(argv[i]);
+            if (len > strlen(VTUIDX_EXTENSION) &&
+                strcmp(argv[i] + len - strlen(VTUIDX_EXTENSION), VTUIDX_EXTENSION) == 0) {
+                continue;
+            }
+            if (replay_file(argv[i]) < 0) {
+                rc = 1;
+            }
+        }
+        flush_tx();
+        have_base = 0;  /* The next pass starts over right away */
+
+        /* Another pass over the same selection would send nothing either */
+        if (frames_sent == sent_before) {
+            printf("[REPLAY] No frames selected, stopping\n");
+            break;
+        }
+    }
+
+    print_stats(now_us() - start);
+    vtu_can_close(&can);
+    return rc;
+}
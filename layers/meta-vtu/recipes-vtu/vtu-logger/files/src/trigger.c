@@ -0,0 +1,209 @@
+/**
+ * @file trigger.c
+ * @brief Event triggers and pre-trigger history for triggered recording
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vtu/vtu_bus.h>
+
+#include "trigger.h"
+#include "vtuidx.h"
+
+/*============================================================================
+ * Signals available to threshold triggers
+ *===========================================================================*/
+
+enum {
+    SIG_RPM,
+    SIG_COOLANT,
+    SIG_THROTTLE,
+    SIG_MAF,
+    SIG_GEAR,
+    SIG_TRANS_TEMP,
+};
+
+static const struct {
+    const char *name;
+    uint32_t can_id;
+    uint8_t min_dlc;
+} signals[] = {
+    [SIG_RPM]        = { "rpm",        VTU_BUS_ENGINE_DATA_1_ID,
+                         VTU_BUS_ENGINE_DATA_1_ENGINE_RPM_MIN_LEN },
+    [SIG_COOLANT]    = { "coolant",    VTU_BUS_ENGINE_DATA_1_ID,
+                         VTU_BUS_ENGINE_DATA_1_COOLANT_TEMP_MIN_LEN },
+    [SIG_THROTTLE]   = { "throttle",   VTU_BUS_ENGINE_DATA_1_ID,
+                         VTU_BUS_ENGINE_DATA_1_THROTTLE_POS_MIN_LEN },
+    [SIG_MAF]        = { "maf",        VTU_BUS_ENGINE_DATA_1_ID,
+                         VTU_BUS_ENGINE_DATA_1_MAF_MIN_LEN },
+    [SIG_GEAR]       = { "gear",       VTU_BUS_TRANS_DATA_ID,
+                         VTU_BUS_TRANS_DATA_GEAR_MIN_LEN },
+    [SIG_TRANS_TEMP] = { "trans_temp", VTU_BUS_TRANS_DATA_ID,
+                         VTU_BUS_TRANS_DATA_TRANS_FLUID_TEMP_MIN_LEN },
+};
+
+#define NUM_SIGNALS (int)(sizeof(signals) / sizeof(signals[0]))
+
+static double decode_signal(int signal, const uint8_t *data) {
+    switch (signal) {
+        case SIG_RPM:        return vtu_bus_engine_data_1_engine_rpm(data);
+        case SIG_COOLANT:    return vtu_bus_engine_data_1_coolant_temp(data);
+        case SIG_THROTTLE:   return vtu_bus_engine_data_1_throttle_pos(data);
+        case SIG_MAF:        return vtu_bus_engine_data_1_maf(data);
+        case SIG_GEAR:       return vtu_bus_trans_data_gear(data);
+        case SIG_TRANS_TEMP: return vtu_bus_trans_data_trans_fluid_temp(data);
+    }
+    return 0.0;
+}
+
+/*============================================================================
+ * Parsing
+ *===========================================================================*/
+
+/* Parse a hex byte string ("0043"), returns number of bytes or -1 */
+static int parse_bytes(const char *s, size_t n, uint8_t *out) {
+    if (n == 0 || n % 2 != 0 || n > 16) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        char byte[3] = { s[i], s[i + 1], '\0' };
+        char *end;
+        out[i / 2] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0') {
+            return -1;
+        }
+    }
+    return (int)(n / 2);
+}
+
+static int parse_signal(const char *spec, const char *op, struct trigger *t) {
+    size_t name_len = op - spec;
+    char *end;
+
+    for (int i = 0; i < NUM_SIGNALS; i++) {
+        if (strlen(signals[i].name) == name_len &&
+            strncmp(spec, signals[i].name, name_len) == 0) {
+            t->type = TRIGGER_SIGNAL;
+            t->signal = i;
+            t->key = signals[i].can_id;   /* VTU_BUS_*_ID: bit 31 for 29-bit, as a key */
+            t->above = *op == '>';
+            t->threshold = strtod(op + 1, &end);
+            return (end != op + 1 && *end == '\0') ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+static int parse_match(const char *spec, struct trigger *t) {
+    const char *data = strchr(spec, ':');
+    const char *mask = data ? strchr(data + 1, ':') : NULL;
+    char *end;
+
+    t->type = TRIGGER_MATCH;
+    if (vtuidx_parse_key(spec, &end, &t->key) < 0 || (*end != '\0' && *end != ':')) {
+        return -1;
+    }
+    if (!data) {
+        return 0;  /* ID only */
+    }
+
+    size_t data_len = mask ? (size_t)(mask - data - 1) : strlen(data + 1);
+    int n = parse_bytes(data + 1, data_len, t->data);
+    if (n < 0) {
+        return -1;
+    }
+    t->len = n;
+    memset(t->mask, 0xFF, sizeof(t->mask));
+    if (mask && parse_bytes(mask + 1, strlen(mask + 1), t->mask) != n) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        t->data[i] &= t->mask[i];
+    }
+    return 0;
+}
+
+int trigger_parse(const char *spec, struct trigger *t) {
+    const char *op = strpbrk(spec, "<>");
+
+    memset(t, 0, sizeof(*t));
+    snprintf(t->desc, sizeof(t->desc), "%s", spec);
+
+    if (strcmp(spec, "usr1") == 0) {
+        t->type = TRIGGER_USR1;
+        return 0;
+    }
+    if (op) {
+        return parse_signal(spec, op, t);
+    }
+    return parse_match(spec, t);
+}
+
+/*============================================================================
+ * Matching
+ *===========================================================================*/
+
+int trigger_match(const struct trigger *t, const struct vtulog_record *rec) {
+    if (t->type == TRIGGER_USR1 || vtuidx_key(rec) != t->key ||
+        (rec->flags & (VTULOG_FLAG_RTR | VTULOG_FLAG_ERR))) {
+        return 0;
+    }
+
+    if (t->type == TRIGGER_SIGNAL) {
+        if (rec->dlc < signals[t->signal].min_dlc) {
+            return 0;
+        }
+        double value = decode_signal(t->signal, rec->data);
+        return t->above ? value > t->threshold : value < t->threshold;
+    }
+
+    if (rec->dlc < t->len) {
+        return 0;
+    }
+    for (int i = 0; i < t->len; i++) {
+        if ((rec->data[i] & t->mask[i]) != t->data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*============================================================================
+ * Pre-trigger history
+ *===========================================================================*/
+
+int pretrigger_init(struct pretrigger *p, size_t bytes) {
+    memset(p, 0, sizeof(*p));
+    p->capacity = bytes / sizeof(struct vtulog_record);
+    if (p->capacity == 0) {
+        return -1;
+    }
+    p->slots = malloc((size_t)p->capacity * sizeof(*p->slots));
+    return p->slots ? 0 : -1;
+}
+
+void pretrigger_free(struct pretrigger *p) {
+    free(p->slots);
+    p->slots = NULL;
+}
+
+uint32_t pretrigger_drain(struct pretrigger *p, uint64_t since_us,
+                          void (*write)(const struct vtulog_record *rec)) {
+    uint32_t idx = (p->head + p->capacity - p->count) % p->capacity;
+    uint32_t written = 0;
+
+    for (uint32_t i = 0; i < p->count; i++) {
+        const struct vtulog_record *rec = &p->slots[idx];
+        if (rec->timestamp_us >= since_us) {
+            write(rec);
+            written++;
+        }
+        idx = idx + 1 == p->capacity ? 0 : idx + 1;
+    }
+
+    p->count = 0;
+    p->head = 0;
+    return written;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file trigger.h
+ * @brief Event triggers and pre-trigger history for triggered recording
+ *
+ * In triggered mode vtu-logger keeps the most recent frames in memory
+ * (struct pretrigger) and only writes to disk when a trigger fires: the
+ * buffered history from the pre-trigger window goes out first, followed
+ * by live frames until the post-trigger window has elapsed.
+ *
+ * Trigger specs (-t):
+ *   ID[:DATA[:MASK]]   Frame with that hex ID whose payload, ANDed with
+ *                      MASK (default: all ones), equals DATA; bytes are
+ *                      given as hex strings, e.g. 7E8:0043:00FF fires on
+ *                      an OBD mode 03 (DTC) response. IDs above 7FF, with
+ *                      8 digits or a trailing x (7E8x) are 29-bit; a frame
+ *                      only matches an ID of its own width
+ *   SIGNAL>VALUE       Decoded signal above / below a threshold, using the
+ *   SIGNAL<VALUE       vtu.dbc layouts: rpm, coolant, throttle, maf,
+ *                      gear, trans_temp (e.g. rpm>4500)
+ *   usr1               Only SIGUSR1 (which always fires in triggered mode)
+ */
+
+#ifndef VTU_TRIGGER_H
+#define VTU_TRIGGER_H
+
+#include <stdint.h>
+
+#include "vtulog.h"
+
+/*============================================================================
+ * Triggers
+ *===========================================================================*/
+
+enum trigger_type {
+    TRIGGER_MATCH,      /* ID + payload under mask */
+    TRIGGER_SIGNAL,     /* Decoded signal threshold */
+    TRIGGER_USR1,       /* SIGUSR1 only, never matches a frame */
+};
+
+struct trigger {
+    enum trigger_type type;
+    uint32_t key;               /* can_id | VTUIDX_KEY_EXT, see vtuidx_key() */
+    uint8_t  len;               /* Payload bytes compared (TRIGGER_MATCH) */
+    uint8_t  data[8];
+    uint8_t  mask[8];
+    int      signal;            /* Index into the signal table (TRIGGER_SIGNAL) */
+    int      above;             /* 1: fires on value > threshold, 0: < */
+    double   threshold;
+    char     desc[48];          /* Spec as given, for log messages */
+};
+
+/**
+ * @brief Parse a -t spec
+ * @return 0 on success, -1 if the spec is invalid
+ */
+int trigger_parse(const char *spec, struct trigger *t);
+
+/**
+ * @return 1 if the frame fires the trigger
+ */
+int trigger_match(const struct trigger *t, const struct vtulog_record *rec);
+
+/*============================================================================
+ * Pre-trigger history
+ *===========================================================================*/
+
+/**
+ * @brief Circular buffer of the most recent frames; the oldest frame is
+ * overwritten when it is full
+ */
+struct pretrigger {
+    struct vtulog_record *slots;
+    uint32_t capacity;
+    uint32_t head;              /* Next slot to write */
+    uint32_t count;
+    unsigned long overwritten;  /* Frames that fell out without a trigger */
+};
+
+/**
+ * @brief Allocate a buffer of (at most) bytes bytes
+ * @return 0 on success, -1 on error
+ */
+int pretrigger_init(struct pretrigger *p, size_t bytes);
+void pretrigger_free(struct pretrigger *p);
+
+static inline void pretrigger_push(struct pretrigger *p, const struct vtulog_record *rec) {
+    p->slots[p->head] = *rec;
+    p->head = p->head + 1 == p->capacity ? 0 : p->head + 1;
+    if (p->count < p->capacity) {
+        p->count++;
+    } else {
+        p->overwritten++;
+    }
+}
+
+/**
+ * @brief Hand every buffered frame at or after since_us to write, oldest
+ * first, and empty the buffer
+ * @return Number of frames written
+ */
+uint32_t pretrigger_drain(struct pretrigger *p, uint64_t since_us,
+                          void (*write)(const struct vtulog_record *rec));
+
+#endif /* VTU_TRIGGER_H */
@@ -0,0 +1,269 @@
+/**
+ * @file uring_log.c
+ * @brief io_uring log file writer for vtu-logger
+ */
+
+#define _GNU_SOURCE  /* O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <liburing.h>
+
+#include "uring_log.h"
+
+#define URING_BUF_COUNT 8               /* Buffers in the pool */
+#define URING_BUF_SIZE  (64 * 1024)     /* Bytes per write */
+#define URING_ALIGN     4096            /* O_DIRECT buffer/offset/length alignment */
+
+struct uring_buf {
+    char  *data;
+    size_t len;         /* Bytes filled */
+    size_t submitted;   /* Bytes handed to the kernel */
+    int    busy;        /* Write in flight */
+};
+
+struct uring_log {
+    struct io_uring  ring;
+    struct uring_buf bufs[URING_BUF_COUNT];
+    int    cur;         /* Buffer being filled, -1 if none */
+    int    inflight;
+    int    fd;
+    int    direct;
+    off_t  offset;      /* File offset of the next submission */
+    int    error;       /* A write failed since the file was opened */
+};
+
+/* Handle completed writes; with wait set, block for at least one */
+static void reap(struct uring_log *ul, int wait) {
+    struct io_uring_cqe *cqe;
+
+    while (ul->inflight > 0) {
+        int ret = wait ? io_uring_wait_cqe(&ul->ring, &cqe)
+                       : io_uring_peek_cqe(&ul->ring, &cqe);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            break;  /* -EAGAIN: nothing completed yet */
+        }
+
+        struct uring_buf *b = &ul->bufs[(uintptr_t)io_uring_cqe_get_data(cqe)];
+        if (cqe->res < 0 || (size_t)cqe->res != b->submitted) {
+            fprintf(stderr, "[LOGGER] io_uring write failed: %s\n",
+                    cqe->res < 0 ? strerror(-cqe->res) : "short write");
+            ul->error = 1;
+        }
+        b->busy = 0;
+        b->len = 0;
+        ul->inflight--;
+        io_uring_cqe_seen(&ul->ring, cqe);
+        wait = 0;
+    }
+}
+
+/* Pick a free buffer to fill, waiting for a completion if all are busy */
+static int acquire_buf(struct uring_log *ul) {
+    for (;;) {
+        for (int i = 0; i < URING_BUF_COUNT; i++) {
+            if (!ul->bufs[i].busy) {
+                ul->bufs[i].len = 0;
+                return i;
+            }
+        }
+        reap(ul, 1);
+    }
+}
+
+/* Queue the current buffer as one fixed-buffer write of len bytes */
+static void submit_cur(struct uring_log *ul, size_t len) {
+    struct uring_buf *b = &ul->bufs[ul->cur];
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ul->ring);
+
+    if (!sqe) {
+        /* Only possible if the SQ is smaller than the pool; flush it */
+        io_uring_submit(&ul->ring);
+        sqe = io_uring_get_sqe(&ul->ring);
+    }
+
+    io_uring_prep_write_fixed(sqe, ul->fd, b->data, len, ul->offset, ul->cur);
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)ul->cur);
+    io_uring_submit(&ul->ring);
+
+    b->busy = 1;
+    b->submitted = len;
+    ul->offset += len;
+    ul->inflight++;
+    ul->cur = -1;
+}
+
+struct uring_log *uring_log_create(void) {
+    struct iovec iov[URING_BUF_COUNT];
+    struct uring_log *ul = calloc(1, sizeof(*ul));
+    int ret;
+
+    if (!ul) {
+        return NULL;
+    }
+
+    ret = io_uring_queue_init(URING_BUF_COUNT * 2, &ul->ring, 0);
+    if (ret < 0) {
+        free(ul);
+        errno = -ret;
+        return NULL;
+    }
+
+    for (int i = 0; i < URING_BUF_COUNT; i++) {
+        if (posix_memalign((void **)&ul->bufs[i].data, URING_ALIGN, URING_BUF_SIZE) != 0) {
+            uring_log_destroy(ul);
+            errno = ENOMEM;
+            return NULL;
+        }
+        iov[i].iov_base = ul->bufs[i].data;
+        iov[i].iov_len = URING_BUF_SIZE;
+    }
+
+    /* Pin the pool once so the kernel doesn't map pages on every write */
+    ret = io_uring_register_buffers(&ul->ring, iov, URING_BUF_COUNT);
+    if (ret < 0) {
+        uring_log_destroy(ul);
+        errno = -ret;
+        return NULL;
+    }
+
+    ul->cur = -1;
+    ul->fd = -1;
+    return ul;
+}
+
+void uring_log_destroy(struct uring_log *ul) {
+    if (!ul) {
+        return;
+    }
+    io_uring_queue_exit(&ul->ring);
+    for (int i = 0; i < URING_BUF_COUNT; i++) {
+        free(ul->bufs[i].data);
+    }
+    free(ul);
+}
+
+int uring_log_open(struct uring_log *ul, const char *path, int direct) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    ul->direct = 0;
+    if (direct) {
+        ul->fd = open(path, flags | O_DIRECT, 0644);
+        if (ul->fd >= 0) {
+            ul->direct = 1;
+        } else if (errno == EINVAL) {
+            /* Filesystem (e.g. tmpfs) doesn't support O_DIRECT */
+            fprintf(stderr, "[LOGGER] O_DIRECT not supported for %s, "
+                    "using buffered writes\n", path);
+        }
+    }
+    if (!ul->direct) {
+        ul->fd = open(path, flags, 0644);
+    }
+    if (ul->fd < 0) {
+        return -1;
+    }
+
+    ul->offset = 0;
+    ul->error = 0;
+    ul->cur = -1;
+    return 0;
+}
+
+int uring_log_write(struct uring_log *ul, const void *data, size_t len) {
+    const char *p = data;
+
+    while (len > 0) {
+        if (ul->cur < 0) {
+            ul->cur = acquire_buf(ul);
+        }
+
+        struct uring_buf *b = &ul->bufs[ul->cur];
+        size_t n = URING_BUF_SIZE - b->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(b->data + b->len, p, n);
+        b->len += n;
+        p += n;
+        len -= n;
+
+        if (b->len == URING_BUF_SIZE) {
+            submit_cur(ul, URING_BUF_SIZE);
+        }
+    }
+
+    reap(ul, 0);
+    return ul->error ? -1 : 0;
+}
+
+int uring_log_flush(struct uring_log *ul) {
+    if (!ul->direct && ul->cur >= 0 && ul->bufs[ul->cur].len > 0) {
+        submit_cur(ul, ul->bufs[ul->cur].len);
+    }
+    reap(ul, 0);
+    return ul->error ? -1 : 0;
+}
+
+int uring_log_sync(struct uring_log *ul) {
+    uring_log_flush(ul);
+    while (ul->inflight > 0) {
+        reap(ul, 1);
+    }
+    if (ul->fd >= 0 && fdatasync(ul->fd) < 0) {
+        ul->error = 1;
+    }
+    return ul->error ? -1 : 0;
+}
+
+int uring_log_fd(const struct uring_log *ul) {
+    return ul->fd;
+}
+
+int uring_log_close(struct uring_log *ul, int do_fsync) {
+    off_t logical_size = -1;
+    int rc;
+
+    if (ul->fd < 0) {
+        return 0;
+    }
+
+    if (ul->cur >= 0 && ul->bufs[ul->cur].len > 0) {
+        struct uring_buf *b = &ul->bufs[ul->cur];
+        size_t len = b->len;
+
+        if (ul->direct) {
+            /* Pad to the alignment, truncate the padding away below */
+            logical_size = ul->offset + len;
+            len = (len + URING_ALIGN - 1) & ~(size_t)(URING_ALIGN - 1);
+            memset(b->data + b->len, 0, len - b->len);
+        }
+        submit_cur(ul, len);
+    }
+
+    while (ul->inflight > 0) {
+        reap(ul, 1);
+    }
+
+    if (logical_size >= 0 && ftruncate(ul->fd, logical_size) < 0) {
+        ul->error = 1;
+    }
+    if (do_fsync && fsync(ul->fd) < 0) {
+        ul->error = 1;
+    }
+
+    close(ul->fd);
+    ul->fd = -1;
+    rc = ul->error ? -1 : 0;
+    ul->error = 0;
+    return rc;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file uring_log.h
+ * @brief io_uring log file writer for vtu-logger
+ *
+ * Appends are copied into a small pool of page-aligned buffers that are
+ * registered with the ring once at startup. Full buffers are submitted as
+ * IORING_OP_WRITE_FIXED at an explicit file offset and the caller carries
+ * on filling the next buffer while the kernel writes; the writer only
+ * waits when every buffer is still in flight. The ring and buffers are
+ * reused across log segments.
+ *
+ * With O_DIRECT only whole buffers are written. The tail is padded to the
+ * buffer alignment on close and the file is truncated back to its logical
+ * length afterwards.
+ *
+ * Only built when liburing is available (HAVE_LIBURING).
+ */
+
+#ifndef VTU_URING_LOG_H
+#define VTU_URING_LOG_H
+
+#include <stddef.h>
+
+struct uring_log;
+
+/**
+ * @brief Set up the ring and register the buffer pool
+ * @return Writer handle, or NULL if io_uring is unavailable (errno set)
+ */
+struct uring_log *uring_log_create(void);
+
+/**
+ * @brief Release the ring and buffers (any open file must be closed first)
+ */
+void uring_log_destroy(struct uring_log *ul);
+
+/**
+ * @brief Create (truncate) the log file that subsequent writes go to
+ * @param direct Open with O_DIRECT, bypassing the page cache
+ * @return 0 on success, -1 on error
+ */
+int uring_log_open(struct uring_log *ul, const char *path, int direct);
+
+/**
+ * @brief Append data to the open file
+ * @return 0 on success, -1 if a write failed
+ */
+int uring_log_write(struct uring_log *ul, const void *data, size_t len);
+
+/**
+ * @brief Submit the partially filled buffer without waiting
+ *
+ * A no-op with O_DIRECT, where only full buffers can be written.
+ */
+int uring_log_flush(struct uring_log *ul);
+
+/**
+ * @brief Make everything written so far durable (fdatasync)
+ *
+ * Submits the partial buffer (except with O_DIRECT, which is only ever
+ * behind by less than one buffer) and waits for in-flight writes first.
+ */
+int uring_log_sync(struct uring_log *ul);
+
+/**
+ * @brief File descriptor of the open file, -1 if none
+ */
+int uring_log_fd(const struct uring_log *ul);
+
+/**
+ * @brief Write out everything, wait for completion and close the file
+ * @param do_fsync fsync() the file before closing
+ */
+int uring_log_close(struct uring_log *ul, int do_fsync);
+
+#endif /* VTU_URING_LOG_H */
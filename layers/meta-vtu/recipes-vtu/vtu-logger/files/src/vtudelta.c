@@ -0,0 +1,333 @@
+/**
+ * @file vtudelta.c
+ * @brief Delta encoding of .vtulog frame records
+ *
+ * Shared by vtu-logger (encoding) and the log readers (decoding).
+ */
+
+#include <string.h>
+
+#include "vtudelta.h"
+
+#define TAG_KIND_MASK   0xC0
+#define TAG_FRAME       0x40    /* 0x00 is never valid: zeroed tails don't decode */
+#define TAG_RESERVED    0x20
+#define KEY_EXT         0x80000000u
+
+static uint32_t hash_key(uint32_t key, uint8_t channel) {
+    uint32_t h = (key ^ ((uint32_t)channel << 24)) * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* 1 on success, 0 if the input ends first, -1 if overlong */
+static int get_varint(const uint8_t **pp, const uint8_t *end, uint64_t *v) {
+    const uint8_t *p = *pp;
+    uint64_t x = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) {
+            return 0;
+        }
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            *pp = p;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/* Drop all slots; bumping the generation invalidates the hash map in O(1) */
+static void new_generation(struct vtudelta_enc *enc) {
+    enc->nslots = 0;
+    if (++enc->gen == 0) {
+        memset(enc->map_gen, 0, sizeof(enc->map_gen));
+        enc->gen = 1;
+    }
+}
+
+void vtudelta_enc_reset(struct vtudelta_enc *enc, uint32_t keyframe_interval) {
+    enc->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+    enc->frames = 0;
+    enc->prev_ts = 0;
+    new_generation(enc);
+}
+
+size_t vtudelta_encode(struct vtudelta_enc *enc, const struct vtulog_record *rec,
+                       uint8_t *out) {
+    uint32_t key = rec->can_id | ((rec->flags & VTULOG_FLAG_EXT) ? KEY_EXT : 0);
+    uint8_t dlc = rec->dlc > VTULOG_MAX_DLEN ? VTULOG_MAX_DLEN : rec->dlc;
+    struct vtudelta_slot *s;
+    uint8_t *p = out;
+    uint8_t *tag;
+    int64_t delta;
+    uint32_t i;
+
+    if (vtudelta_keyframe_due(enc)) {
+        *p++ = VTUDELTA_TAG_KEY;
+        memcpy(p, &rec->timestamp_us, 8);
+        p += 8;
+        enc->prev_ts = rec->timestamp_us;
+        new_generation(enc);
+    }
+    enc->frames++;
+
+    tag = p++;
+    *tag = TAG_FRAME;
+
+    i = hash_key(key, rec->channel) & (VTUDELTA_HASH_SIZE - 1);
+    while (enc->map_gen[i] == enc->gen &&
+           (enc->slots[enc->map[i] - 1].key != key ||
+            enc->slots[enc->map[i] - 1].channel != rec->channel)) {
+        i = (i + 1) & (VTUDELTA_HASH_SIZE - 1);
+    }
+
+    if (enc->map_gen[i] != enc->gen) {
+        /* First frame of this ID since the keyframe: define a slot */
+        enc->map_gen[i] = enc->gen;
+        enc->map[i] = ++enc->nslots;
+        s = &enc->slots[enc->nslots - 1];
+        s->key = key;
+        s->channel = rec->channel;
+        s->flags = rec->flags;
+        s->dlc = 0xFF;  /* Forces a literal payload */
+        *tag |= VTUDELTA_NEW_ID;
+        p = put_varint(p, rec->can_id);
+        *p++ = rec->flags;
+        if (rec->channel) {
+            *tag |= VTUDELTA_CHANNEL;
+            *p++ = rec->channel;
+        }
+    } else {
+        s = &enc->slots[enc->map[i] - 1];
+        p = put_varint(p, enc->map[i] - 1);
+        if (s->flags != rec->flags) {
+            *tag |= VTUDELTA_NEW_FLAGS;
+            *p++ = rec->flags;
+            s->flags = rec->flags;
+        }
+    }
+
+    /* Zigzag: hardware timestamps can step back slightly across sources */
+    delta = (int64_t)(rec->timestamp_us - enc->prev_ts);
+    p = put_varint(p, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    enc->prev_ts = rec->timestamp_us;
+
+    if (s->dlc == dlc) {
+        uint8_t mask[VTULOG_MAX_DLEN / 8] = { 0 };
+        int nmask = (dlc + 7) / 8;
+        int changed = 0;
+        for (int b = 0; b < dlc; b++) {
+            if (rec->data[b] != s->data[b]) {
+                mask[b / 8] |= 1u << (b % 8);
+                changed = 1;
+            }
+        }
+        if (changed) {
+            *tag |= VTUDELTA_XOR;
+            memcpy(p, mask, nmask);
+            p += nmask;
+            for (int b = 0; b < dlc; b++) {
+                if (mask[b / 8] & (1u << (b % 8))) {
+                    *p++ = rec->data[b] ^ s->data[b];
+                }
+            }
+        }
+    } else {
+        *tag |= VTUDELTA_LITERAL;
+        *p++ = dlc;
+        memcpy(p, rec->data, dlc);
+        p += dlc;
+    }
+    s->dlc = dlc;
+    memset(s->data, 0, sizeof(s->data));
+    memcpy(s->data, rec->data, dlc);
+
+    return (size_t)(p - out);
+}
+
+void vtudelta_dec_reset(struct vtudelta_dec *dec) {
+    dec->synced = 0;
+    dec->prev_ts = 0;
+    dec->nslots = 0;
+}
+
+int vtudelta_decode(struct vtudelta_dec *dec, const uint8_t *in, size_t len,
+                    struct vtulog_record *rec, size_t *used) {
+    const uint8_t *p = in;
+    const uint8_t *end = in + len;
+    struct vtudelta_slot *s;
+    uint64_t v;
+    uint8_t tag;
+    int rc;
+
+    if (p == end) {
+        return VTUDELTA_MORE;
+    }
+    tag = *p++;
+
+    switch (tag & TAG_KIND_MASK) {
+        case VTUDELTA_TAG_KEY:
+            if (tag != VTUDELTA_TAG_KEY) {
+                return VTUDELTA_CORRUPT;
+            }
+            if (end - p < 8) {
+                return VTUDELTA_MORE;
+            }
+            memcpy(&dec->prev_ts, p, 8);
+            dec->nslots = 0;
+            dec->synced = 1;
+            *used = 9;
+            return VTUDELTA_KEYFRAME;
+
+        case VTUDELTA_TAG_END:
+            if (tag != VTUDELTA_TAG_END) {
+                return VTUDELTA_CORRUPT;
+            }
+            *used = 1;
+            return VTUDELTA_END;
+
+        case TAG_FRAME:
+            break;
+
+        default:
+            return VTUDELTA_CORRUPT;
+    }
+
+    if (!dec->synced || (tag & TAG_RESERVED) ||
+        (tag & VTUDELTA_PAYLOAD_MASK) > VTUDELTA_LITERAL ||
+        ((tag & VTUDELTA_CHANNEL) && !(tag & VTUDELTA_NEW_ID))) {
+        return VTUDELTA_CORRUPT;
+    }
+
+    if ((rc = get_varint(&p, end, &v)) <= 0) {
+        return rc < 0 ? VTUDELTA_CORRUPT : VTUDELTA_MORE;
+    }
+    if (tag & VTUDELTA_NEW_ID) {
+        if (v > 0x1FFFFFFF || dec->nslots == VTUDELTA_MAX_SLOTS ||
+            (tag & VTUDELTA_PAYLOAD_MASK) != VTUDELTA_LITERAL) {
+            return VTUDELTA_CORRUPT;
+        }
+        if (p == end) {
+            return VTUDELTA_MORE;
+        }
+        s = &dec->slots[dec->nslots];
+        s->flags = *p++;
+        s->key = (uint32_t)v | ((s->flags & VTULOG_FLAG_EXT) ? KEY_EXT : 0);
+        s->channel = 0;
+        if (tag & VTUDELTA_CHANNEL) {
+            if (p == end) {
+                return VTUDELTA_MORE;
+            }
+            s->channel = *p++;
+            if (s->channel == 0 || s->channel >= VTULOG_MAX_CHANNELS) {
+                return VTUDELTA_CORRUPT;
+            }
+        }
+    } else {
+        if (v >= dec->nslots) {
+            return VTUDELTA_CORRUPT;
+        }
+        s = &dec->slots[v];
+    }
+
+    /* Applied below, once the whole frame is known to be here */
+    const uint8_t *flags_at = NULL;
+    if (tag & VTUDELTA_NEW_FLAGS) {
+        if (tag & VTUDELTA_NEW_ID) {
+            return VTUDELTA_CORRUPT;
+        }
+        if (p == end) {
+            return VTUDELTA_MORE;
+        }
+        flags_at = p++;
+    }
+
+    if ((rc = get_varint(&p, end, &v)) <= 0) {
+        return rc < 0 ? VTUDELTA_CORRUPT : VTUDELTA_MORE;
+    }
+    int64_t delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+
+    /* Decode the payload into the record first: the slot only changes
+     * once the frame is complete, so VTUDELTA_MORE can be retried */
+    memset(rec, 0, sizeof(*rec));
+    switch (tag & VTUDELTA_PAYLOAD_MASK) {
+        case VTUDELTA_SAME:
+            rec->dlc = s->dlc;
+            memcpy(rec->data, s->data, sizeof(rec->data));
+            break;
+
+        case VTUDELTA_XOR: {
+            const uint8_t *mask = p;
+            int nmask = (s->dlc + 7) / 8;
+            uint8_t any = 0;
+            if (nmask == 0) {
+                return VTUDELTA_CORRUPT;
+            }
+            if (end - p < nmask) {
+                return VTUDELTA_MORE;
+            }
+            p += nmask;
+            for (int m = 0; m < nmask; m++) {
+                any |= mask[m];
+            }
+            /* No bits beyond the DLC */
+            if (any == 0 || (s->dlc % 8 && (mask[nmask - 1] >> (s->dlc % 8)))) {
+                return VTUDELTA_CORRUPT;
+            }
+            rec->dlc = s->dlc;
+            memcpy(rec->data, s->data, sizeof(rec->data));
+            for (int b = 0; b < s->dlc; b++) {
+                if (mask[b / 8] & (1u << (b % 8))) {
+                    if (p == end) {
+                        return VTUDELTA_MORE;
+                    }
+                    rec->data[b] ^= *p++;
+                }
+            }
+            break;
+        }
+
+        case VTUDELTA_LITERAL:
+            if (p == end) {
+                return VTUDELTA_MORE;
+            }
+            rec->dlc = *p++;
+            if (rec->dlc > VTULOG_MAX_DLEN) {
+                return VTUDELTA_CORRUPT;
+            }
+            if (end - p < rec->dlc) {
+                return VTUDELTA_MORE;
+            }
+            memcpy(rec->data, p, rec->dlc);
+            p += rec->dlc;
+            break;
+    }
+
+    if (tag & VTUDELTA_NEW_ID) {
+        dec->nslots++;
+    } else if (flags_at) {
+        s->flags = *flags_at;
+    }
+    s->dlc = rec->dlc;
+    memcpy(s->data, rec->data, sizeof(s->data));
+    dec->prev_ts += (uint64_t)delta;
+
+    rec->timestamp_us = dec->prev_ts;
+    rec->can_id = s->key & ~KEY_EXT;
+    rec->flags = s->flags;
+    rec->channel = s->channel;
+    *used = (size_t)(p - in);
+    return VTUDELTA_FRAME;
+}
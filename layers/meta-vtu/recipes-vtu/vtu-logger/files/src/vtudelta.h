@@ -0,0 +1,129 @@
+/**
+ * @file vtudelta.h
+ * @brief Delta encoding of .vtulog frame records
+ *
+ * Most broadcast frames repeat their payload (or change a byte or two)
+ * every cycle, so a segment with VTULOG_HDR_DELTA set in its header stores
+ * each frame relative to the previous frame of the same ID instead of as a
+ * full record. A typical cyclic frame takes 3-6 bytes, with no
+ * general-purpose compression involved.
+ *
+ *   header (64) | KEY | frame | frame | ... | KEY | frame | ... | END | footer (32)
+ *
+ * KEY (keyframe): 0x80, then the u64 little-endian timestamp the next
+ *   frame's delta is relative to. Resets the ID table, so decoding can
+ *   start at any keyframe; the writer emits one every keyframe_interval
+ *   frames (stored in the header) and the .vtuidx entries point at them.
+ *
+ * END: 0xC0, followed by the usual struct vtulog_footer. Its record count
+ *   and CRC cover the decoded records in their plain on-disk form.
+ *
+ * Frame: tag byte 0x40-0x5F (a zero byte never decodes, so a zero-filled
+ * tail after a crash ends the stream), then
+ *   - bit 2 set (new ID): varint CAN ID and flags byte, plus the channel
+ *     byte if bit 4 is set (channel 0 otherwise); the ID/channel pair gets
+ *     the next slot number. Otherwise: varint slot number, plus a flags
+ *     byte if bit 3 is set (flags differ from the slot's last frame).
+ *   - zigzag varint timestamp delta (µs) from the previous frame or key.
+ *   - payload, by bits 0-1: 0 = same DLC and data as the slot's last frame,
+ *     1 = sparse XOR (one mask byte per 8 data bytes, with bit i%8 of byte
+ *     i/8 set for each changed data byte, then the XOR of each changed
+ *     byte), 2 = literal (DLC, data bytes; always used for a new ID or a
+ *     DLC change). The DLC is a payload length of up to 64 for CAN-FD
+ *     frames, whose FD/BRS/ESI bits travel in the flags byte.
+ */
+
+#ifndef VTU_VTUDELTA_H
+#define VTU_VTUDELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vtulog.h"
+
+#define VTUDELTA_TAG_KEY        0x80
+#define VTUDELTA_TAG_END        0xC0
+
+#define VTUDELTA_NEW_ID         0x04
+#define VTUDELTA_NEW_FLAGS      0x08
+#define VTUDELTA_CHANNEL        0x10
+#define VTUDELTA_PAYLOAD_MASK   0x03
+#define VTUDELTA_SAME           0x00
+#define VTUDELTA_XOR            0x01
+#define VTUDELTA_LITERAL        0x02
+
+#define VTUDELTA_MAX_FRAME      96      /* Keyframe + largest (64-byte literal) frame */
+#define VTUDELTA_MAX_SLOTS      1024    /* IDs between keyframes */
+#define VTUDELTA_HASH_SIZE      2048
+
+struct vtudelta_slot {
+    uint32_t key;               /* can_id | bit 31 for 29-bit IDs */
+    uint8_t  channel;
+    uint8_t  flags;
+    uint8_t  dlc;
+    uint8_t  data[VTULOG_MAX_DLEN];
+};
+
+/**
+ * @brief Encoder state for one segment
+ */
+struct vtudelta_enc {
+    uint32_t keyframe_interval;
+    uint64_t frames;            /* Frames encoded in this segment */
+    uint64_t prev_ts;
+    uint16_t nslots;
+    struct vtudelta_slot slots[VTUDELTA_MAX_SLOTS];
+    uint16_t map[VTUDELTA_HASH_SIZE];       /* key -> slot + 1 */
+    uint32_t map_gen[VTUDELTA_HASH_SIZE];   /* Entry valid if == gen */
+    uint32_t gen;
+};
+
+/**
+ * @brief Decoder state
+ */
+struct vtudelta_dec {
+    int      synced;            /* A keyframe has been seen */
+    uint64_t prev_ts;
+    uint16_t nslots;
+    struct vtudelta_slot slots[VTUDELTA_MAX_SLOTS];
+};
+
+/* vtudelta_decode() results */
+#define VTUDELTA_FRAME          1   /* *rec holds a frame */
+#define VTUDELTA_KEYFRAME       2   /* Keyframe consumed, no frame */
+#define VTUDELTA_END            3   /* End marker consumed, the footer follows */
+#define VTUDELTA_MORE           0   /* Input ends mid-frame */
+#define VTUDELTA_CORRUPT        -1
+
+/**
+ * @brief Start a new segment (enc must be zeroed before the first call)
+ */
+void vtudelta_enc_reset(struct vtudelta_enc *enc, uint32_t keyframe_interval);
+
+/**
+ * @brief Encode one record (preceded by a keyframe when one is due)
+ * @param out At least VTUDELTA_MAX_FRAME bytes
+ * @return Bytes written
+ */
+size_t vtudelta_encode(struct vtudelta_enc *enc, const struct vtulog_record *rec,
+                       uint8_t *out);
+
+/**
+ * @return 1 if the next vtudelta_encode() call starts with a keyframe
+ */
+static inline int vtudelta_keyframe_due(const struct vtudelta_enc *enc) {
+    return enc->frames % enc->keyframe_interval == 0 ||
+           enc->nslots == VTUDELTA_MAX_SLOTS;
+}
+
+void vtudelta_dec_reset(struct vtudelta_dec *dec);
+
+/**
+ * @brief Decode the next item from in
+ * @param used Bytes consumed (valid for FRAME, KEYFRAME and END)
+ * @return VTUDELTA_FRAME, _KEYFRAME, _END, _MORE or _CORRUPT
+ */
+int vtudelta_decode(struct vtudelta_dec *dec, const uint8_t *in, size_t len,
+                    struct vtulog_record *rec, size_t *used);
+
+#endif /* VTU_VTUDELTA_H */
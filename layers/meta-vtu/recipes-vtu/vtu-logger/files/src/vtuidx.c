@@ -0,0 +1,352 @@
+/**
+ * @file vtuidx.c
+ * @brief Sparse index sidecar for CAN log segments
+ *
+ * Shared by vtu-logger (building) and vtu-logquery (reading).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "vtuidx.h"
+#include "logstream.h"
+
+#define VTUIDX_INITIAL_IDS      256     /* Hash slots, grows by doubling */
+#define VTUIDX_INITIAL_ENTRIES  512
+
+static uint32_t hash_key(uint32_t key) {
+    uint32_t h = key * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+int vtuidx_parse_key(const char *s, char **end, uint32_t *key) {
+    unsigned long id;
+    int ext;
+
+    if (!((*s >= '0' && *s <= '9') || (*s >= 'a' && *s <= 'f') || (*s >= 'A' && *s <= 'F'))) {
+        return -1;  /* strtoul() would take signs and spaces */
+    }
+    id = strtoul(s, end, 16);
+    if (id > 0x1FFFFFFF) {
+        return -1;
+    }
+    ext = id > 0x7FF || *end - s == 8;
+    if (**end == 'x' || **end == 'X') {
+        ext = 1;
+        (*end)++;
+    }
+    *key = (uint32_t)id | (ext ? VTUIDX_KEY_EXT : 0);
+    return 0;
+}
+
+int vtuidx_builder_init(struct vtuidx_builder *b, uint32_t stride) {
+    memset(b, 0, sizeof(*b));
+    b->stride = stride ? stride : VTUIDX_DEFAULT_STRIDE;
+    b->entry_cap = VTUIDX_INITIAL_ENTRIES;
+    b->entries = malloc(b->entry_cap * sizeof(*b->entries));
+    b->ids = calloc(VTUIDX_INITIAL_IDS, sizeof(*b->ids));
+    if (!b->entries || !b->ids) {
+        vtuidx_builder_free(b);
+        return -1;
+    }
+    b->id_mask = VTUIDX_INITIAL_IDS - 1;
+    return 0;
+}
+
+void vtuidx_builder_free(struct vtuidx_builder *b) {
+    free(b->entries);
+    free(b->ids);
+    b->entries = NULL;
+    b->ids = NULL;
+}
+
+void vtuidx_builder_reset(struct vtuidx_builder *b) {
+    memset(b->ids, 0, (b->id_mask + 1) * sizeof(*b->ids));
+    b->id_count = 0;
+    b->entry_count = 0;
+    b->record_count = 0;
+    b->first_us = 0;
+    b->last_us = 0;
+}
+
+static struct vtuidx_id *id_slot(struct vtuidx_id *ids, uint32_t mask, uint32_t key) {
+    uint32_t i = hash_key(key) & mask;
+
+    while (ids[i].count != 0 && ids[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &ids[i];
+}
+
+/* Double the ID table, keeping it at most half full */
+static int grow_ids(struct vtuidx_builder *b) {
+    uint32_t new_mask = b->id_mask * 2 + 1;
+    struct vtuidx_id *ids = calloc(new_mask + 1, sizeof(*ids));
+
+    if (!ids) {
+        return -1;
+    }
+    for (uint32_t i = 0; i <= b->id_mask; i++) {
+        if (b->ids[i].count) {
+            *id_slot(ids, new_mask, b->ids[i].key) = b->ids[i];
+        }
+    }
+    free(b->ids);
+    b->ids = ids;
+    b->id_mask = new_mask;
+    return 0;
+}
+
+int vtuidx_add(struct vtuidx_builder *b, const struct vtulog_record *rec,
+               uint64_t offset) {
+    uint32_t key = vtuidx_key(rec);
+    uint64_t ts = rec->timestamp_us;
+
+    if (b->record_count % b->stride == 0) {
+        if (b->entry_count == b->entry_cap) {
+            struct vtuidx_entry *e = realloc(b->entries,
+                                             b->entry_cap * 2 * sizeof(*e));
+            if (!e) {
+                return -1;
+            }
+            b->entries = e;
+            b->entry_cap *= 2;
+        }
+        b->entries[b->entry_count].timestamp_us = ts;
+        b->entries[b->entry_count].offset = offset;
+        b->entry_count++;
+    }
+
+    struct vtuidx_id *id = id_slot(b->ids, b->id_mask, key);
+    if (id->count == 0) {
+        if ((b->id_count + 1) * 2 > b->id_mask + 1) {
+            if (grow_ids(b) < 0) {
+                return -1;
+            }
+            id = id_slot(b->ids, b->id_mask, key);
+        }
+        id->key = key;
+        id->first_us = ts;
+        b->id_count++;
+    }
+    id->count++;
+    id->last_us = ts;
+
+    if (b->record_count == 0 || ts < b->first_us) {
+        b->first_us = ts;
+    }
+    if (ts > b->last_us) {
+        b->last_us = ts;
+    }
+    b->record_count++;
+    return 0;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t ka = ((const struct vtuidx_id *)a)->key;
+    uint32_t kb = ((const struct vtuidx_id *)b)->key;
+    return ka < kb ? -1 : ka > kb;
+}
+
+int vtuidx_write(const struct vtuidx_builder *b, const char *path,
+                 uint64_t log_size, int text) {
+    struct vtuidx_header hdr;
+    struct vtuidx_id *ids;
+    char tmp_path[512];
+    uint32_t n = 0;
+    int ok;
+
+    /* Compact the hash table into a sorted array for bsearch() */
+    ids = malloc((b->id_count ? b->id_count : 1) * sizeof(*ids));
+    if (!ids) {
+        return -1;
+    }
+    for (uint32_t i = 0; i <= b->id_mask; i++) {
+        if (b->ids[i].count) {
+            ids[n++] = b->ids[i];
+        }
+    }
+    qsort(ids, n, sizeof(*ids), compare_ids);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, VTUIDX_MAGIC, sizeof(hdr.magic));
+    hdr.version = VTUIDX_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.stride = b->stride;
+    hdr.log_size = log_size;
+    hdr.record_count = b->record_count;
+    hdr.entry_count = b->entry_count;
+    hdr.id_count = n;
+    hdr.first_us = b->first_us;
+    hdr.last_us = b->last_us;
+    hdr.text = text ? 1 : 0;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        free(ids);
+        return -1;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(b->entries, sizeof(*b->entries), b->entry_count, f) == b->entry_count &&
+         fwrite(ids, sizeof(*ids), n, f) == n;
+    free(ids);
+    if (fclose(f) != 0 || !ok || rename(tmp_path, path) < 0) {
+        int err = errno;
+        unlink(tmp_path);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int vtuidx_rebuild(const char *log_path, uint32_t stride) {
+    struct vtuidx_builder b;
+    struct vtulog_file_header hdr;
+    struct stat st;
+    char idx_path[512];
+    int text, error, rc = -1;
+
+    FILE *in = fopen(log_path, "rb");
+    if (!in) {
+        return -1;
+    }
+    text = fread(&hdr, sizeof(hdr), 1, in) != 1 || vtulog_check_header(&hdr) < 0;
+
+    /* Entries of a delta-encoded segment must land on its keyframes */
+    if (!text && (hdr.flags & VTULOG_HDR_DELTA)) {
+        stride = hdr.keyframe_interval;
+    }
+    if (fstat(fileno(in), &st) < 0 || vtuidx_builder_init(&b, stride) < 0) {
+        fclose(in);
+        return -1;
+    }
+
+    if (!text) {
+        struct log_reader *r = log_reader_open(log_path);
+        struct vtulog_record rec;
+        struct vtulog_footer ftr;
+        int sealed = 0;
+
+        error = !r || log_reader_read(r, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+                log_reader_set_header(r, &hdr) < 0;
+        /* One at a time: every record's offset is needed */
+        while (!error && log_reader_records(r, &rec, 1, &ftr, &sealed) == 1) {
+            vtuidx_add(&b, &rec, log_reader_record_offset(r));
+        }
+        if (r) {
+            error |= log_reader_error(r);
+            log_reader_close(r);
+        }
+    } else {
+        char line[VTULOG_TEXT_LINE_MAX];
+        struct vtulog_record rec;
+        long offset = 0;
+
+        rewind(in);
+        while (fgets(line, sizeof(line), in)) {
+            if (vtulog_parse_record(line, &rec) == 0) {
+                vtuidx_add(&b, &rec, offset);
+            }
+            offset += strlen(line);
+        }
+        error = ferror(in);
+    }
+
+    if (!error) {
+        vtuidx_path(log_path, idx_path, sizeof(idx_path));
+        rc = vtuidx_write(&b, idx_path, st.st_size, text);
+    }
+    vtuidx_builder_free(&b);
+    fclose(in);
+    return rc;
+}
+
+int vtuidx_load(struct vtuidx *idx, const char *path) {
+    FILE *f = fopen(path, "rb");
+
+    memset(idx, 0, sizeof(*idx));
+    if (!f) {
+        return -1;
+    }
+
+    if (fread(&idx->hdr, sizeof(idx->hdr), 1, f) != 1 ||
+        memcmp(idx->hdr.magic, VTUIDX_MAGIC, sizeof(idx->hdr.magic)) != 0 ||
+        idx->hdr.version != VTUIDX_VERSION ||
+        idx->hdr.header_size != sizeof(idx->hdr)) {
+        fclose(f);
+        return -1;
+    }
+
+    idx->entries = malloc((idx->hdr.entry_count + 1) * sizeof(*idx->entries));
+    idx->ids = malloc((idx->hdr.id_count + 1) * sizeof(*idx->ids));
+    if (!idx->entries || !idx->ids ||
+        fread(idx->entries, sizeof(*idx->entries), idx->hdr.entry_count, f) !=
+            idx->hdr.entry_count ||
+        fread(idx->ids, sizeof(*idx->ids), idx->hdr.id_count, f) != idx->hdr.id_count) {
+        vtuidx_free(idx);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+void vtuidx_free(struct vtuidx *idx) {
+    free(idx->entries);
+    free(idx->ids);
+    idx->entries = NULL;
+    idx->ids = NULL;
+}
+
+uint64_t vtuidx_seek(const struct vtuidx *idx, uint64_t start_us) {
+    uint32_t lo = 0, hi = idx->hdr.entry_count;
+
+    /* Last entry strictly before start_us: frames with the same timestamp
+     * may sit just before an entry */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].timestamp_us < start_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo == 0 ? 0 : idx->entries[lo - 1].offset;
+}
+
+const struct vtuidx_id *vtuidx_find(const struct vtuidx *idx, uint32_t key) {
+    struct vtuidx_id probe = { .key = key };
+
+    return bsearch(&probe, idx->ids, idx->hdr.id_count, sizeof(probe), compare_ids);
+}
+
+void vtuidx_path(const char *log_path, char *buf, size_t len) {
+    static const char *const compressed[] = { ".zst", ".lz4" };
+    const char *slash = strrchr(log_path, '/');
+    const char *base = slash ? slash + 1 : log_path;
+    int base_len = (int)strlen(log_path);
+
+    /* can-3.vtulog.zst shares can-3.vtuidx with the plain segment */
+    for (size_t i = 0; i < sizeof(compressed) / sizeof(compressed[0]); i++) {
+        int ext_len = (int)strlen(compressed[i]);
+        if (base_len > ext_len &&
+            strcmp(log_path + base_len - ext_len, compressed[i]) == 0) {
+            base_len -= ext_len;
+            break;
+        }
+    }
+
+    for (int i = base_len - 1; i >= (int)(base - log_path); i--) {
+        if (log_path[i] == '.') {
+            base_len = i;
+            break;
+        }
+    }
+    snprintf(buf, len, "%.*s%s", base_len, log_path, VTUIDX_EXTENSION);
+}
@@ -0,0 +1,181 @@
+/**
+ * @file vtuidx.h
+ * @brief Sparse index sidecar for CAN log segments (.vtuidx)
+ *
+ * vtu-logger writes one can-N.vtuidx next to every can-N.vtulog / can-N.log
+ * segment when the segment is closed. It lets vtu-logquery jump to a time
+ * window and skip segments that cannot contain the requested IDs without
+ * reading the log itself.
+ *
+ *   +--------------------------+
+ *   | vtuidx_header (64)       |
+ *   +--------------------------+
+ *   | vtuidx_entry (16)        |  timestamp -> byte offset of every
+ *   | ...                      |  stride-th record
+ *   +--------------------------+
+ *   | vtuidx_id (24)           |  per-ID first/last/count, sorted by key
+ *   | ...                      |
+ *   +--------------------------+
+ *
+ * Offsets are byte offsets into the segment, so the same index works for
+ * binary and text logs. In a delta-encoded segment the stride equals the
+ * keyframe interval and each offset is that of the keyframe starting the
+ * entry's record. An index whose log_size doesn't match the segment is
+ * stale and must be ignored.
+ */
+
+#ifndef VTU_VTUIDX_H
+#define VTU_VTUIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vtulog.h"
+
+#define VTUIDX_MAGIC            "VTUIDX\0\0"
+#define VTUIDX_VERSION          1
+#define VTUIDX_EXTENSION        ".vtuidx"
+#define VTUIDX_DEFAULT_STRIDE   1000    /* Records between time entries */
+
+/* ID keys: the identifier with bit 31 set for 29-bit identifiers */
+#define VTUIDX_KEY_EXT          0x80000000u
+
+struct vtuidx_header {
+    char     magic[8];          /* VTUIDX_MAGIC */
+    uint16_t version;           /* VTUIDX_VERSION */
+    uint16_t header_size;       /* sizeof(struct vtuidx_header) */
+    uint32_t stride;            /* Records between time entries */
+    uint64_t log_size;          /* Size of the indexed segment in bytes */
+    uint64_t record_count;      /* Frames in the segment */
+    uint32_t entry_count;       /* struct vtuidx_entry that follow */
+    uint32_t id_count;          /* struct vtuidx_id after the entries */
+    uint64_t first_us;          /* Earliest / latest frame timestamp */
+    uint64_t last_us;
+    uint8_t  text;              /* 1 if the segment is a text log */
+    uint8_t  reserved[7];
+};
+
+struct vtuidx_entry {
+    uint64_t timestamp_us;
+    uint64_t offset;            /* Byte offset of the record in the segment */
+};
+
+struct vtuidx_id {
+    uint32_t key;               /* can_id | VTUIDX_KEY_EXT */
+    uint32_t count;
+    uint64_t first_us;
+    uint64_t last_us;
+};
+
+_Static_assert(sizeof(struct vtuidx_header) == 64, "vtuidx header must be 64 bytes");
+_Static_assert(sizeof(struct vtuidx_entry) == 16, "vtuidx entry must be 16 bytes");
+_Static_assert(sizeof(struct vtuidx_id) == 24, "vtuidx id must be 24 bytes");
+
+static inline uint32_t vtuidx_key(const struct vtulog_record *rec) {
+    return rec->can_id | ((rec->flags & VTULOG_FLAG_EXT) ? VTUIDX_KEY_EXT : 0);
+}
+
+/**
+ * @brief Parse a hex CAN ID as given on the command line into an ID key
+ *
+ * The ID is 29-bit if it has a trailing 'x' (123x), is written with 8
+ * digits (00000123) or is above 7FF; otherwise it is 11-bit.
+ * @param end Set to the first character after the ID
+ * @return 0 on success, -1 if s doesn't start with a valid ID
+ */
+int vtuidx_parse_key(const char *s, char **end, uint32_t *key);
+
+/*============================================================================
+ * Building (vtu-logger)
+ *===========================================================================*/
+
+/**
+ * @brief Index under construction for the segment being written
+ *
+ * IDs are kept in an open-addressed hash table so adding a record is O(1)
+ * on the writer thread; they are sorted only when the index is written.
+ */
+struct vtuidx_builder {
+    uint32_t stride;
+    uint64_t record_count;
+    uint64_t first_us;
+    uint64_t last_us;
+    struct vtuidx_entry *entries;
+    uint32_t entry_count;
+    uint32_t entry_cap;
+    struct vtuidx_id *ids;      /* Hash table, count == 0 marks a free slot */
+    uint32_t id_mask;
+    uint32_t id_count;
+};
+
+/**
+ * @return 0 on success, -1 on allocation failure
+ */
+int vtuidx_builder_init(struct vtuidx_builder *b, uint32_t stride);
+void vtuidx_builder_free(struct vtuidx_builder *b);
+
+/**
+ * @brief Forget everything added so far (start of a new segment)
+ */
+void vtuidx_builder_reset(struct vtuidx_builder *b);
+
+/**
+ * @brief Account for one record written at byte offset in the segment
+ * @return 0 on success, -1 on allocation failure (the record is not indexed)
+ */
+int vtuidx_add(struct vtuidx_builder *b, const struct vtulog_record *rec,
+               uint64_t offset);
+
+/**
+ * @brief Write the index for a segment of log_size bytes
+ *
+ * Written to a temporary file and renamed into place, so readers never
+ * see a partial index.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int vtuidx_write(const struct vtuidx_builder *b, const char *path,
+                 uint64_t log_size, int text);
+
+/**
+ * @brief Build and write the index of an existing segment from scratch
+ * @return 0 on success, -1 on error
+ */
+int vtuidx_rebuild(const char *log_path, uint32_t stride);
+
+/*============================================================================
+ * Reading (vtu-logquery)
+ *===========================================================================*/
+
+struct vtuidx {
+    struct vtuidx_header hdr;
+    struct vtuidx_entry *entries;
+    struct vtuidx_id *ids;      /* Sorted by key */
+};
+
+/**
+ * @brief Load an index
+ * @return 0 on success, -1 if missing or not a valid index
+ */
+int vtuidx_load(struct vtuidx *idx, const char *path);
+void vtuidx_free(struct vtuidx *idx);
+
+/**
+ * @brief Byte offset to start reading from to see every frame at or after start_us
+ * @return Offset of a record, or 0 if the segment must be read from the start
+ */
+uint64_t vtuidx_seek(const struct vtuidx *idx, uint64_t start_us);
+
+/**
+ * @brief Look up the summary for one ID key
+ * @return The summary, or NULL if the ID does not occur in the segment
+ */
+const struct vtuidx_id *vtuidx_find(const struct vtuidx *idx, uint32_t key);
+
+/**
+ * @brief Derive the sidecar path from a segment path (can-3.vtulog or
+ * can-3.vtulog.zst -> can-3.vtuidx)
+ */
+void vtuidx_path(const char *log_path, char *buf, size_t len);
+
+#endif /* VTU_VTUIDX_H */
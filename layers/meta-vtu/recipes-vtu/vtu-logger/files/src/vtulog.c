@@ -0,0 +1,496 @@
+/**
+ * @file vtulog.c
+ * @brief VTU binary CAN log format helpers
+ *
+ * Shared by vtu-logger (writing) and vtu-logdump (reading).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "vtulog.h"
+#include "vtudelta.h"
+
+#define RECOVER_BUF_SIZE (64 * 1024)
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+void vtulog_init_header(struct vtulog_file_header *hdr, const char *ifname,
+                        uint64_t start_time_us) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, VTULOG_MAGIC, VTULOG_MAGIC_LEN);
+    hdr->version = VTULOG_VERSION;
+    hdr->header_size = sizeof(struct vtulog_file_header);
+    hdr->record_size = VTULOG_CLASSIC_RECORD_SIZE;
+    hdr->start_time_us = start_time_us;
+    if (ifname) {
+        strncpy(hdr->ifname, ifname, sizeof(hdr->ifname) - 1);
+    }
+}
+
+int vtulog_check_header(const struct vtulog_file_header *hdr) {
+    if (memcmp(hdr->magic, VTULOG_MAGIC, VTULOG_MAGIC_LEN) != 0) {
+        return -1;
+    }
+    if (hdr->version < 1 || hdr->version > VTULOG_VERSION ||
+        hdr->header_size != sizeof(struct vtulog_file_header) ||
+        hdr->record_size != VTULOG_CLASSIC_RECORD_SIZE) {
+        return -1;
+    }
+    if ((hdr->flags & ~VTULOG_HDR_DELTA) ||
+        ((hdr->flags & VTULOG_HDR_DELTA) && hdr->keyframe_interval == 0) ||
+        hdr->channel_count > VTULOG_MAX_CHANNELS) {
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t vtulog_crc32(uint32_t crc, const void *data, size_t len) {
+    static uint32_t table[256];
+    static int table_ready = 0;
+    const uint8_t *p = data;
+
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void vtulog_init_footer(struct vtulog_footer *ftr, uint64_t record_count,
+                        uint32_t crc32, uint64_t end_time_us) {
+    memset(ftr, 0, sizeof(*ftr));
+    memcpy(ftr->magic, VTULOG_FOOTER_MAGIC, VTULOG_MAGIC_LEN);
+    ftr->record_count = record_count;
+    ftr->end_time_us = end_time_us;
+    ftr->crc32 = crc32;
+}
+
+/* Payload lengths a CAN-FD DLC can encode */
+static int fd_len_valid(uint8_t len) {
+    return len <= 8 || len == 12 || len == 16 || len == 20 || len == 24 ||
+           len == 32 || len == 48 || len == 64;
+}
+
+int vtulog_record_valid(const struct vtulog_record *rec) {
+    const uint8_t known_flags = VTULOG_FLAG_EXT | VTULOG_FLAG_RTR | VTULOG_FLAG_ERR |
+                                VTULOG_FLAG_FD | VTULOG_FLAG_BRS | VTULOG_FLAG_ESI |
+                                VTULOG_TS_SOURCE_MASK;
+
+    if (rec->timestamp_us == 0) {
+        return 0;
+    }
+    if (rec->flags & VTULOG_FLAG_FD) {
+        /* CAN-FD has no remote frames */
+        if (!fd_len_valid(rec->dlc) || (rec->flags & VTULOG_FLAG_RTR)) {
+            return 0;
+        }
+    } else if (rec->dlc > 8 || (rec->flags & (VTULOG_FLAG_BRS | VTULOG_FLAG_ESI))) {
+        return 0;
+    }
+    if ((rec->flags & ~known_flags) || rec->channel >= VTULOG_MAX_CHANNELS ||
+        rec->reserved) {
+        return 0;
+    }
+    if ((rec->flags & VTULOG_TS_SOURCE_MASK) == VTULOG_TS_SOURCE_MASK) {
+        return 0;
+    }
+    if (rec->can_id > ((rec->flags & VTULOG_FLAG_EXT) ? 0x1FFFFFFFu : 0x7FFu)) {
+        return 0;
+    }
+    /* The logger zero-pads the payload */
+    for (size_t i = rec->dlc; i < vtulog_record_size(rec) - VTULOG_RECORD_HEAD_SIZE; i++) {
+        if (rec->data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+long vtulog_segment_records(int fd, struct vtulog_footer *ftr, int *sealed) {
+    struct vtulog_file_header hdr;
+    struct vtulog_footer tail;
+    struct stat st;
+    off_t data_len;
+
+    *sealed = 0;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(hdr) ||
+        pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        return -1;
+    }
+    if (st.st_size < (off_t)vtulog_data_offset(&hdr)) {
+        return -1;
+    }
+    data_len = st.st_size - vtulog_data_offset(&hdr);
+
+    if (hdr.flags & VTULOG_HDR_DELTA) {
+        /* End marker + footer; the size says nothing about the count */
+        uint8_t end[1 + sizeof(tail)];
+
+        if (data_len >= (off_t)sizeof(end) &&
+            pread(fd, end, sizeof(end), st.st_size - sizeof(end)) == sizeof(end) &&
+            end[0] == VTUDELTA_TAG_END &&
+            memcmp(end + 1, VTULOG_FOOTER_MAGIC, VTULOG_MAGIC_LEN) == 0) {
+            memcpy(&tail, end + 1, sizeof(tail));
+            *sealed = 1;
+            if (ftr) {
+                *ftr = tail;
+            }
+            return (long)tail.record_count;
+        }
+        return 0;
+    }
+
+    /* Before version 5 all records have the classic size, and the footer's
+     * count must match the size of the record area */
+    if (data_len >= (off_t)sizeof(tail) &&
+        pread(fd, &tail, sizeof(tail), st.st_size - sizeof(tail)) == sizeof(tail) &&
+        memcmp(tail.magic, VTULOG_FOOTER_MAGIC, VTULOG_MAGIC_LEN) == 0 &&
+        (hdr.version >= 5 ||
+         tail.record_count * VTULOG_CLASSIC_RECORD_SIZE == (uint64_t)(data_len - sizeof(tail)))) {
+        *sealed = 1;
+        if (ftr) {
+            *ftr = tail;
+        }
+        return (long)tail.record_count;
+    }
+
+    return hdr.version >= 5 ? 0 : (long)(data_len / VTULOG_CLASSIC_RECORD_SIZE);
+}
+
+/*
+ * Walk the records of an unsealed plain segment up to the first one that
+ * is torn or fails the plausibility check. Returns the number of records
+ * kept and sets *end to the offset just past the last of them.
+ */
+static long recover_plain(int fd, off_t start, off_t *end, uint32_t *crc) {
+    uint8_t *buf = malloc(RECOVER_BUF_SIZE);
+    struct vtulog_record rec;
+    off_t buf_off = start;      /* File offset of buf[0] */
+    size_t len = 0, pos = 0;
+    int file_done = 0;
+    long kept = 0;
+
+    *end = buf_off;
+    if (!buf) {
+        return -1;
+    }
+
+    for (;;) {
+        if (len - pos < sizeof(rec) && !file_done) {
+            memmove(buf, buf + pos, len - pos);
+            buf_off += pos;
+            len -= pos;
+            pos = 0;
+            ssize_t n = pread(fd, buf + len, RECOVER_BUF_SIZE - len, buf_off + len);
+            if (n <= 0) {
+                file_done = 1;
+            } else {
+                len += n;
+            }
+        }
+
+        if (len - pos < VTULOG_CLASSIC_RECORD_SIZE) {
+            break;
+        }
+        memset(&rec, 0, sizeof(rec));
+        memcpy(&rec, buf + pos, VTULOG_RECORD_HEAD_SIZE);
+        size_t size = vtulog_record_size(&rec);
+        if (rec.dlc > VTULOG_MAX_DLEN || len - pos < size) {
+            break;
+        }
+        memcpy(&rec, buf + pos, size);
+        if (!vtulog_record_valid(&rec)) {
+            break;
+        }
+        *crc = vtulog_record_crc(*crc, &rec);
+        kept++;
+        pos += size;
+        *end = buf_off + pos;
+    }
+
+    free(buf);
+    return kept;
+}
+
+/*
+ * Decode an unsealed delta-encoded segment up to the first frame that is
+ * torn, fails to decode or fails the plausibility check. Returns the number
+ * of frames kept and sets *end to the offset just past the last of them.
+ */
+static long recover_delta(int fd, off_t start, off_t *end, uint32_t *crc) {
+    struct vtudelta_dec *dec = malloc(sizeof(*dec));
+    uint8_t *buf = malloc(RECOVER_BUF_SIZE);
+    struct vtulog_record rec;
+    off_t buf_off = start;      /* File offset of buf[0] */
+    size_t len = 0, pos = 0, used;
+    int file_done = 0;
+    long kept = 0;
+
+    *end = buf_off;
+    if (!dec || !buf) {
+        free(dec);
+        free(buf);
+        return -1;
+    }
+    vtudelta_dec_reset(dec);
+
+    for (;;) {
+        if (len - pos < VTUDELTA_MAX_FRAME && !file_done) {
+            memmove(buf, buf + pos, len - pos);
+            buf_off += pos;
+            len -= pos;
+            pos = 0;
+            ssize_t n = pread(fd, buf + len, RECOVER_BUF_SIZE - len, buf_off + len);
+            if (n <= 0) {
+                file_done = 1;
+            } else {
+                len += n;
+            }
+        }
+
+        int rc = vtudelta_decode(dec, buf + pos, len - pos, &rec, &used);
+        if (rc == VTUDELTA_KEYFRAME) {
+            pos += used;
+            continue;
+        }
+        if (rc != VTUDELTA_FRAME || !vtulog_record_valid(&rec)) {
+            break;
+        }
+        *crc = vtulog_record_crc(*crc, &rec);
+        kept++;
+        pos += used;
+        *end = buf_off + pos;
+    }
+
+    free(dec);
+    free(buf);
+    return kept;
+}
+
+long vtulog_recover(const char *path) {
+    struct vtulog_file_header hdr;
+    struct vtulog_footer ftr;
+    struct timeval tv;
+    uint32_t crc = 0;
+    long total, kept;
+    int sealed;
+    off_t pos;
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || vtulog_check_header(&hdr) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    total = vtulog_segment_records(fd, NULL, &sealed);
+    if (total < 0 || sealed) {
+        close(fd);
+        return total;
+    }
+    pos = vtulog_data_offset(&hdr);
+
+    if (hdr.flags & VTULOG_HDR_DELTA) {
+        static const uint8_t end_tag = VTUDELTA_TAG_END;
+
+        kept = recover_delta(fd, pos, &pos, &crc);
+        if (kept < 0 || pwrite(fd, &end_tag, 1, pos) != 1) {
+            close(fd);
+            return -1;
+        }
+        pos++;
+    } else {
+        /* Keep records up to the first one that fails the plausibility check */
+        kept = recover_plain(fd, pos, &pos, &crc);
+        if (kept < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    gettimeofday(&tv, NULL);
+    vtulog_init_footer(&ftr, kept, crc, (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+    if (ftruncate(fd, pos) < 0 ||
+        pwrite(fd, &ftr, sizeof(ftr), pos) != sizeof(ftr) ||
+        fsync(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return kept;
+}
+
+void vtulog_format_time(uint64_t timestamp_us, char *buf, size_t len) {
+    /* localtime_r() is expensive; frames arrive many times per second, so
+     * only redo the calendar conversion when the second changes. */
+    static time_t cached_sec = (time_t)-1;
+    static char cached_prefix[32];
+    time_t sec = (time_t)(timestamp_us / 1000000);
+
+    if (sec != cached_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cached_prefix, sizeof(cached_prefix), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+
+    snprintf(buf, len, "%s.%06lu", cached_prefix,
+             (unsigned long)(timestamp_us % 1000000));
+}
+
+int vtulog_format_record(const struct vtulog_record *rec, const char *channel, char *buf) {
+    char *p = buf;
+    uint8_t dlc = rec->dlc > VTULOG_MAX_DLEN ? VTULOG_MAX_DLEN : rec->dlc;
+
+    vtulog_format_time(rec->timestamp_us, p, 32);
+    p += strlen(p);
+    if (channel) {
+        p += sprintf(p, "  %.15s", channel);
+    }
+
+    if (rec->flags & VTULOG_FLAG_EXT) {
+        p += sprintf(p, "  %08X  [%u", rec->can_id, dlc);
+    } else {
+        p += sprintf(p, "  %03X  [%u", rec->can_id, dlc);
+    }
+    if (rec->flags & VTULOG_FLAG_FD) {
+        p += sprintf(p, " FD%s%s", (rec->flags & VTULOG_FLAG_BRS) ? " BRS" : "",
+                     (rec->flags & VTULOG_FLAG_ESI) ? " ESI" : "");
+    }
+    *p++ = ']';
+    *p++ = ' ';
+
+    for (int i = 0; i < dlc; i++) {
+        *p++ = ' ';
+        *p++ = hex_digits[rec->data[i] >> 4];
+        *p++ = hex_digits[rec->data[i] & 0x0F];
+    }
+
+    *p++ = '\n';
+    *p = '\0';
+    return (int)(p - buf);
+}
+
+int vtulog_parse_record(const char *line, struct vtulog_record *rec) {
+    /* Same trick as vtulog_format_time(): mktime() only once per second */
+    static char cached_prefix[19];
+    static time_t cached_sec;
+    char id[16];
+    unsigned long usec;
+    unsigned int dlc;
+    uint8_t fd_flags = 0;
+    int pos;
+
+    if (strlen(line) < 27 || line[4] != '-' || line[19] != '.') {
+        return -1;
+    }
+
+    if (memcmp(line, cached_prefix, sizeof(cached_prefix)) != 0) {
+        struct tm tm;
+        time_t sec;
+
+        memset(&tm, 0, sizeof(tm));
+        if (sscanf(line, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+            return -1;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        sec = mktime(&tm);
+        if (sec == (time_t)-1) {
+            return -1;
+        }
+        memcpy(cached_prefix, line, sizeof(cached_prefix));
+        cached_sec = sec;
+    }
+
+    if (sscanf(line + 20, "%6lu %8[0-9A-Fa-f] [%u%n", &usec, id, &dlc, &pos) != 3) {
+        /* Multi-channel layout: skip the interface column */
+        if (sscanf(line + 20, "%6lu %*15s %8[0-9A-Fa-f] [%u%n", &usec, id, &dlc, &pos) != 3) {
+            return -1;
+        }
+    }
+
+    /* CAN-FD markers up to the closing bracket */
+    const char *p = line + 20 + pos;
+    if (strncmp(p, " FD", 3) == 0) {
+        fd_flags = VTULOG_FLAG_FD;
+        p += 3;
+        if (strncmp(p, " BRS", 4) == 0) {
+            fd_flags |= VTULOG_FLAG_BRS;
+            p += 4;
+        }
+        if (strncmp(p, " ESI", 4) == 0) {
+            fd_flags |= VTULOG_FLAG_ESI;
+            p += 4;
+        }
+    }
+    if (*p++ != ']' || dlc > (fd_flags ? VTULOG_MAX_DLEN : 8)) {
+        return -1;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp_us = (uint64_t)cached_sec * 1000000 + usec;
+    rec->can_id = strtoul(id, NULL, 16);
+    rec->dlc = dlc;
+    rec->flags = fd_flags;
+    if (strlen(id) == 8) {
+        rec->flags |= VTULOG_FLAG_EXT;
+    }
+
+    for (unsigned int i = 0; i < dlc; i++) {
+        unsigned int byte;
+        int n;
+        if (sscanf(p, " %2x%n", &byte, &n) != 1) {
+            return -1;
+        }
+        rec->data[i] = byte;
+        p += n;
+    }
+    return 0;
+}
+
+int vtulog_format_text_banner(uint64_t start_time_us, const char *channels,
+                              char *buf, size_t len) {
+    char timestamp[64];
+
+    vtulog_format_time(start_time_us, timestamp, sizeof(timestamp));
+    if (channels) {
+        return snprintf(buf, len,
+                        "=== VTU CAN Bus Log ===\n"
+                        "Started: %s\n"
+                        "Channels: %s\n"
+                        "Format: TIMESTAMP IFACE CAN_ID [DLC] DATA\n"
+                        "========================\n\n",
+                        timestamp, channels);
+    }
+    return snprintf(buf, len,
+                    "=== VTU CAN Bus Log ===\n"
+                    "Started: %s\n"
+                    "Format: TIMESTAMP CAN_ID [DLC] DATA\n"
+                    "========================\n\n",
+                    timestamp);
+}
@@ -0,0 +1,265 @@
+/**
+ * @file vtulog.h
+ * @brief VTU binary CAN log format (.vtulog)
+ *
+ * A .vtulog file is a fixed 64-byte file header followed by a stream of
+ * frame records: 24 bytes for a classic CAN frame, up to 80 for a CAN-FD
+ * frame (see vtulog_record_size()). All fields are stored little-endian
+ * (the native order of every VTU target), so records can be written and
+ * read with a single fwrite()/fread() and no per-field conversion.
+ *
+ *   +--------------------------+
+ *   | vtulog_file_header (64)  |
+ *   +--------------------------+
+ *   | vtulog_channel (16)      |  one per captured interface (v4)
+ *   | ...                      |
+ *   +--------------------------+
+ *   | vtulog_record (24)       |
+ *   | vtulog_record (24-80)    |  CAN-FD frame (v5)
+ *   | ...                      |
+ *   +--------------------------+
+ *   | vtulog_footer (32)       |  written when the segment is closed
+ *   +--------------------------+
+ *
+ * A segment without a valid footer was not closed cleanly; readers treat
+ * every whole record after the header as data, and vtulog_recover()
+ * truncates such a segment to its last valid record and seals it.
+ *
+ * With VTULOG_HDR_DELTA set in the header, the records are delta encoded
+ * (see vtudelta.h) and the footer is preceded by an end marker; everything
+ * else, including the footer's count and CRC, describes the decoded records.
+ */
+
+#ifndef VTU_VTULOG_H
+#define VTU_VTULOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*============================================================================
+ * File Header
+ *===========================================================================*/
+
+#define VTULOG_MAGIC            "VTULOG\0\0"
+#define VTULOG_MAGIC_LEN        8
+#define VTULOG_VERSION          5       /* 2: footer, 3: delta, 4: channels, 5: CAN-FD */
+#define VTULOG_EXTENSION        ".vtulog"
+
+/* Header flags */
+#define VTULOG_HDR_DELTA        0x0001  /* Records are delta encoded (vtudelta.h) */
+
+/**
+ * @brief File header written once at the start of every .vtulog segment
+ */
+struct vtulog_file_header {
+    char     magic[VTULOG_MAGIC_LEN];   /* VTULOG_MAGIC */
+    uint16_t version;                   /* VTULOG_VERSION */
+    uint16_t header_size;               /* sizeof(struct vtulog_file_header) */
+    uint16_t record_size;               /* VTULOG_CLASSIC_RECORD_SIZE */
+    uint16_t flags;                     /* VTULOG_HDR_* */
+    uint64_t start_time_us;             /* Wall clock at file creation (µs since epoch) */
+    char     ifname[16];                /* Source CAN interface, NUL terminated */
+    uint32_t keyframe_interval;         /* VTULOG_HDR_DELTA: frames between keyframes */
+    uint8_t  channel_count;             /* struct vtulog_channel after the header */
+    uint8_t  reserved[19];
+};
+
+#define VTULOG_MAX_CHANNELS     16
+
+/**
+ * @brief Channel table entry; a record's channel indexes this table
+ *
+ * Segments before version 4 have no table (channel_count 0): all their
+ * records are channel 0, the interface named in the header.
+ */
+struct vtulog_channel {
+    char     ifname[16];                /* Interface, NUL terminated */
+};
+
+/*============================================================================
+ * Frame Record
+ *===========================================================================*/
+
+/* Record flags */
+#define VTULOG_FLAG_EXT         0x01    /* 29-bit extended identifier */
+#define VTULOG_FLAG_RTR         0x02    /* Remote transmission request */
+#define VTULOG_FLAG_ERR         0x04    /* Error frame */
+#define VTULOG_FLAG_FD          0x08    /* CAN-FD frame */
+#define VTULOG_FLAG_BRS         0x40    /* CAN-FD bit rate switch */
+#define VTULOG_FLAG_ESI         0x80    /* CAN-FD error state indicator */
+
+/* Timestamp source, stored in bits 4-5 of the record flags */
+#define VTULOG_TS_SOURCE_MASK   0x30
+#define VTULOG_TS_HOST          0x00    /* Host clock when the frame was written */
+#define VTULOG_TS_KERNEL        0x10    /* Kernel software receive timestamp */
+#define VTULOG_TS_HARDWARE      0x20    /* Controller hardware receive timestamp */
+
+#define VTULOG_MAX_DLEN             64  /* CAN-FD payload */
+#define VTULOG_RECORD_HEAD_SIZE     16  /* Record without its payload */
+#define VTULOG_CLASSIC_RECORD_SIZE  24
+
+/**
+ * @brief One logged CAN frame
+ *
+ * On disk a record is stored up to the end of its payload rounded up to
+ * 8 bytes, but never shorter than a classic frame: 24 bytes for up to 8
+ * payload bytes, 80 for a 64-byte CAN-FD frame. In memory it always has
+ * room for the largest payload.
+ */
+struct vtulog_record {
+    uint64_t timestamp_us;      /* Receive time (µs), see VTULOG_TS_* for the clock */
+    uint32_t can_id;            /* 11-bit or 29-bit identifier, no flag bits */
+    uint8_t  dlc;               /* Payload length in bytes (0-8, CAN-FD 0-64) */
+    uint8_t  flags;             /* VTULOG_FLAG_* */
+    uint8_t  channel;           /* Index into the segment's channel table */
+    uint8_t  reserved;
+    uint8_t  data[VTULOG_MAX_DLEN];     /* Payload, zero padded */
+};
+
+/*============================================================================
+ * Segment Footer
+ *===========================================================================*/
+
+#define VTULOG_FOOTER_MAGIC     "VTUEND\0\0"
+
+/**
+ * @brief Trailer sealing a closed segment
+ */
+struct vtulog_footer {
+    char     magic[VTULOG_MAGIC_LEN];   /* VTULOG_FOOTER_MAGIC */
+    uint64_t record_count;              /* Records between header and footer */
+    uint64_t end_time_us;               /* Wall clock when the segment was closed */
+    uint32_t crc32;                     /* CRC-32 (IEEE) of all record bytes */
+    uint32_t reserved;
+};
+
+_Static_assert(sizeof(struct vtulog_file_header) == 64, "vtulog header must be 64 bytes");
+_Static_assert(sizeof(struct vtulog_record) == VTULOG_RECORD_HEAD_SIZE + VTULOG_MAX_DLEN,
+               "vtulog record must be 80 bytes");
+_Static_assert(sizeof(struct vtulog_footer) == 32, "vtulog footer must be 32 bytes");
+_Static_assert(sizeof(struct vtulog_channel) == 16, "vtulog channel must be 16 bytes");
+
+/**
+ * @brief Bytes a record with a dlc-byte payload takes on disk
+ */
+static inline size_t vtulog_record_size_for(uint8_t dlc) {
+    return dlc <= 8 ? VTULOG_CLASSIC_RECORD_SIZE
+                    : VTULOG_RECORD_HEAD_SIZE + ((dlc + 7u) & ~7u);
+}
+
+static inline size_t vtulog_record_size(const struct vtulog_record *rec) {
+    return vtulog_record_size_for(rec->dlc);
+}
+
+/**
+ * @brief Offset of the first record: the header plus its channel table
+ */
+static inline size_t vtulog_data_offset(const struct vtulog_file_header *hdr) {
+    return sizeof(*hdr) + hdr->channel_count * sizeof(struct vtulog_channel);
+}
+
+/*============================================================================
+ * Helpers (vtulog.c)
+ *===========================================================================*/
+
+/* Longest line produced by vtulog_format_record(), including newline */
+#define VTULOG_TEXT_LINE_MAX    288
+
+/**
+ * @brief Fill a file header for a new segment
+ */
+void vtulog_init_header(struct vtulog_file_header *hdr, const char *ifname,
+                        uint64_t start_time_us);
+
+/**
+ * @brief Validate a header read from disk
+ * @return 0 if the header is a supported .vtulog header, -1 otherwise
+ */
+int vtulog_check_header(const struct vtulog_file_header *hdr);
+
+/**
+ * @brief Update a running CRC-32 (IEEE 802.3); start with crc = 0
+ */
+uint32_t vtulog_crc32(uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief Add a record's on-disk bytes to a running segment CRC
+ */
+static inline uint32_t vtulog_record_crc(uint32_t crc, const struct vtulog_record *rec) {
+    return vtulog_crc32(crc, rec, vtulog_record_size(rec));
+}
+
+/**
+ * @brief Fill a footer for a segment holding record_count records
+ */
+void vtulog_init_footer(struct vtulog_footer *ftr, uint64_t record_count,
+                        uint32_t crc32, uint64_t end_time_us);
+
+/**
+ * @brief Plausibility check used when scanning an unsealed segment
+ * @return 1 if the record could have been written by vtu-logger
+ */
+int vtulog_record_valid(const struct vtulog_record *rec);
+
+/**
+ * @brief Find the record area of an open segment
+ *
+ * @param fd          Segment opened for reading, positioned anywhere
+ * @param ftr         Receives the footer if the segment is sealed (may be NULL)
+ * @param sealed      Set to 1 if a valid footer was found
+ * @return Number of whole records in the segment, or -1 on error. The
+ *         count of an unsealed delta-encoded or version 5 segment is only
+ *         known after reading it through; 0 is returned for those.
+ */
+long vtulog_segment_records(int fd, struct vtulog_footer *ftr, int *sealed);
+
+/**
+ * @brief Repair a segment left unsealed by a crash
+ *
+ * Scans the records, truncates the file after the last valid one (dropping
+ * any torn or never-written tail) and appends a footer. Sealed segments
+ * are left untouched.
+ *
+ * @return Number of records kept, or -1 if the file is not a .vtulog segment
+ */
+long vtulog_recover(const char *path);
+
+/**
+ * @brief Format a timestamp as "YYYY-MM-DD HH:MM:SS.uuuuuu" (local time)
+ */
+void vtulog_format_time(uint64_t timestamp_us, char *buf, size_t len);
+
+/**
+ * @brief Format a record in the text log layout
+ *
+ * Produces "TIMESTAMP  CAN_ID  [DLC]  XX XX ...\n", the layout used by
+ * text-mode logs and vtu-logdump. Multi-channel logs name the interface
+ * after the timestamp: "TIMESTAMP  IFACE  CAN_ID  [DLC]  XX XX ...\n".
+ * CAN-FD frames are marked inside the brackets: "[12 FD BRS]".
+ *
+ * @param channel Interface name, or NULL for the single-channel layout
+ * @param buf     Output buffer of at least VTULOG_TEXT_LINE_MAX bytes
+ * @return Number of characters written (excluding the terminating NUL)
+ */
+int vtulog_format_record(const struct vtulog_record *rec, const char *channel, char *buf);
+
+/**
+ * @brief Parse one line of a text log back into a record
+ *
+ * The inverse of vtulog_format_record(). Text logs carry no flags other
+ * than the identifier width and the CAN-FD markers, so only those are
+ * restored; an interface column is skipped (the record's channel is left
+ * at 0).
+ *
+ * @return 0 on success, -1 if the line is not a frame line (banner, trailer)
+ */
+int vtulog_parse_record(const char *line, struct vtulog_record *rec);
+
+/**
+ * @brief Write the banner that opens a text log
+ * @param channels Space-separated interface names of a multi-channel log, or NULL
+ */
+int vtulog_format_text_banner(uint64_t start_time_us, const char *channels,
+                              char *buf, size_t len);
+
+#endif /* VTU_VTULOG_H */
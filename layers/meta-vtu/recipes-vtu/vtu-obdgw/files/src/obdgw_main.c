@@ -1,25 +1,25 @@
 /*
  * VTU OBD-II Gateway
  * 
- * Listens for OBD-II diagnostic requests and responds with simulated data.
+ * Listens for OBD-II diagnostic requests and answers them with the live
+ * values of the bus, read from the shared-memory signal store that
+ * vtu-signald keeps (vtu/signal_store.h); nothing is decoded here.
  * This bridges standard OBD-II tools with our virtual CAN bus.
  */
 
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
-#include <sys/socket.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
+#include <sys/select.h>
 #include <linux/can.h>
-#include <linux/can/raw.h>
 
 #include <vtu/can_defs.h>
+#include <vtu/can_io.h>
 #include <vtu/obd2_pids.h>
+#include <vtu/signal_store.h>
 
 /* OBD-II CAN IDs */
 #define OBD2_REQUEST_BROADCAST  0x7DF   /* Broadcast request (all ECUs) */
@@ -33,64 +33,133 @@
 #define OBD2_MODE_DTC_CLEAR     0x04
 #define OBD2_MODE_VEHICLE_INFO  0x09
 
-/* Simulated vehicle state */
+/* Vehicle state, physical units as in vtu.dbc */
 static struct {
-    uint16_t rpm;           /* Engine RPM */
-    uint8_t  speed;         /* Vehicle speed km/h */
-    int8_t   coolant_temp;  /* Coolant temp (offset by -40) */
-    uint8_t  throttle;      /* Throttle position % */
-    uint8_t  fuel_level;    /* Fuel level % */
-    uint16_t engine_load;   /* Calculated engine load */
-    uint16_t maf;           /* MAF air flow rate */
-    uint8_t  intake_temp;   /* Intake air temp (offset by -40) */
-} vehicle_state = {
-    .rpm = 850,             /* Idle RPM */
-    .speed = 0,
-    .coolant_temp = 90,     /* Normal operating temp */
-    .throttle = 15,
-    .fuel_level = 75,
-    .engine_load = 25,
-    .maf = 10,
-    .intake_temp = 25,
+    float rpm;              /* Engine RPM */
+    float speed;            /* Vehicle speed km/h */
+    float coolant_temp;     /* Coolant temp degC */
+    float throttle;         /* Throttle position % */
+    float fuel_level;       /* Fuel level % */
+    float engine_load;      /* Calculated engine load % */
+    float maf;              /* MAF air flow rate g/s */
+    float intake_temp;      /* Intake air temp degC */
+} vehicle_state;
+
+/* Signal behind each data PID, by its vtu.dbc name */
+static struct {
+    uint8_t     pid;
+    const char *signal;
+    float      *value;
+    int         index;      /* Store slot, -1 = not in the store */
+} pid_signals[] = {
+    { OBD2_PID_ENGINE_LOAD,   "EngineLoad",   &vehicle_state.engine_load,  -1 },
+    { OBD2_PID_COOLANT_TEMP,  "CoolantTemp",  &vehicle_state.coolant_temp, -1 },
+    { OBD2_PID_ENGINE_RPM,    "EngineRPM",    &vehicle_state.rpm,          -1 },
+    { OBD2_PID_VEHICLE_SPEED, "VehicleSpeed", &vehicle_state.speed,        -1 },
+    { OBD2_PID_INTAKE_TEMP,   "IntakeTemp",   &vehicle_state.intake_temp,  -1 },
+    { OBD2_PID_MAF,           "MAF",          &vehicle_state.maf,          -1 },
+    { OBD2_PID_THROTTLE_POS,  "ThrottlePos",  &vehicle_state.throttle,     -1 },
+    { OBD2_PID_FUEL_LEVEL,    "FuelLevel",    &vehicle_state.fuel_level,   -1 },
 };
 
+#define NUM_PID_SIGNALS     (sizeof(pid_signals) / sizeof(pid_signals[0]))
+#define STATS_INTERVAL_SEC  60
+#define MAX_SIGNAL_AGE_US   2000000ULL  /* Older values count as no data */
+
+/* build_mode01_response() */
+#define PID_UNSUPPORTED     -1
+#define PID_NO_DATA         -2
+
 static volatile int running = 1;
-static int can_socket = -1;
+static struct vtu_can can;
+static struct vtu_store store;
+static unsigned long request_count = 0;
+static unsigned long no_data_count = 0;
 
 static void signal_handler(int sig) {
     (void)sig;
     running = 0;
 }
 
-/* Update simulated values with slight variations */
-static void update_simulation(void) {
-    static int tick = 0;
-    tick++;
+/* Map the store if there is none yet or its producer has gone */
+static void update_store(void) {
+    static int waiting = 0;
     
-    /* Simulate idle with small variations */
-    vehicle_state.rpm = 800 + (rand() % 100);
-    vehicle_state.throttle = 12 + (rand() % 6);
-    vehicle_state.engine_load = 20 + (rand() % 10);
+    if (vtu_store_live(&store)) {
+        return;
+    }
+    vtu_store_close(&store);
     
-    /* Slowly varying values */
-    if (tick % 10 == 0) {
-        if (vehicle_state.coolant_temp < 95)
-            vehicle_state.coolant_temp++;
+    if (vtu_store_open(&store, VTU_STORE_DEFAULT_NAME) < 0 || !vtu_store_live(&store)) {
+        vtu_store_close(&store);
+        if (!waiting) {
+            printf("[OBDGW] Waiting for the signal store (%s), is vtu-signald running?\n",
+                   VTU_STORE_DEFAULT_NAME);
+            waiting = 1;
+        }
+        return;
+    }
+    waiting = 0;
+    
+    for (size_t i = 0; i < NUM_PID_SIGNALS; i++) {
+        pid_signals[i].index = vtu_store_find(&store, pid_signals[i].signal);
+        if (pid_signals[i].index < 0) {
+            printf("[OBDGW] Signal %s not in the store, PID %02X has no data\n",
+                   pid_signals[i].signal, pid_signals[i].pid);
+        }
     }
+    printf("[OBDGW] Reading signals from %s (%d signals)\n",
+           VTU_STORE_DEFAULT_NAME, store.nsignals);
+}
+
+/*
+ * Load the current value behind a PID into vehicle_state: a few loads
+ * from the shared store, no syscall
+ * @return 0 when it is fresh (or the PID has no signal), -1 otherwise
+ */
+static int load_pid_value(uint8_t pid) {
+    for (size_t i = 0; i < NUM_PID_SIGNALS; i++) {
+        uint64_t ts;
+        
+        if (pid_signals[i].pid != pid) {
+            continue;
+        }
+        if (!store.hdr || pid_signals[i].index < 0 ||
+            vtu_store_read(&store, pid_signals[i].index, pid_signals[i].value, &ts) < 0 ||
+            vtu_store_now_us() - ts > MAX_SIGNAL_AGE_US) {
+            return -1;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+/* Round and clamp to one OBD-II data byte */
+static uint8_t obd_byte(float x) {
+    return x <= 0 ? 0 : x >= 255 ? 255 : (uint8_t)(x + 0.5f);
+}
+
+/* Round and clamp to two OBD-II data bytes */
+static uint16_t obd_word(float x) {
+    return x <= 0 ? 0 : x >= 65535 ? 65535 : (uint16_t)(x + 0.5f);
 }
 
 /* Build OBD-II response for Mode 01 (Current Data) */
-static int build_mode01_response(uint8_t pid, struct can_frame *response) {
+static int build_mode01_response(uint8_t pid, struct canfd_frame *response) {
     response->can_id = OBD2_RESPONSE_ECU1;
     memset(response->data, 0, 8);
     
+    if (load_pid_value(pid) < 0) {
+        return PID_NO_DATA;
+    }
+    
     switch (pid) {
         case OBD2_PID_ENGINE_LOAD:
             /* A * 100 / 255 = % */
             response->data[0] = 3;  /* Length */
             response->data[1] = 0x41;
             response->data[2] = pid;
-            response->data[3] = (vehicle_state.engine_load * 255) / 100;
+            response->data[3] = obd_byte(vehicle_state.engine_load * 255 / 100);
             response->len = 8;
             break;
             
@@ -99,14 +168,14 @@ static int build_mode01_response(uint8_t pid, struct can_frame *response) {
             response->data[0] = 3;
             response->data[1] = 0x41;
             response->data[2] = pid;
-            response->data[3] = vehicle_state.coolant_temp + 40;
+            response->data[3] = obd_byte(vehicle_state.coolant_temp + 40);
             response->len = 8;
             break;
             
         case OBD2_PID_ENGINE_RPM:
             /* ((A * 256) + B) / 4 = RPM */
             {
-                uint16_t rpm_encoded = vehicle_state.rpm * 4;
+                uint16_t rpm_encoded = obd_word(vehicle_state.rpm * 4);
                 response->data[0] = 4;
                 response->data[1] = 0x41;
                 response->data[2] = pid;
@@ -121,7 +190,7 @@ static int build_mode01_response(uint8_t pid, struct can_frame *response) {
             response->data[0] = 3;
             response->data[1] = 0x41;
             response->data[2] = pid;
-            response->data[3] = vehicle_state.speed;
+            response->data[3] = obd_byte(vehicle_state.speed);
             response->len = 8;
             break;
             
@@ -130,14 +199,14 @@ static int build_mode01_response(uint8_t pid, struct can_frame *response) {
             response->data[0] = 3;
             response->data[1] = 0x41;
             response->data[2] = pid;
-            response->data[3] = vehicle_state.intake_temp + 40;
+            response->data[3] = obd_byte(vehicle_state.intake_temp + 40);
             response->len = 8;
             break;
             
         case OBD2_PID_MAF:
             /* ((A * 256) + B) / 100 = g/s */
             {
-                uint16_t maf_encoded = vehicle_state.maf * 100;
+                uint16_t maf_encoded = obd_word(vehicle_state.maf * 100);
                 response->data[0] = 4;
                 response->data[1] = 0x41;
                 response->data[2] = pid;
@@ -152,7 +221,7 @@ static int build_mode01_response(uint8_t pid, struct can_frame *response) {
             response->data[0] = 3;
             response->data[1] = 0x41;
             response->data[2] = pid;
-            response->data[3] = (vehicle_state.throttle * 255) / 100;
+            response->data[3] = obd_byte(vehicle_state.throttle * 255 / 100);
             response->len = 8;
             break;
             
@@ -161,7 +230,7 @@ static int build_mode01_response(uint8_t pid, struct can_frame *response) {
             response->data[0] = 3;
             response->data[1] = 0x41;
             response->data[2] = pid;
-            response->data[3] = (vehicle_state.fuel_level * 255) / 100;
+            response->data[3] = obd_byte(vehicle_state.fuel_level * 255 / 100);
             response->len = 8;
             break;
             
@@ -192,20 +261,22 @@ static int build_mode01_response(uint8_t pid, struct can_frame *response) {
             
         default:
             /* Unsupported PID - no response */
-            return -1;
+            return PID_UNSUPPORTED;
     }
     
     return 0;
 }
 
 /* Process incoming OBD-II request */
-static void process_obd2_request(struct can_frame *request) {
+static void process_obd2_request(struct canfd_frame *request) {
     uint8_t length = request->data[0];
     uint8_t mode = request->data[1];
     uint8_t pid = request->data[2];
-    struct can_frame response;
+    struct canfd_frame response;
+    int ret;
     
     printf("[OBDGW] Request: Mode=%02X PID=%02X\n", mode, pid);
+    request_count++;
     
     if (length < 2) {
         printf("[OBDGW] Invalid request length\n");
@@ -214,14 +285,19 @@ static void process_obd2_request(struct can_frame *request) {
     
     switch (mode) {
         case OBD2_MODE_CURRENT_DATA:
-            if (build_mode01_response(pid, &response) == 0) {
-                if (write(can_socket, &response, sizeof(response)) < 0) {
+            ret = build_mode01_response(pid, &response);
+            if (ret == 0) {
+                if (vtu_can_send(&can, &response, 0) < 0) {
                     perror("[OBDGW] Failed to send response");
                 } else {
                     printf("[OBDGW] Response: %02X %02X %02X %02X %02X\n",
                            response.data[0], response.data[1], response.data[2],
                            response.data[3], response.data[4]);
                 }
+            } else if (ret == PID_NO_DATA) {
+                /* Like an ECU that isn't talking: no response */
+                printf("[OBDGW] No current data for PID: %02X\n", pid);
+                no_data_count++;
             } else {
                 printf("[OBDGW] Unsupported PID: %02X\n", pid);
             }
@@ -234,42 +310,21 @@ static void process_obd2_request(struct can_frame *request) {
 }
 
 static int setup_can_socket(const char *ifname) {
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    struct can_filter filter[2];
-    
-    can_socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (can_socket < 0) {
-        perror("[OBDGW] Failed to create CAN socket");
-        return -1;
-    }
-    
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
-    if (ioctl(can_socket, SIOCGIFINDEX, &ifr) < 0) {
-        perror("[OBDGW] Failed to get interface index");
-        close(can_socket);
-        return -1;
-    }
-    
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    
-    if (bind(can_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("[OBDGW] Failed to bind CAN socket");
-        close(can_socket);
-        return -1;
-    }
-    
-    /* Filter for OBD-II request IDs only */
-    filter[0].can_id = OBD2_REQUEST_BROADCAST;
-    filter[0].can_mask = CAN_SFF_MASK;
-    filter[1].can_id = OBD2_REQUEST_ECU1;
-    filter[1].can_mask = CAN_SFF_MASK;
+    /* OBD-II requests only; ISO 15765-4 is classic CAN */
+    static const struct can_filter filter[] = {
+        { .can_id = OBD2_REQUEST_BROADCAST, .can_mask = CAN_SFF_MASK },
+        { .can_id = OBD2_REQUEST_ECU1,      .can_mask = CAN_SFF_MASK },
+    };
+    struct vtu_can_opts opts = {
+        .filters = filter,
+        .nfilters = 2,
+        .overflow = 1,
+        .nonblock = 1,
+    };
     
-    if (setsockopt(can_socket, SOL_CAN_RAW, CAN_RAW_FILTER, 
-                   filter, sizeof(filter)) < 0) {
-        perror("[OBDGW] Failed to set CAN filter");
-        close(can_socket);
+    if (vtu_can_open(&can, ifname, &opts) < 0) {
+        fprintf(stderr, "[OBDGW] Failed to open CAN socket on %s: %s\n",
+                ifname, strerror(errno));
         return -1;
     }
     
@@ -279,9 +334,10 @@ static int setup_can_socket(const char *ifname) {
 
 int main(int argc, char *argv[]) {
     const char *can_if = "vcan0";
-    struct can_frame frame;
+    struct vtu_can_rx rx[VTU_CAN_MAX_BATCH];
     fd_set rdfs;
     struct timeval tv;
+    time_t last_stats;
     
     if (argc > 1) {
         can_if = argv[1];
@@ -294,47 +350,58 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    /* Seed random for simulation variations */
-    srand(time(NULL));
-    
     if (setup_can_socket(can_if) < 0) {
         return 1;
     }
+    update_store();
     
     printf("[OBDGW] Ready to respond to OBD-II queries\n");
     printf("[OBDGW] Supported: Mode 01 PIDs 04,05,0C,0D,0F,10,11,2F\n\n");
     
+    last_stats = time(NULL);
+    
     while (running) {
         FD_ZERO(&rdfs);
-        FD_SET(can_socket, &rdfs);
+        FD_SET(can.sock, &rdfs);
         
         tv.tv_sec = 1;
         tv.tv_usec = 0;
         
-        int ret = select(can_socket + 1, &rdfs, NULL, NULL, &tv);
+        int ret = select(can.sock + 1, &rdfs, NULL, NULL, &tv);
         
         if (ret < 0 && errno != EINTR) {
             perror("[OBDGW] select()");
             break;
         }
         
-        if (ret > 0 && FD_ISSET(can_socket, &rdfs)) {
-            ssize_t nbytes = read(can_socket, &frame, sizeof(frame));
-            if (nbytes < 0) {
+        /* Before answering, so requests see a restarted producer */
+        update_store();
+        
+        if (ret > 0 && FD_ISSET(can.sock, &rdfs)) {
+            /* Drain everything queued; the socket is non-blocking */
+            int n = vtu_can_recv_many(&can, rx, VTU_CAN_MAX_BATCH);
+            if (n < 0) {
                 perror("[OBDGW] read()");
                 continue;
             }
             
-            if (nbytes == sizeof(frame)) {
-                process_obd2_request(&frame);
+            for (int i = 0; i < n; i++) {
+                if (!rx[i].fd) {
+                    process_obd2_request(&rx[i].frame);
+                }
             }
         }
         
-        /* Update simulation even when idle */
-        update_simulation();
+        time_t now = time(NULL);
+        if (now - last_stats >= STATS_INTERVAL_SEC) {
+            printf("[OBDGW] Handled %lu requests, %lu without data (kernel drops: %u)\n",
+                   request_count, no_data_count, can.drops);
+            last_stats = now;
+        }
     }
     
     printf("\n[OBDGW] Shutting down...\n");
-    close(can_socket);
+    vtu_can_close(&can);
+    vtu_store_close(&store);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,229 @@
+/*
+ * VTU Signal Daemon
+ *
+ * Decodes every signal of the bus once and keeps the latest value and
+ * time of each in the shared-memory signal store (vtu/signal_store.h),
+ * where the other daemons read them without decoding CAN themselves.
+ * Signals of the VTU bus are decoded by the decoders generated from
+ * vtu.dbc (vtu/vtu_bus.h); a DBC file given with -d goes through the
+ * libvtu-common signal database instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <linux/can.h>
+
+#include <vtu/can_io.h>
+#include <vtu/signal_db.h>
+#include <vtu/signal_store.h>
+#include <vtu/vtu_bus.h>
+
+#define MAX_FILTERS         64      /* More messages than this: receive everything */
+#define STATS_INTERVAL_US   (60 * 1000000ULL)
+
+static volatile int running = 1;
+static struct vtu_can can;
+static struct vtu_sigdb sigdb;
+static struct vtu_store store;
+static float *signal_values;
+static int use_vtu_bus;                         /* Generated decoders (no -d) */
+static unsigned long frame_count = 0;
+static unsigned long unknown_count = 0;
+
+static void signal_handler(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static int setup_signals(const char *dbc_path) {
+    int line;
+    
+    if (dbc_path) {
+        if (vtu_sigdb_load_dbc(&sigdb, dbc_path, &line) < 0) {
+            if (line) {
+                fprintf(stderr, "[SIGNALD] %s:%d: invalid DBC entry\n", dbc_path, line);
+            } else {
+                fprintf(stderr, "[SIGNALD] Failed to load %s: %s\n", dbc_path, strerror(errno));
+            }
+            return -1;
+        }
+    } else if (vtu_sigdb_builtin(&sigdb) < 0) {
+        perror("[SIGNALD] Failed to load the built-in signal database");
+        return -1;
+    }
+    
+    /* The generated decoders index signals like the built-in database */
+    use_vtu_bus = !dbc_path && sigdb.nsignals == VTU_BUS_NUM_SIGNALS;
+    for (int i = 0; use_vtu_bus && i < sigdb.nsignals; i++) {
+        use_vtu_bus = strcmp(sigdb.signals[i].name, vtu_bus_signal_names[i]) == 0;
+    }
+    
+    signal_values = calloc(sigdb.nsignals ? sigdb.nsignals : 1, sizeof(*signal_values));
+    if (!signal_values) {
+        perror("[SIGNALD] calloc");
+        return -1;
+    }
+    
+    printf("[SIGNALD] Signal database: %s (%d messages, %d signals%s)\n",
+           dbc_path ? dbc_path : "built-in", sigdb.nmessages, sigdb.nsignals,
+           use_vtu_bus ? ", generated decoders" : "");
+    return 0;
+}
+
+static int setup_store(const char *name) {
+    if (vtu_store_create(&store, name, &sigdb) < 0) {
+        fprintf(stderr, "[SIGNALD] Failed to create signal store %s: %s\n",
+                name, strerror(errno));
+        return -1;
+    }
+    
+    printf("[SIGNALD] Signal store: /dev/shm%s (%zu bytes)\n", name, store.size);
+    return 0;
+}
+
+static int setup_can_socket(const char *ifname) {
+    struct can_filter filters[MAX_FILTERS];
+    struct vtu_can_opts opts = {
+        .rcv_timeout_ms = 500,      /* Notice SIGTERM on a quiet bus */
+        .fd_frames = VTU_CAN_FD_TRY,
+        .overflow = 1,
+    };
+    
+    /* Only the database's messages reach userspace */
+    if (sigdb.nmessages <= MAX_FILTERS) {
+        for (int i = 0; i < sigdb.nmessages; i++) {
+            uint32_t id = sigdb.messages[i].can_id;
+            filters[i].can_id = id;
+            filters[i].can_mask = CAN_EFF_FLAG | ((id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+        }
+        opts.filters = filters;
+        opts.nfilters = sigdb.nmessages;
+    }
+    
+    if (vtu_can_open(&can, ifname, &opts) < 0) {
+        fprintf(stderr, "[SIGNALD] Failed to open CAN socket on %s: %s\n",
+                ifname, strerror(errno));
+        return -1;
+    }
+    
+    /* Without kernel support only classic frames arrive */
+    if (!can.fd_frames) {
+        printf("[SIGNALD] CAN-FD not supported, classic frames only\n");
+    }
+    
+    printf("[SIGNALD] Listening on %s\n", ifname);
+    return 0;
+}
+
+/* Decode one frame and store the signals it carried */
+static void process_frame(const struct canfd_frame *frame, uint64_t now_us) {
+    const struct vtu_message *msg;
+    
+    if (frame->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+        return;
+    }
+    
+    if (use_vtu_bus) {
+        int m = vtu_bus_decode(frame->can_id, frame->data, frame->len, signal_values);
+        msg = m >= 0 ? &sigdb.messages[m] : NULL;
+    } else {
+        msg = vtu_sigdb_decode_frame(&sigdb, frame->can_id, frame->data, frame->len,
+                                     signal_values);
+    }
+    if (!msg) {
+        unknown_count++;
+        return;
+    }
+    frame_count++;
+    
+    /* A short frame only updates the signals it carried */
+    vtu_store_publish_frame(&store, &sigdb, msg, frame->len, signal_values, now_us);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] [IFACE]\n", prog);
+    printf("Options:\n");
+    printf("  -d DBC      Signal database (default: built-in VTU bus layout)\n");
+    printf("  -s NAME     Shared-memory store name (default: %s)\n", VTU_STORE_DEFAULT_NAME);
+    printf("  -h          Show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *can_if = "vcan0";
+    const char *dbc_path = NULL;
+    const char *store_name = VTU_STORE_DEFAULT_NAME;
+    struct vtu_can_rx rx[VTU_CAN_MAX_BATCH];
+    uint64_t last_stats;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "d:s:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                dbc_path = optarg;
+                break;
+            case 's':
+                store_name = optarg;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        can_if = argv[optind];
+    }
+    
+    printf("VTU Signal Daemon v1.0\n");
+    printf("======================\n");
+    
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    
+    if (setup_signals(dbc_path) < 0 || setup_store(store_name) < 0) {
+        return 1;
+    }
+    if (setup_can_socket(can_if) < 0) {
+        vtu_store_close(&store);
+        return 1;
+    }
+    
+    printf("[SIGNALD] Ready\n\n");
+    
+    last_stats = vtu_store_now_us();
+    
+    while (running) {
+        /* Everything queued in one call; one timestamp per batch */
+        int n = vtu_can_recv_many(&can, rx, VTU_CAN_MAX_BATCH);
+        if (n < 0 && errno != EINTR) {
+            perror("[SIGNALD] read()");
+            break;
+        }
+        
+        uint64_t now = vtu_store_now_us();
+        for (int i = 0; i < n; i++) {
+            process_frame(&rx[i].frame, now);
+        }
+        
+        if (now - last_stats >= STATS_INTERVAL_US) {
+            printf("[SIGNALD] Stored %lu frames, %lu unknown (kernel drops: %u)\n",
+                   frame_count, unknown_count, can.drops);
+            last_stats = now;
+        }
+    }
+    
+    printf("\n[SIGNALD] Shutting down...\n");
+    
+    /* Consumers see the store closed and wait for the next producer */
+    vtu_store_close(&store);
+    vtu_can_close(&can);
+    vtu_sigdb_free(&sigdb);
+    free(signal_values);
+    
+    return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file pubqueue.c
+ * @brief Bounded queue of MQTT messages between the CAN loop and the publisher
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pubqueue.h"
+
+int pubq_init(struct pubqueue *q, uint32_t capacity) {
+    pthread_condattr_t attr;
+
+    memset(q, 0, sizeof(*q));
+    q->slots = calloc(capacity, sizeof(*q->slots));
+    if (!q->slots) {
+        return -1;
+    }
+    q->capacity = capacity;
+
+    /* Timed waits on the monotonic clock, immune to clock steps */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&q->lock, NULL);
+    return 0;
+}
+
+void pubq_free(struct pubqueue *q) {
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q->slots);
+    q->slots = NULL;
+}
+
+int pubq_push(struct pubqueue *q, const char *topic, const char *payload, int payloadlen,
+              int retained) {
+    struct pub_msg *msg;
+    int dropped = 0;
+
+    if (payloadlen > PUBQ_PAYLOAD_LEN) {
+        payloadlen = PUBQ_PAYLOAD_LEN;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->capacity) {
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        q->dropped++;
+        dropped = 1;
+    }
+    msg = &q->slots[(q->head + q->count) % q->capacity];
+    strncpy(msg->topic, topic, sizeof(msg->topic) - 1);
+    msg->topic[sizeof(msg->topic) - 1] = '\0';
+    memcpy(msg->payload, payload, payloadlen);
+    msg->payloadlen = payloadlen;
+    msg->retained = retained;
+    q->count++;
+    q->queued++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return dropped;
+}
+
+int pubq_pop(struct pubqueue *q, struct pub_msg *msg, int timeout_ms) {
+    struct timespec deadline;
+    int ret = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed && !q->wake) {
+        if (pthread_cond_timedwait(&q->cond, &q->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (q->count > 0) {
+        *msg = q->slots[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+    } else {
+        ret = q->closed ? -1 : 0;
+    }
+    q->wake = 0;
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+void pubq_wake(struct pubqueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->wake = 1;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void pubq_close(struct pubqueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void pubq_stats(struct pubqueue *q, unsigned long *queued, unsigned long *dropped) {
+    pthread_mutex_lock(&q->lock);
+    *queued = q->queued;
+    *dropped = q->dropped;
+    pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,77 @@
+/**
+ * @file pubqueue.h
+ * @brief Bounded queue of MQTT messages between the CAN loop and the publisher
+ *
+ * The CAN/timer loop pushes encoded messages and never waits on the
+ * broker: pushing only takes a short mutex, and when the queue is full the
+ * oldest message is dropped to make room. The publisher thread pops them
+ * and does all the (blocking) MQTT work.
+ */
+
+#ifndef VTU_PUBQUEUE_H
+#define VTU_PUBQUEUE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define PUBQ_DEFAULT_CAPACITY   256
+#define PUBQ_TOPIC_LEN          96
+#define PUBQ_PAYLOAD_LEN        512
+
+struct pub_msg {
+    char     topic[PUBQ_TOPIC_LEN];
+    char     payload[PUBQ_PAYLOAD_LEN];
+    int      payloadlen;
+    int      retained;
+};
+
+struct pubqueue {
+    struct pub_msg *slots;
+    uint32_t capacity;
+    uint32_t head;              /* Oldest message */
+    uint32_t count;
+    int      closed;
+    int      wake;               /* pubq_wake() called */
+    unsigned long queued;       /* Pushed since start */
+    unsigned long dropped;      /* Pushed out by newer messages */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+/**
+ * @return 0 on success, -1 on allocation failure
+ */
+int pubq_init(struct pubqueue *q, uint32_t capacity);
+
+void pubq_free(struct pubqueue *q);
+
+/**
+ * @brief Queue a message (payload truncated to PUBQ_PAYLOAD_LEN)
+ * @return 0, 1 if the oldest message was dropped to make room
+ */
+int pubq_push(struct pubqueue *q, const char *topic, const char *payload, int payloadlen,
+              int retained);
+
+/**
+ * @brief Take the oldest message, waiting up to timeout_ms for one
+ * @return 1 with msg filled in, 0 on timeout or pubq_wake(), -1 once
+ *         closed and empty
+ */
+int pubq_pop(struct pubqueue *q, struct pub_msg *msg, int timeout_ms);
+
+/**
+ * @brief End a pubq_pop() wait early (or the next one, if none is waiting)
+ */
+void pubq_wake(struct pubqueue *q);
+
+/**
+ * @brief Wake the publisher for shutdown; pubq_pop() drains, then returns -1
+ */
+void pubq_close(struct pubqueue *q);
+
+/**
+ * @brief Snapshot of the counters, from any thread
+ */
+void pubq_stats(struct pubqueue *q, unsigned long *queued, unsigned long *dropped);
+
+#endif /* VTU_PUBQUEUE_H */
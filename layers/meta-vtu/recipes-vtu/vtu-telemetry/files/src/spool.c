@@ -0,0 +1,238 @@
+/**
+ * @file spool.c
+ * @brief Persistent store-and-forward queue of MQTT messages
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+#define SPOOL_WRAP      0xFFFFFFFFu     /* Record size: rest of the ring is unused */
+
+/* Stored message; topic (no NUL) and payload follow */
+struct spool_record {
+    uint32_t size;                      /* Whole record, multiple of 8, or SPOOL_WRAP */
+    uint16_t topic_len;
+    uint8_t  retained;
+    uint8_t  reserved;
+    uint32_t payload_len;
+    uint32_t reserved2;
+};
+
+static uint32_t record_size(uint32_t topic_len, uint32_t payload_len) {
+    return (sizeof(struct spool_record) + topic_len + payload_len + 7) & ~7u;
+}
+
+static struct spool_record *record_at(const struct spool *sp, uint64_t off) {
+    return (struct spool_record *)(sp->data + off % sp->hdr->capacity);
+}
+
+/* Bytes from off to the end of the ring */
+static uint64_t ring_rest(const struct spool *sp, uint64_t off) {
+    return sp->hdr->capacity - off % sp->hdr->capacity;
+}
+
+/* Past a wrap marker at off, if there is one */
+static uint64_t skip_wrap(const struct spool *sp, uint64_t off) {
+    if (off < sp->hdr->tail && record_at(sp, off)->size == SPOOL_WRAP) {
+        off += ring_rest(sp, off);
+    }
+    return off;
+}
+
+static void reset(struct spool *sp, uint64_t capacity) {
+    memset(sp->hdr, 0, SPOOL_HEADER_SIZE);
+    sp->hdr->version = SPOOL_VERSION;
+    sp->hdr->capacity = capacity;
+    sp->hdr->magic = SPOOL_MAGIC;
+}
+
+/* Count the records left by the last run; cut off at the first bad one */
+static void recover(struct spool *sp) {
+    struct spool_header *hdr = sp->hdr;
+    uint64_t off = hdr->head;
+    uint64_t records = 0;
+
+    if (hdr->tail < hdr->head || hdr->tail - hdr->head > hdr->capacity || hdr->head % 8) {
+        hdr->head = hdr->tail = 0;
+    }
+    while (off < hdr->tail) {
+        const struct spool_record *rec = record_at(sp, off);
+        uint64_t rest = ring_rest(sp, off);
+
+        if (rec->size == SPOOL_WRAP) {
+            off += rest;
+            continue;
+        }
+        if (rest < sizeof(*rec) || rec->size < sizeof(*rec) || rec->size % 8 ||
+            rec->size > rest || off + rec->size > hdr->tail ||
+            rec->topic_len >= PUBQ_TOPIC_LEN || rec->payload_len > PUBQ_PAYLOAD_LEN ||
+            record_size(rec->topic_len, rec->payload_len) != rec->size) {
+            break;
+        }
+        off += rec->size;
+        records++;
+    }
+    hdr->tail = off;
+    hdr->records = records;
+}
+
+int spool_open(struct spool *sp, const char *path, uint64_t capacity) {
+    struct stat st;
+    int fd;
+
+    memset(sp, 0, sizeof(*sp));
+    capacity &= ~7ull;
+    if (capacity < SPOOL_MIN_CAPACITY) {
+        errno = EINVAL;
+        return -1;
+    }
+    sp->map_size = SPOOL_HEADER_SIZE + capacity;
+
+    if (!path) {
+        sp->hdr = mmap(NULL, sp->map_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (sp->hdr == MAP_FAILED) {
+            sp->hdr = NULL;
+            return -1;
+        }
+        sp->data = (uint8_t *)sp->hdr + SPOOL_HEADER_SIZE;
+        reset(sp, capacity);
+        return 0;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 ||
+        ((uint64_t)st.st_size != sp->map_size && ftruncate(fd, sp->map_size) < 0)) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    sp->hdr = mmap(NULL, sp->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sp->hdr == MAP_FAILED) {
+        sp->hdr = NULL;
+        return -1;
+    }
+    sp->data = (uint8_t *)sp->hdr + SPOOL_HEADER_SIZE;
+    sp->persistent = 1;
+
+    /* A new file, or one written with another size or layout */
+    if (sp->hdr->magic != SPOOL_MAGIC || sp->hdr->version != SPOOL_VERSION ||
+        sp->hdr->capacity != capacity) {
+        reset(sp, capacity);
+    }
+    recover(sp);
+    sp->send = sp->hdr->head;
+    return 0;
+}
+
+void spool_sync(struct spool *sp) {
+    if (sp->persistent) {
+        msync(sp->hdr, sp->map_size, MS_SYNC);
+    }
+}
+
+void spool_close(struct spool *sp) {
+    if (!sp->hdr) {
+        return;
+    }
+    spool_sync(sp);
+    munmap(sp->hdr, sp->map_size);
+    sp->hdr = NULL;
+}
+
+/* Drop the oldest record (or wrap marker) */
+static void evict(struct spool *sp) {
+    struct spool_header *hdr = sp->hdr;
+    const struct spool_record *rec = record_at(sp, hdr->head);
+
+    if (rec->size == SPOOL_WRAP) {
+        hdr->head += ring_rest(sp, hdr->head);
+        return;
+    }
+    hdr->head += rec->size;
+    hdr->records--;
+    /* Counted only if it never went out */
+    if (sp->send < hdr->head) {
+        hdr->evicted++;
+        sp->send = hdr->head;
+    }
+}
+
+int spool_append(struct spool *sp, const struct pub_msg *msg) {
+    struct spool_header *hdr = sp->hdr;
+    struct spool_record *rec;
+    uint32_t topic_len = strnlen(msg->topic, PUBQ_TOPIC_LEN - 1);
+    uint32_t size = record_size(topic_len, msg->payloadlen);
+    uint64_t pad = ring_rest(sp, hdr->tail);
+    int evicted = 0;
+
+    if (pad >= size) {
+        pad = 0;
+    }
+    while (hdr->capacity - (hdr->tail - hdr->head) < pad + size) {
+        uint64_t before = hdr->evicted;
+        evict(sp);
+        evicted += hdr->evicted != before;
+    }
+
+    if (pad) {
+        record_at(sp, hdr->tail)->size = SPOOL_WRAP;
+        hdr->tail += pad;
+    }
+    rec = record_at(sp, hdr->tail);
+    rec->topic_len = topic_len;
+    rec->retained = msg->retained;
+    rec->reserved = 0;
+    rec->payload_len = msg->payloadlen;
+    rec->reserved2 = 0;
+    memcpy(rec + 1, msg->topic, topic_len);
+    memcpy((char *)(rec + 1) + topic_len, msg->payload, msg->payloadlen);
+    rec->size = size;
+
+    /* The record is complete before the tail covers it */
+    __atomic_store_n(&hdr->tail, hdr->tail + size, __ATOMIC_RELEASE);
+    hdr->records++;
+    return evicted;
+}
+
+int spool_next(struct spool *sp, struct pub_msg *msg, uint64_t *end) {
+    const struct spool_record *rec;
+
+    if (sp->send < sp->hdr->head) {
+        sp->send = sp->hdr->head;
+    }
+    sp->send = skip_wrap(sp, sp->send);
+    if (sp->send >= sp->hdr->tail) {
+        return 0;
+    }
+
+    rec = record_at(sp, sp->send);
+    memcpy(msg->topic, rec + 1, rec->topic_len);
+    msg->topic[rec->topic_len] = '\0';
+    memcpy(msg->payload, (const char *)(rec + 1) + rec->topic_len, rec->payload_len);
+    msg->payloadlen = rec->payload_len;
+    msg->retained = rec->retained;
+
+    sp->send += rec->size;
+    *end = sp->send;
+    return 1;
+}
+
+void spool_ack(struct spool *sp, uint64_t end) {
+    if (end > sp->hdr->head) {
+        sp->hdr->head = end;
+        sp->hdr->records--;
+    }
+}
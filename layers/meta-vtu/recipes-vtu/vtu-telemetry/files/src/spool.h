@@ -0,0 +1,117 @@
+/**
+ * @file spool.h
+ * @brief Persistent store-and-forward queue of MQTT messages
+ *
+ * Every message the publisher takes from the publish queue is appended
+ * here first and sent from here, in order, so nothing is lost while the
+ * broker is unreachable. The spool is a ring in a memory-mapped file: a
+ * header page holding the head (oldest message not yet acknowledged) and
+ * tail (end of the newest) positions, followed by the records. When the
+ * ring is full the oldest records are evicted to make room.
+ *
+ * Positions are byte offsets that only ever grow; a record sits at
+ * offset % capacity and never wraps (the rest of the ring is skipped
+ * instead). The header lives in the mapping, so a restarted process picks
+ * up at the last acknowledged message and sends the unacknowledged ones
+ * again (at least once). Without a file the same ring lives in memory.
+ *
+ * Not thread-safe: the caller serializes access.
+ */
+
+#ifndef VTU_SPOOL_H
+#define VTU_SPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pubqueue.h"
+
+#define SPOOL_MAGIC             0x4C505356u     /* "VSPL" */
+#define SPOOL_VERSION           1
+#define SPOOL_HEADER_SIZE       4096
+#define SPOOL_MIN_CAPACITY      (64 * 1024)
+#define SPOOL_DEFAULT_CAPACITY  (4 * 1024 * 1024)
+
+/**
+ * @brief First page of the file
+ */
+struct spool_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;                  /* Bytes of records after the header */
+    uint64_t head;                      /* Oldest unacknowledged record */
+    uint64_t tail;                      /* End of the newest record */
+    uint64_t records;                   /* Between head and tail */
+    uint64_t evicted;                   /* Dropped unsent because the ring was full */
+};
+
+struct spool {
+    struct spool_header *hdr;
+    uint8_t *data;
+    size_t   map_size;
+    uint64_t send;                      /* Next record to send (not persisted) */
+    int      persistent;                /* Backed by a file */
+};
+
+/**
+ * @brief Open or create a spool file of capacity bytes of records
+ *
+ * Path NULL keeps the ring in memory only. A file of another capacity or
+ * layout is started afresh; records past a damaged one are discarded.
+ * @return 0 on success, -1 with errno set
+ */
+int spool_open(struct spool *sp, const char *path, uint64_t capacity);
+
+/**
+ * @brief Write the mapping back to the file and unmap it
+ */
+void spool_close(struct spool *sp);
+
+/**
+ * @brief Flush the mapping to the file (blocks for the I/O)
+ */
+void spool_sync(struct spool *sp);
+
+/**
+ * @brief Append a message, evicting the oldest records when full
+ * @return Number of records evicted
+ */
+int spool_append(struct spool *sp, const struct pub_msg *msg);
+
+/**
+ * @return 1 while some record has not been sent yet
+ */
+static inline int spool_pending(const struct spool *sp) {
+    return sp->send < sp->hdr->tail;
+}
+
+/**
+ * @brief Take the next unsent record
+ * @param end Set to the end offset of the record, for spool_ack()
+ * @return 1 with msg filled in, 0 when everything has been sent
+ */
+int spool_next(struct spool *sp, struct pub_msg *msg, uint64_t *end);
+
+/**
+ * @brief The record ending at end was acknowledged; records must be
+ *        acknowledged in order. Records evicted meanwhile are ignored.
+ */
+void spool_ack(struct spool *sp, uint64_t end);
+
+/**
+ * @brief Records waiting and records evicted so far, for the status line
+ */
+static inline void spool_stats(const struct spool *sp, uint64_t *records, uint64_t *evicted) {
+    *records = sp->hdr->records;
+    *evicted = sp->hdr->evicted;
+}
+
+/**
+ * @brief Send everything unacknowledged again (after a lost connection or
+ *        a failed delivery)
+ */
+static inline void spool_rewind(struct spool *sp) {
+    sp->send = sp->hdr->head;
+}
+
+#endif /* VTU_SPOOL_H */
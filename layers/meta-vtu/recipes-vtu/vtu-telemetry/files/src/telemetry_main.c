@@ -1,8 +1,37 @@
 /*
  * VTU MQTT Telemetry Publisher
  * 
- * Reads vehicle data from CAN bus and publishes to MQTT broker.
+ * Reads vehicle data from the shared-memory signal store that vtu-signald
+ * keeps (vtu/signal_store.h) and publishes it to an MQTT broker.
  * Enables remote monitoring, cloud dashboards, and fleet management.
+ * Nothing is decoded here: vtu-signald decodes the bus (CAN-FD included)
+ * with the vtu.dbc decoders or the DBC file it was given.
+ *
+ * The main loop sleeps in epoll_wait() on one timerfd. Every topic has its
+ * own publish interval in milliseconds; the timer is armed for whichever
+ * topic is due next, and the values are read from the store then, so bus
+ * traffic and slow topics cost no wakeups.
+ *
+ * A due topic is only sent when its publish policy (-P) asks for it:
+ * periodic (every interval), or on change, optionally past an absolute or
+ * percent deadband, with a heartbeat after at most so long without one.
+ * The defaults send a value when it moved noticeably and at least once a
+ * minute, so a cruising vehicle sends a fraction of what it decodes.
+ *
+ * By default the values to send are packed into one compact JSON message
+ * per timer wakeup (TOPIC_PREFIX/batch); -m topics publishes one retained
+ * message per topic instead. Either way the loop only queues messages: a
+ * publisher thread feeds them to the asynchronous paho client (MQTTAsync),
+ * so a slow or unreachable broker never holds up CAN reading. At most -w
+ * messages are unacknowledged at a time and reconnects back off
+ * exponentially.
+ *
+ * Every message passes through the spool (spool.h), a ring file under
+ * /var/lib/vtu-telemetry that holds it until the broker acknowledges it:
+ * tunnels and dead zones only delay telemetry. After a reconnect the
+ * backlog goes out in order at up to -r messages per second; when the
+ * ring is full the oldest messages are dropped, and what is left at exit
+ * is sent by the next run.
  */
 
 #include <stdio.h>
@@ -13,129 +42,316 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
-#include <sys/socket.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
-#include <linux/can.h>
-#include <linux/can/raw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
-#include <MQTTClient.h>
+#include <MQTTAsync.h>
+#include <vtu/signal_store.h>
+
+#include "pubqueue.h"
+#include "spool.h"
 
 /* Configuration */
 #define DEFAULT_BROKER      "tcp://localhost:1883"
 #define CLIENT_ID           "vtu-telemetry-001"
 #define TOPIC_PREFIX        "vtu/vehicle001"
 #define QOS                 1
-#define TIMEOUT             10000L
-#define PUBLISH_INTERVAL_MS 1000   /* Publish every second */
+#define TIMEOUT             10000L     /* Connect, ms */
+#define DEFAULT_INTERVAL_MS 1000   /* Per topic, see -p and -t */
+#define RECONNECT_MIN_MS    1000       /* Doubles after every failed attempt */
+#define RECONNECT_MAX_MS    60000
+#define RESEND_PAUSE_MS     1000       /* After a failed delivery, before sending again */
+#define DEFAULT_MAX_INFLIGHT 16        /* Unacknowledged QoS 1 messages, see -w */
+#define MAX_INFLIGHT_LIMIT  1024
+#define BATCH_SUBTOPIC      "batch"
+#define SHUTDOWN_DRAIN_MS   2000   /* Publishing what is still queued at exit */
+#define DISCONNECT_MS       1000   /* Last acks at exit, then the disconnect callback */
+#define DEFAULT_SPOOL_PATH  "/var/lib/vtu-telemetry/spool"
+#define DEFAULT_SPOOL_KB    (SPOOL_DEFAULT_CAPACITY / 1024)
+#define DEFAULT_SEND_RATE   200    /* Messages per second, see -r */
+#define SPOOL_SYNC_MS       5000   /* Spool written back to flash */
+
+/* Publish policies (-P) */
+#define POLICY_PERIODIC     0      /* Every interval */
+#define POLICY_CHANGE       1      /* When the value moved past the deadband */
+#define DEFAULT_SILENCE_MS  60000  /* Heartbeat of an unchanged value */
+
+/* Publish modes (-m) */
+#define MODE_BATCH          0      /* Values sent in a cycle in one message */
+#define MODE_TOPICS         1      /* One retained message per topic */
 
-/* CAN IDs from ECU simulator */
-#define CAN_ID_ENGINE   0x100
-#define CAN_ID_THROTTLE 0x101
-#define CAN_ID_SPEED    0x200
-#define CAN_ID_FUEL     0x300
+#define ENGINE_FD_CYLINDERS 8      /* EGT1..8, Misfire1..8 (CAN-FD) */
 
 static volatile int running = 1;
-static int can_socket = -1;
-static MQTTClient mqtt_client;
-static int mqtt_connected = 0;
+static int publish_mode = MODE_BATCH;
+
+/* Messages on their way to the publisher thread */
+static struct pubqueue pubq;
+static pthread_t publisher_tid;
+
+/* mqtt_state */
+#define MQTT_DISCONNECTED   0
+#define MQTT_CONNECTING     1
+#define MQTT_CONNECTED      2
+#define MQTT_DISCONNECTING  3
+
+/*
+ * MQTT client state, shared by the publisher thread and the paho callbacks
+ * (which run on paho's own thread); guarded by mqtt_lock, like the spool.
+ * Sent messages are numbered; window[] holds the spool position of each
+ * unacknowledged one, win_base is the oldest and win_next the next number.
+ */
+static MQTTAsync mqtt_client;
+static pthread_mutex_t mqtt_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mqtt_state = MQTT_DISCONNECTED;
+static uint64_t next_connect_ms;
+static uint64_t resume_send_ms;                 /* Sending paused after a failure */
+static uint32_t reconnect_delay_ms = RECONNECT_MIN_MS;
+static int max_inflight = DEFAULT_MAX_INFLIGHT;
+static struct {
+    uint64_t end;                               /* spool_ack() position */
+    int      settled;                           /* Acknowledged */
+} window[MAX_INFLIGHT_LIMIT];
+static uintptr_t win_base;
+static uintptr_t win_next;
+static atomic_int inflight;                     /* win_next - win_base, for the status line */
 
-/* Vehicle state decoded from CAN */
+/* Messages not yet acknowledged, kept across restarts */
+static struct spool spool;
+static int send_rate = DEFAULT_SEND_RATE;
+
+/* Counters for the status line */
+static atomic_ulong acked_count;
+static atomic_ulong failed_count;               /* Failed deliveries, sent again */
+
+/* Signals published, by their DBC names */
+enum {
+    SIG_RPM,
+    SIG_COOLANT,
+    SIG_LOAD,
+    SIG_THROTTLE,
+    SIG_SPEED,
+    SIG_ODOMETER,
+    SIG_FUEL,
+    SIG_COUNT
+};
+
+static const char *const signal_names[SIG_COUNT] = {
+    [SIG_RPM]       = "EngineRPM",
+    [SIG_COOLANT]   = "CoolantTemp",
+    [SIG_LOAD]      = "EngineLoad",
+    [SIG_THROTTLE]  = "ThrottlePos",
+    [SIG_SPEED]     = "VehicleSpeed",
+    [SIG_ODOMETER]  = "Odometer",
+    [SIG_FUEL]      = "FuelLevel",
+};
+
+/* Signal store and the slot of every signal published here (-1 = not in it) */
+static struct vtu_store store;
+static int signal_index[SIG_COUNT];
+static int egt_index[ENGINE_FD_CYLINDERS];
+static int misfire_index[ENGINE_FD_CYLINDERS];
+static long cylinder_egt[ENGINE_FD_CYLINDERS];
+static long cylinder_misfires[ENGINE_FD_CYLINDERS];
+static uint64_t newest_us;                      /* Newest slot timestamp read */
+
+/* Vehicle state, as last read from the store */
 static struct {
     uint16_t rpm;
     int8_t   coolant_temp;
     uint8_t  engine_load;
     uint8_t  throttle;
-    uint8_t  speed;
+    uint16_t speed;
     uint32_t odometer;
     uint8_t  fuel_level;
+    uint16_t egt_max;       /* Hottest cylinder, °C (CAN-FD only) */
+    uint32_t misfires;      /* Sum of the per-cylinder counters */
     time_t   last_update;
 } vehicle = {0};
 
+/* Published topics (under TOPIC_PREFIX), each on its own interval */
+enum {
+    TOPIC_RPM,
+    TOPIC_COOLANT,
+    TOPIC_LOAD,
+    TOPIC_THROTTLE,
+    TOPIC_SPEED,
+    TOPIC_ODOMETER,
+    TOPIC_FUEL,
+    TOPIC_EGT_MAX,
+    TOPIC_MISFIRES,
+    TOPIC_STATUS,                               /* All of the above as one JSON object */
+    TOPIC_COUNT
+};
+
+/*
+ * When a due topic is sent. The status topic goes out when any value moved
+ * past the deadband of its own topic since the last status.
+ */
+struct publish_policy {
+    int      mode;                              /* POLICY_PERIODIC / POLICY_CHANGE */
+    long     deadband;                          /* Change needed, 0 = any */
+    int      percent;                           /* deadband is % of the last value sent */
+    uint32_t silence_ms;                        /* Sent anyway after this long, 0 = never */
+};
+
+/* Default policy: past a deadband, heartbeat every DEFAULT_SILENCE_MS */
+#define ON_CHANGE(deadband) { POLICY_CHANGE, deadband, 0, DEFAULT_SILENCE_MS }
+
+static struct {
+    const char *name;
+    const char *key;                            /* In the status and batch JSON */
+    struct publish_policy policy;
+    uint32_t interval_ms;                       /* 0 = not published */
+    uint64_t next_ms;                           /* Due at this monotonic time */
+    long     last_sent;                         /* Value last sent */
+    long     status_value;                      /* Value in the last status */
+    uint64_t sent_ms;                           /* When last sent */
+    int      sent;                              /* Sent at least once */
+} topics[TOPIC_COUNT] = {
+    [TOPIC_RPM]      = { "engine/rpm",      "rpm",        ON_CHANGE(50) },
+    [TOPIC_COOLANT]  = { "engine/coolant",  "coolant",    ON_CHANGE(0) },
+    [TOPIC_LOAD]     = { "engine/load",     "load",       ON_CHANGE(2) },
+    [TOPIC_THROTTLE] = { "engine/throttle", "throttle",   ON_CHANGE(2) },
+    [TOPIC_SPEED]    = { "speed",           "speed",      ON_CHANGE(1) },
+    [TOPIC_ODOMETER] = { "odometer",        "odometer",   ON_CHANGE(0) },
+    [TOPIC_FUEL]     = { "fuel/level",      "fuel_level", ON_CHANGE(1) },
+    [TOPIC_EGT_MAX]  = { "engine/egt_max",  "egt_max",    ON_CHANGE(10) },
+    [TOPIC_MISFIRES] = { "engine/misfires", "misfires",   ON_CHANGE(0) },
+    [TOPIC_STATUS]   = { "status",          NULL,         ON_CHANGE(0) },
+};
+
+/* Values looked at and sent by the policies, for the status line */
+static unsigned long values_due;
+static unsigned long values_sent;
+
+static int timer_fd = -1;
+
 static void signal_handler(int sig) {
     (void)sig;
     running = 0;
 }
 
-/* Decode CAN frame and update vehicle state */
-static void decode_can_frame(struct can_frame *frame) {
-    switch (frame->can_id & CAN_SFF_MASK) {
-        case CAN_ID_ENGINE:
-            vehicle.rpm = (frame->data[0] << 8) | frame->data[1];
-            vehicle.rpm /= 4;  /* Convert from 0.25 RPM units */
-            vehicle.coolant_temp = frame->data[2] - 40;
-            vehicle.engine_load = frame->data[3];
-            vehicle.last_update = time(NULL);
-            break;
-            
-        case CAN_ID_THROTTLE:
-            vehicle.throttle = (frame->data[0] * 100) / 255;
-            break;
-            
-        case CAN_ID_SPEED:
-            vehicle.speed = frame->data[0];
-            vehicle.odometer = (frame->data[2] << 16) | 
-                              (frame->data[3] << 8) | 
-                              frame->data[4];
-            break;
-            
-        case CAN_ID_FUEL:
-            vehicle.fuel_level = (frame->data[0] * 100) / 255;
-            break;
-    }
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-/* Publish a single value to MQTT */
-static void publish_value(const char *subtopic, const char *value) {
-    char topic[128];
-    MQTTClient_message msg = MQTTClient_message_initializer;
-    MQTTClient_deliveryToken token;
+/* Map the store if there is none yet or its producer has gone */
+static void update_store(void) {
+    static int waiting = 0;
+    char name[32];
     
-    snprintf(topic, sizeof(topic), "%s/%s", TOPIC_PREFIX, subtopic);
+    if (vtu_store_live(&store)) {
+        return;
+    }
+    vtu_store_close(&store);
     
-    msg.payload = (void *)value;
-    msg.payloadlen = strlen(value);
-    msg.qos = QOS;
-    msg.retained = 1;  /* Retain last value */
+    if (vtu_store_open(&store, VTU_STORE_DEFAULT_NAME) < 0 || !vtu_store_live(&store)) {
+        vtu_store_close(&store);
+        if (!waiting) {
+            printf("[TELEM] Waiting for the signal store (%s), is vtu-signald running?\n",
+                   VTU_STORE_DEFAULT_NAME);
+            waiting = 1;
+        }
+        return;
+    }
+    waiting = 0;
     
-    int rc = MQTTClient_publishMessage(mqtt_client, topic, &msg, &token);
-    if (rc != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "[TELEM] Publish failed: %d\n", rc);
+    for (int i = 0; i < SIG_COUNT; i++) {
+        signal_index[i] = vtu_store_find(&store, signal_names[i]);
+        if (signal_index[i] < 0) {
+            printf("[TELEM] Signal %s not in the store, publishing 0\n", signal_names[i]);
+        }
     }
+    for (int cyl = 0; cyl < ENGINE_FD_CYLINDERS; cyl++) {
+        snprintf(name, sizeof(name), "EGT%d", cyl + 1);
+        egt_index[cyl] = vtu_store_find(&store, name);
+        snprintf(name, sizeof(name), "Misfire%d", cyl + 1);
+        misfire_index[cyl] = vtu_store_find(&store, name);
+    }
+    printf("[TELEM] Reading signals from %s (%d signals)\n",
+           VTU_STORE_DEFAULT_NAME, store.nsignals);
 }
 
-/* Publish all vehicle data as JSON status */
-static void publish_status(void) {
-    char json[512];
-    char value[32];
+/*
+ * Latest value of a store slot, rounded to the integer that is published;
+ * last while there is none (no producer, or not received since it started)
+ */
+static long signal_int(int idx, long last) {
+    uint64_t ts;
+    float v;
     
-    if (!mqtt_connected) {
-        return;
+    if (!store.hdr || idx < 0 || vtu_store_read(&store, idx, &v, &ts) < 0) {
+        return last;
     }
+    if (ts > newest_us) {
+        newest_us = ts;
+    }
+    return (long)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+/* Refresh the published vehicle state from the store: plain loads, no syscall */
+static void update_vehicle(void) {
+    vehicle.rpm = (uint16_t)signal_int(signal_index[SIG_RPM], vehicle.rpm);
+    vehicle.coolant_temp = (int8_t)signal_int(signal_index[SIG_COOLANT], vehicle.coolant_temp);
+    vehicle.engine_load = (uint8_t)signal_int(signal_index[SIG_LOAD], vehicle.engine_load);
+    vehicle.throttle = (uint8_t)signal_int(signal_index[SIG_THROTTLE], vehicle.throttle);
+    vehicle.speed = (uint16_t)signal_int(signal_index[SIG_SPEED], vehicle.speed);
+    vehicle.odometer = (uint32_t)signal_int(signal_index[SIG_ODOMETER], vehicle.odometer);
+    vehicle.fuel_level = (uint8_t)signal_int(signal_index[SIG_FUEL], vehicle.fuel_level);
     
-    /* Publish individual values */
-    snprintf(value, sizeof(value), "%d", vehicle.rpm);
-    publish_value("engine/rpm", value);
-    
-    snprintf(value, sizeof(value), "%d", vehicle.coolant_temp);
-    publish_value("engine/coolant", value);
-    
-    snprintf(value, sizeof(value), "%d", vehicle.engine_load);
-    publish_value("engine/load", value);
-    
-    snprintf(value, sizeof(value), "%d", vehicle.throttle);
-    publish_value("engine/throttle", value);
-    
-    snprintf(value, sizeof(value), "%d", vehicle.speed);
-    publish_value("speed", value);
+    vehicle.egt_max = 0;
+    vehicle.misfires = 0;
+    for (int cyl = 0; cyl < ENGINE_FD_CYLINDERS; cyl++) {
+        cylinder_egt[cyl] = signal_int(egt_index[cyl], cylinder_egt[cyl]);
+        cylinder_misfires[cyl] = signal_int(misfire_index[cyl], cylinder_misfires[cyl]);
+        if (cylinder_egt[cyl] > vehicle.egt_max) {
+            vehicle.egt_max = (uint16_t)cylinder_egt[cyl];
+        }
+        vehicle.misfires += (uint32_t)cylinder_misfires[cyl];
+    }
     
-    snprintf(value, sizeof(value), "%u", vehicle.odometer);
-    publish_value("odometer", value);
+    /* Slot times are CLOCK_MONOTONIC; the status carries wall time */
+    if (newest_us) {
+        vehicle.last_update = time(NULL) - (time_t)((vtu_store_now_us() - newest_us) / 1000000);
+    }
+}
+
+/* Hand a message to the publisher thread; never blocks on the broker */
+static void publish_value(const char *subtopic, const char *value, int retained) {
+    char topic[PUBQ_TOPIC_LEN];
     
-    snprintf(value, sizeof(value), "%d", vehicle.fuel_level);
-    publish_value("fuel/level", value);
+    snprintf(topic, sizeof(topic), "%s/%s", TOPIC_PREFIX, subtopic);
+    pubq_push(&pubq, topic, value, strlen(value), retained);
+}
+
+/* Value of a single-value topic */
+static long topic_value(int topic) {
+    switch (topic) {
+        case TOPIC_RPM:      return vehicle.rpm;
+        case TOPIC_COOLANT:  return vehicle.coolant_temp;
+        case TOPIC_LOAD:     return vehicle.engine_load;
+        case TOPIC_THROTTLE: return vehicle.throttle;
+        case TOPIC_SPEED:    return vehicle.speed;
+        case TOPIC_ODOMETER: return vehicle.odometer;
+        case TOPIC_FUEL:     return vehicle.fuel_level;
+        case TOPIC_EGT_MAX:  return vehicle.egt_max;
+        case TOPIC_MISFIRES: return vehicle.misfires;
+    }
+    return 0;
+}
+
+/* Publish all vehicle data as JSON status */
+static void publish_status(void) {
+    char json[512];
+    unsigned long queued, dropped;
+    uint64_t spooled, evicted;
     
-    /* Publish combined JSON status */
     snprintf(json, sizeof(json),
         "{"
         "\"rpm\":%d,"
@@ -145,91 +361,501 @@ static void publish_status(void) {
         "\"speed\":%d,"
         "\"odometer\":%u,"
         "\"fuel_level\":%d,"
+        "\"egt_max\":%d,"
+        "\"misfires\":%u,"
         "\"timestamp\":%ld"
         "}",
         vehicle.rpm, vehicle.coolant_temp, vehicle.engine_load,
         vehicle.throttle, vehicle.speed, vehicle.odometer,
-        vehicle.fuel_level, vehicle.last_update);
+        vehicle.fuel_level, vehicle.egt_max, vehicle.misfires,
+        vehicle.last_update);
+    
+    publish_value(topics[TOPIC_STATUS].name, json, 1);  /* Retain last value */
     
-    publish_value("status", json);
+    /* Written by the publisher thread and the paho callbacks */
+    pubq_stats(&pubq, &queued, &dropped);
+    pthread_mutex_lock(&mqtt_lock);
+    spool_stats(&spool, &spooled, &evicted);
+    pthread_mutex_unlock(&mqtt_lock);
     
-    printf("[TELEM] Published: RPM=%d Speed=%d Coolant=%d°C Fuel=%d%%\n",
-           vehicle.rpm, vehicle.speed, vehicle.coolant_temp, vehicle.fuel_level);
+    printf("[TELEM] Published: RPM=%d Speed=%d Coolant=%d°C Fuel=%d%% "
+           "(values sent %lu of %lu, queued %lu, spooled %llu, acked %lu, in flight %d, "
+           "failed %lu, dropped %lu)\n",
+           vehicle.rpm, vehicle.speed, vehicle.coolant_temp, vehicle.fuel_level,
+           values_sent, values_due, queued, (unsigned long long)spooled,
+           atomic_load(&acked_count), atomic_load(&inflight), atomic_load(&failed_count),
+           dropped + (unsigned long)evicted);
 }
 
-static int setup_mqtt(const char *broker) {
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-    int rc;
+/* Milliseconds since the epoch, for the batch timestamp */
+static long long wall_ms(void) {
+    struct timespec ts;
     
-    rc = MQTTClient_create(&mqtt_client, broker, CLIENT_ID,
-                           MQTTCLIENT_PERSISTENCE_NONE, NULL);
-    if (rc != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "[TELEM] Failed to create MQTT client: %d\n", rc);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Whether value moved past the deadband of topic t since last */
+static int moved(int t, long value, long last) {
+    const struct publish_policy *p = &topics[t].policy;
+    long long diff = llabs((long long)value - last);
+    
+    if (p->percent) {
+        return diff * 100 > p->deadband * llabs(last) || (diff && !last);
+    }
+    return diff > p->deadband;
+}
+
+/* Whether due topic t is sent this time; value is unused for the status */
+static int policy_wants(int t, long value, uint64_t now) {
+    const struct publish_policy *p = &topics[t].policy;
+    
+    if (!topics[t].sent || p->mode == POLICY_PERIODIC ||
+        (p->silence_ms && now - topics[t].sent_ms >= p->silence_ms)) {
+        return 1;
+    }
+    if (t != TOPIC_STATUS) {
+        return moved(t, value, topics[t].last_sent);
+    }
+    for (int v = 0; v < TOPIC_STATUS; v++) {
+        if (moved(v, topic_value(v), topics[v].status_value)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void mark_sent(int t, long value, uint64_t now) {
+    topics[t].last_sent = value;
+    topics[t].sent_ms = now;
+    topics[t].sent = 1;
+    values_sent++;
+    
+    if (t == TOPIC_STATUS) {
+        for (int v = 0; v < TOPIC_STATUS; v++) {
+            topics[v].status_value = topic_value(v);
+        }
+    }
+}
+
+/*
+ * Publish every topic that is due and its policy lets through, and move
+ * it to its next slot. A topic that fell behind skips the missed slots
+ * instead of bursting to catch up.
+ *
+ * In batch mode those values go out together as
+ * {"ts":<epoch ms>,"rpm":850,...}; a cycle where nothing is sent sends
+ * nothing (the retained status topic carries the full picture).
+ */
+static void publish_due(uint64_t now) {
+    char value[32];
+    char batch[PUBQ_PAYLOAD_LEN];
+    int len = 0;
+    int nbatch = 0;
+    
+    update_store();
+    update_vehicle();
+    
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        if (!topics[t].interval_ms || topics[t].next_ms > now) {
+            continue;
+        }
+        
+        long v = t == TOPIC_STATUS ? 0 : topic_value(t);
+        values_due++;
+        if (policy_wants(t, v, now)) {
+            if (t == TOPIC_STATUS) {
+                mark_sent(t, v, now);
+                publish_status();
+            } else if (publish_mode == MODE_TOPICS) {
+                snprintf(value, sizeof(value), "%ld", v);
+                publish_value(topics[t].name, value, 1);  /* Retain last value */
+                mark_sent(t, v, now);
+            } else {
+                if (nbatch++ == 0) {
+                    len = snprintf(batch, sizeof(batch), "{\"ts\":%lld", wall_ms());
+                }
+                len += snprintf(batch + len, sizeof(batch) - len, ",\"%s\":%ld",
+                                topics[t].key, v);
+                mark_sent(t, v, now);
+            }
+        }
+        
+        topics[t].next_ms += topics[t].interval_ms;
+        if (topics[t].next_ms <= now) {
+            topics[t].next_ms = now + topics[t].interval_ms;
+        }
+    }
+    
+    if (nbatch) {
+        snprintf(batch + len, sizeof(batch) - len, "}");
+        publish_value(BATCH_SUBTOPIC, batch, 0);
+    }
+}
+
+/* Arm the timer for the earliest topic due */
+static int arm_timer(void) {
+    struct itimerspec its = {0};
+    uint64_t next = UINT64_MAX;
+    
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        if (topics[t].interval_ms && topics[t].next_ms < next) {
+            next = topics[t].next_ms;
+        }
+    }
+    /* Absolute CLOCK_MONOTONIC time; all zero disarms */
+    if (next != UINT64_MAX) {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("[TELEM] timerfd_settime()");
         return -1;
     }
+    return 0;
+}
+
+/* Next attempt after the current delay, which then doubles; mqtt_lock held */
+static void schedule_reconnect(void) {
+    mqtt_state = MQTT_DISCONNECTED;
+    next_connect_ms = now_ms() + reconnect_delay_ms;
+    reconnect_delay_ms = reconnect_delay_ms * 2 > RECONNECT_MAX_MS ?
+                         RECONNECT_MAX_MS : reconnect_delay_ms * 2;
+}
+
+static void on_connect(void *context, MQTTAsync_successData *response) {
+    (void)context;
+    (void)response;
+    
+    pthread_mutex_lock(&mqtt_lock);
+    mqtt_state = MQTT_CONNECTED;
+    reconnect_delay_ms = RECONNECT_MIN_MS;
+    pthread_mutex_unlock(&mqtt_lock);
+    pubq_wake(&pubq);
+    
+    printf("[TELEM] Connected to MQTT broker\n");
+}
+
+static void on_connect_failure(void *context, MQTTAsync_failureData *response) {
+    uint32_t delay;
+    
+    (void)context;
+    pthread_mutex_lock(&mqtt_lock);
+    delay = reconnect_delay_ms;
+    schedule_reconnect();
+    pthread_mutex_unlock(&mqtt_lock);
+    
+    fprintf(stderr, "[TELEM] Failed to connect to broker: %d, retrying in %u ms\n",
+            response ? response->code : 0, delay);
+}
+
+/* Unacknowledged messages are lost with the (clean) session: send them again */
+static void on_connection_lost(void *context, char *cause) {
+    uintptr_t lost;
+    
+    (void)context;
+    pthread_mutex_lock(&mqtt_lock);
+    lost = win_next - win_base;
+    win_base = win_next;
+    atomic_store(&inflight, 0);
+    spool_rewind(&spool);
+    reconnect_delay_ms = RECONNECT_MIN_MS;
+    schedule_reconnect();
+    pthread_mutex_unlock(&mqtt_lock);
+    
+    printf("[TELEM] Lost connection to MQTT broker (%s), %lu messages to send again\n",
+           cause ? cause : "no reason given", (unsigned long)lost);
+}
+
+/* End of the disconnect at exit, either way; the client may be destroyed now */
+static void on_disconnect(void *context, MQTTAsync_successData *response) {
+    (void)context;
+    (void)response;
+    pthread_mutex_lock(&mqtt_lock);
+    mqtt_state = MQTT_DISCONNECTED;
+    pthread_mutex_unlock(&mqtt_lock);
+}
+
+static void on_disconnect_failure(void *context, MQTTAsync_failureData *response) {
+    on_disconnect(context, NULL);
+    fprintf(stderr, "[TELEM] Disconnect failed: %d\n", response ? response->code : 0);
+}
+
+/* Nothing is subscribed, but paho requires the callback */
+static int on_message(void *context, char *topic, int topic_len, MQTTAsync_message *message) {
+    (void)context;
+    (void)topic_len;
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topic);
+    return 1;
+}
+
+/*
+ * Message number seq was acknowledged. The spool moves past it once every
+ * older message has been; numbers from before a lost connection or a
+ * failed delivery are stale.
+ */
+static void settle(uintptr_t seq) {
+    pthread_mutex_lock(&mqtt_lock);
+    if (seq - win_base < win_next - win_base) {
+        window[seq % MAX_INFLIGHT_LIMIT].settled = 1;
+        atomic_fetch_add(&acked_count, 1);
+        while (win_base != win_next && window[win_base % MAX_INFLIGHT_LIMIT].settled) {
+            spool_ack(&spool, window[win_base % MAX_INFLIGHT_LIMIT].end);
+            win_base++;
+        }
+        atomic_store(&inflight, (int)(win_next - win_base));
+    }
+    pthread_mutex_unlock(&mqtt_lock);
+    pubq_wake(&pubq);
+}
+
+/*
+ * Message number seq was not delivered: paho gave up on it (the session
+ * went away) or refused it. It stays in the spool; everything from the
+ * oldest unacknowledged message on is sent again after a pause, or after
+ * the reconnect if the connection is going down.
+ */
+static void unsettle(uintptr_t seq) {
+    pthread_mutex_lock(&mqtt_lock);
+    if (seq - win_base < win_next - win_base) {
+        atomic_fetch_add(&failed_count, 1);
+        win_base = win_next;
+        atomic_store(&inflight, 0);
+        spool_rewind(&spool);
+        resume_send_ms = now_ms() + RESEND_PAUSE_MS;
+    }
+    pthread_mutex_unlock(&mqtt_lock);
+}
+
+static void on_delivered(void *context, MQTTAsync_successData *response) {
+    (void)response;
+    settle((uintptr_t)context);
+}
+
+static void on_delivery_failure(void *context, MQTTAsync_failureData *response) {
+    (void)response;
+    unsettle((uintptr_t)context);
+}
+
+/* Start a connection attempt; the outcome arrives in a callback */
+static void start_connect(void) {
+    MQTTAsync_connectOptions conn_opts = MQTTAsync_connectOptions_initializer;
+    int rc;
     
     conn_opts.keepAliveInterval = 20;
     conn_opts.cleansession = 1;
+    conn_opts.connectTimeout = TIMEOUT / 1000;
+    conn_opts.onSuccess = on_connect;
+    conn_opts.onFailure = on_connect_failure;
     
-    printf("[TELEM] Connecting to MQTT broker: %s\n", broker);
-    
-    rc = MQTTClient_connect(mqtt_client, &conn_opts);
-    if (rc != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "[TELEM] Failed to connect to broker: %d\n", rc);
-        fprintf(stderr, "[TELEM] Will retry in background...\n");
-        return 0;  /* Don't fail, just run without MQTT */
+    rc = MQTTAsync_connect(mqtt_client, &conn_opts);
+    if (rc != MQTTASYNC_SUCCESS) {
+        MQTTAsync_failureData failure = { .code = rc };
+        on_connect_failure(NULL, &failure);
     }
+}
+
+/*
+ * Hand message number seq to paho; its slot in the window is already
+ * taken. Called without mqtt_lock, paho may run callbacks from inside.
+ */
+static void send_message(struct pub_msg *msg, uintptr_t seq) {
+    MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+    MQTTAsync_message m = MQTTAsync_message_initializer;
     
-    printf("[TELEM] Connected to MQTT broker\n");
-    mqtt_connected = 1;
-    return 0;
+    m.payload = msg->payload;
+    m.payloadlen = msg->payloadlen;
+    m.qos = QOS;
+    m.retained = msg->retained;
+    opts.onSuccess = on_delivered;
+    opts.onFailure = on_delivery_failure;
+    opts.context = (void *)seq;
+    
+    if (MQTTAsync_sendMessage(mqtt_client, msg->topic, &m, &opts) != MQTTASYNC_SUCCESS) {
+        unsettle(seq);
+    }
 }
 
-static int setup_can_socket(const char *ifname) {
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    struct can_filter filters[4];
+/*
+ * Moves queued messages into the spool and sends them from there, in
+ * order, while connected, within the in-flight window and the send rate.
+ * Also starts the (re)connect attempts when they are due. Acks and state
+ * changes cut the wait in pubq_pop() short.
+ */
+static void *publisher_thread(void *arg) {
+    struct pub_msg msg;
+    uint64_t last_refill = now_ms();
+    uint64_t last_sync = last_refill;
+    uint64_t drain_until = 0;
+    double tokens = send_rate;                  /* Up to a second's worth at once */
+    uint64_t kept;
+    int closed = 0;
     
-    can_socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (can_socket < 0) {
-        perror("Failed to create CAN socket");
-        return -1;
+    (void)arg;
+    for (;;) {
+        uint64_t now = now_ms();
+        uint32_t wait_ms = 100;
+        int ret;
+        
+        tokens += (double)(now - last_refill) * send_rate / 1000;
+        if (tokens > send_rate) {
+            tokens = send_rate;
+        }
+        last_refill = now;
+        
+        pthread_mutex_lock(&mqtt_lock);
+        /* At exit: send what is left for a while, the spool keeps the rest */
+        if (!running) {
+            if (!drain_until) {
+                drain_until = now + SHUTDOWN_DRAIN_MS;
+            }
+            if (closed && (mqtt_state != MQTT_CONNECTED || now > drain_until ||
+                           (!spool_pending(&spool) && win_base == win_next))) {
+                pthread_mutex_unlock(&mqtt_lock);
+                break;
+            }
+        } else if (mqtt_state == MQTT_DISCONNECTED && now >= next_connect_ms) {
+            mqtt_state = MQTT_CONNECTING;
+            pthread_mutex_unlock(&mqtt_lock);
+            start_connect();
+            continue;
+        }
+        if (mqtt_state == MQTT_CONNECTED && win_next - win_base < (uintptr_t)max_inflight &&
+            spool_pending(&spool)) {
+            uintptr_t seq = win_next;
+            
+            if (now < resume_send_ms) {
+                wait_ms = (uint32_t)(resume_send_ms - now);     /* After a failed delivery */
+            } else if (tokens >= 1 &&
+                       spool_next(&spool, &msg, &window[seq % MAX_INFLIGHT_LIMIT].end)) {
+                /* Counted first: the ack may come back before sendMessage returns */
+                window[seq % MAX_INFLIGHT_LIMIT].settled = 0;
+                win_next++;
+                atomic_store(&inflight, (int)(win_next - win_base));
+                pthread_mutex_unlock(&mqtt_lock);
+                tokens -= 1;
+                send_message(&msg, seq);
+                continue;
+            } else if (tokens < 1) {
+                wait_ms = (uint32_t)((1 - tokens) * 1000 / send_rate) + 1;
+            }
+        }
+        pthread_mutex_unlock(&mqtt_lock);
+        
+        if (now - last_sync >= SPOOL_SYNC_MS) {
+            spool_sync(&spool);
+            last_sync = now;
+        }
+        
+        if (closed) {
+            struct timespec pause = { 0, 10 * 1000000 };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        ret = pubq_pop(&pubq, &msg, wait_ms);
+        if (ret > 0) {
+            pthread_mutex_lock(&mqtt_lock);
+            spool_append(&spool, &msg);
+            pthread_mutex_unlock(&mqtt_lock);
+        }
+        closed = ret < 0;
     }
     
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
-    if (ioctl(can_socket, SIOCGIFINDEX, &ifr) < 0) {
-        perror("Failed to get interface index");
-        close(can_socket);
-        return -1;
+    /*
+     * Paho finishes the disconnect (and takes the last acks, which trim the
+     * spool) on its own thread: wait for it, within reason, before main
+     * destroys the client.
+     */
+    if (MQTTAsync_isConnected(mqtt_client)) {
+        MQTTAsync_disconnectOptions disc_opts = MQTTAsync_disconnectOptions_initializer;
+        uint64_t deadline = now_ms() + 2 * DISCONNECT_MS;
+        int state;
+        
+        disc_opts.timeout = DISCONNECT_MS;
+        disc_opts.onSuccess = on_disconnect;
+        disc_opts.onFailure = on_disconnect_failure;
+        pthread_mutex_lock(&mqtt_lock);
+        mqtt_state = MQTT_DISCONNECTING;
+        pthread_mutex_unlock(&mqtt_lock);
+        state = MQTT_DISCONNECTED;
+        if (MQTTAsync_disconnect(mqtt_client, &disc_opts) == MQTTASYNC_SUCCESS) {
+            do {
+                struct timespec pause = { 0, 10 * 1000000 };
+                nanosleep(&pause, NULL);
+                pthread_mutex_lock(&mqtt_lock);
+                state = mqtt_state;
+                pthread_mutex_unlock(&mqtt_lock);
+            } while (state == MQTT_DISCONNECTING && now_ms() < deadline);
+        }
+        if (state == MQTT_DISCONNECTING) {
+            fprintf(stderr, "[TELEM] No answer to the disconnect, closing anyway\n");
+        }
     }
     
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
+    pthread_mutex_lock(&mqtt_lock);
+    kept = spool.hdr->records;
+    pthread_mutex_unlock(&mqtt_lock);
+    if (kept) {
+        printf("[TELEM] %llu messages kept in the spool for the next start\n",
+               (unsigned long long)kept);
+    }
+    return NULL;
+}
+
+/* Falls back to memory (lost at exit) when the file can't be used */
+static int setup_spool(const char *path, unsigned long size_kb) {
+    uint64_t capacity = (uint64_t)size_kb * 1024;
     
-    if (bind(can_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("Failed to bind CAN socket");
-        close(can_socket);
+    if (path && spool_open(&spool, path, capacity) < 0) {
+        fprintf(stderr, "[TELEM] Failed to open spool %s: %s, keeping it in memory\n",
+                path, strerror(errno));
+        path = NULL;
+    }
+    if (!path && spool_open(&spool, NULL, capacity) < 0) {
+        perror("[TELEM] Failed to allocate the spool");
         return -1;
     }
     
-    /* Filter for vehicle data CAN IDs only */
-    filters[0].can_id = CAN_ID_ENGINE;
-    filters[0].can_mask = CAN_SFF_MASK;
-    filters[1].can_id = CAN_ID_THROTTLE;
-    filters[1].can_mask = CAN_SFF_MASK;
-    filters[2].can_id = CAN_ID_SPEED;
-    filters[2].can_mask = CAN_SFF_MASK;
-    filters[3].can_id = CAN_ID_FUEL;
-    filters[3].can_mask = CAN_SFF_MASK;
+    printf("[TELEM] Spool: %s (%lu KB", path ? path : "memory", size_kb);
+    if (spool.hdr->records) {
+        printf(", %llu messages from the last run", (unsigned long long)spool.hdr->records);
+    }
+    printf(")\n");
+    return 0;
+}
+
+/* The publisher thread connects; startup never waits for the broker */
+static int setup_mqtt(const char *broker) {
+    int rc;
     
-    setsockopt(can_socket, SOL_CAN_RAW, CAN_RAW_FILTER,
-               filters, sizeof(filters));
+    rc = MQTTAsync_create(&mqtt_client, broker, CLIENT_ID,
+                          MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    if (rc != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "[TELEM] Failed to create MQTT client: %d\n", rc);
+        return -1;
+    }
+    rc = MQTTAsync_setCallbacks(mqtt_client, NULL, on_connection_lost, on_message, NULL);
+    if (rc != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "[TELEM] Failed to set MQTT callbacks: %d\n", rc);
+        MQTTAsync_destroy(&mqtt_client);
+        return -1;
+    }
+    if (pubq_init(&pubq, PUBQ_DEFAULT_CAPACITY) < 0) {
+        perror("[TELEM] Failed to allocate the publish queue");
+        MQTTAsync_destroy(&mqtt_client);
+        return -1;
+    }
     
-    /* Set non-blocking for select() */
-    struct timeval tv = {0, 100000};  /* 100ms timeout */
-    setsockopt(can_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    printf("[TELEM] Connecting to MQTT broker: %s (up to %d messages in flight, %d/s)\n",
+           broker, max_inflight, send_rate);
     
-    printf("[TELEM] Listening on %s\n", ifname);
+    if (pthread_create(&publisher_tid, NULL, publisher_thread, NULL) != 0) {
+        fprintf(stderr, "[TELEM] Failed to start the publisher thread\n");
+        pubq_free(&pubq);
+        MQTTAsync_destroy(&mqtt_client);
+        return -1;
+    }
     return 0;
 }
 
@@ -237,24 +863,262 @@ static void print_usage(const char *prog) {
     printf("Usage: %s [OPTIONS]\n", prog);
     printf("Options:\n");
     printf("  -b BROKER   MQTT broker URL (default: %s)\n", DEFAULT_BROKER);
-    printf("  -i IFACE    CAN interface (default: vcan0)\n");
+    printf("  -p MS       Publish interval of every topic (default: %d)\n", DEFAULT_INTERVAL_MS);
+    printf("  -t TOPIC=MS Publish interval of one topic, 0 = off (repeatable,\n");
+    printf("              e.g. -t engine/rpm=100 -t odometer=10000)\n");
+    printf("  -P TOPIC=POLICY[,POLICY]\n");
+    printf("              When a due topic is sent (repeatable, TOPIC may be all):\n");
+    printf("              periodic: every interval; change: when the value changed;\n");
+    printf("              abs:N / pct:N: changed by more than N or N%%;\n");
+    printf("              silence:MS: sent anyway after MS without, 0 = never\n");
+    printf("              (default: change past a per-topic deadband, silence:%d)\n",
+           DEFAULT_SILENCE_MS);
+    printf("  -m MODE     batch: values sent in a cycle together in one message on\n");
+    printf("              %s/%s (default)\n", TOPIC_PREFIX, BATCH_SUBTOPIC);
+    printf("              topics: one retained message per topic\n");
+    printf("  -w N        Messages in flight, sent but not acknowledged (default: %d)\n",
+           DEFAULT_MAX_INFLIGHT);
+    printf("  -s FILE     Spool of unacknowledged messages, none = memory only\n");
+    printf("              (default: %s)\n", DEFAULT_SPOOL_PATH);
+    printf("  -S KB       Spool size; the oldest messages go when full (default: %d)\n",
+           DEFAULT_SPOOL_KB);
+    printf("  -r N        Messages sent per second at most, as when catching up\n");
+    printf("              after a reconnect (default: %d)\n", DEFAULT_SEND_RATE);
     printf("  -h          Show this help\n");
+    printf("Topics:");
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        printf(" %s", topics[t].name);
+    }
+    printf("\n");
+}
+
+/* -t TOPIC=MS */
+static int set_topic_interval(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    char *end;
+    
+    if (!eq) {
+        return -1;
+    }
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        if (strlen(topics[t].name) == (size_t)(eq - arg) &&
+            strncmp(topics[t].name, arg, eq - arg) == 0) {
+            unsigned long ms = strtoul(eq + 1, &end, 10);
+            if (end == eq + 1 || *end || ms > UINT32_MAX) {
+                return -1;
+            }
+            topics[t].interval_ms = (uint32_t)ms;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* One item of -P: periodic, change, abs:N, pct:N or silence:MS */
+static int parse_policy_item(struct publish_policy *p, const char *item, size_t len) {
+    const char *colon = memchr(item, ':', len);
+    char num[16];
+    char *end;
+    long n;
+    
+    if (!colon) {
+        if (len == 8 && strncmp(item, "periodic", len) == 0) {
+            p->mode = POLICY_PERIODIC;
+        } else if (len == 6 && strncmp(item, "change", len) == 0) {
+            p->mode = POLICY_CHANGE;
+            p->deadband = 0;
+            p->percent = 0;
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    
+    if ((size_t)(item + len - colon - 1) >= sizeof(num)) {
+        return -1;
+    }
+    memcpy(num, colon + 1, item + len - colon - 1);
+    num[item + len - colon - 1] = '\0';
+    n = strtol(num, &end, 10);
+    if (end == num || *end || n < 0 || n > UINT32_MAX) {
+        return -1;
+    }
+    
+    if (colon - item == 3 && strncmp(item, "abs", 3) == 0) {
+        p->mode = POLICY_CHANGE;
+        p->deadband = n;
+        p->percent = 0;
+    } else if (colon - item == 3 && strncmp(item, "pct", 3) == 0) {
+        p->mode = POLICY_CHANGE;
+        p->deadband = n;
+        p->percent = 1;
+    } else if (colon - item == 7 && strncmp(item, "silence", 7) == 0) {
+        p->silence_ms = (uint32_t)n;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* -P TOPIC=POLICY[,...]; items change the topic's current policy */
+static int set_topic_policy(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    int all;
+    
+    if (!eq) {
+        return -1;
+    }
+    all = eq - arg == 3 && strncmp(arg, "all", 3) == 0;
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        struct publish_policy policy = topics[t].policy;
+        const char *item = eq + 1;
+        
+        if (!all && (strlen(topics[t].name) != (size_t)(eq - arg) ||
+                     strncmp(topics[t].name, arg, eq - arg) != 0)) {
+            continue;
+        }
+        for (;;) {
+            const char *comma = strchr(item, ',');
+            size_t len = comma ? (size_t)(comma - item) : strlen(item);
+            if (parse_policy_item(&policy, item, len) < 0) {
+                return -1;
+            }
+            if (!comma) {
+                break;
+            }
+            item = comma + 1;
+        }
+        topics[t].policy = policy;
+        if (!all) {
+            return 0;
+        }
+    }
+    return all ? 0 : -1;
+}
+
+/* Policy of topic t for the startup log */
+static void describe_policy(int t, char *buf, size_t size) {
+    const struct publish_policy *p = &topics[t].policy;
+    int len;
+    
+    if (p->mode == POLICY_PERIODIC) {
+        snprintf(buf, size, "every time");
+        return;
+    }
+    if (t == TOPIC_STATUS) {
+        len = snprintf(buf, size, "when a value moved");
+    } else if (p->deadband) {
+        len = snprintf(buf, size, "on change > %ld%s", p->deadband, p->percent ? "%" : "");
+    } else {
+        len = snprintf(buf, size, "on change");
+    }
+    if (p->silence_ms) {
+        snprintf(buf + len, size - len, ", at least every %u ms", p->silence_ms);
+    }
+}
+
+/* Wait on the publish timer; epoll_wait() returns on SIGINT despite SA_RESTART */
+static int setup_event_loop(void) {
+    struct epoll_event ev = { .events = EPOLLIN };
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    
+    if (epfd < 0) {
+        perror("[TELEM] epoll_create1()");
+        return -1;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        perror("[TELEM] timerfd_create()");
+        close(epfd);
+        return -1;
+    }
+    
+    ev.data.fd = timer_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+        perror("[TELEM] epoll_ctl()");
+        close(epfd);
+        return -1;
+    }
+    return epfd;
 }
 
 int main(int argc, char *argv[]) {
     const char *broker = DEFAULT_BROKER;
-    const char *can_if = "vcan0";
-    struct can_frame frame;
-    time_t last_publish = 0;
+    const char *spool_path = DEFAULT_SPOOL_PATH;
+    unsigned long spool_kb = DEFAULT_SPOOL_KB;
+    const char *topic_args[TOPIC_COUNT * 2];
+    const char *policy_args[TOPIC_COUNT * 2];
+    int ntopic_args = 0;
+    int npolicy_args = 0;
+    long interval_ms = DEFAULT_INTERVAL_MS;
+    struct epoll_event event;
+    char *end;
+    int epfd;
     int opt;
+    int rc = 0;
     
-    while ((opt = getopt(argc, argv, "b:i:h")) != -1) {
+    while ((opt = getopt(argc, argv, "b:p:t:P:m:w:s:S:r:h")) != -1) {
         switch (opt) {
             case 'b':
                 broker = optarg;
                 break;
-            case 'i':
-                can_if = optarg;
+            case 'p':
+                interval_ms = strtol(optarg, &end, 10);
+                if (end == optarg || *end || interval_ms <= 0 || interval_ms > UINT32_MAX) {
+                    fprintf(stderr, "Invalid publish interval: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                if (ntopic_args == (int)(sizeof(topic_args) / sizeof(topic_args[0]))) {
+                    fprintf(stderr, "Too many -t options\n");
+                    return 1;
+                }
+                topic_args[ntopic_args++] = optarg;
+                break;
+            case 'P':
+                if (npolicy_args == (int)(sizeof(policy_args) / sizeof(policy_args[0]))) {
+                    fprintf(stderr, "Too many -P options\n");
+                    return 1;
+                }
+                policy_args[npolicy_args++] = optarg;
+                break;
+            case 'm':
+                if (strcmp(optarg, "batch") == 0) {
+                    publish_mode = MODE_BATCH;
+                } else if (strcmp(optarg, "topics") == 0) {
+                    publish_mode = MODE_TOPICS;
+                } else {
+                    fprintf(stderr, "Unknown publish mode: %s (batch or topics)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                max_inflight = (int)strtol(optarg, &end, 10);
+                if (end == optarg || *end || max_inflight < 1 || max_inflight > MAX_INFLIGHT_LIMIT) {
+                    fprintf(stderr, "Invalid in-flight window: %s (1-%d)\n", optarg,
+                            MAX_INFLIGHT_LIMIT);
+                    return 1;
+                }
+                break;
+            case 's':
+                spool_path = strcmp(optarg, "none") == 0 ? NULL : optarg;
+                break;
+            case 'S':
+                spool_kb = strtoul(optarg, &end, 10);
+                if (end == optarg || *end || spool_kb < SPOOL_MIN_CAPACITY / 1024 ||
+                    spool_kb > UINT32_MAX / 1024) {
+                    fprintf(stderr, "Invalid spool size: %s (at least %d KB)\n", optarg,
+                            SPOOL_MIN_CAPACITY / 1024);
+                    return 1;
+                }
+                break;
+            case 'r':
+                send_rate = (int)strtol(optarg, &end, 10);
+                if (end == optarg || *end || send_rate < 1 || send_rate > 100000) {
+                    fprintf(stderr, "Invalid send rate: %s\n", optarg);
+                    return 1;
+                }
                 break;
             case 'h':
             default:
@@ -263,54 +1127,102 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    /* -p first, so -t overrides it whatever the order */
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        topics[t].interval_ms = (uint32_t)interval_ms;
+    }
+    for (int i = 0; i < ntopic_args; i++) {
+        if (set_topic_interval(topic_args[i]) < 0) {
+            fprintf(stderr, "Invalid topic interval: %s (TOPIC=MS, see -h)\n", topic_args[i]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < npolicy_args; i++) {
+        if (set_topic_policy(policy_args[i]) < 0) {
+            fprintf(stderr, "Invalid publish policy: %s (TOPIC=POLICY, see -h)\n",
+                    policy_args[i]);
+            return 1;
+        }
+    }
+    
     printf("VTU MQTT Telemetry v1.0\n");
     printf("=======================\n");
     
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    if (setup_can_socket(can_if) < 0) {
+    epfd = setup_event_loop();
+    if (epfd < 0) {
+        return 1;
+    }
+    
+    if (setup_spool(spool_path, spool_kb) < 0 || setup_mqtt(broker) < 0) {
         return 1;
     }
     
-    setup_mqtt(broker);  /* Don't fail if broker unavailable */
+    printf("[TELEM] Publishing to topic prefix: %s (%s)\n", TOPIC_PREFIX,
+           publish_mode == MODE_BATCH ? "batched" : "one message per topic");
+    printf("[TELEM] Publish interval: %ld ms\n", interval_ms);
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        char policy[64];
+        
+        if (!topics[t].interval_ms) {
+            printf("[TELEM]   %s: off\n", topics[t].name);
+            continue;
+        }
+        describe_policy(t, policy, sizeof(policy));
+        printf("[TELEM]   %s: %u ms, %s\n", topics[t].name, topics[t].interval_ms, policy);
+    }
+    printf("\n");
     
-    printf("[TELEM] Publishing to topic prefix: %s\n", TOPIC_PREFIX);
-    printf("[TELEM] Publish interval: %d ms\n\n", PUBLISH_INTERVAL_MS);
+    /* Everything is due right away, as before the first interval */
+    uint64_t start = now_ms();
+    for (int t = 0; t < TOPIC_COUNT; t++) {
+        topics[t].next_ms = start;
+    }
+    if (arm_timer() < 0) {
+        return 1;
+    }
     
     while (running) {
-        /* Read CAN frames */
-        ssize_t nbytes = read(can_socket, &frame, sizeof(frame));
-        if (nbytes == sizeof(frame)) {
-            decode_can_frame(&frame);
-        }
-        
-        /* Publish at regular intervals */
-        time_t now = time(NULL);
-        if (now - last_publish >= (PUBLISH_INTERVAL_MS / 1000)) {
-            publish_status();
-            last_publish = now;
+        int n = epoll_wait(epfd, &event, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[TELEM] epoll_wait()");
+            rc = 1;
+            break;
         }
         
-        /* Try to reconnect if disconnected */
-        if (!mqtt_connected && (now % 10 == 0)) {
-            MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-            conn_opts.keepAliveInterval = 20;
-            conn_opts.cleansession = 1;
-            if (MQTTClient_connect(mqtt_client, &conn_opts) == MQTTCLIENT_SUCCESS) {
-                printf("[TELEM] Reconnected to MQTT broker\n");
-                mqtt_connected = 1;
+        if (n > 0) {
+            uint64_t expirations;
+            
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0 &&
+                errno != EAGAIN && errno != EINTR) {
+                perror("[TELEM] read(timerfd)");
+                rc = 1;
+                break;
+            }
+            publish_due(now_ms());
+            if (arm_timer() < 0) {
+                rc = 1;
+                break;
             }
         }
     }
     
     printf("\n[TELEM] Shutting down...\n");
     
-    if (mqtt_connected) {
-        MQTTClient_disconnect(mqtt_client, TIMEOUT);
-    }
-    MQTTClient_destroy(&mqtt_client);
-    close(can_socket);
+    /* The publisher sends what is still queued, then disconnects */
+    pubq_close(&pubq);
+    pthread_join(publisher_tid, NULL);
+    MQTTAsync_destroy(&mqtt_client);
+    pubq_free(&pubq);
+    spool_close(&spool);
+    close(timer_fd);
+    close(epfd);
+    vtu_store_close(&store);
     
-    return 0;
+    return rc;
 }
\ No newline at end of file